@@ -18,11 +18,9 @@ You should have received a copy of the GNU Lesser General Public License along w
 
 #include <lofty.hxx>
 #include <lofty/app.hxx>
-#include <lofty/coroutine.hxx>
-#include <lofty/defer_to_scope_end.hxx>
 #include <lofty/io/text.hxx>
-#include <lofty/net/tcp.hxx>
-#include <lofty/thread.hxx>
+#include <lofty/net/http.hxx>
+#include <lofty/to_str.hxx>
 
 using namespace lofty;
 
@@ -42,65 +40,48 @@ public:
       LOFTY_TRACE_FUNC(this/*, args*/);
 
       LOFTY_UNUSED_ARG(args);
-      // Schedule a TCP server.
-      coroutine([this] () {
-         LOFTY_TRACE_FUNC(this);
-
-         net::ip::port port(9080);
-         io::text::stdout->print(LOFTY_SL("server: starting, listening on port {}\n"), port);
-         net::tcp::server server(net::ip::address::any_v4, port);
-         try {
-            for (;;) {
-               io::text::stdout->write_line(LOFTY_SL("server: accepting"));
-               // This will cause a context switch if no connections are ready to be established.
-               auto conn(server.accept());
-
-               io::text::stdout->write_line(LOFTY_SL("server: connection established"));
-
-               // Add a coroutine that will process the newly-established connection.
-               coroutine([conn] () {
-                  LOFTY_TRACE_FUNC(conn);
-
-                  io::text::stdout->print(
-                     LOFTY_SL("responder: handling request from {}:{}\n"),
-                     conn->remote_address(), conn->remote_port()
-                  );
-                  // Create text-mode input and output streams for the connection’s socket.
-                  auto socket_istream(io::text::make_istream(conn->socket()));
-                  auto socket_ostream(io::text::make_ostream(conn->socket(), text::encoding::utf8));
-                  LOFTY_DEFER_TO_SCOPE_END(socket_ostream->finalize());
-                  io::text::stdout->write_line(LOFTY_SL("responder: reading request"));
-                  LOFTY_FOR_EACH(auto & line, socket_istream->lines()) {
-                     if (!line) {
-                        // The request ends on the first empty line.
-                        break;
-                     }
-                  }
-                  io::text::stdout->write_line(LOFTY_SL("responder: responding"));
-
-                  // Send the response headers.
-                  socket_ostream->write_line(LOFTY_SL("HTTP/1.0 200 OK"));
-                  socket_ostream->write_line(LOFTY_SL("Content-Type: text/plain; charset=utf-8"));
-                  socket_ostream->write_line(LOFTY_SL("Content-Length: 2"));
-                  socket_ostream->write_line();
-                  socket_ostream->flush();
-
-                  // Send the response content.
-                  socket_ostream->write(LOFTY_SL("OK"));
-
-                  io::text::stdout->write_line(LOFTY_SL("responder: terminating"));
-               });
-            }
-         } catch (execution_interruption const &) {
-            io::text::stdout->write_line(LOFTY_SL("server: terminating"));
-            // Rethrow the exception to ensure that all remaining coroutines are terminated.
-            throw;
+      net::ip::port port(9080);
+      /* Create an HTTP server with one shard per CPU; each shard will accept connections on its own thread,
+      with its own coroutine scheduler, and the OS will spread incoming connections among them. */
+      net::http::server server(net::ip::address::any_v4, port);
+      io::text::stdout->print(
+         LOFTY_SL("server: starting {} shards, listening on port {}\n"), server.tcp_server().shards_count(), port
+      );
+
+      net::http::router router;
+      router.add_route(LOFTY_SL("GET"), LOFTY_SL("/"), [] (
+         net::http::request const & req, net::http::response * resp
+      ) {
+         LOFTY_UNUSED_ARG(req);
+         resp->add_header(LOFTY_SL("Content-Type"), LOFTY_SL("text/plain; charset=utf-8"));
+         resp->write(LOFTY_SL("OK"));
+      });
+      router.add_route(LOFTY_SL("POST"), LOFTY_SL("/echo"), [] (
+         net::http::request const & req, net::http::response * resp
+      ) {
+         // Send the request body back; the engine takes care of both Content-Length and chunked bodies.
+         auto body(req.body());
+         resp->add_header(LOFTY_SL("Content-Type"), LOFTY_SL("application/octet-stream"));
+         resp->write(body.data(), body.size());
+      });
+      router.add_route(LOFTY_SL("GET"), LOFTY_SL("/stream/*"), [] (
+         net::http::request const & req, net::http::response * resp
+      ) {
+         LOFTY_UNUSED_ARG(req);
+         // Send the response as it’s generated, one chunk per line.
+         resp->add_header(LOFTY_SL("Content-Type"), LOFTY_SL("text/plain; charset=utf-8"));
+         resp->enable_chunked();
+         for (unsigned i = 0; i < 10; ++i) {
+            str line(LOFTY_SL("line "));
+            line += to_str(i);
+            line += LOFTY_SL("\n");
+            resp->write(line);
          }
       });
-
-      // Switch this thread to run coroutines, until they all terminate.
-      this_thread::run_coroutines();
-      // Execution resumes here, after all coroutines have terminated.
+      // This will only return after every shard terminates.
+      server.run([&router] (net::http::request const & req, net::http::response * resp) {
+         router(req, resp);
+      });
       io::text::stdout->write_line(LOFTY_SL("main: terminating"));
       return 0;
    }
@@ -0,0 +1,361 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/app.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/from_str.hxx>
+#include <lofty/io/text.hxx>
+#include <lofty/net/tcp.hxx>
+#include <lofty/thread.hxx>
+
+#include <algorithm> // std::sort()
+#include <chrono> // std::chrono::steady_clock
+#include <cstring> // std::memchr() std::memcmp()
+
+using namespace lofty;
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*! Loopback load generator for the echo-server and http-server examples. Opens a number of concurrent
+connections, each driven by its own coroutine, and sends requests over them either in closed loop (each
+connection sends a new request as soon as it receives the previous response) or at a fixed total rate. Once
+done, it writes a single line of JSON with the throughput and the latency distribution to stdout.
+
+Usage: load-generator echo|http [--port N] [--connections N] [--duration SECONDS]
+   [--rate REQUESTS_PER_SECOND] [--payload BYTES] [--path PATH]
+
+In fixed-rate mode, latencies are measured from the time each request was scheduled to be sent, rather than
+from the time it actually was, so that a stalled server can’t hide its stalls by delaying the load
+generator. */
+class load_generator_app : public app {
+public:
+   //! Default constructor.
+   load_generator_app() :
+      http(false),
+      port_number(0),
+      connections_count(16),
+      duration_secs(10),
+      rate(0),
+      payload_size(64),
+      path(LOFTY_SL("/")),
+      requests_count(0),
+      errors_count(0) {
+   }
+
+   /*! Main function of the program.
+
+   @param args
+      Arguments that were provided to this program via command line.
+   @return
+      Return value of this program.
+   */
+   virtual int main(collections::vector<str> & args) override {
+      LOFTY_TRACE_FUNC(this/*, args*/);
+
+      if (!parse_args(args)) {
+         io::text::stderr->write_line(LOFTY_SL(
+            "usage: load-generator echo|http [--port N] [--connections N] [--duration SECONDS] "
+            "[--rate REQUESTS_PER_SECOND] [--payload BYTES] [--path PATH]"
+         ));
+         return 1;
+      }
+      prepare_request();
+
+      static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+      net::ip::address loopback(loopback_raw);
+      net::ip::port port(port_number);
+      auto start = clock_type::now();
+      auto end = start + std::chrono::seconds(duration_secs);
+      for (unsigned i = 0; i < connections_count; ++i) {
+         latencies.push_back(collections::vector<std::uint64_t>());
+      }
+      for (unsigned i = 0; i < connections_count; ++i) {
+         coroutine([this, i, &loopback, &port, start, end] () {
+            run_connection(i, loopback, port, start, end);
+         });
+      }
+      // Switch this thread to run coroutines, until they all terminate.
+      this_thread::run_coroutines();
+      auto elapsed_ns = static_cast<std::uint64_t>(
+         std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count()
+      );
+
+      // Merge and sort the latencies of every connection.
+      collections::vector<std::uint64_t> all_latencies;
+      LOFTY_FOR_EACH(auto const & conn_latencies, latencies) {
+         all_latencies.push_back(conn_latencies.data(), conn_latencies.size());
+      }
+      std::sort(all_latencies.data(), all_latencies.data() + all_latencies.size());
+
+      io::text::stdout->print(
+         LOFTY_SL(
+            "{{\"target\":\"{}\",\"port\":{},\"connections\":{},\"rate\":{},\"elapsed_ns\":{},"
+            "\"requests\":{},\"errors\":{},\"throughput_rps\":{},"
+            "\"latency_ns\":{{\"min\":{},\"p50\":{},\"p99\":{},\"p999\":{},\"max\":{}}}}}\n"
+         ),
+         http ? LOFTY_SL("http") : LOFTY_SL("echo"), port_number, connections_count, rate, elapsed_ns,
+         requests_count, errors_count, elapsed_ns ? requests_count * 1000000000u / elapsed_ns : 0u,
+         percentile(all_latencies, 0), percentile(all_latencies, 500), percentile(all_latencies, 990),
+         percentile(all_latencies, 999), percentile(all_latencies, 1000)
+      );
+      return errors_count ? 2 : 0;
+   }
+
+private:
+   //! Clock used to measure latencies.
+   typedef std::chrono::steady_clock clock_type;
+
+private:
+   /*! Parses the command-line arguments.
+
+   @param args
+      Arguments that were provided to this program via command line.
+   @return
+      true if the arguments are valid, or false otherwise.
+   */
+   bool parse_args(collections::vector<str> const & args) {
+      if (args.size() < 2) {
+         return false;
+      }
+      if (args[1] == LOFTY_SL("http")) {
+         http = true;
+         port_number = 9080;
+      } else if (args[1] == LOFTY_SL("echo")) {
+         port_number = 9082;
+      } else {
+         return false;
+      }
+      for (std::ptrdiff_t i = 2; i + 1 < static_cast<std::ptrdiff_t>(args.size()); i += 2) {
+         str const & name = args[i], & value = args[i + 1];
+         if (name == LOFTY_SL("--port")) {
+            port_number = from_str<net::ip::port::number_type>(value);
+         } else if (name == LOFTY_SL("--connections")) {
+            connections_count = from_str<unsigned>(value);
+         } else if (name == LOFTY_SL("--duration")) {
+            duration_secs = from_str<unsigned>(value);
+         } else if (name == LOFTY_SL("--rate")) {
+            rate = from_str<unsigned>(value);
+         } else if (name == LOFTY_SL("--payload")) {
+            payload_size = from_str<unsigned>(value);
+         } else if (name == LOFTY_SL("--path")) {
+            path = value;
+         } else {
+            return false;
+         }
+      }
+      return args.size() % 2 == 0 && connections_count > 0 && payload_size > 0;
+   }
+
+   /*! Returns a percentile of a sorted set of latencies.
+
+   @param sorted_latencies
+      Sorted latencies.
+   @param per_mille
+      Percentile to return, in thousandths.
+   @return
+      Requested percentile, or 0 if there are no latencies.
+   */
+   static std::uint64_t percentile(
+      collections::vector<std::uint64_t> const & sorted_latencies, unsigned per_mille
+   ) {
+      if (sorted_latencies.size() == 0) {
+         return 0;
+      }
+      auto i = (sorted_latencies.size() - 1) * per_mille / 1000;
+      return sorted_latencies[static_cast<std::ptrdiff_t>(i)];
+   }
+
+   //! Builds the request that each connection will send repeatedly.
+   void prepare_request() {
+      if (http) {
+         str request_str(LOFTY_SL("GET "));
+         request_str += path;
+         request_str += LOFTY_SL(" HTTP/1.1\r\nHost: localhost\r\n\r\n");
+         request = request_str.encode(text::encoding::utf8, false);
+      } else {
+         // echo-server echoes lines back.
+         request.set_size(payload_size);
+         for (unsigned i = 0; i < payload_size - 1; ++i) {
+            request[static_cast<std::ptrdiff_t>(i)] = static_cast<std::uint8_t>('a' + i % 26);
+         }
+         request[static_cast<std::ptrdiff_t>(payload_size - 1)] = '\n';
+      }
+   }
+
+   /*! Reads a complete response.
+
+   @param buf_istream
+      Stream to read from.
+   @return
+      true if a response was read, or false if the connection was closed or the response was invalid.
+   */
+   bool read_response(io::binary::buffered_istream * buf_istream) {
+      if (!http) {
+         // The echoed line is as long as the request.
+         auto peeked(buf_istream->peek_bytes(payload_size));
+         if (_std::get<1>(peeked) < payload_size) {
+            return false;
+         }
+         buf_istream->consume_bytes(payload_size);
+         return true;
+      }
+      // Wait for the end of the head, then for the end of the body according to its Content-Length.
+      static char const content_length_name[] = "\r\ncontent-length:";
+      std::size_t scanned_size = 0;
+      for (;;) {
+         auto peeked(buf_istream->peek_bytes(scanned_size + 1));
+         auto chars = static_cast<char const *>(_std::get<0>(peeked));
+         std::size_t avail = _std::get<1>(peeked);
+         if (avail <= scanned_size) {
+            return false;
+         }
+         for (std::size_t i = scanned_size < 3 ? 0 : scanned_size - 3; i + 4 <= avail; ++i) {
+            if (std::memcmp(chars + i, "\r\n\r\n", 4) != 0) {
+               continue;
+            }
+            std::size_t head_size = i + 4, content_length = 0;
+            // Find the Content-Length header, ignoring letter case.
+            for (std::size_t j = 0; j + sizeof content_length_name - 1 < head_size; ++j) {
+               std::size_t k = 0;
+               while (
+                  k < sizeof content_length_name - 1 &&
+                  (chars[j + k] | 0x20) == (content_length_name[k] | 0x20)
+               ) {
+                  ++k;
+               }
+               if (k == sizeof content_length_name - 1) {
+                  for (j += k; chars[j] == ' '; ++j) {
+                  }
+                  for (; chars[j] >= '0' && chars[j] <= '9'; ++j) {
+                     content_length = content_length * 10 + static_cast<std::size_t>(chars[j] - '0');
+                  }
+                  break;
+               }
+            }
+            std::size_t response_size = head_size + content_length;
+            if (_std::get<1>(buf_istream->peek_bytes(response_size)) < response_size) {
+               return false;
+            }
+            buf_istream->consume_bytes(response_size);
+            return true;
+         }
+         scanned_size = avail;
+      }
+   }
+
+   /*! Runs a connection until the end of the test. Meant to be run as the main function of a coroutine.
+
+   @param i
+      Index of the connection.
+   @param address
+      Address to connect to.
+   @param port
+      Port to connect to.
+   @param start
+      Start time of the test.
+   @param end
+      End time of the test.
+   */
+   void run_connection(
+      unsigned i, net::ip::address const & address, net::ip::port const & port, clock_type::time_point start,
+      clock_type::time_point end
+   ) {
+      LOFTY_TRACE_FUNC(this, i);
+
+      auto & conn_latencies = latencies[static_cast<std::ptrdiff_t>(i)];
+      try {
+         auto conn(net::tcp::connect(address, port));
+         net::tcp::socket_options opts;
+         opts.set_no_delay(true);
+         conn->set_options(opts);
+         auto socket(conn->socket());
+         auto buf_istream(io::binary::buffer_istream(socket));
+         // In fixed-rate mode, spread the connections’ send times evenly over each interval.
+         clock_type::duration interval(0);
+         if (rate) {
+            interval = std::chrono::duration_cast<clock_type::duration>(
+               std::chrono::nanoseconds(std::uint64_t(1000000000u) * connections_count / rate)
+            );
+         }
+         auto next_send = start + interval * i / connections_count;
+         for (;;) {
+            auto now = clock_type::now();
+            if (now >= end) {
+               break;
+            }
+            clock_type::time_point sent;
+            if (rate) {
+               if (next_send > now) {
+                  // Round the delay up, since the scheduler can only sleep for whole milliseconds.
+                  auto delay_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     next_send - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)
+                  ).count();
+                  this_coroutine::sleep_for_ms(static_cast<unsigned>(delay_ms));
+               }
+               // If the coroutine woke up late, charge the delay to the server.
+               sent = std::min(next_send, clock_type::now());
+               next_send += interval;
+            } else {
+               sent = now;
+            }
+            socket->write(request.data(), request.size());
+            if (!read_response(buf_istream.get())) {
+               ++errors_count;
+               break;
+            }
+            conn_latencies.push_back(static_cast<std::uint64_t>(
+               std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - sent).count()
+            ));
+            ++requests_count;
+         }
+         socket->finalize();
+      } catch (execution_interruption const &) {
+         throw;
+      } catch (_std::exception const &) {
+         ++errors_count;
+      }
+   }
+
+private:
+   //! true to send HTTP requests, or false to send lines to an echo server.
+   bool http;
+   //! Port to connect to.
+   net::ip::port::number_type port_number;
+   //! Count of concurrent connections.
+   unsigned connections_count;
+   //! Duration of the test.
+   unsigned duration_secs;
+   //! Total requests per second to send, or 0 to run in closed loop.
+   unsigned rate;
+   //! Size of each echo request, including its line terminator.
+   unsigned payload_size;
+   //! Path to request from the HTTP server.
+   str path;
+   //! Request to send.
+   collections::vector<std::uint8_t> request;
+   //! Latency of each request, in nanoseconds, for each connection.
+   collections::vector<collections::vector<std::uint64_t>> latencies;
+   //! Count of requests that received a response.
+   std::uint64_t requests_count;
+   //! Count of connections that failed.
+   std::uint64_t errors_count;
+};
+
+LOFTY_APP_CLASS(load_generator_app)
@@ -97,7 +97,10 @@ namespace lofty { namespace _std {
 
    namespace lofty { namespace _std {
 
+   using ::std::current_exception;
    using ::std::exception;
+   using ::std::exception_ptr;
+   using ::std::rethrow_exception;
    using ::std::uncaught_exception;
 
    }} //namespace lofty::_std
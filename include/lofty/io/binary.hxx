@@ -27,6 +27,7 @@ You should have received a copy of the GNU Lesser General Public License along w
 #endif
 
 #include <lofty/io.hxx>
+#include <lofty/numeric.hxx>
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -40,6 +41,15 @@ namespace binary {}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Forward declaration.
+namespace lofty { namespace os {
+
+class path;
+
+}} //namespace lofty::os
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 namespace lofty { namespace io { namespace binary {
 
 //! Base interface for binary (non-text) streams.
@@ -88,6 +98,20 @@ protected:
 
 namespace lofty { namespace io { namespace binary {
 
+//! Describes a block of bytes to be written by ostream::write_buffers().
+struct const_buffer {
+   //! Address of the source buffer.
+   void const * src;
+   //! Size of the source buffer, in bytes.
+   std::size_t src_size;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
 //! Interface for binary (non-text) output streams.
 class LOFTY_SYM ostream : public virtual stream {
 public:
@@ -112,6 +136,19 @@ public:
    */
    virtual std::size_t write(void const * src, std::size_t src_size) = 0;
 
+   /*! Writes multiple arrays of bytes, in order, as if write() were called for each of them. Streams that
+   support it will write them all with a single operation (gather write), avoiding both copying them into a
+   single buffer and issuing one system call for each of them.
+
+   @param bufs
+      Pointer to an array of buffers to write.
+   @param bufs_count
+      Count of elements in bufs.
+   @return
+      Count of bytes written.
+   */
+   virtual std::size_t write_buffers(const_buffer const * bufs, std::size_t bufs_count);
+
 protected:
    //! Default constructor.
    ostream();
@@ -354,6 +391,125 @@ protected:
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace lofty { namespace io { namespace binary {
+
+/*! Options for copy() and copy_file(): which range of the source to copy, and whether to report progress.
+Setters return *this, so they can be chained. */
+class LOFTY_SYM copy_options {
+public:
+   //! Type of the function called to report progress; it receives the count of bytes copied so far.
+   typedef _std::function<void (full_size_t copied)> progress_fn_type;
+
+public:
+   //! Default constructor. Copies everything from the current offset, allowing clones, without progress.
+   copy_options() :
+      max_size_(numeric::max<full_size_t>::value),
+      offset_(-1),
+      allow_clone_(true) {
+   }
+
+   /*! Returns true if the destination may share storage with the source, on file systems that support
+   copy-on-write clones (reflinks).
+
+   @return
+      true if clones are allowed, or false otherwise.
+   */
+   bool allow_clone() const {
+      return allow_clone_;
+   }
+
+   /*! Returns the maximum count of bytes to copy.
+
+   @return
+      Maximum size.
+   */
+   full_size_t max_size() const {
+      return max_size_;
+   }
+
+   /*! Returns the offset in the source to start copying from.
+
+   @return
+      Offset, or -1 to start from the current offset of the source.
+   */
+   offset_t offset() const {
+      return offset_;
+   }
+
+   /*! Returns the function called to report progress.
+
+   @return
+      Progress function; may be empty.
+   */
+   progress_fn_type const & progress() const {
+      return progress_;
+   }
+
+   /*! Allows or forbids the destination to share storage with the source. A clone is only attempted when
+   copying an entire regular file into an empty one.
+
+   @param allow
+      true to allow clones, or false to force the data to be copied.
+   @return
+      *this.
+   */
+   copy_options & set_allow_clone(bool allow) {
+      allow_clone_ = allow;
+      return *this;
+   }
+
+   /*! Sets the maximum count of bytes to copy.
+
+   @param size
+      Maximum size.
+   @return
+      *this.
+   */
+   copy_options & set_max_size(full_size_t size) {
+      max_size_ = size;
+      return *this;
+   }
+
+   /*! Sets the offset in the source to start copying from; the source must be seekable.
+
+   @param offset
+      Offset from the start of the source.
+   @return
+      *this.
+   */
+   copy_options & set_offset(offset_t offset) {
+      offset_ = offset;
+      return *this;
+   }
+
+   /*! Sets a function to be called every time more data has been copied. Copies moved by the OS are split in
+   chunks of a few MiB, so that progress is reported regularly.
+
+   @param fn
+      Progress function.
+   @return
+      *this.
+   */
+   copy_options & set_progress(progress_fn_type fn) {
+      progress_ = _std::move(fn);
+      return *this;
+   }
+
+private:
+   //! See max_size().
+   full_size_t max_size_;
+   //! See offset().
+   offset_t offset_;
+   //! See progress().
+   progress_fn_type progress_;
+   //! See allow_clone().
+   bool allow_clone_;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 namespace lofty { namespace io { namespace binary { namespace _pvt {
 
 /*! Data collected by open() used to construct a file instance. This is only defined in file.cxx, after the
@@ -366,6 +522,18 @@ namespace lofty { namespace io { namespace binary {
 
 //! Base for file binary streams.
 class LOFTY_SYM file_stream : public virtual stream, public noncopyable {
+private:
+   // Allows copy() to hand the file descriptors directly to the OS.
+   friend full_size_t copy(istream * src, ostream * dst, copy_options const & opts);
+   // Allows copy_file() to check whether the source and the destination are the same file.
+   friend full_size_t copy_file(
+      os::path const & src_path, os::path const & dst_path, copy_options const & opts
+   );
+   // Allows default_buffered_istream to wait for data before borrowing a buffer.
+   friend class default_buffered_istream;
+   // Allows mapped_file_istream to map the file in memory.
+   friend class mapped_file_istream;
+
 public:
    //! Destructor.
    virtual ~file_stream();
@@ -441,6 +609,9 @@ public:
 
    //! See ostream::write().
    virtual std::size_t write(void const * src, std::size_t src_size) override;
+
+   //! See ostream::write_buffers().
+   virtual std::size_t write_buffers(const_buffer const * bufs, std::size_t bufs_count) override;
 };
 
 }}} //namespace lofty::io::binary
@@ -505,12 +676,115 @@ public:
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Forward declaration.
-namespace lofty { namespace os {
+namespace lofty { namespace io { namespace binary {
 
-class path;
+/*! Sizing policy for the buffers allocated by buffer_istream() and buffer_ostream(). Setters return *this, so
+they can be chained:
+
+   @verbatim
+   auto buf_istream(io::binary::buffer_istream(
+      conn->socket(), io::binary::buffer_sizing().set_size_max(0x10000).set_release_when_idle(true)
+   ));
+   @endverbatim
+
+A buffer starts at size_min() bytes. Every time a read fills the read buffer, or the write buffer fills up
+and has to be flushed, the buffer size is doubled the next time the buffer is empty, up to size_max() bytes;
+every time a read or explicit flush moves less than a quarter of the buffer, the size is halved instead, down
+to size_min() bytes. A buffer that was emptied after such a short read or flush is shrunk to size_min()
+bytes, or returned to buffer_pool::instance() if release_when_idle() is true, so that streams that have gone
+idle don’t keep holding on to large buffers. Larger buffers are still allocated as needed to satisfy peek()
+or get_buffer() calls for more than size_max() bytes.
+
+Buffer memory comes from buffer_pool, so sizes are rounded up to whole memory pages. */
+class LOFTY_SYM buffer_sizing {
+public:
+   //! Default constructor. Buffers start at 4 KiB, may grow up to 256 KiB, and are kept when idle.
+   buffer_sizing() :
+      size_min_(0x1000),
+      size_max_(0x40000),
+      release_when_idle_(false) {
+   }
 
-}} //namespace lofty::os
+   /*! Returns true if the buffer memory is released when the buffer becomes idle.
+
+   @return
+      true if idle buffers are released, or false if they’re kept.
+   */
+   bool release_when_idle() const {
+      return release_when_idle_;
+   }
+
+   /*! Makes buffers return their memory to buffer_pool::instance() when they go idle (emptied after a short
+   read or flush), instead of just shrinking to size_min() bytes. Read buffers of sockets and pipes read by
+   coroutines also wait for data to arrive before borrowing memory from the pool again, so that streams
+   waiting for data hold no buffer at all. Keeping idle buffers saves a trip to the pool and, for reads, to
+   the coroutine scheduler, every time the stream wakes up, so releasing them is off by default; it pays off
+   for processes with many mostly-idle streams, such as servers with many keep-alive connections.
+
+   @param release
+      true to release idle buffers, or false to keep them.
+   @return
+      *this.
+   */
+   buffer_sizing & set_release_when_idle(bool release) {
+      release_when_idle_ = release;
+      return *this;
+   }
+
+   /*! Sets the size buffers may grow to under sustained streaming.
+
+   @param size
+      Maximum buffer size, in bytes; must not be less than size_min().
+   @return
+      *this.
+   */
+   buffer_sizing & set_size_max(std::size_t size) {
+      size_max_ = size;
+      return *this;
+   }
+
+   /*! Sets the size buffers start at, and shrink back to when idle.
+
+   @param size
+      Minimum buffer size, in bytes; must be greater than 0.
+   @return
+      *this.
+   */
+   buffer_sizing & set_size_min(std::size_t size) {
+      size_min_ = size;
+      return *this;
+   }
+
+   /*! Returns the size buffers may grow to under sustained streaming.
+
+   @return
+      Maximum buffer size, in bytes.
+   */
+   std::size_t size_max() const {
+      return size_max_;
+   }
+
+   /*! Returns the size buffers start at, and shrink back to when idle.
+
+   @return
+      Minimum buffer size, in bytes.
+   */
+   std::size_t size_min() const {
+      return size_min_;
+   }
+
+private:
+   //! See size_min().
+   std::size_t size_min_;
+   //! See size_max().
+   std::size_t size_max_;
+   //! See release_when_idle().
+   bool release_when_idle_;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace lofty { namespace io { namespace binary {
 
@@ -523,6 +797,45 @@ namespace lofty { namespace io { namespace binary {
 */
 LOFTY_SYM _std::shared_ptr<buffered_istream> buffer_istream(_std::shared_ptr<istream> bin_istream);
 
+/*! Creates and returns a buffered input stream for the specified unbuffered binary input stream, using the
+specified buffer sizing policy.
+
+@param bin_istream
+   Pointer to an unbuffered binary stream. If it’s already a buffered stream, it will be returned unchanged,
+   and sizing will be ignored.
+@param sizing
+   Sizing policy for the read buffer.
+@return
+   Pointer to a buffered wrapper for *bin_istream.
+*/
+LOFTY_SYM _std::shared_ptr<buffered_istream> buffer_istream(
+   _std::shared_ptr<istream> bin_istream, buffer_sizing const & sizing
+);
+
+/*! Creates and returns a buffered input stream that reads a regular file by mapping it in memory:
+peek_bytes() returns pointers straight into the OS file cache, instead of copying the file’s contents into a
+buffer.
+
+Files larger than window_size_max are mapped one window at a time, sliding the window forward as needed. The
+OS is advised that the file will be read sequentially, and asked to load each part of it ahead of time.
+Reaching the end of the file checks whether it has grown, so files being appended to can be followed.
+
+The file must not be truncated while mapped: accessing the pages past the new end of the file would terminate
+the process with SIGBUS.
+
+@param bin_istream
+   Pointer to an unbuffered binary stream. If it’s not a regular file, or the OS doesn’t support mapping it,
+   the return value will be the same as buffer_istream(bin_istream).
+@param window_size_max
+   Maximum size of the part of the file mapped at a time. If 0, a default suitable for the size of the
+   address space will be used.
+@return
+   Pointer to a buffered wrapper for *bin_istream.
+*/
+LOFTY_SYM _std::shared_ptr<buffered_istream> map_istream(
+   _std::shared_ptr<istream> bin_istream, std::size_t window_size_max = 0
+);
+
 /*! Creates and returns a buffered output stream for the specified unbuffered binary output stream.
 
 @param bin_ostream
@@ -532,6 +845,88 @@ LOFTY_SYM _std::shared_ptr<buffered_istream> buffer_istream(_std::shared_ptr<ist
 */
 LOFTY_SYM _std::shared_ptr<buffered_ostream> buffer_ostream(_std::shared_ptr<ostream> bin_ostream);
 
+/*! Creates and returns a buffered output stream for the specified unbuffered binary output stream, using the
+specified buffer sizing policy.
+
+@param bin_ostream
+   Pointer to an unbuffered binary stream. If it’s already a buffered stream, it will be returned unchanged,
+   and sizing will be ignored.
+@param sizing
+   Sizing policy for the write buffer.
+@return
+   Pointer to a buffered wrapper for *bin_ostream.
+*/
+LOFTY_SYM _std::shared_ptr<buffered_ostream> buffer_ostream(
+   _std::shared_ptr<ostream> bin_ostream, buffer_sizing const & sizing
+);
+
+/*! Copies data from a binary input stream to a binary output stream, until EOF or until max_size bytes have
+been copied.
+
+If both streams are files (or buffered wrappers of files), the data is moved by the OS without ever reaching
+user space. On Linux, the first of these that works is used:
+•  FICLONE, if an entire regular file is copied into an empty one and opts.allow_clone() is true; the two
+   files will share storage until either is modified;
+•  copy_file_range(), between two regular files; some file systems will clone or copy the data server-side;
+•  sendfile(), when *src is a regular file;
+•  splice() through a pipe.
+In every other case, or if the OS refuses to move the data between the two files, the data is copied through
+a buffer, using the buffers of *src and *dst if they are buffered streams. Any data already in the read buffer
+of *src is copied first, and the write buffer of *dst is flushed before bypassing it; if opts.offset() is set,
+the read buffer is discarded instead.
+
+Like any other I/O operation, this will yield to other coroutines while waiting for either stream to become
+ready.
+
+@param src
+   Pointer to the stream to read from.
+@param dst
+   Pointer to the stream to write to.
+@param opts
+   Range to copy, and progress reporting.
+@return
+   Count of bytes copied.
+*/
+LOFTY_SYM full_size_t copy(istream * src, ostream * dst, copy_options const & opts);
+
+/*! Copies data from a binary input stream to a binary output stream, until EOF or until max_size bytes have
+been copied. See copy(istream *, ostream *, copy_options const &) for details.
+
+@param src
+   Pointer to the stream to read from.
+@param dst
+   Pointer to the stream to write to.
+@param max_size
+   Maximum count of bytes to copy.
+@return
+   Count of bytes copied.
+*/
+inline full_size_t copy(
+   istream * src, ostream * dst, full_size_t max_size = numeric::max<full_size_t>::value
+) {
+   return copy(src, dst, copy_options().set_max_size(max_size));
+}
+
+/*! Copies a file, creating or truncating the destination. The data is moved by the OS as explained for
+copy(istream *, ostream *, copy_options const &); in particular, on file systems that support it the copy
+is a clone that completes in constant time.
+
+If the destination is the source file itself (e.g. via a different path or a hard link), an argument_error
+is thrown and neither file is changed.
+
+@param src_path
+   Path to the file to copy.
+@param dst_path
+   Path to the copy.
+@param opts
+   Range to copy, and progress reporting.
+@return
+   Count of bytes copied.
+*/
+LOFTY_SYM full_size_t copy_file(
+   os::path const & src_path, os::path const & dst_path, copy_options const & opts = copy_options()
+);
+
 /*! Creates and returns a binary input stream for the specified file descriptor.
 
 @param fd
@@ -567,7 +962,8 @@ LOFTY_SYM _std::shared_ptr<file_ostream> make_ostream(io::filedesc && fd);
    Desired access mode.
 @param bypass_cache
    If true, the OS will not cache any portion of the file; if false, accesses to the file will be backed by
-   the OS file cache subsystem.
+   the OS file cache subsystem. Under POSIX, reads and writes of any size and alignment are still allowed, and
+   sequential reads are read ahead; files opened with access_mode::write_append are always cached.
 @return
    Pointer to a binary stream for the file.
 */
@@ -0,0 +1,233 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_APPEND_LOG_HXX
+#define _LOFTY_IO_BINARY_APPEND_LOG_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/thread.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Append-only logs of checksummed records, suitable as write-ahead logs. Each record consists of an 8-byte
+header – payload size, then CRC-32C of the payload size and the payload itself, both 32-bit little endian –
+followed by the payload. */
+namespace append_log {
+
+//! Size of the header preceding each record’s payload.
+std::size_t const record_header_size = 8;
+//! Maximum size of a record’s payload.
+std::size_t const record_size_max = 0x4000000;
+
+} //namespace append_log
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace io { namespace binary {
+
+// Forward declaration.
+class regular_file_ostream;
+
+}}} //namespace lofty::io::binary
+
+namespace lofty { namespace io { namespace binary { namespace append_log {
+
+/*! Appends records to a log file, making them durable before returning. Any number of coroutines and threads
+may call append() concurrently: records submitted while the file is being synced are batched, then written by
+a single write() and made durable by a single fdatasync(), after which all their appenders are woken up. This
+“group commit” amortizes the cost of the sync over all the records in a batch, so throughput grows with the
+count of concurrent appenders instead of being capped by the latency of the storage device.
+
+Disk space is allocated ahead of the records in large chunks, without changing the file size, so that each
+sync doesn’t also have to commit block allocations. */
+class LOFTY_SYM writer : public noncopyable {
+public:
+   //! Default value for the preallocation_size constructor argument.
+   static full_size_t const preallocation_size_default = 0x4000000;
+
+   //! Tracks an append() call waiting for a batch to be committed.
+   struct waiter;
+
+public:
+   /*! Constructor. Opens the log file for appending, creating it if it doesn’t exist.
+
+   @param path
+      Path to the log file, which must be a regular file.
+   @param preallocation_size
+      Size of each chunk of disk space allocated ahead of the records; 0 disables preallocation.
+   */
+   explicit writer(os::path const & path, full_size_t preallocation_size = preallocation_size_default);
+
+   //! Destructor.
+   ~writer();
+
+   /*! Appends a record, suspending the calling coroutine or blocking the calling thread until the record is
+   durable. If the write or the sync fail, the exception is thrown in the appender that performed them, and
+   any other append() call will throw a lofty::io::error, since the state of the log on disk is then unknown.
+   If the calling coroutine is interrupted while committing a batch, the records that were not written yet
+   are left for the next appender to commit, and the log remains usable.
+
+   @param src
+      Pointer to the record’s payload.
+   @param src_size
+      Size of the payload; must not exceed record_size_max.
+   @return
+      Offset of the record in the file.
+   */
+   full_size_t append(void const * src, std::size_t src_size);
+
+   /*! Returns the size of the log that’s known to be durable.
+
+   @return
+      Size of the log, in bytes.
+   */
+   full_size_t durable_size() const;
+
+   //! Commits any records left pending by interrupted append() calls, and closes the file.
+   void finalize();
+
+private:
+   /*! Writes and syncs the records in batch. Must be called by the appender that set committing to true.
+
+   @param batch_end
+      Size the log will have after the batch is committed.
+   */
+   void commit_batch(full_size_t batch_end);
+
+   /*! Waits until the log is durable up to the specified size, committing batches as needed.
+
+   @param end
+      Size of the log to wait for.
+   */
+   void wait_durable(full_size_t end);
+
+   //! Wakes up all waiters. Must be called with mtx locked.
+   void wake_waiters();
+
+private:
+   //! Log file.
+   _std::shared_ptr<regular_file_ostream> file;
+   //! Size of the chunks of disk space allocated ahead of the records.
+   full_size_t preallocation_size;
+   //! End of the disk space preallocated so far. Only accessed by the appender committing a batch.
+   full_size_t preallocated_end;
+   //! Records being committed. Only accessed by the appender committing a batch.
+   collections::vector<std::uint8_t> batch;
+   //! Governs access to the members below.
+   mutable _std::mutex mtx;
+   //! Records waiting for the next batch.
+   collections::vector<std::uint8_t> pending;
+   //! Size the log will have once all the records appended so far are committed.
+   full_size_t appended_size;
+   //! Size of the log that’s known to be durable.
+   full_size_t durable_size_;
+   //! Appenders waiting for the batch being committed.
+   collections::vector<_std::shared_ptr<waiter>> waiters;
+   //! Waiters that can be reused, to avoid creating a pipe for each append() call.
+   collections::vector<_std::shared_ptr<waiter>> spare_waiters;
+   //! true while an appender is committing a batch.
+   bool committing:1;
+   //! true if a batch failed to be committed.
+   bool broken:1;
+   //! true once finalize() has been called.
+   bool finalized:1;
+};
+
+}}}} //namespace lofty::io::binary::append_log
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace append_log {
+
+/*! Reads records from a log, returning views of their payloads in the stream’s buffer. Reading stops at the
+end of the log, or at the first record that’s incomplete or fails its checksum, which is the expected state
+of the tail of a log after a crash; damaged() and valid_size() allow to detect and truncate such a tail. */
+class LOFTY_SYM reader : public noncopyable {
+public:
+   /*! Constructor.
+
+   @param bin_istream
+      Stream to read records from.
+   */
+   explicit reader(_std::shared_ptr<buffered_istream> bin_istream);
+
+   //! Destructor.
+   ~reader();
+
+   /*! Returns true if reading stopped at a damaged record rather than at the end of the log.
+
+   @return
+      true if the log has a damaged tail, or false otherwise.
+   */
+   bool damaged() const {
+      return damaged_;
+   }
+
+   /*! Reads the next record.
+
+   @param record
+      Receives the address and size of the record’s payload, which remains valid until the next call.
+   @return
+      true if a record was read, or false if the end of the log or a damaged record was reached.
+   */
+   bool read(const_buffer * record);
+
+   /*! Returns the size of the records read so far, including their headers; a damaged log can be truncated to
+   this size to drop its damaged tail.
+
+   @return
+      Offset of the end of the last valid record.
+   */
+   full_size_t valid_size() const {
+      return valid_size_;
+   }
+
+private:
+   //! Source stream.
+   _std::shared_ptr<buffered_istream> bin_istream;
+   //! Bytes of the stream’s buffer backing the last returned record, to be consumed by the next read().
+   std::size_t pending_consume_size;
+   //! Size of the records read so far.
+   full_size_t valid_size_;
+   //! true if a damaged record was found.
+   bool damaged_;
+};
+
+}}}} //namespace lofty::io::binary::append_log
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_APPEND_LOG_HXX
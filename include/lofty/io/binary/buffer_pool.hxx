@@ -0,0 +1,166 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_BUFFER_POOL_HXX
+#define _LOFTY_IO_BINARY_BUFFER_POOL_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/thread.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Process-wide cache of page-aligned memory blocks, from which the buffers of the streams returned by
+buffer_istream() and buffer_ostream() are borrowed. Streams whose buffer_sizing::release_when_idle() is true
+return their buffers when they go idle, so a process with many such streams only needs memory for the buffers
+of the streams that are actually transferring data.
+
+Blocks come in size classes of one page, two pages, four pages, and so on up to block_size_max(); larger
+blocks are allocated and freed on demand. Each size class keeps its free blocks in a LIFO list, so a returned
+block is the first to be handed out again while its pages are still resident. */
+class LOFTY_SYM buffer_pool : public noncopyable {
+public:
+   //! Default value for the cached size limit; see set_cached_size_max().
+   static std::size_t const default_cached_size_max = 0x1000000;
+
+   //! Statistics about the pool’s use.
+   struct usage_counters {
+      //! Count of blocks handed out.
+      std::uint64_t acquires;
+      //! Count of blocks handed out from the cache, without allocating memory.
+      std::uint64_t reuses;
+      //! Count of blocks returned and kept in the cache.
+      std::uint64_t releases;
+      //! Count of blocks returned and freed, because they were too large or the cache was full.
+      std::uint64_t frees;
+   };
+
+public:
+   /*! Returns the one and only instance of this class.
+
+   @return
+      Process-wide buffer pool.
+   */
+   static buffer_pool & instance();
+
+   /*! Hands out a block of at least the specified size, from the cache if possible.
+
+   @param size
+      Minimum size of the block, in bytes.
+   @return
+      Memory block; its size() will be that of the smallest size class that can hold size bytes.
+   */
+   memory::pages_ptr acquire(std::size_t size);
+
+   /*! Returns the largest block size that is cached.
+
+   @return
+      Size of the largest size class, in bytes.
+   */
+   static std::size_t block_size_max();
+
+   /*! Returns the size of the block that acquire() would return for a request of the specified size.
+
+   @param size
+      Minimum size of the block, in bytes.
+   @return
+      Actual size of the block, in bytes.
+   */
+   static std::size_t block_size(std::size_t size);
+
+   /*! Returns the total size of the blocks currently in the cache.
+
+   @return
+      Cached memory, in bytes.
+   */
+   std::size_t cached_size() const;
+
+   /*! Returns statistics about the pool’s use.
+
+   @return
+      Current counters.
+   */
+   usage_counters counters() const;
+
+   /*! Returns a block to the pool. The block is freed instead of cached if it’s larger than block_size_max(),
+   or if caching it would exceed the cached size limit.
+
+   @param block
+      Block to return; it will be left empty.
+   */
+   void release(memory::pages_ptr * block);
+
+   /*! Sets the maximum total size of the blocks kept in the cache. Lowering it doesn’t free any blocks; call
+   trim() for that.
+
+   @param size
+      Cached size limit, in bytes.
+   */
+   void set_cached_size_max(std::size_t size);
+
+   //! Frees all the blocks in the cache.
+   void trim();
+
+private:
+   //! Count of size classes: from one page up to 2^(size_classes - 1) pages.
+   static std::size_t const size_classes = 9;
+
+private:
+   //! Constructor.
+   buffer_pool();
+
+   //! Destructor.
+   ~buffer_pool();
+
+   /*! Returns the size class index for the specified block size.
+
+   @param size
+      Block size, in bytes.
+   @return
+      Index of the smallest size class that can hold size bytes, or size_classes if size is too large to
+      be cached.
+   */
+   static std::size_t size_class(std::size_t size);
+
+private:
+   //! Governs access to all the other members.
+   mutable _std::mutex mtx;
+   //! Free blocks, one LIFO list per size class.
+   collections::vector<memory::pages_ptr> free_blocks[size_classes];
+   //! Total size of the blocks in free_blocks.
+   std::size_t cached_size_;
+   //! Maximum value for cached_size_.
+   std::size_t cached_size_max;
+   //! Statistics.
+   usage_counters counters_;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_BUFFER_POOL_HXX
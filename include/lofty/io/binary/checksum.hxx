@@ -0,0 +1,269 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_CHECKSUM_HXX
+#define _LOFTY_IO_BINARY_CHECKSUM_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/io/binary.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+//! Interface for checksums and hashes computed incrementally over a sequence of bytes.
+class LOFTY_SYM checksum {
+public:
+   //! Destructor.
+   virtual ~checksum();
+
+   //! Restores the initial state, as if no data had been processed.
+   virtual void reset() = 0;
+
+   /*! Adds bytes to the data being checksummed.
+
+   @param src
+      Pointer to the bytes.
+   @param src_size
+      Count of bytes.
+   */
+   virtual void update(void const * src, std::size_t src_size) = 0;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! CRC-32C (Castagnoli), as used by iSCSI, SCTP, ext4 and others. Uses the CRC32 instruction of SSE 4.2 if
+the CPU supports it, which is determined at run time; otherwise falls back to a slicing-by-8 lookup table. */
+class LOFTY_SYM crc32c : public checksum {
+public:
+   //! Default constructor.
+   crc32c() :
+      crc(0xffffffff) {
+   }
+
+   //! Destructor.
+   virtual ~crc32c();
+
+   /*! Returns true if the CRC is computed by the CPU instead of a lookup table.
+
+   @return
+      true if hardware acceleration is used, or false otherwise.
+   */
+   static bool hardware_accelerated();
+
+   //! See checksum::reset().
+   virtual void reset() override;
+
+   //! See checksum::update().
+   virtual void update(void const * src, std::size_t src_size) override;
+
+   /*! Returns the CRC of the data processed so far.
+
+   @return
+      CRC-32C value.
+   */
+   std::uint32_t value() const {
+      return ~crc;
+   }
+
+private:
+   //! Current CRC, bit-inverted.
+   std::uint32_t crc;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! 64-bit xxHash (XXH64): a fast non-cryptographic hash that consumes 32-byte stripes as four independent
+lanes, which the CPU can process in parallel. */
+class LOFTY_SYM xxhash64 : public checksum {
+public:
+   /*! Constructor.
+
+   @param seed
+      Seed for the hash; different seeds result in unrelated hashes for the same data.
+   */
+   explicit xxhash64(std::uint64_t seed = 0);
+
+   //! Destructor.
+   virtual ~xxhash64();
+
+   //! See checksum::reset().
+   virtual void reset() override;
+
+   //! See checksum::update().
+   virtual void update(void const * src, std::size_t src_size) override;
+
+   /*! Returns the hash of the data processed so far.
+
+   @return
+      XXH64 value.
+   */
+   std::uint64_t value() const;
+
+private:
+   //! Size of a stripe, in bytes.
+   static std::size_t const stripe_size = 32;
+
+   //! Seed.
+   std::uint64_t seed;
+   //! Accumulators for the four lanes.
+   std::uint64_t lanes[4];
+   //! Count of bytes processed so far.
+   std::uint64_t total_size;
+   //! Bytes that don’t make up a full stripe yet.
+   std::uint8_t stripe[stripe_size];
+   //! Count of bytes in stripe.
+   std::size_t stripe_used;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Buffered input stream that checksums the data read from another buffered input stream. Bytes are passed to
+the checksum as they’re consumed, straight from the wrapped stream’s buffer, so the integrity check overlaps
+with reading and requires no extra copy. Adapters can be stacked to compute multiple checksums at once.
+
+Since reading from the wrapped stream would skip the checksum, unbuffered() returns the adapter itself; this
+also keeps copy() from moving data via the OS behind the adapter’s back. */
+class LOFTY_SYM checksum_istream : public buffered_istream, public noncopyable {
+public:
+   /*! Constructor.
+
+   @param bin_istream
+      Stream to read from.
+   @param sum
+      Checksum to update with the data read.
+   */
+   checksum_istream(_std::shared_ptr<buffered_istream> bin_istream, _std::shared_ptr<checksum> sum);
+
+   //! Destructor.
+   virtual ~checksum_istream();
+
+   //! See buffered_istream::consume_bytes().
+   virtual void consume_bytes(std::size_t count) override;
+
+   //! See buffered_istream::peek_bytes().
+   virtual _std::tuple<void const *, std::size_t> peek_bytes(std::size_t count) override;
+
+   /*! Returns the checksum being updated.
+
+   @return
+      Pointer to the checksum.
+   */
+   _std::shared_ptr<checksum> const & sum() const {
+      return sum_;
+   }
+
+protected:
+   //! See buffered_istream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   //! Wrapped stream.
+   _std::shared_ptr<buffered_istream> bin_istream;
+   //! Checksum to update.
+   _std::shared_ptr<checksum> sum_;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Buffered output stream that checksums the data written to another buffered output stream. Data committed
+via get_buffer_bytes()/commit_bytes() is checksummed in the wrapped stream’s buffer, and data passed to
+write() or write_buffers() before being handed to the wrapped stream, so no extra copy is made. Adapters can
+be stacked to compute multiple checksums at once. See checksum_istream for unbuffered(). */
+class LOFTY_SYM checksum_ostream : public buffered_ostream, public noncopyable {
+public:
+   /*! Constructor.
+
+   @param bin_ostream
+      Stream to write to.
+   @param sum
+      Checksum to update with the data written.
+   */
+   checksum_ostream(_std::shared_ptr<buffered_ostream> bin_ostream, _std::shared_ptr<checksum> sum);
+
+   //! Destructor.
+   virtual ~checksum_ostream();
+
+   //! See buffered_ostream::commit_bytes().
+   virtual void commit_bytes(std::size_t count) override;
+
+   //! See buffered_ostream::finalize().
+   virtual void finalize() override;
+
+   //! See buffered_ostream::flush().
+   virtual void flush() override;
+
+   //! See buffered_ostream::get_buffer_bytes().
+   virtual _std::tuple<void *, std::size_t> get_buffer_bytes(std::size_t count) override;
+
+   /*! Returns the checksum being updated.
+
+   @return
+      Pointer to the checksum.
+   */
+   _std::shared_ptr<checksum> const & sum() const {
+      return sum_;
+   }
+
+   //! See buffered_ostream::write().
+   virtual std::size_t write(void const * src, std::size_t src_size) override;
+
+   //! See buffered_ostream::write_buffers().
+   virtual std::size_t write_buffers(const_buffer const * bufs, std::size_t bufs_count) override;
+
+protected:
+   //! See buffered_ostream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   //! Wrapped stream.
+   _std::shared_ptr<buffered_ostream> bin_ostream;
+   //! Checksum to update.
+   _std::shared_ptr<checksum> sum_;
+   //! Start of the buffer last returned by get_buffer_bytes().
+   void const * reserved_buf;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_CHECKSUM_HXX
@@ -0,0 +1,237 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_FRAMING_HXX
+#define _LOFTY_IO_BINARY_FRAMING_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io/binary.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Length-prefixed message framing on top of buffered binary streams: each frame is a length prefix followed
+by that many bytes of payload. */
+namespace framing {}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace framing {
+
+//! Encoding of the length prefix that precedes each frame’s payload.
+LOFTY_ENUM(length_prefix,
+   //! Unsigned LEB128 (protobuf-style varint), 1 to 10 bytes.
+   (varint,    0),
+   //! 1-byte unsigned integer.
+   (uint8,     1),
+   //! 2-byte unsigned integer, big endian (network byte order).
+   (uint16_be, 2),
+   //! 2-byte unsigned integer, little endian.
+   (uint16_le, 3),
+   //! 4-byte unsigned integer, big endian (network byte order).
+   (uint32_be, 4),
+   //! 4-byte unsigned integer, little endian.
+   (uint32_le, 5)
+);
+
+/*! Returns the size of the length prefix needed to encode the specified payload size.
+
+@param prefix
+   Length prefix encoding.
+@param payload_size
+   Size of the payload, in bytes.
+@return
+   Size of the length prefix, in bytes.
+*/
+LOFTY_SYM std::size_t prefix_size(length_prefix prefix, std::size_t payload_size);
+
+}}}} //namespace lofty::io::binary::framing
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace framing {
+
+/*! Reads length-prefixed frames from a buffered binary input stream.
+
+Frames that are already entirely in the stream’s read buffer, or that can be brought into it by a refill of
+at most view_size_max bytes, are returned as views into that buffer, without copying; larger frames that span
+one or more refills are copied into a buffer owned by the reader, leaving the stream’s buffer at its usual
+size. Either way, the returned payload remains valid until the next call to read() or until the stream is used
+directly. */
+class LOFTY_SYM reader : public noncopyable {
+public:
+   //! Default value for the view_size_max constructor argument.
+   static std::size_t const view_size_max_default = 0x10000;
+
+public:
+   /*! Constructor.
+
+   @param bin_istream
+      Stream to read frames from.
+   @param prefix
+      Encoding of the length prefix.
+   @param frame_size_max
+      Maximum payload size; larger frames are rejected before any of their payload is read.
+   @param view_size_max
+      Largest frame (prefix included) that will be read in a single refill of the stream’s buffer, making it
+      available as a view into it; larger frames that aren’t already buffered in full will be copied.
+   */
+   reader(
+      _std::shared_ptr<buffered_istream> bin_istream, length_prefix prefix, std::size_t frame_size_max,
+      std::size_t view_size_max = view_size_max_default
+   );
+
+   //! Destructor.
+   ~reader();
+
+   /*! Reads the next frame. Throws a lofty::domain_error if the length prefix is malformed or exceeds the
+   maximum frame size, or a lofty::io::error if the stream ends in the middle of a frame.
+
+   @param frame
+      Receives the address and size of the frame’s payload.
+   @return
+      true if a frame was read, or false if the stream ended before the start of a new frame.
+   */
+   bool read(const_buffer * frame);
+
+private:
+   /*! Reads and decodes the length prefix of the next frame.
+
+   @param payload_size
+      Receives the decoded payload size.
+   @return
+      Size of the length prefix, or 0 if the stream ended before the start of a new frame.
+   */
+   std::size_t read_prefix(std::size_t * payload_size);
+
+   /*! Copies a frame that spans a refill of the stream’s buffer into spill_buf.
+
+   @param frame_size
+      Size of the frame’s payload.
+   */
+   void read_spilled(std::size_t frame_size);
+
+private:
+   //! Source stream.
+   _std::shared_ptr<buffered_istream> bin_istream;
+   //! Encoding of the length prefix.
+   length_prefix prefix;
+   //! Maximum payload size.
+   std::size_t frame_size_max;
+   //! Largest frame that will be made available as a view into the stream’s buffer.
+   std::size_t view_size_max;
+   //! Bytes of the stream’s buffer backing the last returned frame, to be consumed by the next read().
+   std::size_t pending_consume_size;
+   //! Storage for frames that couldn’t be returned as views.
+   collections::vector<std::int8_t> spill_buf;
+};
+
+}}}} //namespace lofty::io::binary::framing
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace framing {
+
+/*! Writes length-prefixed frames to a buffered binary output stream, encoding them directly in the stream’s
+write buffer. */
+class LOFTY_SYM writer : public noncopyable {
+public:
+   /*! Payloads of at least this many bytes are handed to the stream’s write() after the length prefix instead
+   of being copied into its buffer, so they can go out together with it in a single gather write. */
+   static std::size_t const pass_through_size_min = 0x1000;
+
+public:
+   /*! Constructor.
+
+   @param bin_ostream
+      Stream to write frames to.
+   @param prefix
+      Encoding of the length prefix.
+   @param frame_size_max
+      Maximum payload size; attempting to write a larger frame will throw a lofty::domain_error.
+   */
+   writer(_std::shared_ptr<buffered_ostream> bin_ostream, length_prefix prefix, std::size_t frame_size_max);
+
+   //! Destructor.
+   ~writer();
+
+   /*! Reserves space for a frame in the stream’s write buffer, allowing the caller to encode its payload in
+   place. The frame must then be completed by calling commit().
+
+   @param payload_size_max
+      Maximum size of the payload that will be committed.
+   @return
+      Pointer to the space reserved for the payload, which can hold at least payload_size_max bytes.
+   */
+   void * get_buffer(std::size_t payload_size_max);
+
+   /*! Completes a frame started with get_buffer(), writing its length prefix.
+
+   @param payload_size
+      Actual size of the payload; must not exceed the payload_size_max argument passed to get_buffer().
+   */
+   void commit(std::size_t payload_size);
+
+   /*! Writes a frame.
+
+   @param src
+      Address of the payload.
+   @param src_size
+      Size of the payload, in bytes.
+   */
+   void write(void const * src, std::size_t src_size);
+
+private:
+   /*! Throws a lofty::domain_error if the specified payload size exceeds the maximum frame size.
+
+   @param payload_size
+      Payload size to validate.
+   */
+   void validate_frame_size(std::size_t payload_size) const;
+
+private:
+   //! Destination stream.
+   _std::shared_ptr<buffered_ostream> bin_ostream;
+   //! Encoding of the length prefix.
+   length_prefix prefix;
+   //! Maximum payload size.
+   std::size_t frame_size_max;
+   //! Start of the frame reserved by get_buffer(), or nullptr if no frame is being constructed.
+   std::int8_t * reserved_frame;
+   //! Size of the length prefix reserved by get_buffer().
+   std::size_t reserved_prefix_size;
+   //! Payload size passed to get_buffer().
+   std::size_t reserved_payload_size_max;
+};
+
+}}}} //namespace lofty::io::binary::framing
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_FRAMING_HXX
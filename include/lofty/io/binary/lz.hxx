@@ -0,0 +1,200 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+/*! @file
+Fast LZ-family compression for binary streams.
+
+Data is compressed in independent blocks using the LZ4 block format (sequences of literals followed by a
+match against up to 64 KiB of preceding data in the same block), which trades some compression ratio for
+very fast compression and decompression. The stream format is:
+
+•  Frame header: the bytes “LFZ1”, followed by one byte containing the base-2 logarithm of the maximum
+   uncompressed block size, and one byte of flags (bit 0: a content checksum follows the end mark);
+•  Zero or more blocks, each preceded by a 32-bit little-endian word containing the size of the block data;
+   if the most significant bit is set, the block data is stored uncompressed;
+•  End mark: a 32-bit word with value 0;
+•  Content checksum, if enabled: CRC-32C of the uncompressed data, as a 32-bit little-endian word. */
+
+#ifndef _LOFTY_IO_BINARY_LZ_HXX
+#define _LOFTY_IO_BINARY_LZ_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/checksum.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Buffered output stream that compresses data and writes it to another buffered output stream. Blocks are
+compressed straight into the wrapped stream’s buffer. Since it’s a buffered_ostream, it can be passed to
+io::text::make_ostream() to compress text output transparently.
+
+flush() compresses and writes any partial block, so it should be used sparingly to avoid reducing the
+compression ratio; finalize() also writes the end mark and the content checksum. */
+class LOFTY_SYM lz_ostream : public buffered_ostream, public noncopyable {
+public:
+   //! Default maximum uncompressed size of a block, in bytes.
+   static std::size_t const default_block_size = 0x10000;
+
+   /*! Constructor.
+
+   @param bin_ostream
+      Stream to write the compressed data to.
+   @param block_size
+      Maximum uncompressed size of a block, in bytes. Must be a power of 2 between 1 KiB and 4 MiB; larger
+      blocks give the compressor more chances to find matches, at the cost of memory on both ends.
+   */
+   explicit lz_ostream(
+      _std::shared_ptr<buffered_ostream> bin_ostream, std::size_t block_size = default_block_size
+   );
+
+   //! Destructor.
+   virtual ~lz_ostream();
+
+   //! See buffered_ostream::commit_bytes().
+   virtual void commit_bytes(std::size_t count) override;
+
+   //! See buffered_ostream::finalize().
+   virtual void finalize() override;
+
+   //! See buffered_ostream::flush().
+   virtual void flush() override;
+
+   //! See buffered_ostream::get_buffer_bytes().
+   virtual _std::tuple<void *, std::size_t> get_buffer_bytes(std::size_t count) override;
+
+   //! See buffered_ostream::write().
+   virtual std::size_t write(void const * src, std::size_t src_size) override;
+
+protected:
+   //! See buffered_ostream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   /*! Compresses a block and writes it to the wrapped stream.
+
+   @param src
+      Pointer to the uncompressed data.
+   @param src_size
+      Size of the uncompressed data; must not be greater than block_size.
+   */
+   void write_block(std::uint8_t const * src, std::size_t src_size);
+
+   //! Writes the frame header, if it hasn’t been written yet.
+   void write_header();
+
+   //! Wrapped stream.
+   _std::shared_ptr<buffered_ostream> bin_ostream;
+   //! Uncompressed data that doesn’t make up a full block yet.
+   collections::vector<std::uint8_t> pending_buf;
+   //! Count of bytes in pending_buf.
+   std::size_t pending_size;
+   //! Maximum uncompressed size of a block.
+   std::size_t block_size;
+   //! Base-2 logarithm of block_size.
+   std::uint8_t block_size_log2;
+   //! true if the frame header has been written.
+   bool header_written;
+   //! Checksum of the uncompressed data.
+   crc32c content_crc;
+   //! Hash table used by the compressor, mapping 4-byte sequences to their last position in the block.
+   _std::unique_ptr<std::uint32_t[]> match_table;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Buffered input stream that decompresses data written by lz_ostream, reading it from another buffered input
+stream. Blocks are decompressed straight from the wrapped stream’s buffer. Since it’s a buffered_istream, it
+can be passed to io::text::make_istream() to read compressed text transparently.
+
+Malformed data causes a lofty::domain_error to be thrown, and data truncated before the end mark a
+lofty::io::error; a content checksum mismatch is also reported as a lofty::io::error. */
+class LOFTY_SYM lz_istream : public buffered_istream, public noncopyable {
+public:
+   /*! Constructor.
+
+   @param bin_istream
+      Stream to read the compressed data from.
+   */
+   explicit lz_istream(_std::shared_ptr<buffered_istream> bin_istream);
+
+   //! Destructor.
+   virtual ~lz_istream();
+
+   //! See buffered_istream::consume_bytes().
+   virtual void consume_bytes(std::size_t count) override;
+
+   //! See buffered_istream::peek_bytes().
+   virtual _std::tuple<void const *, std::size_t> peek_bytes(std::size_t count) override;
+
+protected:
+   //! See buffered_istream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   /*! Reads and decompresses the next block, appending it to the data in the buffer.
+
+   @return
+      true if a block was read, or false if the end mark was reached.
+   */
+   bool read_block();
+
+   //! Reads the frame header.
+   void read_header();
+
+   //! Reads the end of the frame, verifying the content checksum if present.
+   void read_trailer();
+
+   //! Wrapped stream.
+   _std::shared_ptr<buffered_istream> bin_istream;
+   //! Decompressed data.
+   collections::vector<std::uint8_t> buf;
+   //! Offset of the first unconsumed byte in buf.
+   std::size_t buf_offset;
+   //! Count of decompressed bytes in buf, starting from buf_offset.
+   std::size_t buf_used;
+   //! Maximum uncompressed size of a block, from the frame header.
+   std::size_t block_size;
+   //! Flags from the frame header.
+   std::uint8_t flags;
+   //! true if the frame header has been read.
+   bool header_read;
+   //! true if the end mark has been read.
+   bool eof;
+   //! Checksum of the decompressed data.
+   crc32c content_crc;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_LZ_HXX
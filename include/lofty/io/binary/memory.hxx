@@ -0,0 +1,160 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_MEMORY_HXX
+#define _LOFTY_IO_BINARY_MEMORY_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io/binary.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Binary input from a memory buffer. The buffer is not copied, so it must outlive the stream; peek() returns
+pointers straight into it, and reads involve no system calls. */
+class LOFTY_SYM memory_istream : public buffered_istream, public sized, public noncopyable {
+public:
+   /*! Constructor.
+
+   @param src
+      Pointer to the data to read.
+   @param src_size
+      Size of the data, in bytes.
+   */
+   memory_istream(void const * src, std::size_t src_size);
+
+   //! Destructor.
+   virtual ~memory_istream();
+
+   //! See buffered_istream::consume_bytes().
+   virtual void consume_bytes(std::size_t count) override;
+
+   //! See buffered_istream::peek_bytes().
+   virtual _std::tuple<void const *, std::size_t> peek_bytes(std::size_t count) override;
+
+   //! See buffered_istream::read().
+   virtual std::size_t read(void * dst, std::size_t dst_max) override;
+
+   /*! Returns the count of bytes not read yet.
+
+   @return
+      Count of bytes left.
+   */
+   std::size_t remaining_size() const {
+      return static_cast<std::size_t>(src_end - src);
+   }
+
+   //! See sized::size().
+   virtual full_size_t size() const override;
+
+protected:
+   //! See buffered_istream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   //! Start of the data.
+   std::uint8_t const * src_begin;
+   //! Next byte to read.
+   std::uint8_t const * src;
+   //! End of the data.
+   std::uint8_t const * src_end;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Binary output to a vector of bytes. get_buffer() returns a pointer straight into the vector’s spare
+capacity, and writes involve no system calls. */
+class LOFTY_SYM memory_ostream : public buffered_ostream, public noncopyable {
+public:
+   //! Default constructor.
+   memory_ostream();
+
+   /*! Constructor that associates an external vector to write to.
+
+   @param ext_buf
+      Pointer to a non-owned vector; data will be appended to its current contents.
+   */
+   memory_ostream(external_buffer_t const &, collections::vector<std::uint8_t> * ext_buf);
+
+   //! Destructor.
+   virtual ~memory_ostream();
+
+   //! Truncates the vector so that the next write will occur at offset 0.
+   void clear();
+
+   //! See buffered_ostream::commit_bytes().
+   virtual void commit_bytes(std::size_t count) override;
+
+   /*! Returns the data written so far.
+
+   @return
+      Reference to the vector the stream writes to.
+   */
+   collections::vector<std::uint8_t> const & content() const {
+      return *buf;
+   }
+
+   //! See buffered_ostream::finalize().
+   virtual void finalize() override;
+
+   //! See buffered_ostream::flush().
+   virtual void flush() override;
+
+   //! See buffered_ostream::get_buffer_bytes().
+   virtual _std::tuple<void *, std::size_t> get_buffer_bytes(std::size_t count) override;
+
+   /*! Yields ownership of the vector. If the memory_ostream instance was constructed based on an external
+   vector, the result will be an empty vector; the data will only be accessible through the external vector.
+
+   @return
+      Former content of the stream.
+   */
+   collections::vector<std::uint8_t> release_content();
+
+   //! See buffered_ostream::write().
+   virtual std::size_t write(void const * src, std::size_t src_size) override;
+
+protected:
+   //! See buffered_ostream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   //! Pointer to the vector being written to.
+   collections::vector<std::uint8_t> * buf;
+   //! Default target of buf, if none is supplied via the external_buffer constructor.
+   collections::vector<std::uint8_t> default_buf;
+};
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_MEMORY_HXX
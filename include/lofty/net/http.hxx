@@ -0,0 +1,637 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_NET_HTTP_HXX
+#define _LOFTY_NET_HTTP_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/net/tcp.hxx>
+#include <lofty/_std/functional.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net {
+
+//! HTTP/1.1 server engine, running on coroutines on top of lofty::net::tcp.
+namespace http {}
+
+}} //namespace lofty::net
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+namespace _pvt {
+
+class connection_engine;
+
+} //namespace _pvt
+
+/*! Non-owning reference to a sequence of bytes of an HTTP message, such as a header value. Only valid until the
+response to the request it belongs to has been completed. */
+class LOFTY_SYM bytes_view {
+public:
+   //! Default constructor.
+   bytes_view() :
+      chars(nullptr),
+      chars_size(0) {
+   }
+
+   /*! Constructor.
+
+   @param chars_
+      Pointer to the first byte.
+   @param chars_size_
+      Count of bytes.
+   */
+   bytes_view(char const * chars_, std::size_t chars_size_) :
+      chars(chars_),
+      chars_size(chars_size_) {
+   }
+
+   /*! Returns a pointer to the bytes.
+
+   @return
+      Pointer to the first byte.
+   */
+   char const * data() const {
+      return chars;
+   }
+
+   /*! Returns true if the view is empty.
+
+   @return
+      true if size() == 0, or false otherwise.
+   */
+   bool empty() const {
+      return chars_size == 0;
+   }
+
+   /*! Returns true if the view contains exactly the specified ASCII string.
+
+   @param s
+      NUL-terminated string to compare with.
+   @return
+      true if the bytes match s, or false otherwise.
+   */
+   bool equals(char const * s) const;
+
+   /*! Returns true if the view contains the specified ASCII string, ignoring differences in letter case.
+
+   @param s
+      NUL-terminated string to compare with.
+   @return
+      true if the bytes match s, or false otherwise.
+   */
+   bool equals_ignore_case(char const * s) const;
+
+   /*! Returns the count of bytes.
+
+   @return
+      Count of bytes.
+   */
+   std::size_t size() const {
+      return chars_size;
+   }
+
+   /*! Returns true if the view begins with the specified bytes.
+
+   @param s
+      Pointer to the bytes to compare with.
+   @param s_size
+      Count of bytes in s.
+   @return
+      true if the view begins with s, or false otherwise.
+   */
+   bool starts_with(char const * s, std::size_t s_size) const;
+
+   /*! Returns a copy of the bytes as a string, decoded as UTF-8; invalid sequences are replaced.
+
+   @return
+      Decoded string.
+   */
+   str to_str() const;
+
+private:
+   //! Pointer to the first byte.
+   char const * chars;
+   //! Count of bytes.
+   std::size_t chars_size;
+};
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+/*! HTTP request, as parsed from a connection. Every bytes_view returned by its methods points directly into the
+connection’s read buffer, and is only valid until the request handler returns. */
+class LOFTY_SYM request : public noncopyable {
+private:
+   friend class _pvt::connection_engine;
+
+public:
+   /*! Returns the request body. If the body was sent using chunked transfer encoding, this is the decoded
+   body.
+
+   @return
+      Request body.
+   */
+   bytes_view body() const {
+      return bytes_view(body_chars, body_size);
+   }
+
+   /*! Returns the value of the first header with the specified name.
+
+   @param name
+      NUL-terminated header name; matched ignoring letter case.
+   @return
+      Header value, or an empty view if the header was not found.
+   */
+   bytes_view header(char const * name) const;
+
+   /*! Returns the name of a header.
+
+   @param i
+      Index of the header.
+   @return
+      Header name.
+   */
+   bytes_view header_name(std::size_t i) const;
+
+   /*! Returns the value of a header.
+
+   @param i
+      Index of the header.
+   @return
+      Header value, with any leading or trailing whitespace removed.
+   */
+   bytes_view header_value(std::size_t i) const;
+
+   /*! Returns the count of headers in the request.
+
+   @return
+      Count of headers.
+   */
+   std::size_t headers_count() const {
+      return headers.size();
+   }
+
+   /*! Returns true if the connection will be kept open after the response to this request.
+
+   @return
+      true if the connection is persistent, or false if it will be closed after the response.
+   */
+   bool keep_alive() const {
+      return persistent;
+   }
+
+   /*! Returns the request method, e.g. “GET”.
+
+   @return
+      Request method.
+   */
+   bytes_view method() const {
+      return view(method_range);
+   }
+
+   /*! Returns the path component of the request target, i.e. everything before the first “?”.
+
+   @return
+      Request path.
+   */
+   bytes_view path() const {
+      return view(path_range);
+   }
+
+   /*! Returns the query component of the request target, i.e. everything after the first “?”.
+
+   @return
+      Request query, or an empty view if the target has no query.
+   */
+   bytes_view query() const {
+      return view(query_range);
+   }
+
+   /*! Returns the request target, as it appeared in the request line.
+
+   @return
+      Request target.
+   */
+   bytes_view target() const {
+      return view(target_range);
+   }
+
+   /*! Returns the minor version of the HTTP protocol used by the request: 0 for HTTP/1.0, 1 for HTTP/1.1.
+
+   @return
+      HTTP minor version.
+   */
+   unsigned version_minor() const {
+      return ver_minor;
+   }
+
+private:
+   //! Location of a sequence of bytes in the read buffer.
+   struct range {
+      //! Offset of the first byte from the start of the request.
+      std::uint32_t begin;
+      //! Count of bytes.
+      std::uint32_t size;
+   };
+
+   //! Location of a header in the read buffer.
+   struct header_ranges {
+      //! Header name.
+      range name;
+      //! Header value.
+      range value;
+   };
+
+private:
+   //! Default constructor.
+   request();
+
+   //! Resets the request to an empty state, retaining any allocated memory.
+   void reset();
+
+   /*! Returns a view of a range of the read buffer.
+
+   @param r
+      Range of bytes.
+   @return
+      Corresponding view.
+   */
+   bytes_view view(range const & r) const {
+      return bytes_view(chars + r.begin, r.size);
+   }
+
+private:
+   //! Start of the request in the read buffer. Only valid while the request is being handled.
+   char const * chars;
+   //! Request method.
+   range method_range;
+   //! Request target.
+   range target_range;
+   //! Path component of the target.
+   range path_range;
+   //! Query component of the target.
+   range query_range;
+   //! Request headers, in the order they appeared.
+   collections::vector<header_ranges> headers;
+   //! Start of the body.
+   char const * body_chars;
+   //! Size of the body.
+   std::size_t body_size;
+   //! HTTP minor version.
+   unsigned ver_minor;
+   //! true if the connection will be kept open after the response.
+   bool persistent;
+};
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+/*! HTTP response. Its body is normally buffered, and sent with a Content-Length header when the request handler
+returns; after a call to enable_chunked() it’s instead sent as it’s written, using chunked transfer encoding. */
+class LOFTY_SYM response : public noncopyable {
+private:
+   friend class _pvt::connection_engine;
+
+public:
+   /*! Adds a header to the response. Content-Length, Transfer-Encoding and Connection are managed automatically
+   and must not be added.
+
+   @param name
+      Header name.
+   @param value
+      Header value.
+   */
+   void add_header(str const & name, str const & value);
+
+   /*! Causes the connection to be closed after this response has been sent, even if the client requested to
+   keep it open. */
+   void close_connection();
+
+   /*! Sends the status line and headers immediately, switching the response to chunked transfer encoding;
+   each subsequent call to write() will send a chunk. Has no effect for HTTP/1.0 clients, for which the body
+   is instead delimited by closing the connection. */
+   void enable_chunked();
+
+   /*! Sets the status code of the response. The default is 200.
+
+   @param code
+      HTTP status code.
+   */
+   void set_status(unsigned code);
+
+   /*! Returns the status code of the response.
+
+   @return
+      HTTP status code.
+   */
+   unsigned status() const {
+      return status_code;
+   }
+
+   /*! Appends bytes to the response body.
+
+   @param src
+      Pointer to the bytes to write.
+   @param src_size
+      Count of bytes to write.
+   */
+   void write(void const * src, std::size_t src_size);
+
+   /*! Appends a string to the response body, encoded as UTF-8.
+
+   @param s
+      String to write.
+   */
+   void write(str const & s);
+
+private:
+   /*! Constructor.
+
+   @param bin_ostream
+      Stream that responses will be written to.
+   */
+   explicit response(io::binary::ostream * bin_ostream);
+
+   //! Sends any response bytes still queued in the output buffer.
+   void flush();
+
+   //! Completes the response, queueing anything not yet sent.
+   void finish();
+
+   /*! Returns true if any response bytes are queued in the output buffer.
+
+   @return
+      true if flush() has anything to send, or false otherwise.
+   */
+   bool has_pending_output() const {
+      return out_buf.size() > 0;
+   }
+
+   /*! Returns true if the status line and headers have already been queued or sent.
+
+   @return
+      true if the head has been sent, or false otherwise.
+   */
+   bool is_head_sent() const {
+      return head_sent;
+   }
+
+   /*! Prepares the response for a new request, retaining any allocated memory.
+
+   @param ver_minor_
+      HTTP minor version of the request.
+   @param persistent_
+      true if the connection is to be kept open after the response.
+   @param omit_body_
+      true if the response must not include a body, e.g. because the request method is HEAD.
+   */
+   void reset(unsigned ver_minor_, bool persistent_, bool omit_body_);
+
+   /*! Queues the status line and headers.
+
+   @param content_length
+      Value for the Content-Length header, or numeric::max<std::size_t>::value if unknown; ignored if chunked is
+      true.
+   */
+   void send_head(std::size_t content_length);
+
+   /*! Queues bytes for sending, flushing the output buffer together with them if they are large enough not to
+   be worth copying.
+
+   @param src
+      Pointer to the bytes to send.
+   @param src_size
+      Count of bytes to send.
+   @param suffix
+      Pointer to additional bytes to send after src, or nullptr.
+   @param suffix_size
+      Count of bytes in suffix.
+   */
+   void send_bytes(void const * src, std::size_t src_size, char const * suffix, std::size_t suffix_size);
+
+   /*! Returns true if the connection will be kept open after this response.
+
+   @return
+      true if the connection is persistent, or false otherwise.
+   */
+   bool will_keep_alive() const {
+      return persistent;
+   }
+
+private:
+   //! Size above which a body block is passed to the socket directly instead of being copied to out_buf.
+   static std::size_t const pass_through_size_min = 0x1000;
+
+   //! Stream the responses are written to.
+   io::binary::ostream * bin_ostream;
+   //! Responses ready to be sent; reused for every response on the connection.
+   collections::vector<std::uint8_t> out_buf;
+   //! Headers added by the request handler; reused for every response on the connection.
+   collections::vector<std::uint8_t> headers_buf;
+   //! Buffered body; reused for every response on the connection.
+   collections::vector<std::uint8_t> body_buf;
+   //! HTTP status code.
+   unsigned status_code;
+   //! HTTP minor version of the request.
+   unsigned ver_minor;
+   //! true if the connection will be kept open after the response.
+   bool persistent:1;
+   //! true if the body must not be sent.
+   bool omit_body:1;
+   //! true if the body is being sent with chunked transfer encoding.
+   bool chunked:1;
+   //! true if the status line and headers have been queued.
+   bool head_sent:1;
+};
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+//! Type of the function invoked to handle each request.
+typedef _std::function<void (request const & req, response * resp)> request_handler_type;
+
+/*! Dispatches requests to handlers based on their method and path. Routes are matched in the order they were
+added; if a path matches but none of its methods does, the response has status 405. */
+class LOFTY_SYM router : public noncopyable {
+public:
+   //! Default constructor.
+   router();
+
+   //! Destructor.
+   ~router();
+
+   /*! Adds a route.
+
+   @param method
+      Request method to match, e.g. “GET”; if empty, any method will match.
+   @param path
+      Request path to match. If it ends in “*”, any path beginning with the rest of it will match.
+   @param handler
+      Function to invoke for requests matching the route.
+   @return
+      *this.
+   */
+   router & add_route(str const & method, str const & path, request_handler_type handler);
+
+   /*! Handles a request, invoking the handler of the first matching route. Requests that match no routes get
+   a 404 response.
+
+   @param req
+      Request to handle.
+   @param resp
+      Response to the request.
+   */
+   void operator()(request const & req, response * resp) const;
+
+private:
+   //! Route information.
+   struct route {
+      //! Method to match, encoded as UTF-8; empty to match any method.
+      collections::vector<std::uint8_t> method;
+      //! Path to match, encoded as UTF-8, without any trailing “*”.
+      collections::vector<std::uint8_t> path;
+      //! true if path is a prefix to match, or false if it must match exactly.
+      bool prefix;
+      //! Function to invoke.
+      request_handler_type handler;
+   };
+
+private:
+   //! Routes, in the order they were added.
+   collections::vector<route> routes;
+};
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+//! HTTP server, using a tcp::sharded_server to accept connections.
+class LOFTY_SYM server : public noncopyable {
+public:
+   //! Limits applied to each connection, to protect the server from misbehaving clients.
+   struct limits {
+      //! Maximum size of the request line and headers; longer requests get a 431 response.
+      std::size_t head_size_max;
+      //! Maximum size of a request body; larger bodies get a 413 response.
+      std::size_t body_size_max;
+      //! Maximum count of requests that will be served on a connection; 0 means unlimited.
+      std::size_t requests_per_connection_max;
+      //! Maximum count of headers in a request; requests with more get a 431 response.
+      std::size_t headers_max;
+
+      //! Default constructor. Sets every limit to its default value.
+      limits();
+   };
+
+public:
+   /*! Constructor.
+
+   @param address
+      Address to bind to.
+   @param port
+      Port to listen for connections on.
+   @param shards_count
+      Count of shards (threads) to run. If 0, one shard per online CPU will be created.
+   */
+   server(ip::address const & address, ip::port const & port, unsigned shards_count = 0);
+
+   //! Destructor.
+   ~server();
+
+   //! Interrupts the server, causing run() to return (by throwing) as soon as every shard has stopped.
+   void interrupt();
+
+   /*! Runs the server. Each connection is served by a coroutine of its own, which reads and answers requests
+   in order until either side closes the connection. Only returns after every shard has terminated.
+
+   @param handler
+      Function to invoke for each request.
+   */
+   void run(request_handler_type const & handler);
+
+   /*! Serves HTTP requests read from bin_istream, writing responses to bin_ostream, until the connection is
+   closed. Finalizes bin_ostream before returning.
+
+   @param bin_istream
+      Stream to read requests from.
+   @param bin_ostream
+      Stream to write responses to.
+   @param handler
+      Function to invoke for each request.
+   @param lims
+      Limits to apply to the connection.
+   */
+   static void serve(
+      _std::shared_ptr<io::binary::istream> bin_istream, _std::shared_ptr<io::binary::ostream> bin_ostream,
+      request_handler_type const & handler, limits const & lims = limits()
+   );
+
+   /*! Sets the limits applied to each connection. Must be called before run().
+
+   @param lims_
+      New limits.
+   */
+   void set_limits(limits const & lims_) {
+      lims = lims_;
+   }
+
+   /*! Returns the underlying TCP server, e.g. to set socket options.
+
+   @return
+      Reference to the TCP server.
+   */
+   tcp::sharded_server & tcp_server() {
+      return tcp_srv;
+   }
+
+private:
+   //! Underlying TCP server.
+   tcp::sharded_server tcp_srv;
+   //! Limits applied to each connection.
+   limits lims;
+};
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_NET_HTTP_HXX
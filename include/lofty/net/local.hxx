@@ -0,0 +1,222 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_NET_LOCAL_HXX
+#define _LOFTY_NET_LOCAL_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net {
+
+/*! Local (Unix domain, AF_UNIX) socket classes and facilities, for communication between processes on the
+same host. Only available on POSIX hosts. */
+namespace local {}
+
+}} //namespace lofty::net
+
+#if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+//! Type of local socket.
+LOFTY_ENUM(socket_type,
+   //! Reliable byte stream, like a TCP connection.
+   (stream,    1),
+   //! Reliable, ordered sequence of messages, each read in full by a single read.
+   (seqpacket, 2)
+);
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+/*! Connected local socket. Besides regular data, it can transfer file descriptors to the process at the other
+end of the connection (SCM_RIGHTS). */
+class LOFTY_SYM connection : public noncopyable {
+public:
+   //! Maximum count of file descriptors that can be sent or received with a single message.
+   static std::size_t const max_fds_per_message = 16;
+
+public:
+   /*! Constructor.
+
+   @param fd
+      Connected socket.
+   */
+   explicit connection(io::filedesc fd);
+
+   //! Destructor.
+   ~connection();
+
+   /*! Receives data, along with any file descriptors sent with it. Waits for data to become available.
+
+   @param dst
+      Pointer to the buffer to receive the data into.
+   @param dst_max
+      Size of *dst, in bytes. For seqpacket sockets, any excess data in the message will be discarded.
+   @param fds
+      Pointer to a vector to which any received file descriptors will be appended. They are close-on-exec, and
+      share the file status flags (e.g. O_NONBLOCK) of the sender’s file descriptors.
+   @return
+      Count of bytes stored in *dst, or 0 if the peer closed the connection.
+   */
+   std::size_t receive_with_fds(void * dst, std::size_t dst_max, collections::vector<io::filedesc> * fds);
+
+   /*! Sends data along with file descriptors, which the peer will receive as new file descriptors referring to
+   the same open files.
+
+   @param src
+      Pointer to the data to send. At least one byte must be sent along with the file descriptors.
+   @param src_size
+      Size of *src, in bytes. Must be greater than 0.
+   @param fds
+      Pointer to the file descriptors to send.
+   @param fds_count
+      Count of elements in fds. Must not be greater than max_fds_per_message.
+   */
+   void send_with_fds(
+      void const * src, std::size_t src_size, io::filedesc_t const * fds, std::size_t fds_count
+   );
+
+   /*! Returns a stream to read and write data through the socket. The stream is created the first time this is
+   called.
+
+   @return
+      Stream for the socket.
+   */
+   _std::shared_ptr<io::binary::file_iostream> const & socket();
+
+private:
+   //! Connected socket; moved into socket_ when the latter is created.
+   io::filedesc fd;
+   //! Connected socket, even after fd has been moved into socket_.
+   io::filedesc_t raw_fd;
+   //! Stream for the socket. Created by socket() when first needed.
+   _std::shared_ptr<io::binary::file_iostream> socket_;
+};
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+//! Pair of connected local sockets, like the ones that can be shared by a parent and a child process.
+class LOFTY_SYM connection_pair {
+public:
+   /*! Constructor.
+
+   @param type
+      Type of the sockets.
+   */
+   explicit connection_pair(socket_type type = socket_type::stream);
+
+public:
+   //! First end of the connection.
+   _std::shared_ptr<connection> first;
+   //! Second end of the connection.
+   _std::shared_ptr<connection> second;
+};
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+/*! Connects to a local server. If the server’s backlog is full, the connection is retried periodically for
+up to about a second, after which the error is thrown.
+
+@param path
+   Path the server is bound to.
+@param type
+   Type of socket; must match the server’s.
+@return
+   Connection to the server.
+*/
+LOFTY_SYM _std::shared_ptr<connection> connect(os::path const & path, socket_type type = socket_type::stream);
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+//! Local server socket, listening for and accepting connections from other processes.
+class LOFTY_SYM server : public noncopyable {
+public:
+   /*! Constructor.
+
+   @param path
+      Path to bind the socket to. It must not exist; it will be deleted by the destructor.
+   @param type
+      Type of socket.
+   @param backlog_size
+      Count of connections that will be allowed to queue until the server is able to accept them.
+   */
+   explicit server(os::path path, socket_type type = socket_type::stream, unsigned backlog_size = 128);
+
+   //! Destructor. Deletes the socket file.
+   ~server();
+
+   /*! Accepts and returns a connection from a client.
+
+   @return
+      New client connection.
+   */
+   _std::shared_ptr<connection> accept();
+
+   /*! Returns the path the server is bound to.
+
+   @return
+      Socket path.
+   */
+   os::path const & path() const {
+      return path_;
+   }
+
+private:
+   //! Server socket bound to path_.
+   io::filedesc sock_fd;
+   //! Path the server socket is bound to.
+   os::path path_;
+};
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //if LOFTY_HOST_API_POSIX
+
+#endif //ifndef _LOFTY_NET_LOCAL_HXX
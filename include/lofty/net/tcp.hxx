@@ -26,8 +26,10 @@ You should have received a copy of the GNU Lesser General Public License along w
    #pragma once
 #endif
 
+#include <lofty/collections/vector.hxx>
 #include <lofty/io/binary.hxx>
 #include <lofty/net/ip.hxx>
+#include <lofty/thread.hxx>
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -43,7 +45,223 @@ namespace tcp {}
 
 namespace lofty { namespace net { namespace tcp {
 
-//! Initialized TCP connection.
+/*! Set of options to be applied to a TCP socket. Only the options explicitly set are applied; all others keep
+the value chosen by the OS. Setters return *this, so they can be chained:
+
+   @verbatim
+   conn->set_options(net::tcp::socket_options().set_no_delay(true).set_send_buffer_size(0x40000));
+   @endverbatim
+
+Options that the OS doesn’t support cause an exception to be thrown when they’re applied, not when they’re
+set. */
+class LOFTY_SYM socket_options {
+public:
+   //! Default constructor. No options are set.
+   socket_options() :
+      send_buffer_size_(0),
+      receive_buffer_size_(0),
+      keep_alive_idle_secs(0),
+      keep_alive_interval_secs(0),
+      keep_alive_probes(0),
+      linger_timeout_secs(0),
+      defer_accept_timeout_secs(0),
+      fast_open_queue_size_(0),
+      no_delay_set(false),
+      no_delay_(false),
+      cork_set(false),
+      cork_(false),
+      keep_alive_set(false),
+      keep_alive_(false),
+      linger_set(false),
+      linger_(false),
+      defer_accept_set(false) {
+   }
+
+   /*! Applies the options to a socket.
+
+   @param fd
+      Socket to apply the options to.
+   */
+   void apply(io::filedesc_t fd) const;
+
+   /*! Returns true if no options are set.
+
+   @return
+      true if applying the options would not change anything, or false otherwise.
+   */
+   bool empty() const {
+      return !no_delay_set && !cork_set && !send_buffer_size_ && !receive_buffer_size_ && !keep_alive_set &&
+         !linger_set && !defer_accept_set && !fast_open_queue_size_;
+   }
+
+   /*! Enables or disables TCP_CORK (Linux only): while enabled, partial frames are held back until the socket
+   is uncorked, so that headers and body written separately go out in full-sized segments.
+
+   @param enable
+      true to hold back partial frames, or false to send them, also flushing any that are pending.
+   @return
+      *this.
+   */
+   socket_options & set_cork(bool enable) {
+      cork_set = true;
+      cork_ = enable;
+      return *this;
+   }
+
+   /*! Sets TCP_DEFER_ACCEPT (Linux only; only meaningful for server sockets): connections are not reported as
+   accepted until the client sends some data, or the timeout expires.
+
+   @param timeout_secs
+      Maximum time to wait for the first data from a client, in seconds; 0 disables the option.
+   @return
+      *this.
+   */
+   socket_options & set_defer_accept(unsigned timeout_secs) {
+      defer_accept_set = true;
+      defer_accept_timeout_secs = timeout_secs;
+      return *this;
+   }
+
+   /*! Enables TCP_FASTOPEN (only meaningful for server sockets), allowing clients to send data along with the
+   SYN of a connection to a host they have connected to before.
+
+   @param queue_size
+      Maximum count of pending TFO requests; must be greater than 0.
+   @return
+      *this.
+   */
+   socket_options & set_fast_open(unsigned queue_size) {
+      fast_open_queue_size_ = queue_size;
+      return *this;
+   }
+
+   /*! Enables or disables SO_KEEPALIVE, and optionally sets the keep-alive timings (Linux only).
+
+   @param enable
+      true to periodically probe idle connections, or false otherwise.
+   @param idle_secs
+      Time a connection must be idle before probes are sent, in seconds; 0 keeps the OS default.
+   @param interval_secs
+      Time between probes, in seconds; 0 keeps the OS default.
+   @param probes
+      Count of unanswered probes after which the connection is dropped; 0 keeps the OS default.
+   @return
+      *this.
+   */
+   socket_options & set_keep_alive(
+      bool enable, unsigned idle_secs = 0, unsigned interval_secs = 0, unsigned probes = 0
+   ) {
+      keep_alive_set = true;
+      keep_alive_ = enable;
+      keep_alive_idle_secs = idle_secs;
+      keep_alive_interval_secs = interval_secs;
+      keep_alive_probes = probes;
+      return *this;
+   }
+
+   /*! Sets SO_LINGER, which controls how closing a socket behaves when there’s still unsent data.
+
+   @param enable
+      If true, closing the socket will block (or, with a timeout of 0, reset the connection) until the
+      data is sent or the timeout expires; if false, closing returns immediately and the data is sent in the
+      background.
+   @param timeout_secs
+      Linger timeout, in seconds.
+   @return
+      *this.
+   */
+   socket_options & set_linger(bool enable, unsigned timeout_secs = 0) {
+      linger_set = true;
+      linger_ = enable;
+      linger_timeout_secs = timeout_secs;
+      return *this;
+   }
+
+   /*! Enables or disables TCP_NODELAY, which disables Nagle’s algorithm so that small writes are sent
+   immediately instead of being coalesced, trading throughput for latency.
+
+   @param enable
+      true to send small writes immediately, or false to coalesce them.
+   @return
+      *this.
+   */
+   socket_options & set_no_delay(bool enable) {
+      no_delay_set = true;
+      no_delay_ = enable;
+      return *this;
+   }
+
+   /*! Sets SO_RCVBUF, the size of the socket’s receive buffer.
+
+   @param size
+      Size of the buffer, in bytes; the OS may adjust it.
+   @return
+      *this.
+   */
+   socket_options & set_receive_buffer_size(unsigned size) {
+      receive_buffer_size_ = size;
+      return *this;
+   }
+
+   /*! Sets SO_SNDBUF, the size of the socket’s send buffer.
+
+   @param size
+      Size of the buffer, in bytes; the OS may adjust it.
+   @return
+      *this.
+   */
+   socket_options & set_send_buffer_size(unsigned size) {
+      send_buffer_size_ = size;
+      return *this;
+   }
+
+private:
+   //! Size of the send buffer, or 0 if not set.
+   unsigned send_buffer_size_;
+   //! Size of the receive buffer, or 0 if not set.
+   unsigned receive_buffer_size_;
+   //! Keep-alive idle time, in seconds, or 0 for the OS default.
+   unsigned keep_alive_idle_secs;
+   //! Keep-alive probes interval, in seconds, or 0 for the OS default.
+   unsigned keep_alive_interval_secs;
+   //! Count of keep-alive probes, or 0 for the OS default.
+   unsigned keep_alive_probes;
+   //! Linger timeout, in seconds.
+   unsigned linger_timeout_secs;
+   //! TCP_DEFER_ACCEPT timeout, in seconds.
+   unsigned defer_accept_timeout_secs;
+   //! Maximum count of pending TFO requests, or 0 if not set.
+   unsigned fast_open_queue_size_;
+   //! true if no_delay_ is to be applied.
+   bool no_delay_set:1;
+   //! Value for TCP_NODELAY.
+   bool no_delay_:1;
+   //! true if cork_ is to be applied.
+   bool cork_set:1;
+   //! Value for TCP_CORK.
+   bool cork_:1;
+   //! true if keep_alive_ and related members are to be applied.
+   bool keep_alive_set:1;
+   //! Value for SO_KEEPALIVE.
+   bool keep_alive_:1;
+   //! true if linger_ and linger_timeout_secs are to be applied.
+   bool linger_set:1;
+   //! Enables SO_LINGER.
+   bool linger_:1;
+   //! true if defer_accept_timeout_secs is to be applied.
+   bool defer_accept_set:1;
+};
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+/*! Initialized TCP connection.
+
+To keep accepting connections cheap, the binary stream for the socket is only created the first time socket()
+is called, and the local address and port are only retrieved from the OS the first time they’re requested. */
 class LOFTY_SYM connection : public noncopyable {
 public:
    /*! Constructor.
@@ -64,6 +282,17 @@ public:
       ip::port && remote_port
    );
 
+   /*! Constructor. The local address and port will be retrieved from fd when first requested.
+
+   @param fd
+      Connected socket.
+   @param remote_address
+      Address of the remote peer.
+   @param remote_port
+      Port of the remote peer.
+   */
+   connection(io::filedesc fd, ip::address && remote_address, ip::port && remote_port);
+
    //! Destructor.
    ~connection();
 
@@ -73,6 +302,9 @@ public:
       IP address.
    */
    ip::address const & local_address() const {
+      if (!local_address_resolved) {
+         resolve_local_address();
+      }
       return local_address_;
    }
 
@@ -82,6 +314,9 @@ public:
       Port.
    */
    ip::port const & local_port() const {
+      if (!local_address_resolved) {
+         resolve_local_address();
+      }
       return local_port_;
    }
 
@@ -103,26 +338,245 @@ public:
       return remote_port_;
    }
 
+   /*! Checks, without blocking, whether an idle connection can still be used to send a new request: the
+   connection must be open in both directions and there must be no unread data in the OS receive buffer.
+
+   @return
+      true if the connection is usable, or false if the peer closed or reset it, or sent data that nobody
+      asked for.
+   */
+   bool is_reusable() const;
+
+   /*! Applies the specified options to the connection’s socket.
+
+   @param opts
+      Options to apply.
+   */
+   void set_options(socket_options const & opts) {
+      opts.apply(raw_fd);
+   }
+
    /*! Returns a binary input/output stream representing the socket, to receive data from the remote peer.
 
    @return
       Input/output stream for the connection’s socket.
    */
    _std::shared_ptr<io::binary::file_iostream> const & socket() {
+      if (!socket_) {
+         create_socket_stream();
+      }
       return socket_;
    }
 
 private:
-   //! Stream for the connection’s socket.
+   //! Creates socket_, transferring ownership of fd to it.
+   void create_socket_stream();
+
+   //! Retrieves the local address and port of the socket.
+   void resolve_local_address() const;
+
+private:
+   //! Connected socket, until ownership of it is transferred to socket_.
+   io::filedesc fd;
+   //! Connected socket; unlike fd, this remains valid after socket_ is created.
+   io::filedesc_t raw_fd;
+   //! Stream for the connection’s socket. Created by socket() when first needed.
    _std::shared_ptr<io::binary::file_iostream> socket_;
    //! Local address.
-   ip::address local_address_;
+   mutable ip::address local_address_;
    //! Local port.
-   ip::port local_port_;
+   mutable ip::port local_port_;
    //! Address of the remote peer.
    ip::address remote_address_;
    //! Port of the remote peer.
    ip::port remote_port_;
+   //! If false, local_address_ and local_port_ have yet to be retrieved from the OS.
+   mutable bool local_address_resolved:1;
+};
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+/*! Connects to a TCP server. If the calling thread is running coroutines, only the calling coroutine will be
+blocked while the connection is being established.
+
+@param address
+   Address of the server.
+@param port
+   Port the server is listening on.
+@return
+   Connection to the server.
+*/
+LOFTY_SYM _std::shared_ptr<connection> connect(ip::address const & address, ip::port const & port);
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+/*! Pool of outbound connections, reused across requests to the same server (address and port) in order to
+avoid paying for a handshake each time and to keep closed connections from piling up in TIME_WAIT.
+
+Connections are checked out with checkout(), which returns a lease; once the caller is done with the
+connection and has left it in a state suitable for a new request, lease::release() returns it to the pool.
+Leases that are destroyed without being released close their connection, since it might be in the middle of
+an exchange (e.g. after an exception).
+
+Idle connections are checked for liveness before being handed out, and closed after idle_timeout_ms by a
+coroutine that only runs while there are idle connections. When the per-server limit is reached, checkout()
+parks the calling coroutine until another one releases or discards a connection to the same server.
+
+A pool must only be used by coroutines running on a single thread. */
+class LOFTY_SYM connection_pool : public noncopyable {
+private:
+   class impl;
+   struct endpoint;
+
+public:
+   //! Default value for the idle_timeout_ms constructor argument.
+   static unsigned const default_idle_timeout_ms = 60000;
+
+   //! Snapshot of the counters for events that occurred in the pool.
+   struct usage_counters {
+      //! Count of new connections established.
+      std::uint64_t connects;
+      //! Count of checkouts satisfied by an idle connection.
+      std::uint64_t reuses;
+      //! Count of checkouts that had to wait for a connection to be released or discarded.
+      std::uint64_t waits;
+      //! Count of idle connections closed for exceeding the idle timeout.
+      std::uint64_t idle_evictions;
+      //! Count of idle connections found closed by the peer, or otherwise unusable, on checkout.
+      std::uint64_t dead_evictions;
+   };
+
+   //! Exclusive use of a pooled connection, until released or discarded.
+   class LOFTY_SYM lease : public noncopyable {
+   private:
+      friend class connection_pool;
+
+   public:
+      /*! Move constructor.
+
+      @param src
+         Source object.
+      */
+      lease(lease && src);
+
+      //! Destructor. Discards the connection, unless it’s been released.
+      ~lease();
+
+      /*! Returns a pointer to the leased connection.
+
+      @return
+         Pointer to the connection.
+      */
+      _std::shared_ptr<tcp::connection> const & get() const {
+         return conn;
+      }
+
+      //! Closes the connection, freeing its slot in the pool.
+      void discard();
+
+      //! Returns the connection to the pool, for reuse by a later checkout().
+      void release();
+
+      /*! Returns true if the connection was previously used for other requests. A request sent over a reused
+      connection can fail because the server closed it in the meantime, and may be worth retrying once.
+
+      @return
+         true if the connection came from the pool’s idle connections, or false if it was just established.
+      */
+      bool reused() const {
+         return reused_;
+      }
+
+      /*! Dereference operator.
+
+      @return
+         Pointer to the connection.
+      */
+      tcp::connection * operator->() const {
+         return conn.get();
+      }
+
+   private:
+      /*! Constructor.
+
+      @param pool_pimpl
+         Pool that owns the connection.
+      @param ep
+         Server the connection is to.
+      @param conn
+         Connection.
+      @param reused
+         true if conn was an idle connection.
+      */
+      lease(
+         _std::shared_ptr<impl> pool_pimpl, _std::shared_ptr<endpoint> ep,
+         _std::shared_ptr<tcp::connection> conn, bool reused
+      );
+
+   private:
+      //! Pool that owns the connection.
+      _std::shared_ptr<impl> pool_pimpl;
+      //! Server the connection is to.
+      _std::shared_ptr<endpoint> ep;
+      //! Leased connection.
+      _std::shared_ptr<tcp::connection> conn;
+      //! true if conn was an idle connection.
+      bool reused_;
+   };
+
+public:
+   /*! Constructor.
+
+   @param connections_per_host_max
+      Maximum count of connections, leased or idle, to each server.
+   @param idle_timeout_ms
+      Time after which idle connections are closed, in milliseconds.
+   */
+   explicit connection_pool(
+      std::size_t connections_per_host_max, unsigned idle_timeout_ms = default_idle_timeout_ms
+   );
+
+   //! Destructor. Closes every idle connection; leased connections will be closed when released.
+   ~connection_pool();
+
+   /*! Obtains a connection to a server, reusing an idle one if available, or establishing a new one if the
+   limit for the server has not been reached; otherwise, blocks the calling coroutine until another coroutine
+   releases or discards a connection to the same server.
+
+   @param address
+      Address of the server.
+   @param port
+      Port the server is listening on.
+   @return
+      Lease on the connection.
+   */
+   lease checkout(ip::address const & address, ip::port const & port);
+
+   /*! Returns a snapshot of the pool’s counters.
+
+   @return
+      Counters snapshot.
+   */
+   usage_counters counters() const;
+
+   /*! Sets the options to be applied to every new connection established by the pool.
+
+   @param opts
+      Options to apply.
+   */
+   void set_options(socket_options const & opts);
+
+private:
+   //! Pointer to the implementation, shared with leases and with the idle connection eviction coroutine.
+   _std::shared_ptr<impl> pimpl;
 };
 
 }}} //namespace lofty::net::tcp
@@ -131,9 +585,32 @@ private:
 
 namespace lofty { namespace net { namespace tcp {
 
-/*! Attaches a coroutine scheduler to the current thread, and performs and necessary initialization required
-for the current thread to run coroutines. */
+//! TCP server socket, listening for and accepting connections from clients.
 class LOFTY_SYM server : public noncopyable {
+private:
+   friend class sharded_server;
+
+public:
+   /*! Default count of established connections that will be allowed to queue until the server is able to
+   accept them. This is the maximum allowed by the OS, which may further cap it via its own configuration
+   (e.g. net.core.somaxconn on Linux). */
+   static unsigned const default_backlog_size;
+
+   //! Snapshot of the counters for events that occurred while accepting connections.
+   struct accept_counters {
+      //! Count of connections accepted.
+      std::uint64_t accepted;
+      /*! Count of connections that were aborted by the peer, refused due to lack of resources, or closed
+      because their socket refused the accepted-socket options. */
+      std::uint64_t rejected;
+      /*! Count of accept_batch() calls that found the backlog full, i.e. holding more connections than its
+      size, in which case the OS has likely been dropping connection attempts. This is sampled from the
+      TCP_INFO of the listening socket once per call, right after accepting the first connection, and only
+      by calls made on a thread with a coroutine scheduler; it doesn’t count dropped connections, and is
+      always 0 on OSes other than Linux. */
+      std::uint64_t backlog_full_samples;
+   };
+
 public:
    /*! Constructor.
 
@@ -143,8 +620,14 @@ public:
       Port to listen for connections on.
    @param backlog_size
       Count of established connections that will be allowed to queue until the server is able to accept them.
+   @param reuse_port
+      If true, the socket will be bound with SO_REUSEPORT, allowing other sockets with the same option to be
+      bound to the same address and port; the OS will then distribute incoming connections among them.
    */
-   server(ip::address const & address, ip::port const & port, unsigned backlog_size = 5);
+   server(
+      ip::address const & address, ip::port const & port, unsigned backlog_size = default_backlog_size,
+      bool reuse_port = false
+   );
 
    //! Destructor.
    ~server();
@@ -156,7 +639,71 @@ public:
    */
    _std::shared_ptr<connection> accept();
 
+   /*! Accepts all the connections that are pending, up to conns_max, waiting for at least one to become
+   available. This allows to drain the backlog with a single wait, instead of one for each connection.
+
+   If the current thread does not have a coroutine scheduler, the server socket is blocking, so at most one
+   connection will be accepted at a time.
+
+   @param conns
+      Pointer to a vector to which the new client connections will be appended.
+   @param conns_max
+      Maximum count of connections to accept.
+   @return
+      Count of connections appended to *conns.
+   */
+   std::size_t accept_batch(collections::vector<_std::shared_ptr<connection>> * conns, std::size_t conns_max);
+
+   /*! Returns the current values of the accept counters.
+
+   @return
+      Counters snapshot.
+   */
+   accept_counters counters() const;
+
+   /*! Sets the options to be applied to every socket accepted from now on, before it’s returned by accept()
+   or accept_batch(). Connections whose socket rejects the options are closed and counted as rejected, and
+   accepting continues with the next one. Not thread-safe with respect to accepting connections.
+
+   @param opts
+      Options to apply to accepted sockets.
+   */
+   void set_accepted_options(socket_options const & opts) {
+      accepted_opts = opts;
+   }
+
+   /*! Applies the specified options to the server’s listening socket. This is where server-only options such
+   as TCP_DEFER_ACCEPT and TCP_FASTOPEN belong; many OSes also let accepted sockets inherit other options
+   (e.g. buffer sizes) from the listening socket.
+
+   @param opts
+      Options to apply.
+   */
+   void set_options(socket_options const & opts) {
+      opts.apply(sock_fd.get());
+   }
+
 private:
+   /*! Accepts a pending connection, if any.
+
+   @param wait
+      If true and no connections are pending, the method will wait for one; if false, it will return nullptr
+      in that case.
+   @return
+      New client connection, or nullptr if wait was false and no connections were pending.
+   */
+   _std::shared_ptr<connection> accept_one(bool wait);
+
+   /*! Applies accepted_opts to a newly-accepted socket. If that fails, the socket is closed and counted as
+   rejected.
+
+   @param conn_fd
+      Pointer to the accepted socket.
+   @return
+      true if the socket can be used, or false if it was rejected.
+   */
+   bool apply_accepted_options(io::filedesc * conn_fd);
+
    /*! Creates a socket for the server.
 
    @param ip_version
@@ -171,6 +718,133 @@ private:
    io::filedesc sock_fd;
    //! IP version.
    ip::version ip_version;
+   //! Count of connections accepted.
+   _std::atomic<std::uint64_t> accepted_count;
+   //! Count of connections that were aborted by the peer or refused due to lack of resources.
+   _std::atomic<std::uint64_t> rejected_count;
+   //! Count of accept_batch() calls that found the backlog full.
+   _std::atomic<std::uint64_t> backlog_full_sample_count;
+   //! Options applied to every accepted socket.
+   socket_options accepted_opts;
+};
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+/*! TCP server that spreads accepting connections across multiple threads.
+
+Each shard owns a server socket bound with SO_REUSEPORT to the same address and port, and runs on its own
+thread with its own coroutine scheduler; the OS load-balances incoming connections among the shards, so that
+no single accept() loop becomes a serialization point. */
+class LOFTY_SYM sharded_server : public noncopyable {
+public:
+   /*! Type of the function invoked to handle each accepted connection. It runs in a coroutine of its own, on
+   the scheduler of the shard that accepted the connection. */
+   typedef _std::function<void (_std::shared_ptr<connection> conn)> connection_handler_type;
+
+public:
+   /*! Constructor. Binds every shard’s server socket, so that any errors are reported immediately.
+
+   @param address
+      Address to bind to.
+   @param port
+      Port to listen for connections on. Must not be 0, since each shard binds to the same port.
+   @param shards_count
+      Count of shards (threads) to run. If 0, one shard per online CPU will be created.
+   @param backlog_size
+      Count of established connections that will be allowed to queue for each shard until it’s able to
+      accept them.
+   */
+   sharded_server(
+      ip::address const & address, ip::port const & port, unsigned shards_count = 0,
+      unsigned backlog_size = server::default_backlog_size
+   );
+
+   //! Destructor.
+   ~sharded_server();
+
+   /*! Interrupts every shard, including the one running on the thread that called run(), causing run() to
+   return (by throwing) as soon as they’ve all stopped. Can be called from any thread; if called before run(),
+   run() will stop immediately. */
+   void interrupt();
+
+   /*! Runs every shard, each accepting connections and scheduling a coroutine running conn_handler for each
+   of them. The first shard runs on the calling thread, using its coroutine scheduler; every other shard runs
+   on a new thread. Only returns after every shard has terminated.
+
+   @param conn_handler
+      Function to invoke for each accepted connection.
+   */
+   void run(connection_handler_type const & conn_handler);
+
+   /*! Returns the sum of the accept counters of every shard.
+
+   @return
+      Counters snapshot.
+   */
+   server::accept_counters counters() const;
+
+   /*! Sets the options to be applied to every socket accepted by any shard. Must be called before run().
+
+   @param opts
+      Options to apply to accepted sockets.
+   */
+   void set_accepted_options(socket_options const & opts);
+
+   /*! Applies the specified options to every shard’s listening socket.
+
+   @param opts
+      Options to apply.
+   */
+   void set_options(socket_options const & opts);
+
+   /*! Returns the count of shards.
+
+   @return
+      Count of shards.
+   */
+   std::size_t shards_count() const {
+      return servers.size();
+   }
+
+private:
+   /*! Undoes the effects of interrupt(), so that run() can be called again.
+
+   @return
+      true if interrupt() had been called, or false otherwise.
+   */
+   bool reset_interruption();
+
+   /*! Accepts connections from a shard’s server, scheduling conn_handler for each of them, until interrupt()
+   is called. Meant to be run as the main function of a shard thread.
+
+   @param shard_server
+      Shard server to accept connections from.
+   @param conn_handler
+      Function to invoke for each accepted connection.
+   */
+   void run_shard(server * shard_server, connection_handler_type const & conn_handler);
+
+private:
+   //! Maximum count of connections each shard will accept for each wait.
+   static std::size_t const accept_batch_size = 64;
+   //! Time a shard waits before accepting again after running out of file descriptors or memory, in ms.
+   static unsigned const accept_retry_delay_ms = 10;
+
+   //! One server for each shard, all bound to the same address and port.
+   collections::vector<_std::unique_ptr<server>> servers;
+   //! Threads running the shards other than the first; only non-empty while run() is executing.
+   collections::vector<thread> threads;
+   /*! Read end of the pipe that interrupt() writes to. Its contents are never read while shards are running,
+   so every shard’s scheduler sees it become readable. */
+   io::filedesc stop_read_fd;
+   //! Write end of the pipe that interrupt() writes to.
+   io::filedesc stop_write_fd;
+   //! true if interrupt() was called since run() last returned.
+   _std::atomic<bool> interrupted;
 };
 
 }}} //namespace lofty::net::tcp
@@ -0,0 +1,360 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_NET_UDP_HXX
+#define _LOFTY_NET_UDP_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/io/binary.hxx>
+#include <lofty/net/ip.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net {
+
+//! User Datagram Protocol-related classes and facilities.
+namespace udp {}
+
+}} //namespace lofty::net
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace udp {
+
+/*! Fixed-capacity set of datagrams, each with its own preallocated buffer, used to receive or send multiple
+datagrams with a single system call. All the memory needed is allocated by the constructor, so a batch can be
+reused for any number of socket::receive_batch() or socket::send_batch() calls without further allocations.
+*/
+class LOFTY_SYM datagram_batch : public noncopyable {
+private:
+   friend class socket;
+
+public:
+   /*! Constructor.
+
+   @param capacity
+      Maximum count of datagrams in the batch.
+   @param datagram_max_size
+      Size of the buffer for each datagram. Received datagrams larger than this will be truncated, as reported
+      by truncated(); when receive coalescing is enabled, this should be large enough to hold multiple
+      segments (up to 64 KiB).
+   */
+   datagram_batch(std::size_t capacity, std::size_t datagram_max_size);
+
+   //! Destructor.
+   ~datagram_batch();
+
+   /*! Returns a pointer to the address of a datagram’s remote peer: its source if received, or its
+   destination if to be sent.
+
+   @param i
+      Index of the datagram.
+   @return
+      Remote address.
+   */
+   ip::address const & address(std::size_t i) const {
+      return infos[i].address;
+   }
+
+   /*! Returns the maximum count of datagrams in the batch.
+
+   @return
+      Capacity of the batch.
+   */
+   std::size_t capacity() const {
+      return capacity_;
+   }
+
+   //! Removes all datagrams from the batch; their buffers are retained.
+   void clear() {
+      size_ = 0;
+   }
+
+   /*! Returns a pointer to a datagram’s data.
+
+   @param i
+      Index of the datagram.
+   @return
+      Pointer to the data.
+   */
+   std::uint8_t * data(std::size_t i) {
+      return bufs + datagram_max_size_ * i;
+   }
+
+   /*! Returns a pointer to a datagram’s data.
+
+   @param i
+      Index of the datagram.
+   @return
+      Pointer to the data.
+   */
+   std::uint8_t const * data(std::size_t i) const {
+      return bufs + datagram_max_size_ * i;
+   }
+
+   /*! Returns the size of a datagram’s data.
+
+   @param i
+      Index of the datagram.
+   @return
+      Size of the data, in bytes.
+   */
+   std::size_t data_size(std::size_t i) const {
+      return infos[i].size;
+   }
+
+   /*! Returns the size of the buffer for each datagram.
+
+   @return
+      Maximum size of a datagram, in bytes.
+   */
+   std::size_t datagram_max_size() const {
+      return datagram_max_size_;
+   }
+
+   /*! Returns the remote port of a datagram: its source if received, or its destination if to be sent.
+
+   @param i
+      Index of the datagram.
+   @return
+      Remote port.
+   */
+   ip::port const & port(std::size_t i) const {
+      return infos[i].port;
+   }
+
+   /*! Adds a datagram to be sent, returning a pointer to its buffer so the caller can fill it in place.
+
+   @param size
+      Size of the datagram, in bytes. Must not be greater than datagram_max_size().
+   @param address
+      Destination address.
+   @param port
+      Destination port.
+   @return
+      Pointer to the buffer for the datagram’s data, size bytes long.
+   */
+   std::uint8_t * push_back(std::size_t size, ip::address const & address, ip::port const & port);
+
+   /*! Adds a datagram to be sent, copying its data into the datagram’s buffer.
+
+   @param src
+      Pointer to the data.
+   @param src_size
+      Size of *src, in bytes. Must not be greater than datagram_max_size().
+   @param address
+      Destination address.
+   @param port
+      Destination port.
+   */
+   void push_back(void const * src, std::size_t src_size, ip::address const & address, ip::port const & port) {
+      memory::copy(push_back(src_size, address, port), static_cast<std::uint8_t const *>(src), src_size);
+   }
+
+   /*! Returns the size of each segment of a received datagram that the OS coalesced from multiple datagrams
+   from the same source; see socket::set_receive_coalescing().
+
+   @param i
+      Index of the datagram.
+   @return
+      Size of each segment, in bytes (the last one may be shorter), or 0 if the datagram was not coalesced.
+   */
+   std::size_t segment_size(std::size_t i) const {
+      return infos[i].segment_size;
+   }
+
+   /*! Returns the count of datagrams in the batch.
+
+   @return
+      Count of datagrams.
+   */
+   std::size_t size() const {
+      return size_;
+   }
+
+   /*! Returns true if a received datagram was larger than datagram_max_size(), in which case data_size()
+   only accounts for the part that was kept, and the rest was discarded by the OS.
+
+   @param i
+      Index of the datagram.
+   @return
+      true if the datagram was truncated, or false otherwise.
+   */
+   bool truncated(std::size_t i) const {
+      return infos[i].truncated;
+   }
+
+private:
+   //! Metadata for a datagram in the batch.
+   struct datagram_info {
+      //! Remote address.
+      ip::address address;
+      //! Remote port.
+      ip::port port;
+      //! Size of the data.
+      std::size_t size;
+      //! Size of each coalesced segment, or 0.
+      std::size_t segment_size;
+      //! true if the datagram didn’t fit in its buffer.
+      bool truncated;
+   };
+
+   //! Maximum count of datagrams.
+   std::size_t capacity_;
+   //! Size of each datagram buffer.
+   std::size_t datagram_max_size_;
+   //! Count of datagrams in the batch.
+   std::size_t size_;
+   //! Memory for the datagram buffers.
+   memory::pages_ptr bufs_pages;
+   //! Pointer to the first datagram buffer; the others follow, datagram_max_size_ bytes apart.
+   std::uint8_t * bufs;
+   //! Metadata for each datagram.
+   _std::unique_ptr<datagram_info[]> infos;
+   /*! OS-specific structures describing each datagram, set up once so that they don’t need to be rebuilt for
+   every system call. */
+   _std::unique_ptr<void, memory::freeing_deleter> os_descs;
+};
+
+}}} //namespace lofty::net::udp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace udp {
+
+/*! UDP socket. If the thread that creates it has a coroutine scheduler, all its operations will yield to other
+coroutines instead of blocking. */
+class LOFTY_SYM socket : public noncopyable {
+public:
+   /*! Constructor for a socket that is not bound to a specific port; the OS will bind it to an ephemeral port
+   when a datagram is first sent.
+
+   @param ip_version
+      IP version.
+   */
+   explicit socket(ip::version ip_version);
+
+   /*! Constructor for a socket bound to the specified address and port.
+
+   @param address
+      Address to bind to.
+   @param port
+      Port to bind to. If 0, the OS will choose an ephemeral port, which can be retrieved with local_port().
+   */
+   socket(ip::address const & address, ip::port const & port);
+
+   //! Destructor.
+   ~socket();
+
+   /*! Returns the local address the socket is bound to.
+
+   @return
+      Local address.
+   */
+   ip::address local_address() const;
+
+   /*! Returns the local port the socket is bound to.
+
+   @return
+      Local port.
+   */
+   ip::port local_port() const;
+
+   /*! Receives a single datagram, waiting for one to arrive if none is pending.
+
+   @param dst
+      Pointer to the buffer to receive the datagram’s data into.
+   @param dst_max
+      Size of *dst, in bytes. Any excess data in the datagram will be discarded.
+   @param address
+      Pointer to a variable that will receive the source address.
+   @param port
+      Pointer to a variable that will receive the source port.
+   @return
+      Count of bytes stored in *dst.
+   */
+   std::size_t receive(void * dst, std::size_t dst_max, ip::address * address, ip::port * port);
+
+   /*! Receives as many datagrams as are pending, up to batch->capacity(), waiting for at least one to arrive.
+   The contents of *batch are replaced.
+
+   @param batch
+      Pointer to the batch that will receive the datagrams.
+   @return
+      Count of datagrams received, same as batch->size() upon return.
+   */
+   std::size_t receive_batch(datagram_batch * batch);
+
+   /*! Sends a single datagram.
+
+   @param src
+      Pointer to the data to send.
+   @param src_size
+      Size of *src, in bytes.
+   @param address
+      Destination address.
+   @param port
+      Destination port.
+   */
+   void send(void const * src, std::size_t src_size, ip::address const & address, ip::port const & port);
+
+   /*! Sends every datagram in a batch, using as few system calls as possible.
+
+   @param batch
+      Datagrams to send.
+   */
+   void send_batch(datagram_batch const & batch);
+
+   /*! Enables or disables receive coalescing (UDP_GRO, Linux only): the OS will merge consecutive datagrams
+   from the same source into a single larger one, which datagram_batch::segment_size() allows to split again.
+
+   @param enable
+      true to enable coalescing, or false to disable it.
+   */
+   void set_receive_coalescing(bool enable);
+
+   /*! Enables or disables send segmentation (UDP_SEGMENT, Linux only): every datagram sent will be split by
+   the OS (or the NIC) into multiple datagrams of the specified size, so that a single buffer can carry many
+   datagrams to the same destination.
+
+   @param segment_size
+      Size of each datagram to be generated, in bytes; 0 disables segmentation.
+   */
+   void set_send_segment_size(std::size_t segment_size);
+
+private:
+   //! Socket.
+   io::filedesc fd;
+   //! IP version.
+   ip::version ip_version;
+   //! If true, receive coalescing is enabled.
+   bool receive_coalescing:1;
+};
+
+}}} //namespace lofty::net::udp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_NET_UDP_HXX
@@ -0,0 +1,432 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_OS_DIR_HXX
+#define _LOFTY_OS_DIR_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/io.hxx>
+#include <lofty/numeric.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/_std/functional.hxx>
+
+#if LOFTY_HOST_API_POSIX && !LOFTY_HOST_API_LINUX
+   #include <dirent.h> // DIR
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace os {
+
+//! Types of directory entries.
+LOFTY_ENUM_AUTO_VALUES(dir_entry_type,
+   unknown,      //! The type could not be determined.
+   block_device, //! Block device.
+   char_device,  //! Character device.
+   dir,          //! Directory.
+   fifo,         //! Named pipe.
+   regular_file, //! Regular file.
+   socket,       //! Local socket.
+   symlink       //! Symbolic link; never followed.
+);
+
+class dir_iterator;
+class dir_walker;
+
+/*! Entry returned by lofty::os::dir_iterator and lofty::os::dir_walker. To avoid allocating memory for each
+entry, names and paths refer to buffers owned by the iterator or walker, and are only valid until the next
+entry is read. */
+class LOFTY_SYM dir_entry : public noncopyable {
+private:
+   friend class dir_iterator;
+   friend class dir_walker;
+
+public:
+   //! Default constructor.
+   dir_entry() :
+      name_chars(nullptr),
+      rel_path_chars(nullptr),
+      name_size(0),
+      rel_path_size(0),
+      inode_(0),
+      dir_fd_(io::filedesc_t()),
+      depth_(0),
+      type_(dir_entry_type::unknown) {
+   }
+
+   /*! Returns the depth of the entry relative to the directory being walked; entries in that directory have
+   depth 0. Always 0 for entries returned by lofty::os::dir_iterator.
+
+   @return
+      Depth of the entry.
+   */
+   unsigned depth() const {
+      return depth_;
+   }
+
+   /*! Returns the directory containing the entry, suitable for *at() system calls together with name().
+
+   @return
+      File descriptor for the containing directory.
+   */
+   io::filedesc_t dir_fd() const {
+      return dir_fd_;
+   }
+
+   /*! Returns the inode number of the entry.
+
+   @return
+      Inode number.
+   */
+   std::uint64_t inode() const {
+      return inode_;
+   }
+
+   /*! Returns the name of the entry, without any directory.
+
+   @return
+      Name of the entry; it refers to the iterator’s buffer, so it’s only valid until the next entry is read.
+   */
+   str name() const {
+      return str(external_buffer, name_chars, name_size);
+   }
+
+   /*! Returns the path of the entry relative to the directory being walked. For entries returned by
+   lofty::os::dir_iterator, this is the same as name().
+
+   @return
+      Relative path of the entry; it refers to the walker’s buffer, so it’s only valid until the next entry is
+      read.
+   */
+   str rel_path() const {
+      return str(external_buffer, rel_path_chars, rel_path_size);
+   }
+
+   /*! Returns the type of the entry. This comes from the directory itself if the file system stores it, which
+   most do; otherwise the entry is stat()ed as it’s read.
+
+   @return
+      Type of the entry.
+   */
+   dir_entry_type type() const {
+      return type_;
+   }
+
+private:
+   //! Name of the entry; NUL-terminated.
+   char_t const * name_chars;
+   //! Path of the entry relative to the root of the walk.
+   char_t const * rel_path_chars;
+   //! Count of characters in *name_chars.
+   std::size_t name_size;
+   //! Count of characters in *rel_path_chars.
+   std::size_t rel_path_size;
+   //! Inode number.
+   std::uint64_t inode_;
+   //! Directory containing the entry.
+   io::filedesc_t dir_fd_;
+   //! Depth of the entry.
+   unsigned depth_;
+   //! Type of the entry.
+   dir_entry_type type_;
+};
+
+}} //namespace lofty::os
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace os {
+
+/*! Enumerates the entries in a directory, skipping “.” and “..”. Under Linux, entries are read in large
+batches with getdents64(), and their type is taken from the directory instead of stat()ing each of them.
+
+Usage:
+
+   for (os::dir_iterator itr(dir_path); itr; ++itr) {
+      if (itr->type() == os::dir_entry_type::regular_file) {
+         …
+      }
+   }
+*/
+class LOFTY_SYM dir_iterator : public support_explicit_operator_bool<dir_iterator>, public noncopyable {
+public:
+   //! Size of the buffer that receives directory entries from the OS.
+   static std::size_t const buffer_size = 0x10000;
+
+public:
+   /*! Constructor that opens a directory by path.
+
+   @param dir_path
+      Path to the directory to enumerate.
+   */
+   explicit dir_iterator(path const & dir_path);
+
+   /*! Constructor that opens a directory relative to another one, avoiding the resolution of its full path.
+
+   @param parent_fd
+      Open directory that name is relative to.
+   @param name
+      Name of the directory to enumerate.
+   */
+   dir_iterator(io::filedesc_t parent_fd, str const & name);
+
+   /*! Constructor that enumerates an already-open directory.
+
+   @param dir_fd
+      Open directory to enumerate; *this will take ownership of it.
+   */
+   explicit dir_iterator(io::filedesc && dir_fd);
+
+   //! Destructor.
+   ~dir_iterator();
+
+   /*! Boolean evaluation operator.
+
+   @return
+      true if *this points to an entry, or false if all entries have been enumerated.
+   */
+   LOFTY_EXPLICIT_OPERATOR_BOOL() const {
+      return !eof;
+   }
+
+   /*! Dereferencing operator.
+
+   @return
+      Reference to the current entry.
+   */
+   dir_entry const & operator*() const {
+      return curr;
+   }
+
+   /*! Dereferencing member access operator.
+
+   @return
+      Pointer to the current entry.
+   */
+   dir_entry const * operator->() const {
+      return &curr;
+   }
+
+   /*! Prefix increment operator.
+
+   @return
+      *this after it’s moved to the next entry.
+   */
+   dir_iterator & operator++() {
+      read_next();
+      return *this;
+   }
+
+   /*! Returns the file descriptor of the directory being enumerated.
+
+   @return
+      File descriptor for the directory.
+   */
+   io::filedesc_t fd() const {
+      return fd_.get();
+   }
+
+private:
+   //! Moves curr to the next entry other than “.” and “..”, reading more from the OS when needed.
+   void read_next();
+
+private:
+   friend class dir_walker;
+
+   //! Open directory.
+   io::filedesc fd_;
+#if LOFTY_HOST_API_LINUX
+   //! Buffer for getdents64().
+   _std::unique_ptr<void, memory::freeing_deleter> buf;
+   //! Count of bytes read into *buf.
+   std::size_t buf_used;
+   //! Offset of the next entry in *buf.
+   std::size_t buf_offset;
+#else
+   //! Directory stream wrapping fd_.
+   ::DIR * dir;
+#endif
+   //! Current entry.
+   dir_entry curr;
+   //! true if all entries have been enumerated.
+   bool eof;
+};
+
+}} //namespace lofty::os
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace os {
+
+/*! Recursively enumerates the contents of a directory. Subdirectories are opened relative to their parent,
+and entries are reported with a path relative to the root of the walk that’s kept in a reused buffer, so no
+memory is allocated for each entry. Symbolic links are reported but never followed.
+
+With set_threads() > 1, subdirectories are handed to other threads as soon as any of them is idle; in that
+case the filter and visit functions are called concurrently, in no particular order, and must be
+thread-safe. Setters return *this, so they can be chained:
+
+   os::dir_walker().set_threads(4).set_filter([] (os::dir_entry const & entry) {
+      // Skip hidden files and directories.
+      return entry.name()[0] != '.';
+   }).walk(root_path, [] (os::dir_entry const & entry) {
+      …
+   });
+*/
+class LOFTY_SYM dir_walker {
+public:
+   /*! Type of the function called for each entry before it’s visited. Returning false skips the entry and, if
+   it’s a directory, its contents. */
+   typedef _std::function<bool (dir_entry const & entry)> filter_fn_type;
+   //! Type of the function called for each entry.
+   typedef _std::function<void (dir_entry const & entry)> visit_fn_type;
+
+public:
+   //! Default constructor.
+   dir_walker() :
+      max_depth_(numeric::max<unsigned>::value),
+      threads_(1) {
+   }
+
+   /*! Returns the entry filter.
+
+   @return
+      Filter function; may be empty.
+   */
+   filter_fn_type const & filter() const {
+      return filter_;
+   }
+
+   /*! Returns the maximum depth of the walk.
+
+   @return
+      Maximum depth; 0 means that only the root’s own entries will be visited.
+   */
+   unsigned max_depth() const {
+      return max_depth_;
+   }
+
+   /*! Sets the entry filter.
+
+   @param filter
+      Filter function, or an empty function to visit all entries.
+   @return
+      *this.
+   */
+   dir_walker & set_filter(filter_fn_type filter) {
+      filter_ = _std::move(filter);
+      return *this;
+   }
+
+   /*! Sets the maximum depth of the walk.
+
+   @param max_depth
+      Maximum depth; 0 means that only the root’s own entries will be visited.
+   @return
+      *this.
+   */
+   dir_walker & set_max_depth(unsigned max_depth) {
+      max_depth_ = max_depth;
+      return *this;
+   }
+
+   /*! Sets the count of threads that will enumerate directories, including the one calling walk().
+
+   @param threads
+      Count of threads; 0 is treated as 1.
+   @return
+      *this.
+   */
+   dir_walker & set_threads(unsigned threads) {
+      threads_ = threads;
+      return *this;
+   }
+
+   /*! Returns the count of threads that will enumerate directories.
+
+   @return
+      Count of threads.
+   */
+   unsigned threads() const {
+      return threads_;
+   }
+
+   /*! Walks a directory, returning after all the entries have been visited. Subdirectories that disappear or
+   can’t be opened due to their permissions are skipped; other errors are thrown from the calling thread,
+   after the walk has been stopped.
+
+   @param root_path
+      Path to the directory to walk.
+   @param visit
+      Function to call for each entry.
+   */
+   void walk(path const & root_path, visit_fn_type const & visit) const;
+
+private:
+   //! State shared by the threads taking part in a walk.
+   struct walk_state;
+
+   /*! Enumerates a directory, recursing into subdirectories or handing them to idle threads.
+
+   @param state
+      Walk state.
+   @param rel_path
+      Pointer to the calling thread’s buffer for relative paths; on entry it contains the path of the
+      directory.
+   @param dir_fd
+      Open directory to enumerate.
+   @param depth
+      Depth of the directory’s entries.
+   */
+   void walk_dir(
+      walk_state * state, collections::vector<char_t> * rel_path, io::filedesc && dir_fd, unsigned depth
+   ) const;
+
+   /*! Takes directories queued by walk_dir() and enumerates them, until the walk is over. Exceptions are
+   recorded in *state instead of being thrown, and stop the walk.
+
+   @param state
+      Walk state.
+   */
+   void worker_main(walk_state * state) const;
+
+private:
+   //! Entry filter.
+   filter_fn_type filter_;
+   //! Maximum depth of the walk.
+   unsigned max_depth_;
+   //! Count of threads.
+   unsigned threads_;
+};
+
+}} //namespace lofty::os
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_OS_DIR_HXX
@@ -0,0 +1,159 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_OS_FILE_WATCHER_HXX
+#define _LOFTY_OS_FILE_WATCHER_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/vector.hxx>
+#include <lofty/io.hxx>
+#include <lofty/os/path.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_LINUX
+
+namespace lofty { namespace os {
+
+/*! Reports changes to files and directories as they happen, without polling. Paths are registered with
+inotify, whose file descriptor is waited on via the coroutine scheduler like any other, so a coroutine
+blocked in wait() costs nothing until a change occurs; outside of coroutines, wait() blocks the thread.
+
+TODO: implement using kqueue’s EVFILT_VNODE for BSD and Darwin, and ReadDirectoryChangesW() for Win32.
+
+Usage:
+
+   os::file_watcher watcher;
+   watcher.add(config_path, os::file_watcher::change_written | os::file_watcher::change_moved);
+   collections::vector<os::file_watcher::event> events;
+   for (;;) {
+      events.clear();
+      watcher.wait(&events);
+      reload_config();
+   }
+*/
+class LOFTY_SYM file_watcher : public noncopyable {
+public:
+   //! Identifies a path being watched.
+   typedef int watch_id_type;
+
+   //! Changes that can be watched for and reported; they can be combined.
+   enum change {
+      //! Metadata (permissions, timestamps, owner, …) changed.
+      change_attributes = 0x01,
+      //! An entry was created in the watched directory.
+      change_created = 0x02,
+      //! An entry in the watched directory, or the watched path itself, was deleted.
+      change_deleted = 0x04,
+      //! An entry in the watched directory, or the watched path itself, was moved.
+      change_moved = 0x08,
+      //! Data was written to the file.
+      change_modified = 0x10,
+      //! The file was closed after being opened for writing; usually the best time to re-read it.
+      change_written = 0x20,
+      /*! Always reported, never watched for: the watch no longer exists, because it was removed or because
+      the watched path was deleted or unmounted. */
+      change_unwatched = 0x40,
+      /*! Always reported, never watched for: the OS dropped some events, so any state derived from the
+      watched paths should be refreshed. Reported with watch_id == -1. */
+      change_overflow = 0x80,
+      //! All changes that can be watched for.
+      change_all = 0x3f
+   };
+
+   //! Change to a watched path.
+   struct event {
+      //! Watch the change was reported for.
+      watch_id_type watch_id;
+      //! Changes that occurred; combination of change values.
+      unsigned changes;
+      //! Name of the entry in the watched directory, or an empty string for the watched path itself.
+      str name;
+   };
+
+   //! Size of the buffer that receives events from the OS, which determines the maximum size of a batch.
+   static std::size_t const buffer_size = 0x10000;
+
+public:
+   //! Default constructor.
+   file_watcher();
+
+   //! Destructor.
+   ~file_watcher();
+
+   /*! Starts watching a path, or changes the changes watched for if the path is already being watched.
+   Watching a directory reports changes to its entries, but not to the contents of its subdirectories.
+
+   @param path_
+      Path to the file or directory to watch.
+   @param changes
+      Changes to watch for; combination of change values.
+   @return
+      Identifier of the watch, which will be reported in each event for it.
+   */
+   watch_id_type add(path const & path_, unsigned changes = change_all);
+
+   /*! Returns the file descriptor that becomes readable when events are available.
+
+   @return
+      File descriptor.
+   */
+   io::filedesc_t fd() const {
+      return fd_.get();
+   }
+
+   /*! Stops watching a path. An event with change_unwatched will still be reported for it.
+
+   @param watch_id
+      Identifier returned by add().
+   */
+   void remove(watch_id_type watch_id);
+
+   /*! Suspends the calling coroutine (or thread) until at least one change is reported, then appends to
+   *events the changes that the OS has queued, up to what fits in buffer_size; any others will be returned by
+   the next call. Multiple changes to the same entry in a batch are coalesced into a single event, in the
+   position of the first one.
+
+   @param events
+      Pointer to a vector to which events will be appended.
+   @return
+      Count of events appended to *events.
+   */
+   std::size_t wait(collections::vector<event> * events);
+
+private:
+   //! inotify file descriptor.
+   io::filedesc fd_;
+   //! Buffer for events read from fd_.
+   _std::unique_ptr<void, memory::freeing_deleter> buf;
+};
+
+}} //namespace lofty::os
+
+#endif //if LOFTY_HOST_API_LINUX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_OS_FILE_WATCHER_HXX
@@ -23,6 +23,7 @@ You should have received a copy of the GNU Lesser General Public License along w
 #include <lofty/numeric.hxx>
 #include <lofty/os.hxx>
 #include <lofty/thread.hxx>
+#include "binary/blocking_offload.hxx"
 #include "binary/default_buffered.hxx"
 #include "binary/_pvt/file_init_data.hxx"
 #include "binary/file-subclasses.hxx"
@@ -31,9 +32,15 @@ You should have received a copy of the GNU Lesser General Public License along w
 
 #if LOFTY_HOST_API_POSIX
    #include <errno.h> // E* errno
-   #include <fcntl.h> // F_* fcntl()
+   #include <fcntl.h> // F_* SPLICE_* fcntl() splice()
    #include <sys/stat.h> // S_* stat()
-   #include <unistd.h> // *_FILENO isatty() open() pipe()
+   #include <sys/uio.h> // iovec writev()
+   #include <unistd.h> // *_FILENO ftruncate() isatty() open() pipe()
+#endif
+#if LOFTY_HOST_API_LINUX
+   #include <linux/fs.h> // FICLONE
+   #include <sys/ioctl.h> // ioctl()
+   #include <sys/sendfile.h> // sendfile()
 #endif
 
 
@@ -209,6 +216,16 @@ LOFTY_SYM _std::shared_ptr<buffered_istream> buffer_istream(_std::shared_ptr<ist
    }
 }
 
+LOFTY_SYM _std::shared_ptr<buffered_istream> buffer_istream(
+   _std::shared_ptr<istream> bin_istream, buffer_sizing const & sizing
+) {
+   if (auto buf_bin_istream = _std::dynamic_pointer_cast<buffered_istream>(bin_istream)) {
+      return _std::move(buf_bin_istream);
+   } else {
+      return _std::make_shared<default_buffered_istream>(_std::move(bin_istream), sizing);
+   }
+}
+
 LOFTY_SYM _std::shared_ptr<buffered_ostream> buffer_ostream(_std::shared_ptr<ostream> bin_ostream) {
    // See if *bin_ostream is also a binary::buffered_ostream.
    if (auto buf_bin_ostream = _std::dynamic_pointer_cast<buffered_ostream>(bin_ostream)) {
@@ -219,6 +236,511 @@ LOFTY_SYM _std::shared_ptr<buffered_ostream> buffer_ostream(_std::shared_ptr<ost
    }
 }
 
+LOFTY_SYM _std::shared_ptr<buffered_ostream> buffer_ostream(
+   _std::shared_ptr<ostream> bin_ostream, buffer_sizing const & sizing
+) {
+   if (auto buf_bin_ostream = _std::dynamic_pointer_cast<buffered_ostream>(bin_ostream)) {
+      return _std::move(buf_bin_ostream);
+   } else {
+      return _std::make_shared<default_buffered_ostream>(_std::move(bin_ostream), sizing);
+   }
+}
+
+//! Size of the buffer used by copy() when the data can’t be moved by the OS.
+static std::size_t const copy_buffer_size = 0x10000;
+//! Size of the chunks moved by the OS between progress reports and interruption points.
+static std::size_t const copy_kernel_chunk_size = 0x1000000;
+
+/*! Adds to the count of bytes copied, and reports it if requested.
+
+@param copied
+   Pointer to the count of bytes copied so far.
+@param size
+   Count of bytes just copied.
+@param progress
+   Function to report progress to; may be empty.
+*/
+static void copy_progress(
+   full_size_t * copied, full_size_t size, copy_options::progress_fn_type const & progress
+) {
+   *copied += size;
+   if (progress) {
+      progress(*copied);
+   }
+}
+
+/*! Implementation of copy() for streams that can’t be handled by the OS, or for any data left after the OS
+refused to continue.
+
+@param src
+   Pointer to the stream to read from.
+@param dst
+   Pointer to the stream to write to.
+@param max_size
+   Maximum count of bytes to copy, including those already counted in *copied.
+@param progress
+   Function to report progress to; may be empty.
+@param copied
+   Pointer to a variable that will be incremented by the count of bytes copied.
+*/
+static void copy_via_buffer(
+   istream * src, ostream * dst, full_size_t max_size, copy_options::progress_fn_type const & progress,
+   full_size_t * copied
+) {
+   LOFTY_TRACE_FUNC(src, dst, max_size, copied);
+
+   if (auto buf_src = dynamic_cast<buffered_istream *>(src)) {
+      // Write directly from the read buffer.
+      while (*copied < max_size) {
+         auto buf(buf_src->peek_bytes(1));
+         std::size_t buf_size = _std::get<1>(buf);
+         if (buf_size == 0) {
+            break;
+         }
+         buf_size = static_cast<std::size_t>(std::min<full_size_t>(buf_size, max_size - *copied));
+         dst->write(_std::get<0>(buf), buf_size);
+         buf_src->consume_bytes(buf_size);
+         copy_progress(copied, buf_size, progress);
+      }
+   } else if (auto buf_dst = dynamic_cast<buffered_ostream *>(dst)) {
+      // Read directly into the write buffer.
+      while (*copied < max_size) {
+         std::size_t chunk_size = static_cast<std::size_t>(
+            std::min<full_size_t>(copy_buffer_size, max_size - *copied)
+         );
+         auto buf(buf_dst->get_buffer_bytes(chunk_size));
+         std::size_t read_bytes = src->read(_std::get<0>(buf), chunk_size);
+         if (read_bytes == 0) {
+            break;
+         }
+         buf_dst->commit_bytes(read_bytes);
+         copy_progress(copied, read_bytes, progress);
+      }
+   } else {
+      auto buf(memory::alloc_bytes_unique(copy_buffer_size));
+      while (*copied < max_size) {
+         std::size_t chunk_size = static_cast<std::size_t>(
+            std::min<full_size_t>(copy_buffer_size, max_size - *copied)
+         );
+         std::size_t read_bytes = src->read(buf.get(), chunk_size);
+         if (read_bytes == 0) {
+            break;
+         }
+         dst->write(buf.get(), read_bytes);
+         copy_progress(copied, read_bytes, progress);
+      }
+   }
+}
+
+#if LOFTY_HOST_API_LINUX
+/*! Makes dst_fd a clone of src_fd, sharing its storage, using FICLONE. Since that replaces the whole contents
+of dst_fd, this is only attempted if src_fd is at its start and dst_fd is empty.
+
+@param src_fd
+   File to clone; must be a regular file.
+@param dst_fd
+   File to turn into a clone; must be a regular file.
+@param progress
+   Function to report progress to; may be empty.
+@param copied
+   Pointer to a variable that will be incremented by the count of bytes copied.
+@return
+   true if the file was cloned, or false if the caller should copy it by other means.
+*/
+static bool copy_via_clone(
+   filedesc_t src_fd, filedesc_t dst_fd, copy_options::progress_fn_type const & progress, full_size_t * copied
+) {
+   LOFTY_TRACE_FUNC(src_fd, dst_fd, copied);
+
+   #ifdef FICLONE
+   struct ::stat src_stat, dst_stat;
+   if (
+      ::lseek(src_fd, 0, SEEK_CUR) != 0 || ::lseek(dst_fd, 0, SEEK_CUR) != 0 ||
+      ::fstat(src_fd, &src_stat) < 0 || ::fstat(dst_fd, &dst_stat) < 0 ||
+      src_stat.st_size == 0 || dst_stat.st_size != 0
+   ) {
+      return false;
+   }
+   // Any error (EOPNOTSUPP, EXDEV, EINVAL, …) just means that the file system can’t do it.
+   if (::ioctl(dst_fd, FICLONE, src_fd) < 0) {
+      return false;
+   }
+   // Leave both files at the end, as if the data had been read and written.
+   if (::lseek(src_fd, src_stat.st_size, SEEK_SET) < 0 || ::lseek(dst_fd, src_stat.st_size, SEEK_SET) < 0) {
+      exception::throw_os_error();
+   }
+   this_coroutine::interruption_point();
+   copy_progress(copied, static_cast<full_size_t>(src_stat.st_size), progress);
+   return true;
+   #else
+   LOFTY_UNUSED_ARG(src_fd);
+   LOFTY_UNUSED_ARG(dst_fd);
+   LOFTY_UNUSED_ARG(progress);
+   LOFTY_UNUSED_ARG(copied);
+   return false;
+   #endif
+}
+
+/*! Moves data between two regular files using copy_file_range(), starting from their current offsets. The
+kernel may clone the data or have a network file system copy it server-side. Since regular files never block
+as far as the coroutine scheduler is concerned, each chunk is handed to _pvt::blocking_offload.
+
+@param src_fd
+   File to read from; must be a regular file.
+@param dst_fd
+   File to write to; must be a regular file.
+@param max_size
+   Maximum count of bytes to copy, including those already counted in *copied.
+@param progress
+   Function to report progress to; may be empty.
+@param copied
+   Pointer to a variable that will be incremented by the count of bytes copied.
+@return
+   true if the copy was completed (EOF or max_size reached), or false if the OS doesn’t support
+   copy_file_range() between the two files, in which case the caller should finish the copy by other means.
+*/
+static bool copy_via_copy_file_range(
+   filedesc_t src_fd, filedesc_t dst_fd, full_size_t max_size,
+   copy_options::progress_fn_type const & progress, full_size_t * copied
+) {
+   LOFTY_TRACE_FUNC(src_fd, dst_fd, max_size, copied);
+
+   while (*copied < max_size) {
+      std::size_t chunk_size = static_cast<std::size_t>(
+         std::min<full_size_t>(copy_kernel_chunk_size, max_size - *copied)
+      );
+      ::ssize_t copied_bytes;
+      int err;
+      _pvt::blocking_offload::instance().run([src_fd, dst_fd, chunk_size, &copied_bytes, &err] () {
+         copied_bytes = ::copy_file_range(src_fd, nullptr, dst_fd, nullptr, chunk_size, 0);
+         err = errno;
+      });
+      if (copied_bytes > 0) {
+         copy_progress(copied, static_cast<full_size_t>(copied_bytes), progress);
+      } else if (copied_bytes == 0) {
+         // EOF.
+         break;
+      } else {
+         switch (err) {
+            case EINTR:
+               break;
+            case EBADF: // dst_fd was opened with O_APPEND.
+            case EINVAL:
+            case ENOSYS:
+            case EOPNOTSUPP:
+            case EXDEV:
+               return false;
+            default:
+               exception::throw_os_error(err);
+         }
+      }
+      this_coroutine::interruption_point();
+   }
+   this_coroutine::interruption_point();
+   return true;
+}
+
+/*! Moves data from a regular file to any file using sendfile(), starting from the current offset of src_fd.
+
+@param src_fd
+   File to read from; must be a regular file.
+@param dst_fd
+   File to write to.
+@param max_size
+   Maximum count of bytes to copy, including those already counted in *copied.
+@param progress
+   Function to report progress to; may be empty.
+@param copied
+   Pointer to a variable that will be incremented by the count of bytes copied.
+@return
+   true if the copy was completed (EOF or max_size reached), or false if the OS doesn’t support sendfile()
+   between the two files, in which case the caller should finish the copy by other means.
+*/
+static bool copy_via_sendfile(
+   filedesc_t src_fd, filedesc_t dst_fd, full_size_t max_size,
+   copy_options::progress_fn_type const & progress, full_size_t * copied
+) {
+   LOFTY_TRACE_FUNC(src_fd, dst_fd, max_size, copied);
+
+   /* Linux transfers at most 0x7ffff000 bytes with a single call; use smaller chunks if progress needs to be
+   reported. */
+   std::size_t chunk_size_max = progress ? copy_kernel_chunk_size : 0x7ffff000;
+   while (*copied < max_size) {
+      std::size_t chunk_size = static_cast<std::size_t>(
+         std::min<full_size_t>(chunk_size_max, max_size - *copied)
+      );
+      ::ssize_t sent_bytes = ::sendfile(dst_fd, src_fd, nullptr, chunk_size);
+      if (sent_bytes > 0) {
+         copy_progress(copied, static_cast<full_size_t>(sent_bytes), progress);
+      } else if (sent_bytes == 0) {
+         // EOF.
+         break;
+      } else {
+         int err = errno;
+         switch (err) {
+            case EINTR:
+               this_coroutine::interruption_point();
+               break;
+            case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+   #endif
+               this_coroutine::sleep_until_fd_ready(dst_fd, true);
+               break;
+            case EINVAL:
+            case ENOSYS:
+               return false;
+            default:
+               exception::throw_os_error(err);
+         }
+      }
+   }
+   this_coroutine::interruption_point();
+   return true;
+}
+
+/*! Moves data between any two files using splice() through an intermediate pipe, so that neither file needs
+to be a pipe.
+
+@param src_fd
+   File to read from.
+@param dst_fd
+   File to write to.
+@param dst
+   Stream for dst_fd; used to write any data left in the intermediate pipe in case splice() fails.
+@param max_size
+   Maximum count of bytes to copy, including those already counted in *copied.
+@param progress
+   Function to report progress to; may be empty.
+@param copied
+   Pointer to a variable that will be incremented by the count of bytes copied.
+@return
+   true if the copy was completed (EOF or max_size reached), or false if the OS doesn’t support splice()
+   between the two files, in which case the caller should finish the copy by other means.
+*/
+static bool copy_via_splice(
+   filedesc_t src_fd, filedesc_t dst_fd, ostream * dst, full_size_t max_size,
+   copy_options::progress_fn_type const & progress, full_size_t * copied
+) {
+   LOFTY_TRACE_FUNC(src_fd, dst_fd, dst, max_size, copied);
+
+   int pipe_fds[2];
+   // The pipe is non-blocking, so that EAGAIN can only be caused by src_fd or dst_fd.
+   if (::pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+      exception::throw_os_error();
+   }
+   filedesc pipe_read_fd(pipe_fds[0]), pipe_write_fd(pipe_fds[1]);
+   unsigned const flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+   std::size_t in_pipe = 0;
+   for (;;) {
+      if (in_pipe == 0) {
+         if (*copied >= max_size) {
+            break;
+         }
+         std::size_t chunk_size = static_cast<std::size_t>(
+            std::min<full_size_t>(copy_buffer_size, max_size - *copied)
+         );
+         ::ssize_t read_bytes = ::splice(src_fd, nullptr, pipe_write_fd.get(), nullptr, chunk_size, flags);
+         if (read_bytes > 0) {
+            in_pipe = static_cast<std::size_t>(read_bytes);
+         } else if (read_bytes == 0) {
+            // EOF.
+            break;
+         } else {
+            int err = errno;
+            switch (err) {
+               case EINTR:
+                  this_coroutine::interruption_point();
+                  break;
+               case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+               case EWOULDBLOCK:
+   #endif
+                  this_coroutine::sleep_until_fd_ready(src_fd, false);
+                  break;
+               case EINVAL:
+               case ENOSYS:
+                  return false;
+               default:
+                  exception::throw_os_error(err);
+            }
+            continue;
+         }
+      }
+      ::ssize_t written_bytes = ::splice(pipe_read_fd.get(), nullptr, dst_fd, nullptr, in_pipe, flags);
+      if (written_bytes > 0) {
+         in_pipe -= static_cast<std::size_t>(written_bytes);
+         copy_progress(copied, static_cast<full_size_t>(written_bytes), progress);
+      } else {
+         int err = errno;
+         switch (err) {
+            case EINTR:
+               this_coroutine::interruption_point();
+               break;
+            case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+   #endif
+               this_coroutine::sleep_until_fd_ready(dst_fd, true);
+               break;
+            case EINVAL:
+            case ENOSYS: {
+               /* Don’t lose the data already read into the pipe: write it out the old-fashioned way. A read
+               from a pipe may return fewer bytes than requested, so repeat until the pipe is empty. */
+               auto buf(memory::alloc_bytes_unique(in_pipe));
+               while (in_pipe > 0) {
+                  ::ssize_t pipe_read_bytes = ::read(pipe_read_fd.get(), buf.get(), in_pipe);
+                  if (pipe_read_bytes < 0) {
+                     int read_err = errno;
+                     if (read_err != EINTR) {
+                        exception::throw_os_error(read_err);
+                     }
+                     this_coroutine::interruption_point();
+                  } else {
+                     dst->write(buf.get(), static_cast<std::size_t>(pipe_read_bytes));
+                     in_pipe -= static_cast<std::size_t>(pipe_read_bytes);
+                     copy_progress(copied, static_cast<full_size_t>(pipe_read_bytes), progress);
+                  }
+               }
+               return false;
+            }
+            default:
+               exception::throw_os_error(err);
+         }
+      }
+   }
+   this_coroutine::interruption_point();
+   return true;
+}
+#endif //if LOFTY_HOST_API_LINUX
+
+full_size_t copy(istream * src, ostream * dst, copy_options const & opts) {
+   LOFTY_TRACE_FUNC(src, dst);
+
+   full_size_t copied = 0, max_size = opts.max_size();
+   auto const & progress = opts.progress();
+   istream * unbuf_src = src;
+   ostream * unbuf_dst = dst;
+   _std::shared_ptr<istream> unbuf_src_ptr;
+   _std::shared_ptr<ostream> unbuf_dst_ptr;
+   if (auto buf_src = dynamic_cast<buffered_istream *>(src)) {
+      auto buf(buf_src->peek_bytes(0));
+      if (opts.offset() >= 0) {
+         // The buffered data comes from the wrong offset.
+         buf_src->consume_bytes(_std::get<1>(buf));
+      } else {
+         // Copy whatever is already in the read buffer, without reading any more.
+         std::size_t buf_size = static_cast<std::size_t>(std::min<full_size_t>(_std::get<1>(buf), max_size));
+         if (buf_size > 0) {
+            dst->write(_std::get<0>(buf), buf_size);
+            buf_src->consume_bytes(buf_size);
+            copy_progress(&copied, buf_size, progress);
+         }
+      }
+      unbuf_src_ptr = buf_src->unbuffered();
+      unbuf_src = unbuf_src_ptr.get();
+   }
+   if (opts.offset() >= 0) {
+      auto seekable_src = dynamic_cast<seekable *>(unbuf_src);
+      if (!seekable_src) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+      }
+      seekable_src->seek(opts.offset(), seek_from::start);
+   }
+   if (auto buf_dst = dynamic_cast<buffered_ostream *>(dst)) {
+      unbuf_dst_ptr = buf_dst->unbuffered();
+      unbuf_dst = unbuf_dst_ptr.get();
+   }
+#if LOFTY_HOST_API_LINUX
+   auto file_src = dynamic_cast<file_istream *>(unbuf_src);
+   auto file_dst = dynamic_cast<file_ostream *>(unbuf_dst);
+   auto reg_src = dynamic_cast<regular_file_istream *>(file_src);
+   auto reg_dst = dynamic_cast<regular_file_ostream *>(file_dst);
+   if (
+      file_src && file_dst && copied < max_size &&
+      // Files opened with O_DIRECT stage data in memory, so their descriptors can’t be used directly.
+      !(reg_src && reg_src->uses_direct_io()) && !(reg_dst && reg_dst->uses_direct_io())
+   ) {
+      if (unbuf_dst != dst) {
+         /* Anything in the write buffer must reach the file before the data we’re about to move, but there’s
+         no need to wait for it to reach the storage, as flush() would for a regular file. */
+         if (auto def_buf_dst = dynamic_cast<default_buffered_ostream *>(dst)) {
+            def_buf_dst->flush_buffer();
+         } else {
+            dst->flush();
+         }
+      }
+      filedesc_t src_fd = static_cast<file_stream *>(file_src)->fd.get();
+      filedesc_t dst_fd = static_cast<file_stream *>(file_dst)->fd.get();
+      bool done = false;
+      if (reg_src && reg_dst) {
+         if (opts.allow_clone() && copied == 0 && max_size == numeric::max<full_size_t>::value) {
+            done = copy_via_clone(src_fd, dst_fd, progress, &copied);
+         }
+         if (!done) {
+            done = copy_via_copy_file_range(src_fd, dst_fd, max_size, progress, &copied);
+         }
+      }
+      if (!done) {
+         if (reg_src) {
+            done = copy_via_sendfile(src_fd, dst_fd, max_size, progress, &copied);
+         } else {
+            done = copy_via_splice(src_fd, dst_fd, file_dst, max_size, progress, &copied);
+         }
+      }
+      if (done) {
+         return copied;
+      }
+      // The OS refused to move the data; finish the copy the old-fashioned way.
+   }
+#else
+   LOFTY_UNUSED_ARG(unbuf_dst);
+#endif
+   copy_via_buffer(unbuf_src, dst, max_size, progress, &copied);
+   return copied;
+}
+
+full_size_t copy_file(
+   os::path const & src_path, os::path const & dst_path, copy_options const & opts /*= copy_options()*/
+) {
+   LOFTY_TRACE_FUNC(src_path, dst_path);
+
+   auto src(open_istream(src_path));
+#if LOFTY_HOST_API_POSIX
+   /* Open the destination without truncating it, since it might be the source itself: truncating it would
+   lose the data that’s about to be copied. */
+   auto dst(_std::dynamic_pointer_cast<file_ostream>(open(dst_path, access_mode::read_write)));
+   try {
+      filedesc_t src_fd = src->fd.get(), dst_fd = dst->fd.get();
+      struct ::stat src_stat, dst_stat;
+      if (::fstat(src_fd, &src_stat) < 0 || ::fstat(dst_fd, &dst_stat) < 0) {
+         exception::throw_os_error();
+      }
+      if (src_stat.st_dev == dst_stat.st_dev && src_stat.st_ino == dst_stat.st_ino) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+      }
+      while (::ftruncate(dst_fd, 0) < 0) {
+         int err = errno;
+         if (err != EINTR) {
+            exception::throw_os_error(err);
+         }
+         this_coroutine::interruption_point();
+      }
+   } catch (...) {
+      dst->finalize();
+      throw;
+   }
+#else
+   // TODO: check whether the two paths refer to the same file.
+   auto dst(open_ostream(dst_path));
+#endif
+   full_size_t copied = copy(src.get(), dst.get(), opts);
+   dst->finalize();
+   return copied;
+}
+
 _std::shared_ptr<file_istream> make_istream(io::filedesc && fd) {
    LOFTY_TRACE_FUNC(fd);
 
@@ -267,7 +789,7 @@ _std::shared_ptr<file_stream> open(os::path const & path, access_mode mode, bool
          flags = O_WRONLY | O_CREAT | O_TRUNC;
          break;
       case access_mode::write_append:
-         flags = O_APPEND;
+         flags = O_WRONLY | O_APPEND | O_CREAT;
          break;
    }
    flags |= O_CLOEXEC;
@@ -465,6 +987,16 @@ ostream::ostream() {
 /*virtual*/ ostream::~ostream() {
 }
 
+/*virtual*/ std::size_t ostream::write_buffers(const_buffer const * bufs, std::size_t bufs_count) {
+   LOFTY_TRACE_FUNC(this, bufs, bufs_count);
+
+   std::size_t written_size = 0;
+   for (std::size_t i = 0; i < bufs_count; ++i) {
+      written_size += write(bufs[i].src, bufs[i].src_size);
+   }
+   return written_size;
+}
+
 }}} //namespace lofty::io::binary
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -536,6 +1068,7 @@ buffered_ostream::buffered_ostream() {
    _std::tie(buf, buf_size) = get_buffer<std::int8_t>(src_size);
    // Copy the source data into the buffer.
    memory::copy(buf, static_cast<std::int8_t const *>(src), src_size);
+   commit_bytes(src_size);
    return src_size;
 }
 
@@ -775,6 +1308,75 @@ file_ostream::file_ostream(_pvt::file_init_data * init_data) :
    return static_cast<std::size_t>(src_bytes - static_cast<std::int8_t const *>(src));
 }
 
+/*virtual*/ std::size_t file_ostream::write_buffers(
+   const_buffer const * bufs, std::size_t bufs_count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, bufs, bufs_count);
+
+#if LOFTY_HOST_API_POSIX
+   // Maximum count of buffers that can be passed to a single ::writev() call.
+   #ifdef IOV_MAX
+   static std::size_t const iovs_max = IOV_MAX;
+   #else
+   static std::size_t const iovs_max = 16;
+   #endif
+   // Small batches are built on the stack; larger ones are written in multiple ::writev() calls.
+   static std::size_t const iovs_batch_size = 64;
+   ::iovec iovs[iovs_batch_size];
+   std::size_t written_size = 0;
+   while (bufs_count) {
+      std::size_t iovs_count = std::min(bufs_count, std::min(iovs_max, iovs_batch_size));
+      for (std::size_t i = 0; i < iovs_count; ++i) {
+         iovs[i].iov_base = const_cast<void *>(bufs[i].src);
+         iovs[i].iov_len = bufs[i].src_size;
+      }
+      bufs += iovs_count;
+      bufs_count -= iovs_count;
+      // This may repeat in case of EINTR or in case ::writev() couldn’t write all the bytes.
+      ::iovec * next_iov = iovs;
+      while (iovs_count) {
+         ::ssize_t bytes_written = ::writev(fd.get(), next_iov, static_cast<int>(iovs_count));
+         if (bytes_written >= 0) {
+            written_size += static_cast<std::size_t>(bytes_written);
+            // Skip the buffers that were written entirely, and adjust the first one that wasn’t.
+            std::size_t bytes_left = static_cast<std::size_t>(bytes_written);
+            while (iovs_count && bytes_left >= next_iov->iov_len) {
+               bytes_left -= next_iov->iov_len;
+               ++next_iov;
+               --iovs_count;
+            }
+            if (iovs_count) {
+               next_iov->iov_base = static_cast<std::int8_t *>(next_iov->iov_base) + bytes_left;
+               next_iov->iov_len -= bytes_left;
+            }
+         } else {
+            int err = errno;
+            switch (err) {
+               case EINTR:
+                  this_coroutine::interruption_point();
+                  break;
+               case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+               case EWOULDBLOCK:
+   #endif
+                  this_coroutine::sleep_until_fd_ready(fd.get(), true);
+                  break;
+               default:
+                  exception::throw_os_error(err);
+            }
+         }
+      }
+   }
+   this_coroutine::interruption_point();
+   return written_size;
+#elif LOFTY_HOST_API_WIN32 //if LOFTY_HOST_API_POSIX
+   // TODO: use ::WriteFileGather() for unbuffered files, and ::WSASend() for sockets.
+   return ostream::write_buffers(bufs, bufs_count);
+#else //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32
+   #error "TODO: HOST_API"
+#endif //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32 … else
+}
+
 }}} //namespace lofty::io::binary
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,421 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/byte_order.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/io/binary/append_log.hxx>
+#include <lofty/io/binary/checksum.hxx>
+#include <lofty/thread.hxx>
+#include "file-subclasses.hxx"
+
+#if LOFTY_HOST_API_POSIX
+   #include <errno.h> // EAGAIN EINTR EWOULDBLOCK errno
+   #include <fcntl.h> // O_CLOEXEC O_NONBLOCK
+   #include <poll.h> // poll() pollfd POLLIN
+   #include <unistd.h> // pipe() pipe2() read() write()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace append_log {
+
+namespace {
+
+/*! Returns the CRC stored in a record header.
+
+@param size_le
+   Pointer to the payload size, as stored in the header.
+@param payload
+   Pointer to the payload.
+@param payload_size
+   Size of the payload.
+@return
+   CRC-32C of the payload size and payload.
+*/
+std::uint32_t record_crc(std::uint8_t const * size_le, void const * payload, std::size_t payload_size) {
+   crc32c crc;
+   crc.update(size_le, sizeof(std::uint32_t));
+   crc.update(payload, payload_size);
+   return crc.value();
+}
+
+/*! Stores a 32-bit little-endian word.
+
+@param dst
+   Pointer to the destination.
+@param value
+   Value to store.
+*/
+void store_le_32(std::uint8_t * dst, std::uint32_t value) {
+   value = byte_order::host_to_le(value);
+   memory::copy(dst, reinterpret_cast<std::uint8_t const *>(&value), sizeof value);
+}
+
+/*! Loads a 32-bit little-endian word.
+
+@param src
+   Pointer to the source.
+@return
+   Loaded value.
+*/
+std::uint32_t load_le_32(std::uint8_t const * src) {
+   std::uint32_t ret;
+   memory::copy(reinterpret_cast<std::uint8_t *>(&ret), src, sizeof ret);
+   return byte_order::le_to_host(ret);
+}
+
+} //namespace
+
+}}}} //namespace lofty::io::binary::append_log
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace io { namespace binary { namespace append_log {
+
+//! Pipe used to wake up an append() call once its batch has been committed.
+struct writer::waiter {
+   //! Read end of the pipe.
+   filedesc read_fd;
+   //! Write end of the pipe.
+   filedesc write_fd;
+
+   //! Default constructor.
+   waiter() {
+      int fds[2];
+   #if LOFTY_HOST_API_DARWIN
+      // pipe2() is not available, so emulate it with pipe() + fcntl().
+      if (::pipe(fds) < 0) {
+         exception::throw_os_error();
+      }
+      read_fd = filedesc(fds[0]);
+      write_fd = filedesc(fds[1]);
+      read_fd.set_close_on_exec(true);
+      write_fd.set_close_on_exec(true);
+      read_fd.set_nonblocking(true);
+      write_fd.set_nonblocking(true);
+   #else
+      if (::pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+         exception::throw_os_error();
+      }
+      read_fd = filedesc(fds[0]);
+      write_fd = filedesc(fds[1]);
+   #endif
+   }
+
+   /*! Consumes the wake-up byte, if it has been written.
+
+   @return
+      true if the waiter was woken up, or false otherwise.
+   */
+   bool consume_wake() {
+      std::int8_t b;
+      for (;;) {
+         if (::read(read_fd.get(), &b, 1) > 0) {
+            return true;
+         }
+         int err = errno;
+         switch (err) {
+            case EINTR:
+               break;
+            case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+   #endif
+               return false;
+            default:
+               exception::throw_os_error(err);
+         }
+      }
+   }
+
+   /*! Suspends the calling coroutine, or blocks the calling thread, until wake() is called.
+
+   Only the coroutine case is an interruption point; a thread will only be interrupted once woken up, which
+   happens as soon as the batch being committed is durable. */
+   void wait() {
+      while (!consume_wake()) {
+         if (this_coroutine::id() != 0) {
+            this_coroutine::sleep_until_fd_ready(read_fd.get(), false);
+         } else {
+            ::pollfd pfd;
+            pfd.fd = read_fd.get();
+            pfd.events = POLLIN;
+            // Errors, including EINTR, will just cause another attempt at reading.
+            ::poll(&pfd, 1, -1);
+         }
+      }
+   }
+
+   /*! Wakes up the append() call waiting on the pipe. This is not an interruption point, since the byte is
+   needed to unblock the waiter. */
+   void wake() {
+      std::int8_t b = 0;
+      while (::write(write_fd.get(), &b, 1) < 0) {
+         int err = errno;
+         if (err != EINTR) {
+            exception::throw_os_error(err);
+         }
+      }
+   }
+};
+
+
+full_size_t const writer::preallocation_size_default;
+
+writer::writer(os::path const & path, full_size_t preallocation_size_ /*= preallocation_size_default*/) :
+   preallocation_size(preallocation_size_),
+   committing(false),
+   broken(false),
+   finalized(false) {
+   LOFTY_TRACE_FUNC(this, path, preallocation_size_);
+
+   file = _std::dynamic_pointer_cast<regular_file_ostream>(open(path, access_mode::write_append));
+   if (!file) {
+      // Only regular files can be made durable, and preallocated.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   appended_size = durable_size_ = preallocated_end = file->size();
+}
+
+writer::~writer() {
+}
+
+full_size_t writer::append(void const * src, std::size_t src_size) {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   if (src_size > record_size_max) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   // Prepare the header outside of the lock.
+   std::uint8_t header[record_header_size];
+   store_le_32(header, static_cast<std::uint32_t>(src_size));
+   store_le_32(header + sizeof(std::uint32_t), record_crc(header, src, src_size));
+   full_size_t record_offset, record_end;
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      if (broken || finalized) {
+         LOFTY_THROW(io::error, ());
+      }
+      pending.push_back(header, record_header_size);
+      pending.push_back(static_cast<std::uint8_t const *>(src), src_size);
+      record_offset = appended_size;
+      appended_size += record_header_size + src_size;
+      record_end = appended_size;
+   }
+   wait_durable(record_end);
+   return record_offset;
+}
+
+void writer::commit_batch(full_size_t batch_end) {
+   LOFTY_TRACE_FUNC(this, batch_end);
+
+   try {
+      if (preallocation_size && batch_end > preallocated_end) {
+         // Allocate enough for this batch, plus a whole chunk for the ones that will follow.
+         full_size_t new_preallocated_end = batch_end + preallocation_size;
+         file->preallocate(preallocated_end, new_preallocated_end - preallocated_end);
+         preallocated_end = new_preallocated_end;
+      }
+      file->write(batch.data(), batch.size());
+      file->flush_data();
+   } catch (execution_interruption const &) {
+      /* The caller was interrupted, possibly after the data was written: the file is not broken, so put back
+      whatever didn’t make it to the file, to be committed with the next batch, and let another appender take
+      over as the committer. */
+      std::size_t unwritten_size = 0;
+      bool unwritten_known = false;
+      try {
+         full_size_t file_size = file->size(), batch_begin = batch_end - batch.size();
+         if (file_size >= batch_begin && file_size <= batch_end) {
+            unwritten_size = static_cast<std::size_t>(batch_end - file_size);
+            unwritten_known = true;
+         }
+      } catch (...) {
+         // Can’t tell what was written, which is handled below.
+      }
+      _std::lock_guard<_std::mutex> lock(mtx);
+      if (unwritten_known) {
+         pending.insert(pending.cbegin(), batch.data() + batch.size() - unwritten_size, unwritten_size);
+      } else {
+         broken = true;
+      }
+      batch.set_size(0);
+      committing = false;
+      wake_waiters();
+      throw;
+   } catch (...) {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      broken = true;
+      committing = false;
+      wake_waiters();
+      throw;
+   }
+   batch.set_size(0);
+   _std::lock_guard<_std::mutex> lock(mtx);
+   durable_size_ = batch_end;
+   committing = false;
+   wake_waiters();
+}
+
+full_size_t writer::durable_size() const {
+   _std::lock_guard<_std::mutex> lock(mtx);
+   return durable_size_;
+}
+
+void writer::finalize() {
+   LOFTY_TRACE_FUNC(this);
+
+   full_size_t end;
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      end = appended_size;
+   }
+   wait_durable(end);
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      finalized = true;
+   }
+   file->finalize();
+}
+
+void writer::wait_durable(full_size_t end) {
+   LOFTY_TRACE_FUNC(this, end);
+
+   _std::shared_ptr<waiter> w;
+   for (;;) {
+      bool commit;
+      full_size_t batch_end;
+      {
+         _std::lock_guard<_std::mutex> lock(mtx);
+         if (durable_size_ >= end) {
+            if (w) {
+               spare_waiters.push_back(_std::move(w));
+            }
+            return;
+         } else if (broken) {
+            LOFTY_THROW(io::error, ());
+         }
+         if (committing) {
+            // Another appender is committing a batch; wait for it to finish, then check again.
+            if (!w) {
+               w = spare_waiters ? spare_waiters.pop_back() : _std::make_shared<waiter>();
+            }
+            waiters.push_back(w);
+            commit = false;
+            batch_end = 0;
+         } else {
+            // Become the committer of a batch containing all pending records, including the caller’s.
+            committing = true;
+            collections::vector<std::uint8_t> empty_batch(_std::move(batch));
+            batch = _std::move(pending);
+            pending = _std::move(empty_batch);
+            commit = true;
+            batch_end = appended_size;
+         }
+      }
+      if (commit) {
+         commit_batch(batch_end);
+         continue;
+      }
+      try {
+         w->wait();
+      } catch (...) {
+         // Stop waiting; the record will still be committed with the next batch.
+         _std::lock_guard<_std::mutex> lock(mtx);
+         for (auto itr(waiters.begin()); itr != waiters.end(); ++itr) {
+            if (*itr == w) {
+               waiters.remove_at(itr);
+               break;
+            }
+         }
+         // Don’t reuse w, since it may have been woken up in the meantime.
+         throw;
+      }
+   }
+}
+
+void writer::wake_waiters() {
+   LOFTY_FOR_EACH(auto & w, waiters) {
+      w->wake();
+   }
+   waiters.clear();
+}
+
+}}}} //namespace lofty::io::binary::append_log
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace append_log {
+
+reader::reader(_std::shared_ptr<buffered_istream> bin_istream_) :
+   bin_istream(_std::move(bin_istream_)),
+   pending_consume_size(0),
+   valid_size_(0),
+   damaged_(false) {
+}
+
+reader::~reader() {
+}
+
+bool reader::read(const_buffer * record) {
+   LOFTY_TRACE_FUNC(this, record);
+
+   if (pending_consume_size) {
+      bin_istream->consume_bytes(pending_consume_size);
+      pending_consume_size = 0;
+   }
+   if (damaged_) {
+      return false;
+   }
+   std::uint8_t const * buf;
+   std::size_t buf_size;
+   _std::tie(buf, buf_size) = bin_istream->peek<std::uint8_t>(record_header_size);
+   if (buf_size == 0) {
+      // Clean end of the log.
+      return false;
+   } else if (buf_size >= record_header_size) {
+      std::size_t payload_size = load_le_32(buf);
+      if (payload_size <= record_size_max) {
+         std::size_t record_size = record_header_size + payload_size;
+         _std::tie(buf, buf_size) = bin_istream->peek<std::uint8_t>(record_size);
+         if (
+            buf_size >= record_size &&
+            load_le_32(buf + sizeof(std::uint32_t)) == record_crc(buf, buf + record_header_size, payload_size)
+         ) {
+            record->src = buf + record_header_size;
+            record->src_size = payload_size;
+            pending_consume_size = record_size;
+            valid_size_ += record_size;
+            return true;
+         }
+      }
+   }
+   // The record is incomplete, or its header or payload are corrupted.
+   damaged_ = true;
+   return false;
+}
+
+}}}} //namespace lofty::io::binary::append_log
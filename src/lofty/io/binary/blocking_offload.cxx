@@ -0,0 +1,288 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/thread.hxx>
+#include "blocking_offload.hxx"
+
+#if LOFTY_HOST_API_POSIX
+   #include <errno.h> // EINTR errno
+   #include <fcntl.h> // O_*
+   #include <poll.h> // poll()
+   #include <unistd.h> // pipe() pipe2() read() write()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace _pvt {
+
+/*! Creates a pipe whose ends will be closed on exec().
+
+@param read_fd
+   Receives the read end of the pipe.
+@param write_fd
+   Receives the write end of the pipe.
+@param nonblocking
+   If true, both ends will be in non-blocking mode.
+*/
+static void create_pipe(filedesc * read_fd, filedesc * write_fd, bool nonblocking) {
+   int fds[2];
+   #if LOFTY_HOST_API_DARWIN
+   // pipe2() is not available, so emulate it with pipe() + fcntl().
+   if (::pipe(fds) < 0) {
+      exception::throw_os_error();
+   }
+   *read_fd = filedesc(fds[0]);
+   *write_fd = filedesc(fds[1]);
+   read_fd->set_close_on_exec(true);
+   write_fd->set_close_on_exec(true);
+   if (nonblocking) {
+      read_fd->set_nonblocking(true);
+      write_fd->set_nonblocking(true);
+   }
+   #else
+   if (::pipe2(fds, O_CLOEXEC | (nonblocking ? O_NONBLOCK : 0)) < 0) {
+      exception::throw_os_error();
+   }
+   *read_fd = filedesc(fds[0]);
+   *write_fd = filedesc(fds[1]);
+   #endif
+}
+
+/*! Reads a single byte from a non-blocking file descriptor, retrying in case of EINTR.
+
+@param fd
+   File descriptor to read from.
+@return
+   true if a byte was read, or false if none was available.
+*/
+static bool read_byte(filedesc_t fd) {
+   std::int8_t b;
+   for (;;) {
+      if (::read(fd, &b, 1) > 0) {
+         return true;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            return false;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+}
+
+/*! Writes a single byte to a file descriptor, retrying in case of EINTR. This is not an interruption point,
+since the byte is needed to unblock whoever’s waiting for it.
+
+@param fd
+   File descriptor to write to.
+*/
+static void write_byte(filedesc_t fd) {
+   std::int8_t b = 0;
+   while (::write(fd, &b, 1) < 0) {
+      int err = errno;
+      if (err != EINTR) {
+         exception::throw_os_error(err);
+      }
+   }
+}
+
+
+struct blocking_offload::job {
+   //! Function to run.
+   _std::function<void ()> fn;
+   //! Read end of the pipe that signals completion.
+   filedesc done_read_fd;
+   //! Write end of the pipe that signals completion.
+   filedesc done_write_fd;
+   //! true if a worker has taken the job.
+   bool started:1;
+   //! true if the caller gave up on the job before any worker took it.
+   bool cancelled:1;
+
+   //! Default constructor.
+   job() :
+      started(false),
+      cancelled(false) {
+      create_pipe(&done_read_fd, &done_write_fd, true);
+   }
+};
+
+
+std::size_t const blocking_offload::workers_max;
+
+blocking_offload::blocking_offload() :
+   workers_count(0),
+   idle_workers(0) {
+   create_pipe(&wake_read_fd, &wake_write_fd, false);
+}
+
+/*static*/ bool blocking_offload::enabled() {
+   return this_coroutine::id() != 0;
+}
+
+_std::shared_ptr<blocking_offload::job> blocking_offload::get_spare_job() {
+   if (spare_jobs) {
+      return spare_jobs.pop_back();
+   } else {
+      return _std::make_shared<job>();
+   }
+}
+
+/*static*/ blocking_offload & blocking_offload::instance() {
+   static blocking_offload * const pool = new blocking_offload();
+   return *pool;
+}
+
+void blocking_offload::abandon(_std::shared_ptr<job> const & j) {
+   LOFTY_TRACE_FUNC(this, j.get());
+
+   bool started;
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      started = j->started;
+      if (!started) {
+         // No worker will touch the job anymore; it will be discarded once dequeued.
+         j->cancelled = true;
+      }
+   }
+   if (started) {
+      // fn may be accessing the caller’s memory, so its completion must be awaited.
+      wait_for_job(j, false);
+   }
+}
+
+void blocking_offload::run(_std::function<void ()> const & fn) {
+   LOFTY_TRACE_FUNC(this);
+
+   if (!enabled()) {
+      // Not in a coroutine, so there’s nothing else to keep running: just block.
+      fn();
+      return;
+   }
+   wait(start(fn));
+}
+
+_std::shared_ptr<blocking_offload::job> blocking_offload::start(_std::function<void ()> const & fn) {
+   LOFTY_TRACE_FUNC(this);
+
+   _std::shared_ptr<job> j;
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      j = get_spare_job();
+      j->fn = fn;
+      queued_jobs.push_back(j);
+      if (queued_jobs.size() > idle_workers && workers_count < workers_max) {
+         thread([this] () {
+            worker_main();
+         }).detach();
+         ++workers_count;
+         ++idle_workers;
+      }
+   }
+   wake_worker();
+   return _std::move(j);
+}
+
+void blocking_offload::wait(_std::shared_ptr<job> const & j) {
+   LOFTY_TRACE_FUNC(this, j.get());
+
+   try {
+      wait_for_job(j, true);
+   } catch (...) {
+      abandon(j);
+      throw;
+   }
+}
+
+void blocking_offload::wait_for_job(_std::shared_ptr<job> const & j, bool interruptible) {
+   LOFTY_TRACE_FUNC(this, j.get(), interruptible);
+
+   while (!read_byte(j->done_read_fd.get())) {
+      if (interruptible) {
+         this_coroutine::sleep_until_fd_ready(j->done_read_fd.get(), false);
+      } else {
+         ::pollfd pfd;
+         pfd.fd = j->done_read_fd.get();
+         pfd.events = POLLIN;
+         // Errors, including EINTR, will just cause another attempt at reading.
+         ::poll(&pfd, 1, -1);
+      }
+   }
+   j->fn = nullptr;
+   _std::lock_guard<_std::mutex> lock(mtx);
+   j->started = false;
+   spare_jobs.push_back(j);
+}
+
+void blocking_offload::wake_worker() {
+   write_byte(wake_write_fd.get());
+}
+
+void blocking_offload::worker_main() {
+   LOFTY_TRACE_FUNC(this);
+
+   try {
+      for (;;) {
+         // Check for an interruption that arrived while running the last job, since it won’t cause EINTR.
+         this_thread::interruption_point();
+         // Wait for the byte written for a queued job.
+         std::int8_t b;
+         if (::read(wake_read_fd.get(), &b, 1) < 0) {
+            int err = errno;
+            if (err != EINTR) {
+               exception::throw_os_error(err);
+            }
+            this_thread::interruption_point();
+            continue;
+         }
+         _std::shared_ptr<job> j;
+         {
+            _std::lock_guard<_std::mutex> lock(mtx);
+            if (!queued_jobs) {
+               continue;
+            }
+            j = queued_jobs.pop_front();
+            if (j->cancelled) {
+               continue;
+            }
+            j->started = true;
+            --idle_workers;
+         }
+         j->fn();
+         {
+            _std::lock_guard<_std::mutex> lock(mtx);
+            ++idle_workers;
+         }
+         write_byte(j->done_write_fd.get());
+      }
+   } catch (execution_interruption const &) {
+      // The process is terminating.
+   }
+}
+
+}}}} //namespace lofty::io::binary::_pvt
+
+#endif //if LOFTY_HOST_API_POSIX
@@ -0,0 +1,163 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_BLOCKING_OFFLOAD_HXX
+#define _LOFTY_IO_BINARY_BLOCKING_OFFLOAD_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/collections/queue.hxx>
+#include <lofty/collections/vector.hxx>
+#include <lofty/io.hxx>
+#include <lofty/thread.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace io { namespace binary { namespace _pvt {
+
+/*! Pool of threads that run blocking system calls on behalf of coroutines.
+
+Regular files are always reported as ready by ::epoll() and ::kqueue(), so a ::read() that misses the page
+cache or an ::fsync() would stall every other coroutine on the scheduler’s thread. Running such calls on a
+worker thread instead allows the scheduler to resume other coroutines until the call returns.
+
+Worker threads are only started when needed, up to workers_max, and are detached right away: like any other
+Lofty-managed thread, they’re interrupted and waited for by app::run() once main() returns, so the pool never
+needs to join them. Win32 doesn’t need this, since file I/O there is already asynchronous via IOCP. */
+class blocking_offload : public noncopyable {
+public:
+   //! Maximum count of worker threads.
+   static std::size_t const workers_max = 4;
+
+   //! Tracks a single function handed to a worker thread.
+   struct job;
+
+public:
+   //! Default constructor.
+   blocking_offload();
+
+   /*! Returns true if run() would hand its function to a worker thread, which is the case when called from a
+   coroutine.
+
+   @return
+      true if the caller is a coroutine, or false otherwise.
+   */
+   static bool enabled();
+
+   /*! Returns the process-wide instance. It’s deliberately never destroyed: a static destructor would run
+   after the Lofty runtime has been torn down, when worker threads can no longer be touched.
+
+   @return
+      Reference to the pool.
+   */
+   static blocking_offload & instance();
+
+   /*! Waits for a function passed to start() to return, without being interrupted. If the function is still
+   queued, it’s discarded instead. Meant for cleanup paths that can’t let exceptions escape.
+
+   @param j
+      Job returned by start().
+   */
+   void abandon(_std::shared_ptr<job> const & j);
+
+   /*! Runs a function on a worker thread, suspending the calling coroutine until the function returns. The
+   function must not throw, since it runs outside of the caller’s context; system call results should be
+   passed back via captured variables instead.
+
+   If the coroutine is interrupted while the function is still queued, the function is discarded; if it’s
+   already running, the coroutine waits for it to return before letting the interruption propagate, since the
+   function most likely accesses memory owned by the caller.
+
+   @param fn
+      Function to run.
+   */
+   void run(_std::function<void ()> const & fn);
+
+   /*! Queues a function to run on a worker thread and returns immediately, even if the caller is not a
+   coroutine. The same restrictions as for run() apply to the function.
+
+   @param fn
+      Function to run.
+   @return
+      Job to be passed to wait() or abandon().
+   */
+   _std::shared_ptr<job> start(_std::function<void ()> const & fn);
+
+   /*! Waits for a function passed to start() to return, suspending the calling coroutine or thread. See run()
+   for what happens in case of interruptions.
+
+   @param j
+      Job returned by start().
+   */
+   void wait(_std::shared_ptr<job> const & j);
+
+private:
+   /*! Returns a job from the spare list, or a new one if the list is empty. Must be called with mtx locked.
+
+   @return
+      Job ready to be queued.
+   */
+   _std::shared_ptr<job> get_spare_job();
+
+   /*! Waits for a job to be completed by a worker, then returns it to the spare list.
+
+   @param j
+      Job to wait for.
+   @param interruptible
+      If true, the calling coroutine will be suspended while waiting; if false, the thread will block.
+   */
+   void wait_for_job(_std::shared_ptr<job> const & j, bool interruptible);
+
+   //! Wakes up one worker thread by writing a byte to wake_write_fd.
+   void wake_worker();
+
+   //! Main function of worker threads.
+   void worker_main();
+
+private:
+   //! Governs access to all the other members.
+   _std::mutex mtx;
+   //! Jobs waiting for a worker.
+   collections::queue<_std::shared_ptr<job>> queued_jobs;
+   //! Completed jobs, kept to reuse their pipes.
+   collections::vector<_std::shared_ptr<job>> spare_jobs;
+   //! Count of worker threads started.
+   std::size_t workers_count;
+   //! Count of workers not running a job.
+   std::size_t idle_workers;
+   //! Read end of the pipe used to wake workers, one byte per queued job.
+   filedesc wake_read_fd;
+   //! Write end of the pipe used to wake workers.
+   filedesc wake_write_fd;
+};
+
+}}}} //namespace lofty::io::binary::_pvt
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_BLOCKING_OFFLOAD_HXX
@@ -0,0 +1,142 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/bitmanip.hxx>
+#include <lofty/io/binary/buffer_pool.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+std::size_t const buffer_pool::default_cached_size_max;
+std::size_t const buffer_pool::size_classes;
+
+buffer_pool::buffer_pool() :
+   cached_size_(0),
+   cached_size_max(default_cached_size_max) {
+   memory::clear(&counters_);
+}
+
+buffer_pool::~buffer_pool() {
+}
+
+memory::pages_ptr buffer_pool::acquire(std::size_t size) {
+   LOFTY_TRACE_FUNC(this, size);
+
+   std::size_t class_index = size_class(size);
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      ++counters_.acquires;
+      if (class_index < size_classes && free_blocks[class_index]) {
+         ++counters_.reuses;
+         memory::pages_ptr block(free_blocks[class_index].pop_back());
+         cached_size_ -= block.size();
+         return _std::move(block);
+      }
+   }
+   // Allocate outside of the lock, since this can take a while.
+   return memory::pages_ptr(block_size(size));
+}
+
+/*static*/ std::size_t buffer_pool::block_size(std::size_t size) {
+   std::size_t class_index = size_class(size);
+   if (class_index < size_classes) {
+      return memory::page_size() << class_index;
+   } else {
+      return bitmanip::ceiling_to_pow2_multiple(size, memory::page_size());
+   }
+}
+
+/*static*/ std::size_t buffer_pool::block_size_max() {
+   return memory::page_size() << (size_classes - 1);
+}
+
+std::size_t buffer_pool::cached_size() const {
+   _std::lock_guard<_std::mutex> lock(mtx);
+   return cached_size_;
+}
+
+buffer_pool::usage_counters buffer_pool::counters() const {
+   _std::lock_guard<_std::mutex> lock(mtx);
+   return counters_;
+}
+
+/*static*/ buffer_pool & buffer_pool::instance() {
+   static buffer_pool pool;
+   return pool;
+}
+
+void buffer_pool::release(memory::pages_ptr * block) {
+   LOFTY_TRACE_FUNC(this, block);
+
+   if (!block->get()) {
+      return;
+   }
+   /* Take the block away from the caller now; if it doesn’t end up in the cache, it will be freed when this
+   goes out of scope, after the lock is released. */
+   memory::pages_ptr released(_std::move(*block));
+   std::size_t size = released.size();
+   std::size_t class_index = size_class(size);
+   _std::lock_guard<_std::mutex> lock(mtx);
+   // Only cache blocks of exactly a class size, since acquire() assumes that.
+   if (
+      class_index < size_classes && size == memory::page_size() << class_index &&
+      cached_size_ + size <= cached_size_max
+   ) {
+      free_blocks[class_index].push_back(_std::move(released));
+      cached_size_ += size;
+      ++counters_.releases;
+   } else {
+      ++counters_.frees;
+   }
+}
+
+void buffer_pool::set_cached_size_max(std::size_t size) {
+   LOFTY_TRACE_FUNC(this, size);
+
+   _std::lock_guard<_std::mutex> lock(mtx);
+   cached_size_max = size;
+}
+
+/*static*/ std::size_t buffer_pool::size_class(std::size_t size) {
+   std::size_t class_size = memory::page_size();
+   for (std::size_t class_index = 0; class_index < size_classes; ++class_index, class_size <<= 1) {
+      if (size <= class_size) {
+         return class_index;
+      }
+   }
+   return size_classes;
+}
+
+void buffer_pool::trim() {
+   LOFTY_TRACE_FUNC(this);
+
+   // Move the blocks out of the cache, so they can be freed after releasing the lock.
+   collections::vector<memory::pages_ptr> freed_blocks[size_classes];
+   {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      for (std::size_t class_index = 0; class_index < size_classes; ++class_index) {
+         freed_blocks[class_index] = _std::move(free_blocks[class_index]);
+      }
+      cached_size_ = 0;
+   }
+}
+
+}}} //namespace lofty::io::binary
@@ -0,0 +1,457 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/byte_order.hxx>
+#include <lofty/io/binary/checksum.hxx>
+
+#if (LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC) && (LOFTY_HOST_ARCH_I386 || LOFTY_HOST_ARCH_X86_64)
+   #include <nmmintrin.h> // _mm_crc32_*()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+/*virtual*/ checksum::~checksum() {
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+namespace {
+
+//! Signature of the functions implementing crc32c::update().
+typedef std::uint32_t (* crc32c_update_fn)(std::uint32_t crc, std::uint8_t const * src, std::size_t src_size);
+
+//! Lookup tables for the slicing-by-8 implementation of CRC-32C.
+struct crc32c_tables {
+   //! tables[k][b] is the CRC of byte b followed by k zero bytes.
+   std::uint32_t tables[8][256];
+
+   //! Default constructor.
+   crc32c_tables() {
+      // Reversed Castagnoli polynomial.
+      static std::uint32_t const poly = 0x82f63b78;
+      for (unsigned i = 0; i < 256; ++i) {
+         std::uint32_t crc = i;
+         for (unsigned bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+         }
+         tables[0][i] = crc;
+      }
+      for (unsigned i = 0; i < 256; ++i) {
+         for (unsigned k = 1; k < 8; ++k) {
+            tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xff];
+         }
+      }
+   }
+
+   /*! Returns the tables, generating them on first use.
+
+   @return
+      Reference to the tables.
+   */
+   static crc32c_tables const & instance() {
+      static crc32c_tables const tables_;
+      return tables_;
+   }
+};
+
+//! Portable implementation of crc32c::update(), processing 8 bytes at a time.
+std::uint32_t crc32c_update_table(std::uint32_t crc, std::uint8_t const * src, std::size_t src_size) {
+   auto const & t = crc32c_tables::instance().tables;
+   for (; src_size >= 8; src += 8, src_size -= 8) {
+      // Assembling the words byte by byte makes this independent of the host’s byte order.
+      std::uint32_t lo = crc ^ (
+         static_cast<std::uint32_t>(src[0])       | static_cast<std::uint32_t>(src[1]) << 8 |
+         static_cast<std::uint32_t>(src[2]) << 16 | static_cast<std::uint32_t>(src[3]) << 24
+      );
+      std::uint32_t hi =
+         static_cast<std::uint32_t>(src[4])       | static_cast<std::uint32_t>(src[5]) << 8 |
+         static_cast<std::uint32_t>(src[6]) << 16 | static_cast<std::uint32_t>(src[7]) << 24;
+      crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+   }
+   for (; src_size > 0; ++src, --src_size) {
+      crc = (crc >> 8) ^ t[0][(crc ^ *src) & 0xff];
+   }
+   return crc;
+}
+
+#if (LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC) && (LOFTY_HOST_ARCH_I386 || LOFTY_HOST_ARCH_X86_64)
+//! Implementation of crc32c::update() using the SSE 4.2 CRC32 instruction, processing a word at a time.
+__attribute__((target("sse4.2"))) std::uint32_t crc32c_update_sse42(
+   std::uint32_t crc, std::uint8_t const * src, std::size_t src_size
+) {
+   // Get to a word boundary, so that the loop below only performs aligned loads.
+   for (; src_size > 0 && (reinterpret_cast<std::uintptr_t>(src) & (sizeof(std::size_t) - 1)); --src_size) {
+      crc = _mm_crc32_u8(crc, *src++);
+   }
+   #if LOFTY_HOST_ARCH_X86_64
+   std::uint64_t crc64 = crc;
+   for (; src_size >= 8; src += 8, src_size -= 8) {
+      crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<std::uint64_t const *>(src));
+   }
+   crc = static_cast<std::uint32_t>(crc64);
+   #else
+   for (; src_size >= 4; src += 4, src_size -= 4) {
+      crc = _mm_crc32_u32(crc, *reinterpret_cast<std::uint32_t const *>(src));
+   }
+   #endif
+   for (; src_size > 0; --src_size) {
+      crc = _mm_crc32_u8(crc, *src++);
+   }
+   return crc;
+}
+#endif
+
+/*! Returns the fastest implementation of crc32c::update() that the CPU supports.
+
+@return
+   Pointer to the implementation.
+*/
+crc32c_update_fn select_crc32c_update() {
+#if (LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC) && (LOFTY_HOST_ARCH_I386 || LOFTY_HOST_ARCH_X86_64)
+   // Needed in case this runs before the constructor that normally initializes the CPU model.
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse4.2")) {
+      return &crc32c_update_sse42;
+   }
+#endif
+   return &crc32c_update_table;
+}
+
+/*! Returns the implementation of crc32c::update() to use, selecting it on first use.
+
+@return
+   Pointer to the implementation.
+*/
+crc32c_update_fn get_crc32c_update() {
+   static crc32c_update_fn const update = select_crc32c_update();
+   return update;
+}
+
+} //namespace
+
+
+/*virtual*/ crc32c::~crc32c() {
+}
+
+/*static*/ bool crc32c::hardware_accelerated() {
+   return get_crc32c_update() != &crc32c_update_table;
+}
+
+/*virtual*/ void crc32c::reset() /*override*/ {
+   crc = 0xffffffff;
+}
+
+/*virtual*/ void crc32c::update(void const * src, std::size_t src_size) /*override*/ {
+   crc = get_crc32c_update()(crc, static_cast<std::uint8_t const *>(src), src_size);
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+namespace {
+
+std::uint64_t const xxh64_prime1 = 0x9e3779b185ebca87ULL;
+std::uint64_t const xxh64_prime2 = 0xc2b2ae3d27d4eb4fULL;
+std::uint64_t const xxh64_prime3 = 0x165667b19e3779f9ULL;
+std::uint64_t const xxh64_prime4 = 0x85ebca77c2b2ae63ULL;
+std::uint64_t const xxh64_prime5 = 0x27d4eb2f165667c5ULL;
+
+//! Rotates a 64-bit value left.
+inline std::uint64_t rotl64(std::uint64_t i, unsigned bits) {
+   return (i << bits) | (i >> (64 - bits));
+}
+
+//! Reads a little-endian 64-bit value from a possibly unaligned address.
+inline std::uint64_t read_le64(std::uint8_t const * src) {
+   std::uint64_t ret;
+   memory::copy(reinterpret_cast<std::uint8_t *>(&ret), src, sizeof ret);
+   return byte_order::le_to_host(ret);
+}
+
+//! Reads a little-endian 32-bit value from a possibly unaligned address.
+inline std::uint32_t read_le32(std::uint8_t const * src) {
+   std::uint32_t ret;
+   memory::copy(reinterpret_cast<std::uint8_t *>(&ret), src, sizeof ret);
+   return byte_order::le_to_host(ret);
+}
+
+//! Mixes 8 bytes of input into a lane accumulator.
+inline std::uint64_t xxh64_round(std::uint64_t acc, std::uint64_t input) {
+   return rotl64(acc + input * xxh64_prime2, 31) * xxh64_prime1;
+}
+
+//! Folds a lane accumulator into the hash.
+inline std::uint64_t xxh64_merge_round(std::uint64_t hash, std::uint64_t lane) {
+   return (hash ^ xxh64_round(0, lane)) * xxh64_prime1 + xxh64_prime4;
+}
+
+/*! Processes as many whole stripes as possible.
+
+@param lanes
+   Lane accumulators.
+@param src
+   Pointer to the data.
+@param src_size
+   Size of the data; must be at least one stripe.
+@return
+   Count of bytes processed.
+*/
+std::size_t xxh64_stripes(std::uint64_t * lanes, std::uint8_t const * src, std::size_t src_size) {
+   std::uint64_t lane0 = lanes[0], lane1 = lanes[1], lane2 = lanes[2], lane3 = lanes[3];
+   std::uint8_t const * src_begin = src;
+   // The four lanes are independent, so their rounds can execute in parallel.
+   for (; src_size >= 32; src += 32, src_size -= 32) {
+      lane0 = xxh64_round(lane0, read_le64(src));
+      lane1 = xxh64_round(lane1, read_le64(src + 8));
+      lane2 = xxh64_round(lane2, read_le64(src + 16));
+      lane3 = xxh64_round(lane3, read_le64(src + 24));
+   }
+   lanes[0] = lane0;
+   lanes[1] = lane1;
+   lanes[2] = lane2;
+   lanes[3] = lane3;
+   return static_cast<std::size_t>(src - src_begin);
+}
+
+} //namespace
+
+
+std::size_t const xxhash64::stripe_size;
+
+xxhash64::xxhash64(std::uint64_t seed_ /*= 0*/) :
+   seed(seed_) {
+   reset();
+}
+
+/*virtual*/ xxhash64::~xxhash64() {
+}
+
+/*virtual*/ void xxhash64::reset() /*override*/ {
+   lanes[0] = seed + xxh64_prime1 + xxh64_prime2;
+   lanes[1] = seed + xxh64_prime2;
+   lanes[2] = seed;
+   lanes[3] = seed - xxh64_prime1;
+   total_size = 0;
+   stripe_used = 0;
+}
+
+/*virtual*/ void xxhash64::update(void const * src, std::size_t src_size) /*override*/ {
+   auto src_bytes = static_cast<std::uint8_t const *>(src);
+   total_size += src_size;
+   if (stripe_used > 0) {
+      // Complete the partial stripe first.
+      std::size_t fill_size = std::min(stripe_size - stripe_used, src_size);
+      memory::copy(stripe + stripe_used, src_bytes, fill_size);
+      stripe_used += fill_size;
+      src_bytes += fill_size;
+      src_size -= fill_size;
+      if (stripe_used < stripe_size) {
+         return;
+      }
+      xxh64_stripes(lanes, stripe, stripe_size);
+      stripe_used = 0;
+   }
+   if (src_size >= stripe_size) {
+      std::size_t processed_size = xxh64_stripes(lanes, src_bytes, src_size);
+      src_bytes += processed_size;
+      src_size -= processed_size;
+   }
+   if (src_size > 0) {
+      memory::copy(stripe, src_bytes, src_size);
+      stripe_used = src_size;
+   }
+}
+
+std::uint64_t xxhash64::value() const {
+   std::uint64_t hash;
+   if (total_size >= stripe_size) {
+      hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+      for (unsigned i = 0; i < 4; ++i) {
+         hash = xxh64_merge_round(hash, lanes[i]);
+      }
+   } else {
+      hash = seed + xxh64_prime5;
+   }
+   hash += total_size;
+   // Mix in the bytes that don’t make up a full stripe.
+   std::uint8_t const * src = stripe;
+   std::size_t src_size = stripe_used;
+   for (; src_size >= 8; src += 8, src_size -= 8) {
+      hash ^= xxh64_round(0, read_le64(src));
+      hash = rotl64(hash, 27) * xxh64_prime1 + xxh64_prime4;
+   }
+   if (src_size >= 4) {
+      hash ^= static_cast<std::uint64_t>(read_le32(src)) * xxh64_prime1;
+      hash = rotl64(hash, 23) * xxh64_prime2 + xxh64_prime3;
+      src += 4;
+      src_size -= 4;
+   }
+   for (; src_size > 0; ++src, --src_size) {
+      hash ^= *src * xxh64_prime5;
+      hash = rotl64(hash, 11) * xxh64_prime1;
+   }
+   // Final avalanche.
+   hash ^= hash >> 33;
+   hash *= xxh64_prime2;
+   hash ^= hash >> 29;
+   hash *= xxh64_prime3;
+   hash ^= hash >> 32;
+   return hash;
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+checksum_istream::checksum_istream(
+   _std::shared_ptr<buffered_istream> bin_istream_, _std::shared_ptr<checksum> sum
+) :
+   bin_istream(_std::move(bin_istream_)),
+   sum_(_std::move(sum)) {
+}
+
+/*virtual*/ checksum_istream::~checksum_istream() {
+}
+
+/*virtual*/ void checksum_istream::consume_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > 0) {
+      // The bytes being consumed are at the start of the wrapped stream’s buffer.
+      auto buf(bin_istream->peek_bytes(0));
+      if (count > _std::get<1>(buf)) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+      }
+      sum_->update(_std::get<0>(buf), count);
+      bin_istream->consume_bytes(count);
+   }
+}
+
+/*virtual*/ _std::tuple<void const *, std::size_t> checksum_istream::peek_bytes(
+   std::size_t count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   return bin_istream->peek_bytes(count);
+}
+
+/*virtual*/ _std::shared_ptr<stream> checksum_istream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   // Non-owning pointer to *this; see the class documentation.
+   return _std::shared_ptr<stream>(
+      _std::shared_ptr<stream>(), static_cast<stream *>(const_cast<checksum_istream *>(this))
+   );
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+checksum_ostream::checksum_ostream(
+   _std::shared_ptr<buffered_ostream> bin_ostream_, _std::shared_ptr<checksum> sum
+) :
+   bin_ostream(_std::move(bin_ostream_)),
+   sum_(_std::move(sum)),
+   reserved_buf(nullptr) {
+}
+
+/*virtual*/ checksum_ostream::~checksum_ostream() {
+}
+
+/*virtual*/ void checksum_ostream::commit_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > 0) {
+      if (!reserved_buf) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+      }
+      sum_->update(reserved_buf, count);
+   }
+   reserved_buf = nullptr;
+   bin_ostream->commit_bytes(count);
+}
+
+/*virtual*/ void checksum_ostream::finalize() /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   bin_ostream->finalize();
+}
+
+/*virtual*/ void checksum_ostream::flush() /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   bin_ostream->flush();
+}
+
+/*virtual*/ _std::tuple<void *, std::size_t> checksum_ostream::get_buffer_bytes(
+   std::size_t count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   auto ret(bin_ostream->get_buffer_bytes(count));
+   reserved_buf = _std::get<0>(ret);
+   return ret;
+}
+
+/*virtual*/ std::size_t checksum_ostream::write(void const * src, std::size_t src_size) /*override*/ {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   sum_->update(src, src_size);
+   return bin_ostream->write(src, src_size);
+}
+
+/*virtual*/ std::size_t checksum_ostream::write_buffers(
+   const_buffer const * bufs, std::size_t bufs_count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, bufs, bufs_count);
+
+   for (std::size_t i = 0; i < bufs_count; ++i) {
+      sum_->update(bufs[i].src, bufs[i].src_size);
+   }
+   return bin_ostream->write_buffers(bufs, bufs_count);
+}
+
+/*virtual*/ _std::shared_ptr<stream> checksum_ostream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   // Non-owning pointer to *this; see checksum_istream.
+   return _std::shared_ptr<stream>(
+      _std::shared_ptr<stream>(), static_cast<stream *>(const_cast<checksum_ostream *>(this))
+   );
+}
+
+}}} //namespace lofty::io::binary
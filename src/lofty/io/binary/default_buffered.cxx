@@ -17,62 +17,192 @@ You should have received a copy of the GNU Lesser General Public License along w
 ------------------------------------------------------------------------------------------------------------*/
 
 #include <lofty.hxx>
-#include <lofty/bitmanip.hxx>
+#include <lofty/coroutine.hxx>
 #include <lofty/destructing_unfinalized_object.hxx>
 #include <lofty/io/binary.hxx>
+#include <lofty/thread.hxx>
 #include "default_buffered.hxx"
 #include "file-subclasses.hxx"
 
+#if LOFTY_HOST_API_LINUX
+   #include <errno.h> // errno E*
+   #include <sys/mman.h> // MAP_* MFD_* PROT_* memfd_create() mmap() munmap()
+   #include <unistd.h> // ftruncate()
+#endif
+
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace lofty { namespace io { namespace binary { namespace _pvt {
 
+ring_pages::ring_pages(ring_pages && src) :
+   ptr(src.ptr),
+   size_(src.size_) {
+   src.ptr = nullptr;
+   src.size_ = 0;
+}
+
+ring_pages::~ring_pages() {
+   unmap();
+}
+
+ring_pages & ring_pages::operator=(ring_pages && src) {
+   unmap();
+   ptr = src.ptr;
+   src.ptr = nullptr;
+   size_ = src.size_;
+   src.size_ = 0;
+   return *this;
+}
+
+bool ring_pages::map(std::size_t size) {
+   LOFTY_TRACE_FUNC(this, size);
+
+   unmap();
+#if LOFTY_HOST_API_LINUX
+   // Create an anonymous file to hold the pages, so that they can be mapped more than once.
+   io::filedesc fd(::memfd_create("lofty-ring_pages", MFD_CLOEXEC));
+   if (!fd) {
+      int err = errno;
+      if (err == ENOSYS) {
+         return false;
+      }
+      exception::throw_os_error(err);
+   }
+   if (::ftruncate(fd.get(), static_cast< ::off_t>(size)) < 0) {
+      exception::throw_os_error();
+   }
+   // Reserve an address range for both mappings, then map the file twice over it.
+   auto range = static_cast<std::int8_t *>(
+      ::mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+   );
+   if (range == MAP_FAILED) {
+      exception::throw_os_error();
+   }
+   for (std::size_t i = 0; i < 2; ++i) {
+      if (::mmap(
+         range + size * i, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd.get(), 0
+      ) == MAP_FAILED) {
+         int err = errno;
+         ::munmap(range, size * 2);
+         exception::throw_os_error(err);
+      }
+   }
+   // The mappings keep the pages alive; fd can be closed now.
+   ptr = range;
+   size_ = size;
+   return true;
+#elif LOFTY_HOST_API_POSIX || LOFTY_HOST_API_WIN32
+   // TODO: shm_open() + mmap() on other POSIX hosts, VirtualAlloc2() + MapViewOfFile3() on Win32.
+   LOFTY_UNUSED_ARG(size);
+   return false;
+#else
+   #error "TODO: HOST_API"
+#endif
+}
+
+void ring_pages::unmap() {
+   if (ptr) {
+#if LOFTY_HOST_API_LINUX
+      ::munmap(ptr, size_ * 2);
+#endif
+      ptr = nullptr;
+      size_ = 0;
+   }
+}
+
+std::size_t const buffer::ring_size_min;
+
 buffer::buffer(std::size_t size__) :
-   ptr(memory::alloc_bytes_unique(size__)),
-   size_(size__),
    used_offset(0),
-   available_offset(0) {
+   available_offset(0),
+   ring_enabled(false) {
+   allocate(size__);
 }
 buffer::buffer(buffer && src) :
-   ptr(_std::move(src.ptr)),
-   size_(src.size_),
+   block(_std::move(src.block)),
+   ring(_std::move(src.ring)),
    used_offset(src.used_offset),
-   available_offset(src.available_offset) {
-   src.size_ = 0;
+   available_offset(src.available_offset),
+   ring_enabled(src.ring_enabled) {
    src.used_offset = 0;
    src.available_offset = 0;
 }
 
 buffer::~buffer() {
+   release();
 }
 
 buffer & buffer::operator=(buffer && src) {
    LOFTY_TRACE_FUNC(this/*, src*/);
 
-   ptr = _std::move(src.ptr);
-   size_ = src.size_;
-   src.size_ = 0;
+   release();
+   block = _std::move(src.block);
+   ring = _std::move(src.ring);
    used_offset = src.used_offset;
    src.used_offset = 0;
    available_offset = src.available_offset;
    src.available_offset = 0;
+   ring_enabled = src.ring_enabled;
    return *this;
 }
 
+void buffer::allocate(std::size_t new_size) {
+   LOFTY_TRACE_FUNC(this, new_size);
+
+   std::size_t block_size = buffer_pool::block_size(new_size);
+   if (ring_enabled && block_size >= ring_size_min) {
+      if (ring.map(block_size)) {
+         return;
+      }
+      // The OS can’t do it; don’t try again.
+      ring_enabled = false;
+   }
+   block = buffer_pool::instance().acquire(new_size);
+}
+
 void buffer::expand_to(std::size_t new_size) {
    LOFTY_TRACE_FUNC(this, new_size);
 
-   memory::realloc_unique(&ptr, new_size);
-   size_ = new_size;
+   if (buffer_pool::block_size(new_size) != size()) {
+      // Move the used portion to the start of a new buffer.
+      buffer new_buf;
+      new_buf.ring_enabled = ring_enabled;
+      new_buf.allocate(new_size);
+      std::size_t used_size_ = used_size();
+      memory::copy(new_buf.get_base(), get_used(), used_size_);
+      new_buf.available_offset = used_size_;
+      *this = _std::move(new_buf);
+   }
 }
 
 void buffer::make_unused_available() {
    LOFTY_TRACE_FUNC(this);
 
-   memory::move(static_cast<std::int8_t *>(ptr.get()), get_used(), used_size());
-   available_offset -= used_offset;
+   if (!ring.get()) {
+      memory::move(get_base(), get_used(), used_size());
+      available_offset -= used_offset;
+      used_offset = 0;
+   }
+}
+
+void buffer::release() {
+   ring.unmap();
+   buffer_pool::instance().release(&block);
+}
+
+void buffer::reset(std::size_t new_size) {
+   LOFTY_TRACE_FUNC(this, new_size);
+
    used_offset = 0;
+   available_offset = 0;
+   if (!new_size || buffer_pool::block_size(new_size) != size()) {
+      // Release the old memory before getting new memory, so that the two are never held at the same time.
+      release();
+      if (new_size) {
+         allocate(new_size);
+      }
+   }
 }
 
 }}}} //namespace lofty::io::binary::_pvt
@@ -81,8 +211,89 @@ void buffer::make_unused_available() {
 
 namespace lofty { namespace io { namespace binary {
 
-default_buffered_istream::default_buffered_istream(_std::shared_ptr<istream> bin_istream_) :
-   bin_istream(_std::move(bin_istream_)) {
+/*! Validates a buffer sizing policy.
+
+@param sizing
+   Policy to validate.
+*/
+static void validate_sizing(buffer_sizing const & sizing) {
+   LOFTY_TRACE_FUNC(sizing.size_min(), sizing.size_max());
+
+   if (sizing.size_min() == 0 || sizing.size_max() < sizing.size_min()) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+}
+
+/*! Returns the size to give to an empty buffer.
+
+@param sizing
+   Sizing policy for the buffer.
+@param size_target
+   Size the buffer would have if the stream weren’t idle.
+@param idle
+   true if the stream is idle.
+@param count
+   Count of bytes the buffer must be able to hold.
+@return
+   Buffer size, in bytes.
+*/
+static std::size_t empty_buffer_size(
+   buffer_sizing const & sizing, std::size_t size_target, bool idle, std::size_t count
+) {
+   std::size_t size_min = sizing.size_min();
+   std::size_t size = idle ? size_min : size_target;
+   if (count > size) {
+      // Round up to a multiple of size_min.
+      size = (count + size_min - 1) / size_min * size_min;
+   }
+   return size;
+}
+
+/*! Updates the target size of a buffer after a read into it or a flush out of it.
+
+@param sizing
+   Sizing policy for the buffer.
+@param size_target
+   Pointer to the target size of the buffer.
+@param moved_size
+   Count of bytes read or flushed.
+@param capacity
+   Count of bytes that could have been read or flushed.
+@return
+   true if the transfer was short enough to consider the stream idle, or false otherwise.
+*/
+static bool adapt_buffer_size(
+   buffer_sizing const & sizing, std::size_t * size_target, std::size_t moved_size, std::size_t capacity
+) {
+   if (moved_size >= capacity) {
+      // Sustained streaming: double the buffer, so that fewer system calls are needed.
+      *size_target = *size_target < sizing.size_max() / 2 ? *size_target * 2 : sizing.size_max();
+      return false;
+   } else if (moved_size < capacity / 4) {
+      *size_target = *size_target / 2 > sizing.size_min() ? *size_target / 2 : sizing.size_min();
+      return true;
+   } else {
+      return false;
+   }
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+default_buffered_istream::default_buffered_istream(
+   _std::shared_ptr<istream> bin_istream_, buffer_sizing const & sizing_
+) :
+   bin_istream(_std::move(bin_istream_)),
+   sizing(sizing_),
+   buf_size_target(sizing_.size_min()),
+   idle(false) {
+   validate_sizing(sizing);
+   // Large frames trickling in would otherwise keep getting moved to the start of the buffer.
+   read_buf.enable_ring();
 }
 
 /*virtual*/ default_buffered_istream::~default_buffered_istream() {
@@ -98,6 +309,14 @@ default_buffered_istream::default_buffered_istream(_std::shared_ptr<istream> bin
    }
    // Shift the “used window” of the read buffer by count bytes.
    read_buf.mark_as_unused(count);
+   if (idle && !read_buf.used_size()) {
+      // The buffer was emptied after a short read: don’t hold on to more memory than needed while idle.
+      if (sizing.release_when_idle()) {
+         read_buf.reset(0);
+      } else if (read_buf.size() > sizing.size_min()) {
+         read_buf.reset(sizing.size_min());
+      }
+   }
 }
 
 /*virtual*/ _std::tuple<void const *, std::size_t> default_buffered_istream::peek_bytes(
@@ -107,6 +326,29 @@ default_buffered_istream::default_buffered_istream(_std::shared_ptr<istream> bin
 
    while (count > read_buf.used_size()) {
       // The caller wants more data than what’s currently in the buffer: try to load more.
+#if LOFTY_HOST_API_POSIX
+      if (!read_buf.size() && sizing.release_when_idle() && this_thread::coroutine_scheduler()) {
+         if (auto bin_pipe_istream = dynamic_cast<pipe_istream *>(bin_istream.get())) {
+            /* Don’t borrow a buffer until there’s something to read into it, so that streams waiting for data
+            don’t hold on to one. */
+            this_coroutine::sleep_until_fd_ready(bin_pipe_istream->fd.get(), false);
+         }
+      }
+#elif LOFTY_HOST_API_WIN32
+      /* TODO: overlapped reads need their destination buffer up front, so waiting for data before borrowing
+      one would require a zero-byte read. */
+#else
+   #error "TODO: HOST_API"
+#endif
+      if (!read_buf.used_size()) {
+         // The buffer is empty, so it can be resized without copying anything.
+         std::size_t buf_size = empty_buffer_size(sizing, buf_size_target, idle, count);
+         if (buf_size != read_buf.size()) {
+            read_buf.reset(buf_size);
+         } else {
+            read_buf.make_unused_available();
+         }
+      }
       std::size_t read_byte_size_min = count - read_buf.used_size();
       if (read_byte_size_min > read_buf.available_size()) {
          /* The buffer doesn’t have enough available space to hold the data that needs to be read; see if
@@ -115,18 +357,19 @@ default_buffered_istream::default_buffered_istream(_std::shared_ptr<istream> bin
             read_buf.make_unused_available();
          } else {
             // Not enough room; the buffer needs to be enlarged.
-            std::size_t read_buf_size = bitmanip::ceiling_to_pow2_multiple(count, read_buf_default_size);
-            read_buf.expand_to(read_buf_size);
+            read_buf.expand_to(empty_buffer_size(sizing, buf_size_target, false, count));
          }
       }
       // Try to fill the available part of the buffer.
-      std::size_t read_bytes = bin_istream->read(read_buf.get_available(), read_buf.available_size());
+      std::size_t read_size = read_buf.available_size();
+      std::size_t read_bytes = bin_istream->read(read_buf.get_available(), read_size);
       if (read_bytes == 0) {
          // No more data available (EOF).
          break;
       }
       // Account for the additional data read.
       read_buf.mark_as_used(read_bytes);
+      idle = adapt_buffer_size(sizing, &buf_size_target, read_bytes, read_size);
    }
    // Return the “used window” of the buffer.
    return _std::make_tuple(read_buf.get_used(), read_buf.used_size());
@@ -144,10 +387,16 @@ default_buffered_istream::default_buffered_istream(_std::shared_ptr<istream> bin
 
 namespace lofty { namespace io { namespace binary {
 
-default_buffered_ostream::default_buffered_ostream(_std::shared_ptr<ostream> bin_ostream_) :
+default_buffered_ostream::default_buffered_ostream(
+   _std::shared_ptr<ostream> bin_ostream_, buffer_sizing const & sizing_
+) :
    bin_ostream(_std::move(bin_ostream_)),
+   sizing(sizing_),
+   buf_size_target(sizing_.size_min()),
    // Disable buffering for console (interactive) files.
-   flush_after_commit(_std::dynamic_pointer_cast<tty_ostream>(bin_ostream) != nullptr) {
+   flush_after_commit(_std::dynamic_pointer_cast<tty_ostream>(bin_ostream) != nullptr),
+   idle(false) {
+   validate_sizing(sizing);
 }
 
 /*virtual*/ default_buffered_ostream::~default_buffered_ostream() {
@@ -169,7 +418,12 @@ default_buffered_ostream::default_buffered_ostream(_std::shared_ptr<ostream> bin
    }
    // Increase the count of used bytes in the buffer; if that makes the buffer full, flush it.
    write_buf.mark_as_used(count);
-   if (flush_after_commit || !write_buf.available_size()) {
+   if (!write_buf.available_size()) {
+      // Sustained streaming: have the buffer grow the next time it’s empty.
+      std::size_t buf_used_size = write_buf.used_size();
+      idle = adapt_buffer_size(sizing, &buf_size_target, buf_used_size, buf_used_size);
+      flush_buffer();
+   } else if (flush_after_commit) {
       flush_buffer();
    }
 }
@@ -188,6 +442,8 @@ default_buffered_ostream::default_buffered_ostream(_std::shared_ptr<ostream> bin
       bin_ostream->finalize();
       throw;
    }
+   // The buffer won’t be needed anymore.
+   write_buf.reset(0);
    bin_ostream->finalize();
 }
 
@@ -195,7 +451,18 @@ default_buffered_ostream::default_buffered_ostream(_std::shared_ptr<ostream> bin
    LOFTY_TRACE_FUNC(this);
 
    // Flush both the write buffer and any lower-level buffers.
+   if (!flush_after_commit && write_buf.size()) {
+      idle = adapt_buffer_size(sizing, &buf_size_target, write_buf.used_size(), write_buf.size());
+   }
    flush_buffer();
+   if (idle) {
+      // The buffer was mostly unused: don’t hold on to more memory than needed while idle.
+      if (sizing.release_when_idle()) {
+         write_buf.reset(0);
+      } else if (write_buf.size() > sizing.size_min()) {
+         write_buf.reset(sizing.size_min());
+      }
+   }
    bin_ostream->flush();
 }
 
@@ -216,18 +483,19 @@ void default_buffered_ostream::flush_buffer() {
 ) /*override*/ {
    LOFTY_TRACE_FUNC(this, count);
 
-   // If the requested size is more than what can fit in the buffer, compact it, flush it, or enlarge it.
+   // If the requested size is more than what can fit in the buffer, compact it, or flush and resize it.
    if (count > write_buf.available_size()) {
       // See if compacting the buffer would create enough room.
-      if (write_buf.unused_size() + write_buf.available_size() >= count) {
+      if (write_buf.used_size() && write_buf.unused_size() + write_buf.available_size() >= count) {
          write_buf.make_unused_available();
       } else {
-         // If the buffer is still too small, enlarge it.
          flush_buffer();
-         write_buf.make_unused_available();
-         if (count > write_buf.available_size()) {
-            std::size_t write_buf_size = bitmanip::ceiling_to_pow2_multiple(count, write_buf_default_size);
-            write_buf.expand_to(write_buf_size);
+         // The buffer is now empty, so it can be resized without copying anything.
+         std::size_t buf_size = empty_buffer_size(sizing, buf_size_target, idle, count);
+         if (buf_size != write_buf.size()) {
+            write_buf.reset(buf_size);
+         } else {
+            write_buf.make_unused_available();
          }
       }
    }
@@ -235,6 +503,64 @@ void default_buffered_ostream::flush_buffer() {
    return _std::make_tuple(write_buf.get_available(), write_buf.available_size());
 }
 
+/*virtual*/ std::size_t default_buffered_ostream::write(void const * src, std::size_t src_size) /*override*/ {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   const_buffer buf;
+   buf.src = src;
+   buf.src_size = src_size;
+   return write_buffers(&buf, 1);
+}
+
+/*virtual*/ std::size_t default_buffered_ostream::write_buffers(
+   const_buffer const * bufs, std::size_t bufs_count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, bufs, bufs_count);
+
+   std::size_t written_size = 0;
+   while (bufs_count) {
+      // Take as many buffers as can be passed through in one go, and see how many bytes they amount to.
+      std::size_t batch_count = bufs_count < pass_through_bufs_max ? bufs_count : pass_through_bufs_max;
+      std::size_t batch_size = 0;
+      for (std::size_t i = 0; i < batch_count; ++i) {
+         batch_size += bufs[i].src_size;
+      }
+      if (!flush_after_commit && batch_size < pass_through_size_min) {
+         /* Small payloads are cheaper to copy into the write buffer, where they can be coalesced with other
+         writes. */
+         for (std::size_t i = 0; i < batch_count; ++i) {
+            buffered_ostream::write(bufs[i].src, bufs[i].src_size);
+         }
+         written_size += batch_size;
+      } else {
+         /* Hand the pending contents of the write buffer and the caller’s buffers to bin_ostream in a single
+         gather write, so that large payloads are never copied. */
+         const_buffer pass_through_bufs[1 + pass_through_bufs_max];
+         const_buffer * next_buf = pass_through_bufs;
+         std::size_t buf_used_size = write_buf.used_size();
+         if (buf_used_size) {
+            next_buf->src = write_buf.get_used();
+            next_buf->src_size = buf_used_size;
+            ++next_buf;
+         }
+         for (std::size_t i = 0; i < batch_count; ++i, ++next_buf) {
+            *next_buf = bufs[i];
+         }
+         std::size_t batch_written_size = bin_ostream->write_buffers(
+            pass_through_bufs, static_cast<std::size_t>(next_buf - pass_through_bufs)
+         );
+         LOFTY_ASSERT(
+            batch_written_size == buf_used_size + batch_size, LOFTY_SL("all the buffers must have been written")
+         );
+         write_buf.mark_as_unused(buf_used_size);
+         written_size += batch_written_size - buf_used_size;
+      }
+      bufs += batch_count;
+      bufs_count -= batch_count;
+   }
+   return written_size;
+}
+
 /*virtual*/ _std::shared_ptr<stream> default_buffered_ostream::_unbuffered_stream() const /*override*/ {
    LOFTY_TRACE_FUNC(this);
 
@@ -27,8 +27,81 @@ You should have received a copy of the GNU Lesser General Public License along w
 #endif
 
 #include <lofty/io/binary.hxx>
+#include <lofty/io/binary/buffer_pool.hxx>
 
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace _pvt {
+
+/*! Memory block mapped twice in a row, so that the byte after its last one is its first one again: data that
+wraps around the end of the block can be accessed as a single contiguous range of up to size() bytes. */
+class LOFTY_SYM ring_pages : public noncopyable {
+public:
+   //! Default constructor.
+   ring_pages() :
+      ptr(nullptr),
+      size_(0) {
+   }
+
+   /*! Move constructor.
+
+   @param src
+      Source object.
+   */
+   ring_pages(ring_pages && src);
+
+   //! Destructor.
+   ~ring_pages();
+
+   /*! Move-assignment operator.
+
+   @param src
+      Source object.
+   @return
+      *this.
+   */
+   ring_pages & operator=(ring_pages && src);
+
+   /*! Returns the raw pointer.
+
+   @return
+      Pointer to the start of the first mapping of the memory block.
+   */
+   void * get() const {
+      return ptr;
+   }
+
+   /*! Maps a new memory block, releasing the current one (if any).
+
+   @param size
+      Size of the block, in bytes; must be a multiple of the memory page size.
+   @return
+      true if the block was mapped, or false if the OS can’t map memory twice.
+   */
+   bool map(std::size_t size);
+
+   /*! Returns the size of the memory block, which is half the size of the mapped address range.
+
+   @return
+      Size of the memory block, in bytes.
+   */
+   std::size_t size() const {
+      return size_;
+   }
+
+   //! Unmaps the memory block, if any.
+   void unmap();
+
+private:
+   //! Pointer to the first mapping of the memory block.
+   void * ptr;
+   //! Size of the memory block, in bytes.
+   std::size_t size_;
+};
+
+}}}} //namespace lofty::io::binary::_pvt
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace lofty { namespace io { namespace binary { namespace _pvt {
@@ -94,14 +167,28 @@ And more bytes are read into the buffer, repeating the cycle.
    │used                  │available      │ 0 = used_offset < available_offset < size
    └──────────────────────┴───────────────┘
    @endverbatim
+
+If enable_ring() was called, buffers of at least ring_size_min bytes are instead backed by ring_pages, and the
+unused portion is never moved: since the memory following the end of the buffer is its beginning again, the
+available portion extends past the end, and wraps around to end where the used portion begins:
+   @verbatim
+   ┌────────┬─────────┬───────────────────┬────────┐
+   │avail.  │used     │available          │(avail.)│ 0 ≤ used_offset < size, available_offset ≤
+   └────────┴─────────┴───────────────────┴────────┘ used_offset + size
+   @endverbatim
+In this mode, unused_size() is always 0, and make_unused_available() has nothing to do.
 */
 class LOFTY_SYM buffer : public noncopyable {
+public:
+   //! Minimum buffer size for which ring_pages will be used, if enabled.
+   static std::size_t const ring_size_min = 0x10000;
+
 public:
    //! Default constructor.
    buffer() :
-      size_(0),
       used_offset(0),
-      available_offset(0) {
+      available_offset(0),
+      ring_enabled(false) {
    }
 
    /*! Move constructor.
@@ -118,7 +205,7 @@ public:
    */
    buffer(std::size_t size);
 
-   //! Destructor.
+   //! Destructor. Returns the memory to the buffer pool.
    ~buffer();
 
    /*! Move-assignment operator.
@@ -136,7 +223,13 @@ public:
       Size of available buffer space, in bytes.
    */
    std::size_t available_size() const {
-      return size_ - available_offset;
+      return ring.get() ? used_offset + ring.size() - available_offset : block.size() - available_offset;
+   }
+
+   /*! Allows the buffer to use ring_pages once it grows to ring_size_min bytes or more, so that it never
+   needs to be compacted. */
+   void enable_ring() {
+      ring_enabled = true;
    }
 
    /*! Increases the size of the buffer.
@@ -152,7 +245,7 @@ public:
       Pointer to the available portion of the buffer.
    */
    std::int8_t * get_available() const {
-      return static_cast<std::int8_t *>(ptr.get()) + available_offset;
+      return get_base() + available_offset;
    }
 
    /*! Returns a pointer to the used portion of the buffer.
@@ -161,13 +254,20 @@ public:
       Pointer to the used portion of the buffer.
    */
    std::int8_t * get_used() const {
-      return static_cast<std::int8_t *>(ptr.get()) + used_offset;
+      return get_base() + used_offset;
    }
 
    /*! Shifts the used portion of the buffer to completely obliterate the unused portion, resulting in an
    increase in available space. */
    void make_unused_available();
 
+   /*! Discards the contents of the buffer, replacing its memory with a block of a different size if needed.
+
+   @param new_size
+      New size of the buffer, in bytes. If 0, the memory will be returned to the buffer pool.
+   */
+   void reset(std::size_t new_size);
+
    /*! Increases the unused bytes count, reducing the used bytes count.
 
    @param unused_size
@@ -175,6 +275,11 @@ public:
    */
    void mark_as_unused(std::size_t unused_size_) {
       used_offset += unused_size_;
+      if (ring.get() && used_offset >= ring.size()) {
+         // Move back to the first mapping of the ring.
+         used_offset -= ring.size();
+         available_offset -= ring.size();
+      }
    }
 
    /*! Increases the used bytes count, reducing the available bytes count.
@@ -186,13 +291,14 @@ public:
       available_offset += used_size_;
    }
 
-   /*! Returns the size of the buffer.
+   /*! Returns the size of the buffer. This may be larger than requested, since the memory comes from a size
+   class of buffer_pool.
 
    @return
       Size of the buffer space, in bytes.
    */
    std::size_t size() const {
-      return size_;
+      return ring.get() ? ring.size() : block.size();
    }
 
    /*! Returns the amount of used buffer space.
@@ -210,19 +316,41 @@ public:
       Size of the unused buffer space, in bytes.
    */
    std::size_t unused_size() const {
-      return used_offset;
+      return ring.get() ? 0 : used_offset;
    }
 
 private:
-   //! Pointer to the allocated memory block.
-   _std::unique_ptr<void, memory::freeing_deleter> ptr;
-   //! Size of *ptr.
-   std::size_t size_;
+   /*! Replaces the memory of the buffer with a new block, without changing the offsets.
+
+   @param new_size
+      Size of the new block, in bytes; must be greater than 0.
+   */
+   void allocate(std::size_t new_size);
+
+   /*! Returns a pointer to the start of the memory.
+
+   @return
+      Pointer to the start of the buffer.
+   */
+   std::int8_t * get_base() const {
+      return static_cast<std::int8_t *>(ring.get() ? ring.get() : block.get());
+   }
+
+   //! Releases the memory of the buffer.
+   void release();
+
+private:
+   //! Memory block, borrowed from buffer_pool::instance(). Not used if ring is.
+   memory::pages_ptr block;
+   //! Doubly-mapped memory block, used instead of block for large buffers if ring_enabled is true.
+   ring_pages ring;
    /*! Offset of the used portion of the buffer. Only bytes following the used portion are reported as
    available. */
    std::size_t used_offset;
    //! Count of used bytes.
    std::size_t available_offset;
+   //! If true, ring can be used.
+   bool ring_enabled;
 };
 
 }}}} //namespace lofty::io::binary::_pvt
@@ -238,8 +366,12 @@ public:
 
    @param bin_istream
       Pointer to a buffered istream to wrap.
+   @param sizing
+      Sizing policy for the read buffer.
    */
-   default_buffered_istream(_std::shared_ptr<istream> bin_istream);
+   default_buffered_istream(
+      _std::shared_ptr<istream> bin_istream, buffer_sizing const & sizing = buffer_sizing()
+   );
 
    //! Destructor.
    virtual ~default_buffered_istream();
@@ -259,9 +391,12 @@ protected:
    _std::shared_ptr<istream> bin_istream;
    //! Main read buffer.
    _pvt::buffer read_buf;
-   //! Default/increment size of read_buf.
-   // TODO: tune this value.
-   static std::size_t const read_buf_default_size = 0x1000;
+   //! Sizing policy for read_buf.
+   buffer_sizing sizing;
+   //! Size read_buf will be given the next time it’s reallocated, unless the stream is idle.
+   std::size_t buf_size_target;
+   //! If true, the last read from bin_istream filled less than a quarter of the space it was offered.
+   bool idle:1;
 };
 
 }}} //namespace lofty::io::binary
@@ -277,8 +412,12 @@ public:
 
    @param bin_ostream
       Pointer to a buffered output stream to wrap.
+   @param sizing
+      Sizing policy for the write buffer.
    */
-   default_buffered_ostream(_std::shared_ptr<ostream> bin_ostream);
+   default_buffered_ostream(
+      _std::shared_ptr<ostream> bin_ostream, buffer_sizing const & sizing = buffer_sizing()
+   );
 
    //! Destructor.
    virtual ~default_buffered_ostream();
@@ -292,13 +431,21 @@ public:
    //! See buffered_ostream::flush().
    virtual void flush() override;
 
+   /*! Writes the contents of the internal write buffer to the wrapped stream, without flushing the latter
+   (which, for regular files, would also wait for the data to reach the storage). */
+   void flush_buffer();
+
    //! See buffered_ostream::get_buffer_bytes().
    virtual _std::tuple<void *, std::size_t> get_buffer_bytes(std::size_t count) override;
 
-protected:
-   //! Flushes the internal write buffer.
-   void flush_buffer();
+   /*! See buffered_ostream::write(). Payloads of at least pass_through_size_min bytes are passed straight
+   through to the wrapped stream, together with any pending buffered bytes, instead of being copied. */
+   virtual std::size_t write(void const * src, std::size_t src_size) override;
 
+   //! See buffered_ostream::write_buffers().
+   virtual std::size_t write_buffers(const_buffer const * bufs, std::size_t bufs_count) override;
+
+protected:
    //! See buffered_ostream::_unbuffered_stream().
    virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
 
@@ -307,11 +454,20 @@ protected:
    _std::shared_ptr<ostream> bin_ostream;
    //! Write buffer.
    _pvt::buffer write_buf;
+   //! Sizing policy for write_buf.
+   buffer_sizing sizing;
+   //! Size write_buf will be given the next time it’s reallocated, unless the stream is idle.
+   std::size_t buf_size_target;
    //! If true, every commit_bytes() call will flush the buffer.
    bool flush_after_commit:1;
-   //! Default/increment size of write_buf.
+   //! If true, the last explicit flush found the buffer less than a quarter full.
+   bool idle:1;
+   /*! Minimum size of a write() or write_buffers() payload for it to be passed straight through to
+   bin_ostream instead of being copied into write_buf. */
    // TODO: tune this value.
-   static std::size_t const write_buf_default_size = 0x1000;
+   static std::size_t const pass_through_size_min = 0x1000;
+   //! Maximum count of caller buffers that write_buffers() will pass through to bin_ostream in one call.
+   static std::size_t const pass_through_bufs_max = 15;
 };
 
 }}} //namespace lofty::io::binary
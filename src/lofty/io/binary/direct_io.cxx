@@ -0,0 +1,369 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/io/binary/buffer_pool.hxx>
+#include <lofty/numeric.hxx>
+#include "direct_io.hxx"
+
+#include <algorithm> // std::min()
+#include <cstring> // std::memcpy() std::memmove() std::memset()
+
+#if LOFTY_HOST_API_POSIX
+   #include <errno.h> // EINTR EINVAL errno
+   #include <sys/stat.h> // stat fstat()
+   #include <unistd.h> // ftruncate() pread() pwrite()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace _pvt {
+
+std::size_t const direct_io::chunk_size;
+
+direct_io::direct_io(filedesc_t fd_) :
+   fd(fd_),
+   align(memory::page_size()),
+   offset(0),
+   state(chunk_state::empty),
+   chunk_offset(0),
+   chunk_used(0),
+   last_fill_end(-1),
+   ahead_offset(0),
+   ahead_size(0),
+   ahead_err(0) {
+}
+
+direct_io::~direct_io() {
+   discard();
+   auto & pool = buffer_pool::instance();
+   pool.release(&chunks[0]);
+   pool.release(&chunks[1]);
+}
+
+void direct_io::discard() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (ahead_job) {
+      blocking_offload::instance().abandon(ahead_job);
+      ahead_job.reset();
+   }
+   state = chunk_state::empty;
+}
+
+bool direct_io::fill_chunk() {
+   LOFTY_TRACE_FUNC(this);
+
+   offset_t fill_offset = offset & ~static_cast<offset_t>(align - 1);
+   std::size_t fill_size;
+   if (ahead_job && ahead_offset == fill_offset) {
+      wait_read_ahead();
+      memory::pages_ptr tmp(_std::move(chunks[0]));
+      chunks[0] = _std::move(chunks[1]);
+      chunks[1] = _std::move(tmp);
+      fill_size = static_cast<std::size_t>(ahead_size);
+   } else {
+      if (ahead_job) {
+         // The caller went somewhere else.
+         blocking_offload::instance().abandon(ahead_job);
+         ahead_job.reset();
+      }
+      if (!chunks[0].get()) {
+         chunks[0] = buffer_pool::instance().acquire(chunk_size);
+      }
+      // Until the read completes, chunks[0] holds nothing.
+      state = chunk_state::empty;
+      fill_size = pread(chunks[0].get(), chunk_size, fill_offset);
+   }
+   bool sequential = (fill_offset == last_fill_end);
+   last_fill_end = fill_offset + static_cast<offset_t>(fill_size);
+   chunk_offset = fill_offset;
+   chunk_used = fill_size;
+   state = chunk_state::reading;
+   if (sequential && fill_size == chunk_size) {
+      if (!chunks[1].get()) {
+         chunks[1] = buffer_pool::instance().acquire(chunk_size);
+      }
+      ahead_offset = last_fill_end;
+      void * ahead_dst = chunks[1].get();
+      ahead_job = blocking_offload::instance().start([this, ahead_dst] () {
+         while ((ahead_size = ::pread(fd, ahead_dst, chunk_size, ahead_offset)) < 0 && errno == EINTR) {
+         }
+         ahead_err = errno;
+      });
+   }
+   return offset < last_fill_end;
+}
+
+void direct_io::flush() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (state != chunk_state::writing) {
+      return;
+   }
+   std::int8_t * chunk_bytes = static_cast<std::int8_t *>(chunks[0].get());
+   std::size_t aligned_size = chunk_used & ~(align - 1), tail_size = chunk_used - aligned_size;
+   if (aligned_size) {
+      pwrite(chunk_bytes, aligned_size, chunk_offset);
+   }
+   if (tail_size) {
+      write_partial_block(
+         chunk_bytes + aligned_size, tail_size, chunk_offset + static_cast<offset_t>(aligned_size)
+      );
+      // Keep the tail, so that more writes can complete its block and write it again.
+      if (aligned_size) {
+         std::memmove(chunk_bytes, chunk_bytes + aligned_size, tail_size);
+         chunk_offset += static_cast<offset_t>(aligned_size);
+         chunk_used = tail_size;
+      }
+   } else {
+      state = chunk_state::empty;
+   }
+}
+
+full_size_t direct_io::pending_end() const {
+   if (state == chunk_state::writing) {
+      return static_cast<full_size_t>(chunk_offset) + chunk_used;
+   } else {
+      return 0;
+   }
+}
+
+std::size_t direct_io::pread(void * dst, std::size_t dst_size, offset_t at) {
+   LOFTY_TRACE_FUNC(this, dst, dst_size, at);
+
+   ::ssize_t bytes_read;
+   int err;
+   blocking_offload::instance().run([this, dst, dst_size, at, &bytes_read, &err] () {
+      while ((bytes_read = ::pread(fd, dst, dst_size, at)) < 0 && errno == EINTR) {
+      }
+      err = errno;
+   });
+   this_coroutine::interruption_point();
+   if (bytes_read < 0) {
+      exception::throw_os_error(err);
+   }
+   return static_cast<std::size_t>(bytes_read);
+}
+
+void direct_io::pwrite(void const * src, std::size_t src_size, offset_t at) {
+   LOFTY_TRACE_FUNC(this, src, src_size, at);
+
+   int err = 0;
+   blocking_offload::instance().run([this, src, src_size, at, &err] () mutable {
+      while (src_size) {
+         ::ssize_t bytes_written = ::pwrite(fd, src, src_size, at);
+         if (bytes_written >= 0) {
+            src = static_cast<std::int8_t const *>(src) + bytes_written;
+            src_size -= static_cast<std::size_t>(bytes_written);
+            at += bytes_written;
+         } else if (errno != EINTR) {
+            err = errno;
+            break;
+         }
+      }
+   });
+   this_coroutine::interruption_point();
+   if (err != 0) {
+      exception::throw_os_error(err);
+   }
+}
+
+std::size_t direct_io::read(void * dst, std::size_t dst_max) {
+   LOFTY_TRACE_FUNC(this, dst, dst_max);
+
+   if (state == chunk_state::writing) {
+      flush();
+      state = chunk_state::empty;
+   }
+   if (dst_max == 0) {
+      return 0;
+   }
+   if (
+      state != chunk_state::reading || offset < chunk_offset ||
+      offset >= chunk_offset + static_cast<offset_t>(chunk_used)
+   ) {
+      if (
+         !ahead_job && dst_max >= align && (offset & static_cast<offset_t>(align - 1)) == 0 &&
+         (reinterpret_cast<std::uintptr_t>(dst) & (align - 1)) == 0
+      ) {
+         // The caller’s buffer is good for O_DIRECT, so skip chunks[0].
+         std::size_t dst_size = std::min<std::size_t>(dst_max, numeric::max< ::ssize_t>::value);
+         std::size_t bytes_read = pread(dst, dst_size & ~(align - 1), offset);
+         offset += static_cast<offset_t>(bytes_read);
+         last_fill_end = offset;
+         return bytes_read;
+      }
+      if (!fill_chunk()) {
+         return 0;
+      }
+   }
+   std::size_t chunk_begin = static_cast<std::size_t>(offset - chunk_offset);
+   std::size_t bytes_read = std::min(dst_max, chunk_used - chunk_begin);
+   std::memcpy(dst, static_cast<std::int8_t *>(chunks[0].get()) + chunk_begin, bytes_read);
+   offset += static_cast<offset_t>(bytes_read);
+   return bytes_read;
+}
+
+offset_t direct_io::seek(offset_t offset_, seek_from whence) {
+   LOFTY_TRACE_FUNC(this, offset_, whence);
+
+   // Any read chunk and read-ahead are kept, in case the new offset falls within them.
+   flush();
+   if (state == chunk_state::writing) {
+      state = chunk_state::empty;
+   }
+   offset_t new_offset;
+   switch (whence.base()) {
+      case seek_from::start:
+         new_offset = offset_;
+         break;
+      case seek_from::current:
+         new_offset = offset + offset_;
+         break;
+      case seek_from::end: {
+         struct ::stat stat;
+         if (::fstat(fd, &stat)) {
+            exception::throw_os_error();
+         }
+         new_offset = static_cast<offset_t>(stat.st_size) + offset_;
+         break;
+      }
+      LOFTY_SWITCH_WITHOUT_DEFAULT
+   }
+   if (new_offset < 0) {
+      exception::throw_os_error(EINVAL);
+   }
+   offset = new_offset;
+   return offset;
+}
+
+void direct_io::wait_read_ahead() {
+   LOFTY_TRACE_FUNC(this);
+
+   // If interrupted, wait() will have abandoned the job, so ahead_job must be cleared in any case.
+   _std::shared_ptr<blocking_offload::job> job(_std::move(ahead_job));
+   blocking_offload::instance().wait(job);
+   this_coroutine::interruption_point();
+   if (ahead_size < 0) {
+      exception::throw_os_error(ahead_err);
+   }
+}
+
+void direct_io::write_partial_block(std::int8_t * block, std::size_t used, offset_t at) {
+   LOFTY_TRACE_FUNC(this, block, used, at);
+
+   struct ::stat stat;
+   if (::fstat(fd, &stat)) {
+      exception::throw_os_error();
+   }
+   offset_t file_size = static_cast<offset_t>(stat.st_size), used_end = at + static_cast<offset_t>(used);
+   std::size_t kept_size = 0;
+   if (file_size > used_end) {
+      /* The block continues with bytes already in the file, which must be preserved. No read-ahead can be in
+      progress while writing, so chunks[1] is free to receive them. */
+      if (!chunks[1].get()) {
+         chunks[1] = buffer_pool::instance().acquire(chunk_size);
+      }
+      std::size_t block_size = pread(chunks[1].get(), align, at);
+      if (block_size > used) {
+         kept_size = block_size - used;
+         std::memcpy(block + used, static_cast<std::int8_t *>(chunks[1].get()) + used, kept_size);
+      }
+   }
+   std::memset(block + used + kept_size, 0, align - used - kept_size);
+   pwrite(block, align, at);
+   // Trim any zeroes that the padding added past the end of the file.
+   offset_t new_file_size = std::max(file_size, used_end);
+   if (new_file_size < at + static_cast<offset_t>(align)) {
+      int err = 0;
+      blocking_offload::instance().run([this, new_file_size, &err] () {
+         while (::ftruncate(fd, static_cast< ::off_t>(new_file_size)) < 0) {
+            if (errno != EINTR) {
+               err = errno;
+               break;
+            }
+         }
+      });
+      this_coroutine::interruption_point();
+      if (err != 0) {
+         exception::throw_os_error(err);
+      }
+   }
+}
+
+std::size_t direct_io::write(void const * src, std::size_t src_size) {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   if (state == chunk_state::reading) {
+      discard();
+   }
+   std::int8_t const * src_bytes = static_cast<std::int8_t const *>(src);
+   std::size_t written_size = 0;
+   while (src_size) {
+      if (state != chunk_state::writing) {
+         if (
+            src_size >= align && (offset & static_cast<offset_t>(align - 1)) == 0 &&
+            (reinterpret_cast<std::uintptr_t>(src_bytes) & (align - 1)) == 0
+         ) {
+            // The caller’s buffer is good for O_DIRECT, so skip chunks[0].
+            std::size_t bytes_to_write = std::min<std::size_t>(src_size, numeric::max< ::ssize_t>::value);
+            bytes_to_write &= ~(align - 1);
+            pwrite(src_bytes, bytes_to_write, offset);
+            src_bytes += bytes_to_write;
+            src_size -= bytes_to_write;
+            written_size += bytes_to_write;
+            offset += static_cast<offset_t>(bytes_to_write);
+            continue;
+         }
+         if (!chunks[0].get()) {
+            chunks[0] = buffer_pool::instance().acquire(chunk_size);
+         }
+         chunk_offset = offset & ~static_cast<offset_t>(align - 1);
+         chunk_used = static_cast<std::size_t>(offset - chunk_offset);
+         if (chunk_used) {
+            /* Writing back the block containing offset will also write the bytes that precede it, so they
+            must be read first; any past EOF are zeroes. */
+            std::size_t head_size = pread(chunks[0].get(), align, chunk_offset);
+            if (head_size < chunk_used) {
+               std::memset(
+                  static_cast<std::int8_t *>(chunks[0].get()) + head_size, 0, chunk_used - head_size
+               );
+            }
+         }
+         state = chunk_state::writing;
+      }
+      std::size_t copy_size = std::min(src_size, chunk_size - chunk_used);
+      std::memcpy(static_cast<std::int8_t *>(chunks[0].get()) + chunk_used, src_bytes, copy_size);
+      src_bytes += copy_size;
+      src_size -= copy_size;
+      written_size += copy_size;
+      chunk_used += copy_size;
+      offset += static_cast<offset_t>(copy_size);
+      if (chunk_used == chunk_size) {
+         pwrite(chunks[0].get(), chunk_size, chunk_offset);
+         state = chunk_state::empty;
+      }
+   }
+   return written_size;
+}
+
+}}}} //namespace lofty::io::binary::_pvt
+
+#endif //if LOFTY_HOST_API_POSIX
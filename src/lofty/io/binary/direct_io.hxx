@@ -0,0 +1,213 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_DIRECT_IO_HXX
+#define _LOFTY_IO_BINARY_DIRECT_IO_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/io/binary.hxx>
+#include "blocking_offload.hxx"
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace io { namespace binary { namespace _pvt {
+
+/*! Staging buffers for a regular file opened with O_DIRECT, which only accepts transfers whose memory
+address, size and file offset are all multiples of the device’s block size.
+
+Data is moved between the file and page-aligned chunks borrowed from buffer_pool, using ::pread() and
+::pwrite() at offsets tracked here; transfers that happen to be aligned skip the chunk and go straight to the
+caller’s buffer. An unaligned head is handled by reading the block it belongs to before writing over it, and
+an unaligned tail by padding it to a whole block with the bytes that follow it in the file, then trimming the
+file back to its size.
+
+Once two consecutive chunks have been read sequentially, the next one is read ahead into a second chunk on a
+blocking_offload worker, so the device stays busy while the caller consumes the current chunk. */
+class direct_io : public noncopyable {
+public:
+   //! Size of each staging chunk; it’s also the size of each transfer to or from the file.
+   static std::size_t const chunk_size = 0x100000;
+
+public:
+   /*! Constructor.
+
+   @param fd
+      File descriptor, opened with O_DIRECT.
+   */
+   explicit direct_io(filedesc_t fd);
+
+   //! Destructor. Pending writes are discarded; flush() must be called before.
+   ~direct_io();
+
+   /*! Waits for any read-ahead and drops the buffered data, without ever throwing. Must be called before the
+   file descriptor is closed. */
+   void discard();
+
+   //! Writes any pending bytes to the file, including an unaligned tail.
+   void flush();
+
+   /*! Returns the offset one past the last byte written, counting bytes not yet flushed to the file.
+
+   @return
+      End of the pending writes, or 0 if there are none.
+   */
+   full_size_t pending_end() const;
+
+   /*! See istream::read().
+
+   @param dst
+      Pointer to the destination buffer.
+   @param dst_max
+      Size of the destination buffer, in bytes.
+   @return
+      Count of bytes read, or 0 on EOF.
+   */
+   std::size_t read(void * dst, std::size_t dst_max);
+
+   /*! Changes the logical offset of the stream, flushing pending writes first.
+
+   @param offset
+      New offset, relative to whence.
+   @param whence
+      Position offset is relative to.
+   @return
+      Resulting offset from the start of the file.
+   */
+   offset_t seek(offset_t offset, seek_from whence);
+
+   /*! Returns the logical offset of the stream.
+
+   @return
+      Offset from the start of the file.
+   */
+   offset_t tell() const {
+      return offset;
+   }
+
+   /*! See ostream::write().
+
+   @param src
+      Pointer to the source buffer.
+   @param src_size
+      Size of the source buffer, in bytes.
+   @return
+      Count of bytes written.
+   */
+   std::size_t write(void const * src, std::size_t src_size);
+
+private:
+   //! What the chunk currently holds.
+   LOFTY_ENUM_AUTO_VALUES(chunk_state,
+      empty,    //! No data.
+      reading,  //! Bytes read from the file.
+      writing   //! Bytes to be written to the file.
+   );
+
+private:
+   /*! Reads a chunk of the file, starting at the block containing offset. Starts a read-ahead if the access
+   is sequential.
+
+   @return
+      true if any bytes at offset or after it were read, or false on EOF.
+   */
+   bool fill_chunk();
+
+   /*! Reads from the file on a blocking_offload worker, suspending the calling coroutine.
+
+   @param dst
+      Pointer to the destination buffer; must be aligned.
+   @param dst_size
+      Size of the destination buffer, in bytes; must be a multiple of align.
+   @param at
+      File offset to read from; must be aligned.
+   @return
+      Count of bytes read.
+   */
+   std::size_t pread(void * dst, std::size_t dst_size, offset_t at);
+
+   /*! Writes to the file on a blocking_offload worker, suspending the calling coroutine.
+
+   @param src
+      Pointer to the source buffer.
+   @param src_size
+      Size of the source buffer, in bytes.
+   @param at
+      File offset to write at.
+   */
+   void pwrite(void const * src, std::size_t src_size, offset_t at);
+
+   //! Waits for a pending read-ahead and stores its result in ahead_size.
+   void wait_read_ahead();
+
+   /*! Writes a block only partially filled with new data. O_DIRECT only accepts whole blocks, and turning it
+   off on the file descriptor would affect read-aheads and dup’d descriptors sharing its flags, so the block
+   is padded with the bytes that follow the data in the file, or zeroes past the end of the file; if the
+   padding made the file longer, it’s then truncated back.
+
+   @param block
+      Pointer to the block; must be aligned and have room for align bytes.
+   @param used
+      Count of bytes of new data at the start of the block.
+   @param at
+      File offset of the block; must be aligned.
+   */
+   void write_partial_block(std::int8_t * block, std::size_t used, offset_t at);
+
+private:
+   //! File descriptor.
+   filedesc_t fd;
+   //! Alignment required for addresses, sizes and offsets of every transfer.
+   std::size_t align;
+   //! Logical offset of the stream.
+   offset_t offset;
+   //! Current chunk, followed by the one used for read-ahead.
+   memory::pages_ptr chunks[2];
+   //! What chunks[0] holds.
+   chunk_state state;
+   //! File offset of the first byte in chunks[0].
+   offset_t chunk_offset;
+   //! Count of valid bytes in chunks[0].
+   std::size_t chunk_used;
+   //! File offset one past the last byte read by the previous fill_chunk(); used to detect sequential reads.
+   offset_t last_fill_end;
+   //! Read-ahead in progress into chunks[1], if any.
+   _std::shared_ptr<blocking_offload::job> ahead_job;
+   //! File offset of the read-ahead.
+   offset_t ahead_offset;
+   //! Count of bytes read ahead, set once ahead_job completes.
+   ::ssize_t ahead_size;
+   //! errno from the read-ahead, if ahead_size < 0.
+   int ahead_err;
+};
+
+}}}} //namespace lofty::io::binary::_pvt
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_DIRECT_IO_HXX
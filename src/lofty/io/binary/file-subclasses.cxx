@@ -23,16 +23,19 @@ You should have received a copy of the GNU Lesser General Public License along w
 #include <lofty/text.hxx>
 #include <lofty/thread.hxx>
 #include "_pvt/file_init_data.hxx"
+#include "blocking_offload.hxx"
 #include "file-subclasses.hxx"
 
-#if LOFTY_HOST_API_WIN32
-   #include <algorithm> // std::min()
-#endif
+#include <algorithm> // std::max() std::min()
 #include <climits> // CHAR_BIT
 
 #if LOFTY_HOST_API_POSIX
+   #include <errno.h> // EINTR errno
+   #include <fcntl.h> // F_* FALLOC_* O_DIRECT fallocate() fcntl()
+   #include <limits.h> // IOV_MAX
    #include <sys/stat.h> // stat fstat()
-   #include <unistd.h> // lseek()
+   #include <sys/uio.h> // iovec preadv2() writev()
+   #include <unistd.h> // fdatasync() fsync() lseek() read() write()
 #endif
 
 
@@ -395,24 +398,29 @@ namespace lofty { namespace io { namespace binary {
 
 regular_file_stream::regular_file_stream(_pvt::file_init_data * init_data) :
    file_stream(init_data) {
-#if 0
    LOFTY_TRACE_FUNC(this, init_data);
 
 #if LOFTY_HOST_API_POSIX
+   #ifdef O_DIRECT
    if (init_data->bypass_cache) {
-      // For unbuffered access, use the filesystem-suggested I/O size increment.
-      physical_align = static_cast<unsigned>(init_data->stat.st_blksize);
+      if (init_data->mode == access_mode::write_append) {
+         /* Appends go wherever the file ends, which is unlikely to be aligned as O_DIRECT requires, so let
+         them go through the cache. */
+         int flags = ::fcntl(fd.get(), F_GETFL);
+         if (flags < 0 || ::fcntl(fd.get(), F_SETFL, flags & ~O_DIRECT) < 0) {
+            exception::throw_os_error();
+         }
+      } else {
+         direct.reset(new _pvt::direct_io(fd.get()));
+      }
    }
+   #endif
 #elif LOFTY_HOST_API_WIN32
-   if (init_data->bypass_cache) {
-      /* Should really use ::DeviceIoCtl(IOCTL_STORAGE_QUERY_PROPERTY) on the disk containing this file. For
-      now, use 4 KiB alignment, since that’s the most recent commonly used physical sector size. */
-      physical_align = 4096;
-   }
+   /* TODO: FILE_FLAG_NO_BUFFERING has the same alignment requirements as O_DIRECT, and needs the equivalent
+   of _pvt::direct_io. */
 #else
    #error "TODO: HOST_API"
 #endif
-#endif
 }
 
 /*virtual*/ regular_file_stream::~regular_file_stream() {
@@ -422,6 +430,9 @@ regular_file_stream::regular_file_stream(_pvt::file_init_data * init_data) :
    LOFTY_TRACE_FUNC(this, offset, whence);
 
 #if LOFTY_HOST_API_POSIX
+   if (direct) {
+      return direct->seek(offset, whence);
+   }
 
    int whence_i;
    switch (whence.base()) {
@@ -488,7 +499,12 @@ regular_file_stream::regular_file_stream(_pvt::file_init_data * init_data) :
    if (::fstat(fd.get(), &stat)) {
       exception::throw_os_error();
    }
-   return static_cast<full_size_t>(stat.st_size);
+   full_size_t size = static_cast<full_size_t>(stat.st_size);
+   if (direct) {
+      // Writes still staged may extend the file.
+      size = std::max(size, direct->pending_end());
+   }
+   return size;
 #elif LOFTY_HOST_API_WIN32
    #if _WIN32_WINNT >= 0x0500
       ::LARGE_INTEGER file_size;
@@ -514,6 +530,11 @@ regular_file_stream::regular_file_stream(_pvt::file_init_data * init_data) :
 /*virtual*/ offset_t regular_file_stream::tell() const /*override*/ {
    LOFTY_TRACE_FUNC(this);
 
+#if LOFTY_HOST_API_POSIX
+   if (direct) {
+      return direct->tell();
+   }
+#endif
 #if LOFTY_HOST_API_POSIX || LOFTY_HOST_API_WIN32
    /* Seeking 0 bytes from the current position won’t change the internal status of the file descriptor, so
    casting the const-ness away is not semantically wrong. */
@@ -533,11 +554,71 @@ regular_file_istream::regular_file_istream(_pvt::file_init_data * init_data) :
    file_stream(init_data),
    regular_file_stream(init_data),
    file_istream(init_data) {
+#if LOFTY_HOST_API_POSIX
+   try_nowait = true;
+#endif
 }
 
 /*virtual*/ regular_file_istream::~regular_file_istream() {
+#if LOFTY_HOST_API_POSIX
+   // The file will be closed by file_istream, so any read-ahead must end first.
+   if (direct) {
+      direct->discard();
+   }
+#endif
 }
 
+#if LOFTY_HOST_API_POSIX
+/*virtual*/ std::size_t regular_file_istream::read(void * dst, std::size_t dst_max) /*override*/ {
+   LOFTY_TRACE_FUNC(this, dst, dst_max);
+
+   if (direct) {
+      return direct->read(dst, dst_max);
+   }
+   if (!_pvt::blocking_offload::enabled()) {
+      return file_istream::read(dst, dst_max);
+   }
+   std::size_t bytes_to_read = std::min<std::size_t>(dst_max, numeric::max< ::ssize_t>::value);
+   ::ssize_t bytes_read;
+   int err;
+   #ifdef RWF_NOWAIT
+   if (try_nowait) {
+      /* Data already in the page cache can be read without blocking, which is much cheaper than a round trip
+      to a worker thread. An offset of -1 makes ::preadv2() use and update the file offset, like ::read(). */
+      ::iovec iov;
+      iov.iov_base = dst;
+      iov.iov_len = bytes_to_read;
+      while ((bytes_read = ::preadv2(fd.get(), &iov, 1, -1, RWF_NOWAIT)) < 0 && (err = errno) == EINTR) {
+         this_coroutine::interruption_point();
+      }
+      if (bytes_read >= 0) {
+         this_coroutine::interruption_point();
+         return static_cast<std::size_t>(bytes_read);
+      }
+      if (err != EAGAIN) {
+         // Anything other than “would block” means RWF_NOWAIT is not supported for this file.
+         try_nowait = false;
+      }
+   }
+   #endif
+   // This may repeat in case of EINTR.
+   for (;;) {
+      _pvt::blocking_offload::instance().run([this, dst, bytes_to_read, &bytes_read, &err] () {
+         bytes_read = ::read(fd.get(), dst, bytes_to_read);
+         err = errno;
+      });
+      if (bytes_read >= 0) {
+         this_coroutine::interruption_point();
+         return static_cast<std::size_t>(bytes_read);
+      }
+      if (err != EINTR) {
+         exception::throw_os_error(err);
+      }
+      this_coroutine::interruption_point();
+   }
+}
+#endif
+
 }}} //namespace lofty::io::binary
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -558,7 +639,213 @@ regular_file_ostream::regular_file_ostream(_pvt::file_init_data * init_data) :
 /*virtual*/ regular_file_ostream::~regular_file_ostream() {
 }
 
-#if LOFTY_HOST_API_WIN32
+#if LOFTY_HOST_API_POSIX
+/*virtual*/ void regular_file_ostream::finalize() /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   if (direct) {
+      direct->flush();
+      direct->discard();
+   }
+   file_ostream::finalize();
+}
+
+/*virtual*/ void regular_file_ostream::flush() /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   if (direct) {
+      direct->flush();
+   }
+   if (!_pvt::blocking_offload::enabled()) {
+      file_ostream::flush();
+      return;
+   }
+   int err = 0;
+   _pvt::blocking_offload::instance().run([this, &err] () {
+      while (::fsync(fd.get()) < 0) {
+         err = errno;
+         if (err != EINTR) {
+            break;
+         }
+         err = 0;
+      }
+   });
+   this_coroutine::interruption_point();
+   if (err != 0 && err !=
+   #if LOFTY_HOST_API_DARWIN
+      ENOTSUP
+   #else
+      EINVAL
+   #endif
+   ) {
+      exception::throw_os_error(err);
+   }
+}
+
+void regular_file_ostream::flush_data() {
+   LOFTY_TRACE_FUNC(this);
+
+   #if LOFTY_HOST_API_LINUX
+   if (direct) {
+      direct->flush();
+   }
+   int err = 0;
+   auto sync_fn = [this, &err] () {
+      while (::fdatasync(fd.get()) < 0) {
+         err = errno;
+         if (err != EINTR) {
+            break;
+         }
+         err = 0;
+      }
+   };
+   if (_pvt::blocking_offload::enabled()) {
+      _pvt::blocking_offload::instance().run(sync_fn);
+      this_coroutine::interruption_point();
+   } else {
+      sync_fn();
+   }
+   if (err != 0 && err != EINVAL) {
+      exception::throw_os_error(err);
+   }
+   #else
+   flush();
+   #endif
+}
+
+void regular_file_ostream::preallocate(full_size_t offset, full_size_t size) {
+   LOFTY_TRACE_FUNC(this, offset, size);
+
+   #if LOFTY_HOST_API_LINUX
+   int err = 0;
+   auto fallocate_fn = [this, offset, size, &err] () {
+      while (::fallocate(
+         fd.get(), FALLOC_FL_KEEP_SIZE, static_cast< ::off_t>(offset), static_cast< ::off_t>(size)
+      ) < 0) {
+         err = errno;
+         if (err != EINTR) {
+            break;
+         }
+         err = 0;
+      }
+   };
+   if (_pvt::blocking_offload::enabled()) {
+      _pvt::blocking_offload::instance().run(fallocate_fn);
+      this_coroutine::interruption_point();
+   } else {
+      fallocate_fn();
+   }
+   if (err != 0 && err != EOPNOTSUPP && err != ENOSYS) {
+      exception::throw_os_error(err);
+   }
+   #else
+   /* ::posix_fallocate() would extend the file, moving the point where appended data goes; there’s no
+   portable way to preallocate while keeping the size unchanged. */
+   LOFTY_UNUSED_ARG(offset);
+   LOFTY_UNUSED_ARG(size);
+   #endif
+}
+
+/*virtual*/ std::size_t regular_file_ostream::write(void const * src, std::size_t src_size) /*override*/ {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   if (direct) {
+      return direct->write(src, src_size);
+   }
+   if (!_pvt::blocking_offload::enabled()) {
+      return file_ostream::write(src, src_size);
+   }
+   std::int8_t const * src_bytes = static_cast<std::int8_t const *>(src);
+   int err = 0;
+   // The whole write is performed by the worker, to avoid a round trip for each partial ::write().
+   _pvt::blocking_offload::instance().run([this, &src_bytes, &src_size, &err] () {
+      while (src_size) {
+         std::size_t bytes_to_write = std::min<std::size_t>(src_size, numeric::max< ::ssize_t>::value);
+         ::ssize_t bytes_written = ::write(fd.get(), src_bytes, bytes_to_write);
+         if (bytes_written >= 0) {
+            src_bytes += bytes_written;
+            src_size -= static_cast<std::size_t>(bytes_written);
+         } else if (errno != EINTR) {
+            err = errno;
+            break;
+         }
+      }
+   });
+   this_coroutine::interruption_point();
+   if (err != 0) {
+      exception::throw_os_error(err);
+   }
+   return static_cast<std::size_t>(src_bytes - static_cast<std::int8_t const *>(src));
+}
+
+/*virtual*/ std::size_t regular_file_ostream::write_buffers(
+   const_buffer const * bufs, std::size_t bufs_count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, bufs, bufs_count);
+
+   if (direct) {
+      // Data is mostly staged in chunks anyway, so there’s nothing to gain from ::writev().
+      std::size_t written_size = 0;
+      for (std::size_t i = 0; i < bufs_count; ++i) {
+         written_size += direct->write(bufs[i].src, bufs[i].src_size);
+      }
+      return written_size;
+   }
+   if (!_pvt::blocking_offload::enabled()) {
+      return file_ostream::write_buffers(bufs, bufs_count);
+   }
+   // Maximum count of buffers that can be passed to a single ::writev() call.
+   #ifdef IOV_MAX
+   static std::size_t const iovs_max = IOV_MAX;
+   #else
+   static std::size_t const iovs_max = 16;
+   #endif
+   static std::size_t const iovs_batch_size = 64;
+   std::size_t written_size = 0;
+   int err = 0;
+   // As in write(), all the ::writev() calls are performed by the worker.
+   _pvt::blocking_offload::instance().run([this, bufs, bufs_count, &written_size, &err] () mutable {
+      ::iovec iovs[iovs_batch_size];
+      while (bufs_count && err == 0) {
+         std::size_t iovs_count = std::min(bufs_count, std::min(iovs_max, iovs_batch_size));
+         for (std::size_t i = 0; i < iovs_count; ++i) {
+            iovs[i].iov_base = const_cast<void *>(bufs[i].src);
+            iovs[i].iov_len = bufs[i].src_size;
+         }
+         bufs += iovs_count;
+         bufs_count -= iovs_count;
+         ::iovec * next_iov = iovs;
+         while (iovs_count) {
+            ::ssize_t bytes_written = ::writev(fd.get(), next_iov, static_cast<int>(iovs_count));
+            if (bytes_written < 0) {
+               if (errno == EINTR) {
+                  continue;
+               }
+               err = errno;
+               break;
+            }
+            written_size += static_cast<std::size_t>(bytes_written);
+            // Skip the buffers that were written entirely, and adjust the first one that wasn’t.
+            std::size_t bytes_left = static_cast<std::size_t>(bytes_written);
+            while (iovs_count && bytes_left >= next_iov->iov_len) {
+               bytes_left -= next_iov->iov_len;
+               ++next_iov;
+               --iovs_count;
+            }
+            if (iovs_count) {
+               next_iov->iov_base = static_cast<std::int8_t *>(next_iov->iov_base) + bytes_left;
+               next_iov->iov_len -= bytes_left;
+            }
+         }
+      }
+   });
+   this_coroutine::interruption_point();
+   if (err != 0) {
+      exception::throw_os_error(err);
+   }
+   return written_size;
+}
+#elif LOFTY_HOST_API_WIN32
 /*virtual*/ std::size_t regular_file_ostream::write(void const * src, std::size_t src_size) /*override*/ {
    LOFTY_TRACE_FUNC(this, src, src_size);
 
@@ -656,7 +943,7 @@ regular_file_ostream::regular_file_ostream(_pvt::file_init_data * init_data) :
 
    return file_ostream::write(src, src_size);
 }
-#endif //if LOFTY_HOST_API_WIN32
+#endif //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32
 
 }}} //namespace lofty::io::binary
 
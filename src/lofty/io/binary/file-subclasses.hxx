@@ -27,6 +27,7 @@ You should have received a copy of the GNU Lesser General Public License along w
 #endif
 
 #include <lofty/io/binary.hxx>
+#include "direct_io.hxx"
 #if LOFTY_HOST_API_WIN32
    #include <lofty/text/parsers/ansi_escape_sequences.hxx>
 #endif
@@ -232,14 +233,28 @@ public:
    //! See seekable::tell().
    virtual offset_t tell() const override;
 
+   /*! Returns true if the file is accessed bypassing the OS cache, in which case its file descriptor can’t be
+   used directly without losing data staged in memory.
+
+   @return
+      true if data goes through a _pvt::direct_io instance, or false otherwise.
+   */
+   bool uses_direct_io() const {
+#if LOFTY_HOST_API_POSIX
+      return direct != nullptr;
+#else
+      return false;
+#endif
+   }
+
 protected:
    //! See file_stream::file_stream().
    regular_file_stream(_pvt::file_init_data * init_data);
 
 protected:
-#if 0
-   //! Physical alignment for unbuffered/direct disk access.
-   unsigned physical_align;
+#if LOFTY_HOST_API_POSIX
+   //! Aligned staging for files opened with O_DIRECT; nullptr if the file is accessed through the OS cache.
+   _std::unique_ptr<_pvt::direct_io> direct;
 #endif
 };
 
@@ -257,6 +272,17 @@ public:
 
    //! Destructor.
    virtual ~regular_file_istream();
+
+#if LOFTY_HOST_API_POSIX
+   /*! See file_istream::read(). When called from a coroutine, this override first tries to read from the page
+   cache without blocking, then hands the read to _pvt::blocking_offload. Files opened with O_DIRECT are read
+   via _pvt::direct_io instead. */
+   virtual std::size_t read(void * dst, std::size_t dst_max) override;
+
+protected:
+   //! If false, the file system doesn’t support non-blocking reads via RWF_NOWAIT, so they won’t be tried.
+   bool try_nowait:1;
+#endif
 };
 
 }}} //namespace lofty::io::binary
@@ -274,7 +300,37 @@ public:
    //! Destructor.
    virtual ~regular_file_ostream();
 
-#if LOFTY_HOST_API_WIN32
+#if LOFTY_HOST_API_POSIX
+   //! See file_ostream::finalize(). This override also writes out any data still staged in direct.
+   virtual void finalize() override;
+
+   /*! See file_ostream::flush(). When called from a coroutine, this override hands ::fsync() to
+   _pvt::blocking_offload. */
+   virtual void flush() override;
+
+   /*! Like flush(), but under Linux only forces out the metadata needed to read the data back (e.g. the file
+   size, but not the modification time), via ::fdatasync(); elsewhere this is the same as flush(). */
+   void flush_data();
+
+   /*! Allocates disk space for a range of the file without changing its size, so that later writes in the
+   range won’t have to allocate blocks, making each flush_data() cheaper. Does nothing if the platform or
+   file system doesn’t support it.
+
+   @param offset
+      Start of the range.
+   @param size
+      Size of the range, in bytes.
+   */
+   void preallocate(full_size_t offset, full_size_t size);
+
+   /*! See file_ostream::write(). When called from a coroutine, this override hands the write to
+   _pvt::blocking_offload. */
+   virtual std::size_t write(void const * src, std::size_t src_size) override;
+
+   /*! See file_ostream::write_buffers(). When called from a coroutine, this override hands the write to
+   _pvt::blocking_offload. */
+   virtual std::size_t write_buffers(const_buffer const * bufs, std::size_t bufs_count) override;
+#elif LOFTY_HOST_API_WIN32
    //! See file_ostream::write(). This override is necessary to emulate O_APPEND under Win32.
    virtual std::size_t write(void const * src, std::size_t src_size) override;
 
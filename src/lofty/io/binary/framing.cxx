@@ -0,0 +1,351 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary/framing.hxx>
+#include <lofty/numeric.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace framing {
+
+namespace {
+
+//! Maximum size of a varint length prefix: enough 7-bit groups for a 64-bit value.
+std::size_t const varint_size_max = 10;
+
+/*! Returns the largest payload size that can be expressed by a length prefix.
+
+@param prefix
+   Length prefix encoding.
+@return
+   Largest payload size that prefix can encode.
+*/
+std::size_t prefix_value_max(length_prefix prefix) {
+   switch (prefix.base()) {
+      case length_prefix::uint8:
+         return 0xff;
+      case length_prefix::uint16_be:
+      case length_prefix::uint16_le:
+         return 0xffff;
+      case length_prefix::uint32_be:
+      case length_prefix::uint32_le:
+         return static_cast<std::size_t>(
+            std::min<std::uint64_t>(0xffffffff, numeric::max<std::size_t>::value)
+         );
+      default:
+         return numeric::max<std::size_t>::value;
+   }
+}
+
+/*! Encodes a length prefix. A varint prefix is padded with continuation bytes to fill dst_size bytes, which
+lets writer::get_buffer() reserve its space before the final payload size is known.
+
+@param prefix
+   Length prefix encoding.
+@param dst
+   Destination buffer.
+@param dst_size
+   Size of the prefix to write; must be at least prefix_size(prefix, payload_size).
+@param payload_size
+   Value to encode.
+*/
+void encode_prefix(length_prefix prefix, std::uint8_t * dst, std::size_t dst_size, std::size_t payload_size) {
+   std::uint64_t value = payload_size;
+   switch (prefix.base()) {
+      case length_prefix::varint:
+         for (std::size_t i = 0; i < dst_size; ++i) {
+            std::uint8_t b = static_cast<std::uint8_t>(value & 0x7f);
+            value >>= 7;
+            dst[i] = i + 1 < dst_size ? static_cast<std::uint8_t>(b | 0x80) : b;
+         }
+         break;
+      case length_prefix::uint8:
+         dst[0] = static_cast<std::uint8_t>(value);
+         break;
+      case length_prefix::uint16_be:
+      case length_prefix::uint32_be:
+         for (std::size_t i = dst_size; i > 0; value >>= 8) {
+            dst[--i] = static_cast<std::uint8_t>(value);
+         }
+         break;
+      case length_prefix::uint16_le:
+      case length_prefix::uint32_le:
+         for (std::size_t i = 0; i < dst_size; ++i, value >>= 8) {
+            dst[i] = static_cast<std::uint8_t>(value);
+         }
+         break;
+   }
+}
+
+} //namespace
+
+std::size_t prefix_size(length_prefix prefix, std::size_t payload_size) {
+   switch (prefix.base()) {
+      case length_prefix::varint: {
+         std::size_t ret = 1;
+         for (std::uint64_t value = payload_size; value >= 0x80; value >>= 7) {
+            ++ret;
+         }
+         return ret;
+      }
+      case length_prefix::uint8:
+         return 1;
+      case length_prefix::uint16_be:
+      case length_prefix::uint16_le:
+         return 2;
+      case length_prefix::uint32_be:
+      case length_prefix::uint32_le:
+         return 4;
+      default:
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+   }
+}
+
+}}}} //namespace lofty::io::binary::framing
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace framing {
+
+reader::reader(
+   _std::shared_ptr<buffered_istream> bin_istream_, length_prefix prefix_, std::size_t frame_size_max_,
+   std::size_t view_size_max_ /*= view_size_max_default*/
+) :
+   bin_istream(_std::move(bin_istream_)),
+   prefix(prefix_),
+   frame_size_max(frame_size_max_),
+   view_size_max(view_size_max_),
+   pending_consume_size(0) {
+}
+
+reader::~reader() {
+}
+
+bool reader::read(const_buffer * frame) {
+   LOFTY_TRACE_FUNC(this, frame);
+
+   // Release the bytes backing the frame returned by the previous call.
+   if (pending_consume_size) {
+      bin_istream->consume_bytes(pending_consume_size);
+      pending_consume_size = 0;
+   }
+   std::size_t payload_size;
+   std::size_t prefix_size_ = read_prefix(&payload_size);
+   if (prefix_size_ == 0) {
+      return false;
+   }
+   std::size_t frame_size = prefix_size_ + payload_size;
+   std::int8_t const * buf;
+   std::size_t buf_size;
+   /* If the frame is small enough, have the stream read as much of it as it’s missing; otherwise just look
+   at what’s already buffered. */
+   _std::tie(buf, buf_size) = bin_istream->peek<std::int8_t>(frame_size <= view_size_max ? frame_size : 0);
+   if (buf_size >= frame_size) {
+      // The whole frame is in the stream’s buffer: return a view of it.
+      frame->src = buf + prefix_size_;
+      frame->src_size = payload_size;
+      pending_consume_size = frame_size;
+      return true;
+   } else if (frame_size <= view_size_max) {
+      // The stream ended in the middle of the frame.
+      LOFTY_THROW(io::error, ());
+   }
+   // The frame is larger than we’re willing to make the stream buffer: copy it piecemeal as it arrives.
+   bin_istream->consume_bytes(prefix_size_);
+   read_spilled(payload_size);
+   frame->src = spill_buf.data();
+   frame->src_size = payload_size;
+   return true;
+}
+
+std::size_t reader::read_prefix(std::size_t * payload_size) {
+   LOFTY_TRACE_FUNC(this, payload_size);
+
+   std::uint8_t const * buf;
+   std::size_t buf_size;
+   if (prefix != length_prefix::varint) {
+      std::size_t prefix_size_ = prefix_size(prefix, 0);
+      _std::tie(buf, buf_size) = bin_istream->peek<std::uint8_t>(prefix_size_);
+      if (buf_size == 0) {
+         return 0;
+      } else if (buf_size < prefix_size_) {
+         // The stream ended in the middle of the length prefix.
+         LOFTY_THROW(io::error, ());
+      }
+      std::uint64_t value = 0;
+      switch (prefix.base()) {
+         case length_prefix::uint16_le:
+         case length_prefix::uint32_le:
+            for (std::size_t i = prefix_size_; i > 0; ) {
+               value = (value << 8) | buf[--i];
+            }
+            break;
+         default:
+            for (std::size_t i = 0; i < prefix_size_; ++i) {
+               value = (value << 8) | buf[i];
+            }
+            break;
+      }
+      if (value > frame_size_max) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      }
+      *payload_size = static_cast<std::size_t>(value);
+      return prefix_size_;
+   }
+
+   // Varint: peek one more byte at a time until the terminating byte (without the continuation bit) shows up.
+   std::size_t needed_size = 1;
+   for (;;) {
+      _std::tie(buf, buf_size) = bin_istream->peek<std::uint8_t>(needed_size);
+      if (buf_size == 0) {
+         return 0;
+      }
+      std::uint64_t value = 0;
+      std::size_t scan_size = std::min(buf_size, varint_size_max);
+      for (std::size_t i = 0; i < scan_size; ++i) {
+         std::uint64_t group = buf[i] & 0x7f;
+         unsigned shift = static_cast<unsigned>(i * 7);
+         if (group && (shift >= 64 || group > (static_cast<std::uint64_t>(frame_size_max) >> shift))) {
+            // Larger than the maximum frame size (or than any 64-bit value).
+            // TODO: use a better exception class.
+            LOFTY_THROW(domain_error, ());
+         }
+         value |= group << shift;
+         if ((buf[i] & 0x80) == 0) {
+            if (value > frame_size_max) {
+               // TODO: use a better exception class.
+               LOFTY_THROW(domain_error, ());
+            }
+            *payload_size = static_cast<std::size_t>(value);
+            return i + 1;
+         }
+      }
+      if (scan_size == varint_size_max) {
+         // Too many continuation bytes.
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      } else if (buf_size < needed_size) {
+         // The stream ended in the middle of the length prefix.
+         LOFTY_THROW(io::error, ());
+      }
+      needed_size = buf_size + 1;
+   }
+}
+
+void reader::read_spilled(std::size_t frame_size) {
+   LOFTY_TRACE_FUNC(this, frame_size);
+
+   spill_buf.set_size(frame_size);
+   std::int8_t * dst = spill_buf.data();
+   for (std::size_t remaining_size = frame_size; remaining_size > 0; ) {
+      // Take whatever is buffered, or have the stream refill its buffer at its usual size.
+      std::int8_t const * buf;
+      std::size_t buf_size;
+      _std::tie(buf, buf_size) = bin_istream->peek<std::int8_t>(1);
+      if (buf_size == 0) {
+         // The stream ended in the middle of the frame.
+         LOFTY_THROW(io::error, ());
+      }
+      std::size_t copy_size = std::min(buf_size, remaining_size);
+      memory::copy(dst, buf, copy_size);
+      bin_istream->consume_bytes(copy_size);
+      dst += copy_size;
+      remaining_size -= copy_size;
+   }
+}
+
+}}}} //namespace lofty::io::binary::framing
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary { namespace framing {
+
+writer::writer(
+   _std::shared_ptr<buffered_ostream> bin_ostream_, length_prefix prefix_, std::size_t frame_size_max_
+) :
+   bin_ostream(_std::move(bin_ostream_)),
+   prefix(prefix_),
+   frame_size_max(frame_size_max_),
+   reserved_frame(nullptr),
+   reserved_prefix_size(0),
+   reserved_payload_size_max(0) {
+}
+
+writer::~writer() {
+}
+
+void writer::commit(std::size_t payload_size) {
+   LOFTY_TRACE_FUNC(this, payload_size);
+
+   if (!reserved_frame || payload_size > reserved_payload_size_max) {
+      // No frame to commit, or it’s larger than the space reserved for it.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   encode_prefix(
+      prefix, reinterpret_cast<std::uint8_t *>(reserved_frame), reserved_prefix_size, payload_size
+   );
+   reserved_frame = nullptr;
+   bin_ostream->commit_bytes(reserved_prefix_size + payload_size);
+}
+
+void * writer::get_buffer(std::size_t payload_size_max) {
+   LOFTY_TRACE_FUNC(this, payload_size_max);
+
+   validate_frame_size(payload_size_max);
+   // The prefix is sized for the largest payload; commit() will pad it if the actual payload is smaller.
+   reserved_prefix_size = prefix_size(prefix, payload_size_max);
+   reserved_payload_size_max = payload_size_max;
+   reserved_frame = _std::get<0>(bin_ostream->get_buffer<std::int8_t>(reserved_prefix_size + payload_size_max));
+   return reserved_frame + reserved_prefix_size;
+}
+
+void writer::validate_frame_size(std::size_t payload_size) const {
+   if (payload_size > frame_size_max || payload_size > prefix_value_max(prefix)) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(domain_error, ());
+   }
+}
+
+void writer::write(void const * src, std::size_t src_size) {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   validate_frame_size(src_size);
+   std::size_t prefix_size_ = prefix_size(prefix, src_size);
+   if (src_size >= pass_through_size_min) {
+      /* Commit just the prefix, and let the stream send it along with the payload with a single gather
+      write, instead of copying the payload into its buffer. */
+      auto buf(_std::get<0>(bin_ostream->get_buffer<std::uint8_t>(prefix_size_)));
+      encode_prefix(prefix, buf, prefix_size_, src_size);
+      bin_ostream->commit_bytes(prefix_size_);
+      bin_ostream->write(src, src_size);
+   } else {
+      auto buf(_std::get<0>(
+         bin_ostream->get_buffer<std::uint8_t>(prefix_size_ + src_size)
+      ));
+      encode_prefix(prefix, buf, prefix_size_, src_size);
+      memory::copy(buf + prefix_size_, static_cast<std::uint8_t const *>(src), src_size);
+      bin_ostream->commit_bytes(prefix_size_ + src_size);
+   }
+}
+
+}}}} //namespace lofty::io::binary::framing
@@ -0,0 +1,732 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/byte_order.hxx>
+#include <lofty/destructing_unfinalized_object.hxx>
+#include <lofty/io/binary/lz.hxx>
+
+#if LOFTY_HOST_ARCH_X86_64
+   #include <emmintrin.h> // _mm_loadu_si128() _mm_storeu_si128()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+namespace {
+
+//! Signature at the start of the frame header.
+std::uint8_t const frame_magic[] = { 'L', 'F', 'Z', '1' };
+//! Size of the frame header: signature, block size, flags.
+std::size_t const frame_header_size = sizeof frame_magic + 2;
+//! Frame header flag indicating that the end mark is followed by the content checksum.
+std::uint8_t const frame_flag_content_checksum = 0x01;
+//! Minimum base-2 logarithm of the block size.
+unsigned const block_size_log2_min = 10;
+//! Maximum base-2 logarithm of the block size.
+unsigned const block_size_log2_max = 22;
+//! Block header bit indicating that the block data is stored uncompressed.
+std::uint32_t const block_stored_bit = 0x80000000;
+
+//! Minimum length of a match.
+std::size_t const match_size_min = 4;
+//! Maximum distance between a match and the data it repeats.
+std::size_t const match_offset_max = 0xffff;
+//! The last bytes of a block are always literals, as required by the LZ4 block format.
+std::size_t const last_literals_size = 5;
+//! Matches can’t start within this many bytes from the end of a block, as required by the LZ4 block format.
+std::size_t const match_start_margin = 12;
+//! Base-2 logarithm of the count of entries in the compressor’s hash table.
+unsigned const match_table_log2 = 12;
+//! Count of entries in the compressor’s hash table.
+std::size_t const match_table_size = std::size_t(1) << match_table_log2;
+/*! Base-2 logarithm of the count of failed match searches after which the compressor starts skipping bytes,
+to quickly get through incompressible data. */
+unsigned const search_skip_log2 = 6;
+/*! Extra bytes allocated after the decompression buffer, so that literals and matches can be copied in whole
+16-byte chunks without checking for the end of the buffer. */
+std::size_t const copy_slack_size = 32;
+
+/*! Returns the maximum size of a compressed block.
+
+@param src_size
+   Size of the uncompressed data.
+@return
+   Maximum size of the compressed data.
+*/
+std::size_t compressed_size_max(std::size_t src_size) {
+   return src_size + src_size / 255 + 16;
+}
+
+/*! Loads 4 bytes from a possibly unaligned address, in host byte order.
+
+@param src
+   Pointer to the bytes.
+@return
+   Loaded value.
+*/
+std::uint32_t load_32(std::uint8_t const * src) {
+   std::uint32_t ret;
+   memory::copy(reinterpret_cast<std::uint8_t *>(&ret), src, sizeof ret);
+   return ret;
+}
+
+/*! Loads 8 bytes from a possibly unaligned address, in host byte order.
+
+@param src
+   Pointer to the bytes.
+@return
+   Loaded value.
+*/
+std::uint64_t load_64(std::uint8_t const * src) {
+   std::uint64_t ret;
+   memory::copy(reinterpret_cast<std::uint8_t *>(&ret), src, sizeof ret);
+   return ret;
+}
+
+/*! Stores a 32-bit little-endian word.
+
+@param dst
+   Pointer to the destination.
+@param value
+   Value to store.
+*/
+void store_le_32(std::uint8_t * dst, std::uint32_t value) {
+   value = byte_order::host_to_le(value);
+   memory::copy(dst, reinterpret_cast<std::uint8_t const *>(&value), sizeof value);
+}
+
+/*! Returns the index in the compressor’s hash table for a 4-byte sequence.
+
+@param seq
+   Sequence.
+@return
+   Hash table index.
+*/
+std::size_t hash_sequence(std::uint32_t seq) {
+   // Fibonacci hashing: the top bits of the product are the best mixed.
+   return static_cast<std::size_t>((seq * std::uint32_t(2654435761u)) >> (32 - match_table_log2));
+}
+
+/*! Copies 16 bytes, using a single vector load and store where available.
+
+@param dst
+   Pointer to the destination.
+@param src
+   Pointer to the source; [src, src + 16) must not overlap [dst, dst + 16).
+*/
+void copy_16_bytes(std::uint8_t * dst, std::uint8_t const * src) {
+#if LOFTY_HOST_ARCH_X86_64
+   // SSE2 is part of the x86-64 baseline.
+   __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), chunk);
+#else
+   memory::copy(dst, src, 16);
+#endif
+}
+
+/*! Copies 16-byte chunks until at least the requested count of bytes has been copied; up to 15 bytes past
+dst_end may be overwritten.
+
+@param dst
+   Pointer to the destination.
+@param src
+   Pointer to the source; src must not be within 16 bytes before dst.
+@param dst_end
+   End of the bytes that need to be copied.
+*/
+void wild_copy(std::uint8_t * dst, std::uint8_t const * src, std::uint8_t const * dst_end) {
+   for (; dst < dst_end; dst += 16, src += 16) {
+      copy_16_bytes(dst, src);
+   }
+}
+
+/*! Writes the continuation bytes for a literals or match length that doesn’t fit in a token nibble.
+
+@param dst
+   Pointer to the destination.
+@param size
+   Length, minus the 15 expressed by the token nibble.
+@return
+   Pointer to the byte following the last one written.
+*/
+std::uint8_t * write_extra_length(std::uint8_t * dst, std::size_t size) {
+   for (; size >= 255; size -= 255) {
+      *dst++ = 255;
+   }
+   *dst++ = static_cast<std::uint8_t>(size);
+   return dst;
+}
+
+/*! Writes a sequence: token, literals and, if match_size is not 0, match.
+
+@param dst
+   Pointer to the destination.
+@param lits
+   Pointer to the literals.
+@param lits_size
+   Count of literals.
+@param match_offset
+   Distance between the match and the data it repeats.
+@param match_size
+   Length of the match, or 0 for the last sequence in a block, which has no match.
+@return
+   Pointer to the byte following the last one written.
+*/
+std::uint8_t * write_sequence(
+   std::uint8_t * dst, std::uint8_t const * lits, std::size_t lits_size, std::size_t match_offset,
+   std::size_t match_size
+) {
+   std::uint8_t * token = dst++;
+   *token = static_cast<std::uint8_t>((lits_size < 15 ? lits_size : 15) << 4);
+   if (lits_size >= 15) {
+      dst = write_extra_length(dst, lits_size - 15);
+   }
+   memory::copy(dst, lits, lits_size);
+   dst += lits_size;
+   if (match_size) {
+      *dst++ = static_cast<std::uint8_t>(match_offset);
+      *dst++ = static_cast<std::uint8_t>(match_offset >> 8);
+      std::size_t match_code = match_size - match_size_min;
+      *token = static_cast<std::uint8_t>(*token | (match_code < 15 ? match_code : 15));
+      if (match_code >= 15) {
+         dst = write_extra_length(dst, match_code - 15);
+      }
+   }
+   return dst;
+}
+
+/*! Compresses a block using the LZ4 block format.
+
+@param src
+   Pointer to the uncompressed data.
+@param src_size
+   Size of the uncompressed data; must not be greater than 4 MiB.
+@param dst
+   Pointer to the destination, which must be at least compressed_size_max(src_size) bytes large.
+@param match_table
+   Pointer to a hash table with match_table_size entries, used as scratch space.
+@return
+   Size of the compressed data.
+*/
+std::size_t compress_block(
+   std::uint8_t const * src, std::size_t src_size, std::uint8_t * dst, std::uint32_t * match_table
+) {
+   std::uint8_t * out = dst;
+   std::size_t anchor = 0;
+   if (src_size > match_start_margin) {
+      memory::clear(match_table, match_table_size);
+      std::size_t const match_start_max = src_size - match_start_margin;
+      std::size_t const match_end_max = src_size - last_literals_size;
+      std::size_t search_count = std::size_t(1) << search_skip_log2;
+      for (std::size_t pos = 0; pos <= match_start_max; ) {
+         std::uint32_t seq = load_32(src + pos);
+         std::uint32_t & slot = match_table[hash_sequence(seq)];
+         std::size_t match_pos = slot;
+         slot = static_cast<std::uint32_t>(pos);
+         if (match_pos >= pos || pos - match_pos > match_offset_max || load_32(src + match_pos) != seq) {
+            // No match; the more consecutive failures, the more bytes are skipped.
+            pos += search_count++ >> search_skip_log2;
+            continue;
+         }
+         search_count = std::size_t(1) << search_skip_log2;
+         // Extend the match backwards into the pending literals, then forwards.
+         while (pos > anchor && match_pos > 0 && src[pos - 1] == src[match_pos - 1]) {
+            --pos;
+            --match_pos;
+         }
+         std::size_t match_end = pos + match_size_min;
+         std::size_t match_distance = pos - match_pos;
+         while (
+            match_end + 8 <= match_end_max &&
+            load_64(src + match_end) == load_64(src + match_end - match_distance)
+         ) {
+            match_end += 8;
+         }
+         while (match_end < match_end_max && src[match_end] == src[match_end - match_distance]) {
+            ++match_end;
+         }
+         out = write_sequence(out, src + anchor, pos - anchor, match_distance, match_end - pos);
+         pos = anchor = match_end;
+         // Index a position inside the match, to improve the chances of finding a match for what follows it.
+         std::size_t skipped_pos = match_end - 2;
+         match_table[hash_sequence(load_32(src + skipped_pos))] = static_cast<std::uint32_t>(skipped_pos);
+      }
+   }
+   out = write_sequence(out, src + anchor, src_size - anchor, 0, 0);
+   return static_cast<std::size_t>(out - dst);
+}
+
+/*! Reads the continuation bytes for a literals or match length that doesn’t fit in a token nibble.
+
+@param src
+   Pointer to a pointer to the first continuation byte; on return, it will point to the byte after the last
+   continuation byte.
+@param src_end
+   End of the compressed data.
+@return
+   Length to be added to the 15 expressed by the token nibble.
+*/
+std::size_t read_extra_length(std::uint8_t const ** src, std::uint8_t const * src_end) {
+   std::size_t ret = 0;
+   std::uint8_t const * src_ = *src;
+   std::uint8_t b;
+   do {
+      if (src_ == src_end) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      }
+      b = *src_++;
+      ret += b;
+   } while (b == 255);
+   *src = src_;
+   return ret;
+}
+
+/*! Copies a match, expanding it if it overlaps the destination. Up to 31 bytes past the end of the match may
+be overwritten.
+
+@param dst
+   Pointer to the destination.
+@param offset
+   Distance between dst and the data to repeat.
+@param size
+   Length of the match.
+*/
+void copy_match(std::uint8_t * dst, std::size_t offset, std::size_t size) {
+   std::uint8_t const * src = dst - offset;
+   std::uint8_t const * dst_end = dst + size;
+   if (offset < 16) {
+      /* The match overlaps the destination, so it repeats with a period of offset bytes. Expand the first 16
+      bytes one at a time, then copy 16-byte chunks from a distance that’s a multiple of the period and
+      doesn’t overlap the destination. */
+      for (unsigned i = 0; i < 16; ++i) {
+         dst[i] = src[i];
+      }
+      dst += 16;
+      src = dst - offset * ((16 + offset - 1) / offset);
+   }
+   wild_copy(dst, src, dst_end);
+}
+
+/*! Decompresses a block in the LZ4 block format, validating it along the way.
+
+@param src
+   Pointer to the compressed data.
+@param src_size
+   Size of the compressed data.
+@param dst
+   Pointer to the destination, which must be followed by at least copy_slack_size writable bytes.
+@param dst_max
+   Maximum size of the uncompressed data.
+@return
+   Size of the uncompressed data.
+*/
+std::size_t decompress_block(
+   std::uint8_t const * src, std::size_t src_size, std::uint8_t * dst, std::size_t dst_max
+) {
+   std::uint8_t const * src_end = src + src_size;
+   std::uint8_t * out = dst, * out_end = dst + dst_max;
+   for (;;) {
+      if (src == src_end) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      }
+      unsigned token = *src++;
+      std::size_t lits_size = token >> 4;
+      if (lits_size == 15) {
+         lits_size += read_extra_length(&src, src_end);
+      }
+      std::size_t src_avail = static_cast<std::size_t>(src_end - src);
+      if (lits_size > src_avail || lits_size > static_cast<std::size_t>(out_end - out)) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      }
+      if (src_avail >= lits_size + 16) {
+         wild_copy(out, src, out + lits_size);
+      } else {
+         memory::copy(out, src, lits_size);
+      }
+      src += lits_size;
+      out += lits_size;
+      if (src == src_end) {
+         // The last sequence has no match.
+         break;
+      } else if (src_end - src < 2) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      }
+      std::size_t match_offset = static_cast<std::size_t>(src[0]) | (static_cast<std::size_t>(src[1]) << 8);
+      src += 2;
+      std::size_t match_size = token & 0x0f;
+      if (match_size == 15) {
+         match_size += read_extra_length(&src, src_end);
+      }
+      match_size += match_size_min;
+      if (
+         match_offset == 0 || match_offset > static_cast<std::size_t>(out - dst) ||
+         match_size > static_cast<std::size_t>(out_end - out)
+      ) {
+         // TODO: use a better exception class.
+         LOFTY_THROW(domain_error, ());
+      }
+      copy_match(out, match_offset, match_size);
+      out += match_size;
+   }
+   return static_cast<std::size_t>(out - dst);
+}
+
+} //namespace
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+std::size_t const lz_ostream::default_block_size;
+
+lz_ostream::lz_ostream(
+   _std::shared_ptr<buffered_ostream> bin_ostream_, std::size_t block_size_ /*= default_block_size*/
+) :
+   bin_ostream(_std::move(bin_ostream_)),
+   pending_size(0),
+   block_size(block_size_),
+   block_size_log2(0),
+   header_written(false),
+   match_table(new std::uint32_t[match_table_size]) {
+   while (block_size_log2 < block_size_log2_max && (std::size_t(1) << block_size_log2) < block_size) {
+      ++block_size_log2;
+   }
+   if (block_size_log2 < block_size_log2_min || (std::size_t(1) << block_size_log2) != block_size) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   pending_buf.set_size(block_size);
+}
+
+/*virtual*/ lz_ostream::~lz_ostream() {
+   // Verify that all the data was compressed; if not, the caller neglected to call finalize().
+   if (pending_size) {
+      // This will cause a call to std::terminate().
+      LOFTY_THROW(destructing_unfinalized_object, (this));
+   }
+}
+
+/*virtual*/ void lz_ostream::commit_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > pending_buf.size() - pending_size) {
+      // Can’t commit more bytes than were returned by get_buffer_bytes().
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   std::uint8_t * buf = pending_buf.data();
+   content_crc.update(buf + pending_size, count);
+   pending_size += count;
+   // Compress any full blocks, and move what’s left to the start of the buffer.
+   std::size_t offset = 0;
+   for (; pending_size - offset >= block_size; offset += block_size) {
+      write_block(buf + offset, block_size);
+   }
+   if (offset) {
+      pending_size -= offset;
+      memory::move(buf, buf + offset, pending_size);
+   }
+}
+
+/*virtual*/ void lz_ostream::finalize() /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   if (pending_size) {
+      write_block(pending_buf.data(), pending_size);
+      pending_size = 0;
+   }
+   write_header();
+   std::uint8_t * buf;
+   _std::tie(buf, _std::ignore) = bin_ostream->get_buffer<std::uint8_t>(sizeof(std::uint32_t) * 2);
+   store_le_32(buf, 0);
+   store_le_32(buf + sizeof(std::uint32_t), content_crc.value());
+   bin_ostream->commit<std::uint8_t>(sizeof(std::uint32_t) * 2);
+   bin_ostream->finalize();
+}
+
+/*virtual*/ void lz_ostream::flush() /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   if (pending_size) {
+      write_block(pending_buf.data(), pending_size);
+      pending_size = 0;
+   } else {
+      write_header();
+   }
+   bin_ostream->flush();
+}
+
+/*virtual*/ _std::tuple<void *, std::size_t> lz_ostream::get_buffer_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   /* Rather than compressing a partial block to make room, enlarge the buffer; commit_bytes() will compress
+   the data in whole blocks. */
+   if (pending_buf.size() - pending_size < count) {
+      pending_buf.set_size(pending_size + count);
+   }
+   return _std::make_tuple(
+      static_cast<void *>(pending_buf.data() + pending_size), pending_buf.size() - pending_size
+   );
+}
+
+/*virtual*/ std::size_t lz_ostream::write(void const * src, std::size_t src_size) /*override*/ {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   auto src_bytes = static_cast<std::uint8_t const *>(src);
+   std::size_t ret = src_size;
+   content_crc.update(src_bytes, src_size);
+   if (pending_size) {
+      // Complete the pending block first.
+      std::size_t fill_size = block_size - pending_size;
+      if (fill_size > src_size) {
+         fill_size = src_size;
+      }
+      memory::copy(pending_buf.data() + pending_size, src_bytes, fill_size);
+      pending_size += fill_size;
+      src_bytes += fill_size;
+      src_size -= fill_size;
+      if (pending_size < block_size) {
+         return ret;
+      }
+      write_block(pending_buf.data(), block_size);
+      pending_size = 0;
+   }
+   // Compress whole blocks straight from the caller’s buffer, and keep the rest for later.
+   for (; src_size >= block_size; src_bytes += block_size, src_size -= block_size) {
+      write_block(src_bytes, block_size);
+   }
+   memory::copy(pending_buf.data(), src_bytes, src_size);
+   pending_size = src_size;
+   return ret;
+}
+
+void lz_ostream::write_block(std::uint8_t const * src, std::size_t src_size) {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   write_header();
+   std::uint8_t * buf;
+   _std::tie(buf, _std::ignore) = bin_ostream->get_buffer<std::uint8_t>(
+      sizeof(std::uint32_t) + compressed_size_max(src_size)
+   );
+   std::uint8_t * block_data = buf + sizeof(std::uint32_t);
+   std::size_t block_data_size = compress_block(src, src_size, block_data, match_table.get());
+   std::uint32_t block_header;
+   if (block_data_size < src_size) {
+      block_header = static_cast<std::uint32_t>(block_data_size);
+   } else {
+      // Incompressible data: store it as-is, so it can be read without decompressing it.
+      memory::copy(block_data, src, src_size);
+      block_data_size = src_size;
+      block_header = static_cast<std::uint32_t>(block_data_size) | block_stored_bit;
+   }
+   store_le_32(buf, block_header);
+   bin_ostream->commit<std::uint8_t>(sizeof(std::uint32_t) + block_data_size);
+}
+
+void lz_ostream::write_header() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (!header_written) {
+      std::uint8_t * buf;
+      _std::tie(buf, _std::ignore) = bin_ostream->get_buffer<std::uint8_t>(frame_header_size);
+      memory::copy(buf, frame_magic, sizeof frame_magic);
+      buf[sizeof frame_magic] = block_size_log2;
+      buf[sizeof frame_magic + 1] = frame_flag_content_checksum;
+      bin_ostream->commit<std::uint8_t>(frame_header_size);
+      header_written = true;
+   }
+}
+
+/*virtual*/ _std::shared_ptr<stream> lz_ostream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   // The wrapped stream carries compressed data, so return a non-owning pointer to *this instead.
+   return _std::shared_ptr<stream>(
+      _std::shared_ptr<stream>(), static_cast<stream *>(const_cast<lz_ostream *>(this))
+   );
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+lz_istream::lz_istream(_std::shared_ptr<buffered_istream> bin_istream_) :
+   bin_istream(_std::move(bin_istream_)),
+   buf_offset(0),
+   buf_used(0),
+   block_size(0),
+   flags(0),
+   header_read(false),
+   eof(false) {
+}
+
+/*virtual*/ lz_istream::~lz_istream() {
+}
+
+/*virtual*/ void lz_istream::consume_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > buf_used) {
+      // Can’t consume more bytes than are in the buffer.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   buf_offset += count;
+   buf_used -= count;
+}
+
+/*virtual*/ _std::tuple<void const *, std::size_t> lz_istream::peek_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (!header_read) {
+      read_header();
+   }
+   while (buf_used < count && !eof) {
+      // Make room for another block after the unconsumed data, moving that to the start of the buffer.
+      std::size_t needed_size = buf_used + block_size + copy_slack_size;
+      if (buf.size() - buf_offset < needed_size) {
+         if (buf_offset) {
+            memory::move(buf.data(), buf.data() + buf_offset, buf_used);
+            buf_offset = 0;
+         }
+         if (buf.size() < needed_size) {
+            buf.set_size(needed_size);
+         }
+      }
+      if (!read_block()) {
+         read_trailer();
+         eof = true;
+      }
+   }
+   return _std::make_tuple(static_cast<void const *>(buf.data() + buf_offset), buf_used);
+}
+
+bool lz_istream::read_block() {
+   LOFTY_TRACE_FUNC(this);
+
+   std::uint8_t const * src;
+   std::size_t src_size;
+   _std::tie(src, src_size) = bin_istream->peek<std::uint8_t>(sizeof(std::uint32_t));
+   if (src_size < sizeof(std::uint32_t)) {
+      // The stream ended before the end mark.
+      LOFTY_THROW(io::error, ());
+   }
+   std::uint32_t block_header;
+   memory::copy(reinterpret_cast<std::uint8_t *>(&block_header), src, sizeof block_header);
+   block_header = byte_order::le_to_host(block_header);
+   if (block_header == 0) {
+      bin_istream->consume<std::uint8_t>(sizeof(std::uint32_t));
+      return false;
+   }
+   bool stored = (block_header & block_stored_bit) != 0;
+   std::size_t block_data_size = block_header & ~block_stored_bit;
+   if (block_data_size > (stored ? block_size : compressed_size_max(block_size))) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(domain_error, ());
+   }
+   std::size_t block_total_size = sizeof(std::uint32_t) + block_data_size;
+   _std::tie(src, src_size) = bin_istream->peek<std::uint8_t>(block_total_size);
+   if (src_size < block_total_size) {
+      // The stream ended in the middle of the block.
+      LOFTY_THROW(io::error, ());
+   }
+   src += sizeof(std::uint32_t);
+   std::uint8_t * dst = buf.data() + buf_offset + buf_used;
+   std::size_t dst_size;
+   if (stored) {
+      memory::copy(dst, src, block_data_size);
+      dst_size = block_data_size;
+   } else {
+      dst_size = decompress_block(src, block_data_size, dst, block_size);
+   }
+   bin_istream->consume<std::uint8_t>(block_total_size);
+   if (flags & frame_flag_content_checksum) {
+      content_crc.update(dst, dst_size);
+   }
+   buf_used += dst_size;
+   return true;
+}
+
+void lz_istream::read_header() {
+   LOFTY_TRACE_FUNC(this);
+
+   std::uint8_t const * src;
+   std::size_t src_size;
+   _std::tie(src, src_size) = bin_istream->peek<std::uint8_t>(frame_header_size);
+   if (src_size < frame_header_size) {
+      // The stream ended before the end of the header.
+      LOFTY_THROW(io::error, ());
+   }
+   std::uint8_t block_size_log2 = src[sizeof frame_magic];
+   flags = src[sizeof frame_magic + 1];
+   if (
+      load_32(src) != load_32(frame_magic) ||
+      block_size_log2 < block_size_log2_min || block_size_log2 > block_size_log2_max ||
+      (flags & ~frame_flag_content_checksum)
+   ) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(domain_error, ());
+   }
+   block_size = std::size_t(1) << block_size_log2;
+   bin_istream->consume<std::uint8_t>(frame_header_size);
+   header_read = true;
+}
+
+void lz_istream::read_trailer() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (flags & frame_flag_content_checksum) {
+      std::uint8_t const * src;
+      std::size_t src_size;
+      _std::tie(src, src_size) = bin_istream->peek<std::uint8_t>(sizeof(std::uint32_t));
+      if (src_size < sizeof(std::uint32_t)) {
+         // The stream ended before the content checksum.
+         LOFTY_THROW(io::error, ());
+      }
+      std::uint32_t expected_crc;
+      memory::copy(reinterpret_cast<std::uint8_t *>(&expected_crc), src, sizeof expected_crc);
+      if (byte_order::le_to_host(expected_crc) != content_crc.value()) {
+         // The decompressed data doesn’t match what was compressed.
+         // TODO: use a better exception class.
+         LOFTY_THROW(io::error, ());
+      }
+      bin_istream->consume<std::uint8_t>(sizeof(std::uint32_t));
+   }
+}
+
+/*virtual*/ _std::shared_ptr<stream> lz_istream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   // The wrapped stream carries compressed data, so return a non-owning pointer to *this instead.
+   return _std::shared_ptr<stream>(
+      _std::shared_ptr<stream>(), static_cast<stream *>(const_cast<lz_istream *>(this))
+   );
+}
+
+}}} //namespace lofty::io::binary
@@ -0,0 +1,180 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include "mapped_file.hxx"
+
+#if LOFTY_HOST_API_POSIX
+   #include <sys/mman.h> // madvise() mmap() munmap()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace io { namespace binary {
+
+std::size_t const mapped_file_istream::window_size_default;
+std::size_t const mapped_file_istream::readahead_size;
+
+mapped_file_istream::mapped_file_istream(
+   _std::shared_ptr<regular_file_istream> file_, std::size_t window_size_max_
+) :
+   file(_std::move(file_)),
+   window_size_max(window_size_max_),
+   window(nullptr),
+   window_size(0),
+   window_offset(0),
+   used_offset(0),
+   willneed_offset(0),
+   file_size(file->size()) {
+}
+
+/*virtual*/ mapped_file_istream::~mapped_file_istream() {
+   unmap_window();
+}
+
+void mapped_file_istream::advise_willneed() {
+   std::size_t advise_size = std::min(readahead_size, window_size - willneed_offset);
+   if (advise_size > 0) {
+      // This is only a hint, so ignore errors.
+      ::madvise(window + willneed_offset, advise_size, MADV_WILLNEED);
+      willneed_offset += advise_size;
+   }
+}
+
+/*virtual*/ void mapped_file_istream::consume_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > window_size - used_offset) {
+      // Can’t consume more bytes than are available in the window.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   used_offset += count;
+   // Keep the OS loading the file ahead of the reader, by half the readahead size at least.
+   if (willneed_offset < window_size && used_offset + readahead_size / 2 > willneed_offset) {
+      advise_willneed();
+   }
+}
+
+/*virtual*/ _std::tuple<void const *, std::size_t> mapped_file_istream::peek_bytes(
+   std::size_t count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > window_size - used_offset) {
+      slide_window(count);
+   }
+   return _std::make_tuple(window + used_offset, window_size - used_offset);
+}
+
+void mapped_file_istream::slide_window(std::size_t count) {
+   LOFTY_TRACE_FUNC(this, count);
+
+   full_size_t pos;
+   if (used_offset < window_size) {
+      pos = window_offset + used_offset;
+   } else {
+      /* The window has been used up: continue from the file’s position, which is the end of the window unless
+      the file was accessed directly, as copy() does. */
+      pos = static_cast<full_size_t>(file->tell());
+   }
+   if (pos + count > file_size) {
+      // See if the file has grown since we last checked.
+      file_size = file->size();
+      if (pos >= file_size) {
+         // EOF.
+         return;
+      }
+   }
+   if (used_offset < window_size && window_offset + window_size >= file_size) {
+      // The current window already extends to EOF.
+      return;
+   }
+   // Start the new window at the page containing the current position.
+   full_size_t new_window_offset = pos & ~static_cast<full_size_t>(memory::page_size() - 1);
+   std::size_t new_used_offset = static_cast<std::size_t>(pos - new_window_offset);
+   std::size_t new_window_size = std::max(window_size_max, new_used_offset + count);
+   if (new_window_size > file_size - new_window_offset) {
+      new_window_size = static_cast<std::size_t>(file_size - new_window_offset);
+   }
+   void * new_window = ::mmap(
+      nullptr, new_window_size, PROT_READ, MAP_SHARED, file->fd.get(),
+      static_cast< ::off_t>(new_window_offset)
+   );
+   if (new_window == MAP_FAILED) {
+      exception::throw_os_error();
+   }
+   unmap_window();
+   window = static_cast<std::int8_t *>(new_window);
+   window_size = new_window_size;
+   window_offset = new_window_offset;
+   used_offset = new_used_offset;
+   // This is only a hint, so ignore errors.
+   ::madvise(window, window_size, MADV_SEQUENTIAL);
+   willneed_offset = new_used_offset & ~(memory::page_size() - 1);
+   advise_willneed();
+   /* Leave the file’s position at the end of the window, as if the window were a read buffer that was just
+   filled; this keeps unbuffered() consistent with what’s been “read”, as copy() expects. */
+   file->seek(static_cast<offset_t>(window_offset + window_size), seek_from::start);
+}
+
+void mapped_file_istream::unmap_window() {
+   if (window) {
+      ::munmap(window, window_size);
+      window = nullptr;
+   }
+}
+
+/*virtual*/ _std::shared_ptr<stream> mapped_file_istream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   return _std::static_pointer_cast<stream>(file);
+}
+
+}}} //namespace lofty::io::binary
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+_std::shared_ptr<buffered_istream> map_istream(
+   _std::shared_ptr<istream> bin_istream, std::size_t window_size_max /*= 0*/
+) {
+   LOFTY_TRACE_FUNC(bin_istream, window_size_max);
+
+#if LOFTY_HOST_API_POSIX
+   if (auto file = _std::dynamic_pointer_cast<regular_file_istream>(bin_istream)) {
+      return _std::make_shared<mapped_file_istream>(
+         _std::move(file), window_size_max ? window_size_max : mapped_file_istream::window_size_default
+      );
+   }
+#elif LOFTY_HOST_API_WIN32
+   // TODO: implement a mapped_file_istream using CreateFileMapping() and MapViewOfFile().
+#else
+   #error "TODO: HOST_API"
+#endif
+   return buffer_istream(_std::move(bin_istream));
+}
+
+}}} //namespace lofty::io::binary
@@ -0,0 +1,111 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_IO_BINARY_MAPPED_FILE_HXX
+#define _LOFTY_IO_BINARY_MAPPED_FILE_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/io/binary.hxx>
+#include "file-subclasses.hxx"
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace io { namespace binary {
+
+/*! Buffered input stream for regular files, using a memory mapping of the file in place of a read buffer. See
+map_istream(). */
+class LOFTY_SYM mapped_file_istream : public buffered_istream, public noncopyable {
+public:
+   //! Default maximum size of a window: large, but a small fraction of the address space.
+   static std::size_t const window_size_default = sizeof(void *) > 4 ? 0x40000000 : 0x4000000;
+   //! Amount of the file the OS is asked to load ahead of the current position.
+   static std::size_t const readahead_size = 0x200000;
+
+public:
+   /*! Constructor.
+
+   @param file
+      Pointer to the file to map.
+   @param window_size_max
+      Maximum size of the part of the file mapped at a time.
+   */
+   mapped_file_istream(_std::shared_ptr<regular_file_istream> file, std::size_t window_size_max);
+
+   //! Destructor.
+   virtual ~mapped_file_istream();
+
+   //! See buffered_istream::consume_bytes().
+   virtual void consume_bytes(std::size_t count) override;
+
+   //! See buffered_istream::peek_bytes().
+   virtual _std::tuple<void const *, std::size_t> peek_bytes(std::size_t count) override;
+
+protected:
+   //! See buffered_istream::_unbuffered_stream().
+   virtual _std::shared_ptr<stream> _unbuffered_stream() const override;
+
+private:
+   //! Asks the OS to load the next readahead_size bytes after willneed_offset, and advances it.
+   void advise_willneed();
+
+   /*! Replaces the current window with one that starts at the current position and includes at least count
+   bytes, or as many as the file has left.
+
+   @param count
+      Minimum count of bytes to map after the current position.
+   */
+   void slide_window(std::size_t count);
+
+   //! Releases the current window, if any.
+   void unmap_window();
+
+private:
+   //! Mapped file.
+   _std::shared_ptr<regular_file_istream> file;
+   //! Maximum size of a window.
+   std::size_t window_size_max;
+   //! Start of the mapped window, or nullptr if no part of the file is mapped.
+   std::int8_t * window;
+   //! Size of the mapped window.
+   std::size_t window_size;
+   //! Offset of the window in the file; always a multiple of the page size.
+   full_size_t window_offset;
+   //! Offset of the current position in the window.
+   std::size_t used_offset;
+   //! Offset in the window of the end of the part the OS has been asked to load ahead of time.
+   std::size_t willneed_offset;
+   //! Size of the file, as last queried.
+   full_size_t file_size;
+};
+
+}}} //namespace lofty::io::binary
+
+#endif //if LOFTY_HOST_API_POSIX
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_IO_BINARY_MAPPED_FILE_HXX
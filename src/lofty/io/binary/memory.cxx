@@ -0,0 +1,165 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary/memory.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+memory_istream::memory_istream(void const * src_, std::size_t src_size) :
+   src_begin(static_cast<std::uint8_t const *>(src_)),
+   src(src_begin),
+   src_end(src_begin + src_size) {
+}
+
+/*virtual*/ memory_istream::~memory_istream() {
+}
+
+/*virtual*/ void memory_istream::consume_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   if (count > remaining_size()) {
+      // Can’t consume more bytes than are available.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   src += count;
+}
+
+/*virtual*/ _std::tuple<void const *, std::size_t> memory_istream::peek_bytes(
+   std::size_t count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   // All the data is always available, regardless of count.
+   LOFTY_UNUSED_ARG(count);
+   return _std::make_tuple(static_cast<void const *>(src), remaining_size());
+}
+
+/*virtual*/ std::size_t memory_istream::read(void * dst, std::size_t dst_max) /*override*/ {
+   LOFTY_TRACE_FUNC(this, dst, dst_max);
+
+   std::size_t ret = remaining_size();
+   if (ret > dst_max) {
+      ret = dst_max;
+   }
+   memory::copy(static_cast<std::uint8_t *>(dst), src, ret);
+   src += ret;
+   return ret;
+}
+
+/*virtual*/ full_size_t memory_istream::size() const /*override*/ {
+   return static_cast<full_size_t>(src_end - src_begin);
+}
+
+/*virtual*/ _std::shared_ptr<stream> memory_istream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   // There’s no underlying stream, so return a non-owning pointer to *this.
+   return _std::shared_ptr<stream>(
+      _std::shared_ptr<stream>(), static_cast<stream *>(const_cast<memory_istream *>(this))
+   );
+}
+
+}}} //namespace lofty::io::binary
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace io { namespace binary {
+
+memory_ostream::memory_ostream() :
+   buf(&default_buf) {
+}
+
+memory_ostream::memory_ostream(external_buffer_t const &, collections::vector<std::uint8_t> * ext_buf) :
+   buf(ext_buf) {
+}
+
+/*virtual*/ memory_ostream::~memory_ostream() {
+}
+
+void memory_ostream::clear() {
+   LOFTY_TRACE_FUNC(this);
+
+   buf->set_size(0);
+}
+
+/*virtual*/ void memory_ostream::commit_bytes(std::size_t count) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   std::size_t size = buf->size();
+   if (count > buf->capacity() - size) {
+      // Can’t commit more bytes than were returned by get_buffer_bytes().
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   // The bytes are already in the vector’s spare capacity, so this won’t reallocate.
+   buf->set_size(size + count);
+}
+
+/*virtual*/ void memory_ostream::finalize() /*override*/ {
+   // Nothing to do.
+}
+
+/*virtual*/ void memory_ostream::flush() /*override*/ {
+   // Nothing to do.
+}
+
+/*virtual*/ _std::tuple<void *, std::size_t> memory_ostream::get_buffer_bytes(
+   std::size_t count
+) /*override*/ {
+   LOFTY_TRACE_FUNC(this, count);
+
+   std::size_t size = buf->size();
+   if (buf->capacity() - size < count) {
+      // The vector grows geometrically, so repeated small requests are amortized.
+      buf->set_capacity(size + count, true);
+   }
+   return _std::make_tuple(static_cast<void *>(buf->data() + size), buf->capacity() - size);
+}
+
+collections::vector<std::uint8_t> memory_ostream::release_content() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (buf == &default_buf) {
+      return _std::move(default_buf);
+   } else {
+      return collections::vector<std::uint8_t>();
+   }
+}
+
+/*virtual*/ std::size_t memory_ostream::write(void const * src, std::size_t src_size) /*override*/ {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   buf->push_back(static_cast<std::uint8_t const *>(src), src_size);
+   return src_size;
+}
+
+/*virtual*/ _std::shared_ptr<stream> memory_ostream::_unbuffered_stream() const /*override*/ {
+   LOFTY_TRACE_FUNC(this);
+
+   // There’s no underlying stream, so return a non-owning pointer to *this.
+   return _std::shared_ptr<stream>(
+      _std::shared_ptr<stream>(), static_cast<stream *>(const_cast<memory_ostream *>(this))
+   );
+}
+
+}}} //namespace lofty::io::binary
@@ -0,0 +1,171 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2015-2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/net/ip.hxx>
+#include <lofty/thread.hxx>
+#include "socket.hxx"
+
+#if LOFTY_HOST_API_POSIX
+   #include <arpa/inet.h> // htons() ntohs()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace _pvt {
+
+std::size_t address_and_port_to_sockaddr(ip::address const & address, ip::port const & port, sockaddr_any * sa) {
+   switch (address.version().base()) {
+      case ip::version::v4:
+         memory::clear(&sa->sa4);
+         sa->sa4.sin_family = AF_INET;
+         memory::copy(
+            reinterpret_cast<std::uint8_t *>(&sa->sa4.sin_addr.s_addr), address.raw(),
+            sizeof sa->sa4.sin_addr.s_addr
+         );
+         sa->sa4.sin_port = htons(port.number());
+         return sizeof sa->sa4;
+      case ip::version::v6:
+         memory::clear(&sa->sa6);
+         //sa->sa6.sin6_flowinfo = 0;
+         sa->sa6.sin6_family = AF_INET6;
+         memory::copy(&sa->sa6.sin6_addr.s6_addr[0], address.raw(), sizeof sa->sa6.sin6_addr.s6_addr);
+         sa->sa6.sin6_port = htons(port.number());
+         return sizeof sa->sa6;
+      default:
+         // TODO: provide more information in the exception.
+         LOFTY_THROW(domain_error, ());
+   }
+}
+
+io::filedesc create_socket(int family, int type) {
+   LOFTY_TRACE_FUNC(family, type);
+
+   bool async = (this_thread::coroutine_scheduler() != nullptr);
+#if LOFTY_HOST_API_POSIX
+   #if !LOFTY_HOST_API_DARWIN
+      type |= SOCK_CLOEXEC;
+      if (async) {
+         // Using coroutines, so make this socket non-blocking.
+         type |= SOCK_NONBLOCK;
+      }
+   #endif
+   io::filedesc fd(::socket(family, type, 0));
+   if (!fd) {
+      exception::throw_os_error();
+   }
+   #if LOFTY_HOST_API_DARWIN
+      /* Note that at this point there’s no hack that will ensure a fork()/exec() from another thread won’t
+      leak the file descriptor. That’s the whole point of the extra SOCK_* flags. */
+      fd.set_close_on_exec(true);
+      if (async) {
+         fd.set_nonblocking(true);
+      }
+   #endif
+   return _std::move(fd);
+#elif LOFTY_HOST_API_WIN32 //if LOFTY_HOST_API_POSIX
+   static std::uint8_t const wsa_major_version = 2, wsa_minor_version = 2;
+   ::WSADATA wsa_data;
+   if (int ret = ::WSAStartup(MAKEWORD(wsa_major_version, wsa_minor_version), &wsa_data)) {
+      exception::throw_os_error(static_cast<errint_t>(ret));
+   }
+   if (LOBYTE(wsa_data.wVersion) != wsa_major_version || HIBYTE(wsa_data.wVersion) != wsa_minor_version) {
+      // The loaded WinSock implementation does not support the requested version.
+      ::WSACleanup();
+      // TODO: use a better exception class.
+      LOFTY_THROW(generic_error, ());
+   }
+
+   ::DWORD flags = 0;
+   if (async) {
+      flags |= WSA_FLAG_OVERLAPPED;
+   }
+   #ifdef WSA_FLAG_NO_HANDLE_INHERIT
+      flags |= WSA_FLAG_NO_HANDLE_INHERIT;
+   #endif
+   ::SOCKET sock = ::WSASocket(family, type, 0, nullptr, 0, flags);
+   if (sock == INVALID_SOCKET) {
+      exception::throw_os_error();
+   }
+   return io::filedesc(reinterpret_cast<io::filedesc_t>(sock));
+#else //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32
+   #error "TODO: HOST_API"
+#endif //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32 … else
+}
+
+io::filedesc create_socket(ip::version ip_version, int type) {
+   LOFTY_TRACE_FUNC(ip_version, type);
+
+   int family;
+   switch (ip_version.base()) {
+      case ip::version::v4:
+         family = AF_INET;
+         break;
+      case ip::version::v6:
+         family = AF_INET6;
+         break;
+      default:
+         // TODO: provide more information in the exception.
+         LOFTY_THROW(domain_error, ());
+   }
+   return create_socket(family, type);
+}
+
+void get_socket_name(io::filedesc_t fd, ip::version ip_version, ip::address * address, ip::port * port) {
+   LOFTY_TRACE_FUNC(fd, ip_version, address, port);
+
+   sockaddr_any sa;
+#if LOFTY_HOST_API_POSIX
+   ::socklen_t sa_size = sizeof sa;
+   if (::getsockname(fd, reinterpret_cast< ::sockaddr *>(&sa), &sa_size) < 0) {
+      exception::throw_os_error();
+   }
+#elif LOFTY_HOST_API_WIN32
+   int sa_size = sizeof sa;
+   if (::getsockname(reinterpret_cast< ::SOCKET>(fd), reinterpret_cast< ::SOCKADDR *>(&sa), &sa_size) < 0) {
+      exception::throw_os_error(static_cast<errint_t>(::WSAGetLastError()));
+   }
+#else
+   #error "TODO: HOST_API"
+#endif
+   sockaddr_to_address_and_port(sa, static_cast<std::size_t>(sa_size), ip_version, address, port);
+}
+
+void sockaddr_to_address_and_port(
+   sockaddr_any const & sa, std::size_t sa_size, ip::version ip_version, ip::address * address, ip::port * port
+) {
+   switch (ip_version.base()) {
+      case ip::version::v4:
+         if (sa_size == sizeof sa.sa4) {
+            *address = ip::address(*reinterpret_cast<ip::address::v4_type const *>(&sa.sa4.sin_addr.s_addr));
+            *port = ip::port(ntohs(sa.sa4.sin_port));
+         }
+         break;
+      case ip::version::v6:
+         if (sa_size == sizeof sa.sa6) {
+            *address = ip::address(*reinterpret_cast<ip::address::v6_type const *>(&sa.sa6.sin6_addr.s6_addr));
+            *port = ip::port(ntohs(sa.sa6.sin6_port));
+         }
+         break;
+      LOFTY_SWITCH_WITHOUT_DEFAULT
+   }
+}
+
+}}} //namespace lofty::net::_pvt
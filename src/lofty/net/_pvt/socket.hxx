@@ -0,0 +1,131 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2015-2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_NET__PVT_SOCKET_HXX
+#define _LOFTY_NET__PVT_SOCKET_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/net/ip.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <netinet/in.h> // sockaddr_in sockaddr_in6
+   #include <sys/types.h> // sockaddr
+   #include <sys/socket.h> // SOCK_*
+#elif LOFTY_HOST_API_WIN32
+   #include <winsock2.h>
+   #if LOFTY_HOST_CXX_MSC
+      // Silence warnings from system header files.
+      #pragma warning(push)
+
+      // “'id' : conversion from 'type1' to 'type2', signed / unsigned mismatch”
+      #pragma warning(disable: 4365)
+   #endif
+   #include <ws2tcpip.h>
+   #if LOFTY_HOST_CXX_MSC
+      #pragma warning(pop)
+   #endif
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace _pvt {
+
+//! Storage for a socket address of any of the supported IP versions.
+union sockaddr_any {
+   ::sockaddr_in sa4;
+   ::sockaddr_in6 sa6;
+};
+
+/*! Fills a socket address with an IP address and port.
+
+@param address
+   IP address.
+@param port
+   Port.
+@param sa
+   Pointer to the destination socket address.
+@return
+   Size of the socket address.
+*/
+std::size_t address_and_port_to_sockaddr(ip::address const & address, ip::port const & port, sockaddr_any * sa);
+
+/*! Creates a socket, making it non-blocking if the current thread has a coroutine scheduler. On Win32, this
+also initializes WinSock, so each call must be matched by a call to ::WSACleanup() once the socket is closed.
+
+@param family
+   Address family, e.g. AF_INET.
+@param type
+   Socket type, e.g. SOCK_STREAM.
+@return
+   New socket.
+*/
+io::filedesc create_socket(int family, int type);
+
+/*! Creates a socket for the specified IP version. See create_socket(int, int).
+
+@param ip_version
+   IP version.
+@param type
+   Socket type, e.g. SOCK_STREAM.
+@return
+   New socket.
+*/
+io::filedesc create_socket(ip::version ip_version, int type);
+
+/*! Retrieves the local address and port a socket is bound to.
+
+@param fd
+   Socket.
+@param ip_version
+   IP version of the socket.
+@param address
+   Pointer to the destination IP address.
+@param port
+   Pointer to the destination port.
+*/
+void get_socket_name(io::filedesc_t fd, ip::version ip_version, ip::address * address, ip::port * port);
+
+/*! Converts a socket address into an IP address and port.
+
+@param sa
+   Socket address to convert.
+@param sa_size
+   Size of the socket address, as returned by the OS.
+@param ip_version
+   IP version of the socket the address refers to.
+@param address
+   Pointer to the destination IP address. Not modified if the address is not of the expected size.
+@param port
+   Pointer to the destination port. Not modified if the address is not of the expected size.
+*/
+void sockaddr_to_address_and_port(
+   sockaddr_any const & sa, std::size_t sa_size, ip::version ip_version, ip::address * address, ip::port * port
+);
+
+}}} //namespace lofty::net::_pvt
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_NET__PVT_SOCKET_HXX
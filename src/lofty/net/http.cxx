@@ -0,0 +1,1078 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/net/http.hxx>
+#include <lofty/numeric.hxx>
+#include <lofty/text.hxx>
+
+#include <cstring> // std::memchr() std::memcmp()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+namespace {
+
+/*! Returns the lowercase version of an ASCII letter; other characters are returned unchanged.
+
+@param ch
+   Character to convert.
+@return
+   Converted character.
+*/
+inline char ascii_to_lower(char ch) {
+   return ch >= 'A' && ch <= 'Z' ? static_cast<char>(ch + ('a' - 'A')) : ch;
+}
+
+/*! Appends a NUL-terminated ASCII string to a byte buffer.
+
+@param buf
+   Buffer to append to.
+@param s
+   String to append.
+*/
+void append_ascii(collections::vector<std::uint8_t> * buf, char const * s) {
+   buf->push_back(reinterpret_cast<std::uint8_t const *>(s), std::strlen(s));
+}
+
+/*! Appends the decimal representation of a number to a byte buffer.
+
+@param buf
+   Buffer to append to.
+@param n
+   Number to append.
+*/
+void append_decimal(collections::vector<std::uint8_t> * buf, std::size_t n) {
+   std::uint8_t digits[24], * digits_begin = digits + sizeof digits;
+   do {
+      *--digits_begin = static_cast<std::uint8_t>('0' + n % 10);
+      n /= 10;
+   } while (n);
+   buf->push_back(digits_begin, static_cast<std::size_t>(digits + sizeof digits - digits_begin));
+}
+
+/*! Appends the hexadecimal representation of a number to a byte buffer.
+
+@param buf
+   Buffer to append to.
+@param n
+   Number to append.
+*/
+void append_hex(collections::vector<std::uint8_t> * buf, std::size_t n) {
+   static char const hex_digits[] = "0123456789abcdef";
+   std::uint8_t digits[16], * digits_begin = digits + sizeof digits;
+   do {
+      *--digits_begin = static_cast<std::uint8_t>(hex_digits[n & 0xf]);
+      n >>= 4;
+   } while (n);
+   buf->push_back(digits_begin, static_cast<std::size_t>(digits + sizeof digits - digits_begin));
+}
+
+/*! Appends a string to a byte buffer, encoded as UTF-8.
+
+@param buf
+   Buffer to append to.
+@param s
+   String to append.
+*/
+void append_str(collections::vector<std::uint8_t> * buf, str const & s) {
+#if LOFTY_HOST_UTF == 8
+   buf->push_back(reinterpret_cast<std::uint8_t const *>(s.data()), s.size_in_bytes());
+#else
+   auto bytes(s.encode(text::encoding::utf8, false));
+   buf->push_back(bytes.data(), bytes.size());
+#endif
+}
+
+/*! Returns true if a view contains exactly the specified bytes.
+
+@param view
+   View to compare.
+@param bytes
+   Bytes to compare with.
+@return
+   true if the contents of view and bytes are the same, or false otherwise.
+*/
+bool view_equals(bytes_view const & view, collections::vector<std::uint8_t> const & bytes) {
+   return view.size() == bytes.size() && std::memcmp(view.data(), bytes.data(), bytes.size()) == 0;
+}
+
+/*! Returns the reason phrase for an HTTP status code.
+
+@param code
+   HTTP status code.
+@return
+   Reason phrase.
+*/
+char const * get_reason_phrase(unsigned code) {
+   switch (code) {
+      case 100: return "Continue";
+      case 101: return "Switching Protocols";
+      case 200: return "OK";
+      case 201: return "Created";
+      case 202: return "Accepted";
+      case 204: return "No Content";
+      case 206: return "Partial Content";
+      case 301: return "Moved Permanently";
+      case 302: return "Found";
+      case 303: return "See Other";
+      case 304: return "Not Modified";
+      case 307: return "Temporary Redirect";
+      case 308: return "Permanent Redirect";
+      case 400: return "Bad Request";
+      case 401: return "Unauthorized";
+      case 403: return "Forbidden";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 408: return "Request Timeout";
+      case 409: return "Conflict";
+      case 411: return "Length Required";
+      case 413: return "Content Too Large";
+      case 414: return "URI Too Long";
+      case 415: return "Unsupported Media Type";
+      case 417: return "Expectation Failed";
+      case 429: return "Too Many Requests";
+      case 431: return "Request Header Fields Too Large";
+      case 500: return "Internal Server Error";
+      case 501: return "Not Implemented";
+      case 502: return "Bad Gateway";
+      case 503: return "Service Unavailable";
+      case 505: return "HTTP Version Not Supported";
+      default:  return "Unknown";
+   }
+}
+
+/*! Throws if a string contains characters that would break the framing of an HTTP header.
+
+@param s
+   String to validate.
+*/
+void validate_header_str(str const & s) {
+   LOFTY_FOR_EACH(char32_t cp, s) {
+      if (cp == '\r' || cp == '\n' || cp == '\0') {
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+      }
+   }
+}
+
+} //namespace
+
+bool bytes_view::equals(char const * s) const {
+   std::size_t s_size = std::strlen(s);
+   return s_size == chars_size && std::memcmp(chars, s, s_size) == 0;
+}
+
+bool bytes_view::equals_ignore_case(char const * s) const {
+   std::size_t s_size = std::strlen(s);
+   if (s_size != chars_size) {
+      return false;
+   }
+   for (std::size_t i = 0; i < s_size; ++i) {
+      if (ascii_to_lower(chars[i]) != ascii_to_lower(s[i])) {
+         return false;
+      }
+   }
+   return true;
+}
+
+bool bytes_view::starts_with(char const * s, std::size_t s_size) const {
+   return s_size <= chars_size && std::memcmp(chars, s, s_size) == 0;
+}
+
+str bytes_view::to_str() const {
+   LOFTY_TRACE_FUNC(this);
+
+   str ret;
+   void const * src = chars;
+   std::size_t src_size = chars_size;
+   std::size_t dst_size = text::transcode(false, text::encoding::utf8, &src, &src_size, text::encoding::host);
+   ret.set_size_in_chars(dst_size / sizeof(text::char_t));
+   void * dst = ret.data();
+   text::transcode(false, text::encoding::utf8, &src, &src_size, text::encoding::host, &dst, &dst_size);
+   return _std::move(ret);
+}
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+request::request() {
+   reset();
+}
+
+void request::reset() {
+   chars = nullptr;
+   method_range = range();
+   target_range = range();
+   path_range = range();
+   query_range = range();
+   headers.set_size(0);
+   body_chars = nullptr;
+   body_size = 0;
+   ver_minor = 1;
+   persistent = false;
+}
+
+bytes_view request::header(char const * name) const {
+   LOFTY_FOR_EACH(auto const & hdr, headers) {
+      if (view(hdr.name).equals_ignore_case(name)) {
+         return view(hdr.value);
+      }
+   }
+   return bytes_view();
+}
+
+bytes_view request::header_name(std::size_t i) const {
+   return view(headers[static_cast<std::ptrdiff_t>(i)].name);
+}
+
+bytes_view request::header_value(std::size_t i) const {
+   return view(headers[static_cast<std::ptrdiff_t>(i)].value);
+}
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+response::response(io::binary::ostream * bin_ostream_) :
+   bin_ostream(bin_ostream_) {
+   reset(1, false, false);
+}
+
+void response::add_header(str const & name, str const & value) {
+   LOFTY_TRACE_FUNC(this, name, value);
+
+   if (head_sent) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   validate_header_str(name);
+   validate_header_str(value);
+   append_str(&headers_buf, name);
+   append_ascii(&headers_buf, ": ");
+   append_str(&headers_buf, value);
+   append_ascii(&headers_buf, "\r\n");
+}
+
+void response::close_connection() {
+   persistent = false;
+}
+
+void response::enable_chunked() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (head_sent) {
+      return;
+   }
+   if (ver_minor == 0) {
+      // HTTP/1.0 doesn’t support chunked transfer encoding; the end of the body will be signaled by closing.
+      persistent = false;
+   } else {
+      chunked = true;
+   }
+   send_head(numeric::max<std::size_t>::value);
+   // Let the client see the head right away, since the body may take a while.
+   flush();
+}
+
+void response::finish() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (!head_sent) {
+      send_head(body_buf.size());
+      if (!omit_body && body_buf.size()) {
+         send_bytes(body_buf.data(), body_buf.size(), nullptr, 0);
+      }
+   } else if (chunked && !omit_body) {
+      // Last chunk, with no trailers.
+      append_ascii(&out_buf, "0\r\n\r\n");
+   }
+   body_buf.set_size(0);
+   headers_buf.set_size(0);
+}
+
+void response::flush() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (std::size_t out_buf_size = out_buf.size()) {
+      bin_ostream->write(out_buf.data(), out_buf_size);
+      out_buf.set_size(0);
+   }
+}
+
+void response::reset(unsigned ver_minor_, bool persistent_, bool omit_body_) {
+   status_code = 200;
+   ver_minor = ver_minor_;
+   persistent = persistent_;
+   omit_body = omit_body_;
+   chunked = false;
+   head_sent = false;
+   headers_buf.set_size(0);
+   body_buf.set_size(0);
+}
+
+void response::send_bytes(void const * src, std::size_t src_size, char const * suffix, std::size_t suffix_size) {
+   LOFTY_TRACE_FUNC(this, src, src_size, suffix_size);
+
+   if (src_size >= pass_through_size_min) {
+      // Send the queued bytes, src and suffix with a single gather write, without copying src.
+      io::binary::const_buffer bufs[3];
+      std::size_t bufs_count = 0;
+      if (out_buf.size()) {
+         bufs[bufs_count].src = out_buf.data();
+         bufs[bufs_count].src_size = out_buf.size();
+         ++bufs_count;
+      }
+      bufs[bufs_count].src = src;
+      bufs[bufs_count].src_size = src_size;
+      ++bufs_count;
+      if (suffix_size) {
+         bufs[bufs_count].src = suffix;
+         bufs[bufs_count].src_size = suffix_size;
+         ++bufs_count;
+      }
+      bin_ostream->write_buffers(bufs, bufs_count);
+      out_buf.set_size(0);
+   } else {
+      out_buf.push_back(static_cast<std::uint8_t const *>(src), src_size);
+      if (suffix_size) {
+         out_buf.push_back(reinterpret_cast<std::uint8_t const *>(suffix), suffix_size);
+      }
+   }
+}
+
+void response::send_head(std::size_t content_length) {
+   LOFTY_TRACE_FUNC(this, content_length);
+
+   if (status_code == 204 || status_code == 304 || status_code < 200) {
+      // These responses never have a body.
+      omit_body = true;
+   }
+   append_ascii(&out_buf, "HTTP/1.1 ");
+   append_decimal(&out_buf, status_code);
+   out_buf.push_back(' ');
+   append_ascii(&out_buf, get_reason_phrase(status_code));
+   append_ascii(&out_buf, "\r\n");
+   if (chunked) {
+      append_ascii(&out_buf, "Transfer-Encoding: chunked\r\n");
+   } else if (
+      content_length != numeric::max<std::size_t>::value && status_code != 204 && status_code != 304 &&
+      status_code >= 200
+   ) {
+      append_ascii(&out_buf, "Content-Length: ");
+      append_decimal(&out_buf, content_length);
+      append_ascii(&out_buf, "\r\n");
+   }
+   if (!persistent) {
+      append_ascii(&out_buf, "Connection: close\r\n");
+   } else if (ver_minor == 0) {
+      append_ascii(&out_buf, "Connection: keep-alive\r\n");
+   }
+   out_buf.push_back(headers_buf.data(), headers_buf.size());
+   append_ascii(&out_buf, "\r\n");
+   head_sent = true;
+}
+
+void response::set_status(unsigned code) {
+   if (head_sent || code < 100 || code > 999) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   status_code = code;
+}
+
+void response::write(void const * src, std::size_t src_size) {
+   LOFTY_TRACE_FUNC(this, src, src_size);
+
+   if (!head_sent) {
+      body_buf.push_back(static_cast<std::uint8_t const *>(src), src_size);
+   } else if (omit_body || src_size == 0) {
+      // Nothing to send; an empty chunk would also terminate the body.
+   } else if (chunked) {
+      append_hex(&out_buf, src_size);
+      append_ascii(&out_buf, "\r\n");
+      send_bytes(src, src_size, "\r\n", 2);
+   } else {
+      // The body is delimited by closing the connection.
+      send_bytes(src, src_size, nullptr, 0);
+   }
+}
+
+void response::write(str const & s) {
+   LOFTY_TRACE_FUNC(this, s);
+
+#if LOFTY_HOST_UTF == 8
+   write(s.data(), s.size_in_bytes());
+#else
+   auto bytes(s.encode(text::encoding::utf8, false));
+   write(bytes.data(), bytes.size());
+#endif
+}
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http { namespace _pvt {
+
+//! Reads requests from a connection, invoking the request handler for each of them and sending the responses.
+class connection_engine : public noncopyable {
+public:
+   /*! Constructor.
+
+   @param bin_istream
+      Stream to read requests from.
+   @param bin_ostream_
+      Stream to write responses to.
+   @param handler_
+      Function to invoke for each request.
+   @param lims_
+      Limits to apply to the connection.
+   */
+   connection_engine(
+      _std::shared_ptr<io::binary::istream> bin_istream, io::binary::ostream * bin_ostream_,
+      request_handler_type const & handler_, server::limits const & lims_
+   ) :
+      // Keep-alive connections spend most of their time idle, so don’t let them hold on to a read buffer.
+      buf_istream(io::binary::buffer_istream(
+         _std::move(bin_istream), io::binary::buffer_sizing().set_release_when_idle(true)
+      )),
+      resp(bin_ostream_),
+      handler(handler_),
+      lims(lims_) {
+   }
+
+   //! Serves requests until the connection is closed by either side.
+   void run();
+
+private:
+   /*! Ensures that at least the specified count of bytes are available in the read buffer, reading more if
+   necessary. Any queued responses are sent before blocking to wait for more data.
+
+   @param size
+      Count of bytes needed.
+   @param avail
+      Pointer to a variable that will receive the count of bytes available in the read buffer, which will be
+      less than size only in case of EOF.
+   @return
+      Pointer to the start of the read buffer.
+   */
+   char const * fill(std::size_t size, std::size_t * avail);
+
+   /*! Waits for a complete request line and headers.
+
+   @param head_size
+      Pointer to a variable that will receive the size of the request line and headers, including the
+      terminating empty line.
+   @return
+      0 if a head was read, 1 if the connection was closed before a request started, or an HTTP status code
+      if the head is invalid.
+   */
+   unsigned read_head(std::size_t * head_size);
+
+   /*! Parses the request line and headers into req.
+
+   @param chars
+      Start of the head in the read buffer.
+   @param head_size
+      Size of the head.
+   @return
+      0 if the head is valid, or an HTTP status code otherwise.
+   */
+   unsigned parse_head(char const * chars, std::size_t head_size);
+
+   /*! Reads a body sent with chunked transfer encoding, decoding it into chunked_body.
+
+   @param offset
+      Offset of the first chunk in the read buffer.
+   @param raw_size
+      Pointer to a variable that will receive the size of the encoded body.
+   @return
+      0 if the body was read, 1 if the connection was closed before its end, or an HTTP status code if the body
+      is invalid.
+   */
+   unsigned read_chunked_body(std::size_t offset, std::size_t * raw_size);
+
+   /*! Reads a line from the read buffer, starting at the specified offset.
+
+   @param offset
+      Offset of the line in the read buffer.
+   @param line_size
+      Pointer to a variable that will receive the size of the line, excluding its terminator.
+   @param next_offset
+      Pointer to a variable that will receive the offset of the next line.
+   @return
+      0 if a line was read, 1 if the connection was closed before its end, or 400 if the line is too long.
+   */
+   unsigned read_line(std::size_t offset, std::size_t * line_size, std::size_t * next_offset);
+
+   /*! Sends a response with no body, closing the connection afterwards.
+
+   @param status
+      HTTP status code.
+   */
+   void send_error(unsigned status);
+
+private:
+   //! Maximum length of a chunk size line in a chunked body.
+   static std::size_t const chunk_line_size_max = 0x400;
+
+   //! Buffered stream to read requests from.
+   _std::shared_ptr<io::binary::buffered_istream> buf_istream;
+   //! Current request.
+   request req;
+   //! Response to the current request.
+   response resp;
+   //! Decoded chunked request body; reused for every request.
+   collections::vector<std::uint8_t> chunked_body;
+   //! Function to invoke for each request.
+   request_handler_type const & handler;
+   //! Limits to apply to the connection.
+   server::limits const & lims;
+   //! Size of the request body, if delimited by a Content-Length header.
+   std::size_t content_length;
+   //! true if the request body uses chunked transfer encoding.
+   bool chunked:1;
+   //! true if the client expects a 100 Continue response before sending the body.
+   bool expect_continue:1;
+};
+
+char const * connection_engine::fill(std::size_t size, std::size_t * avail) {
+   auto peeked(buf_istream->peek_bytes(0));
+   if (_std::get<1>(peeked) < size) {
+      /* Before possibly blocking for more data, send the responses to any pipelined requests; otherwise, keep
+      them queued to send them together. */
+      if (resp.has_pending_output()) {
+         resp.flush();
+      }
+      peeked = buf_istream->peek_bytes(size);
+   }
+   *avail = _std::get<1>(peeked);
+   return static_cast<char const *>(_std::get<0>(peeked));
+}
+
+unsigned connection_engine::read_head(std::size_t * head_size) {
+   LOFTY_TRACE_FUNC(this, head_size);
+
+   // Offset of the first byte not yet scanned, and of the start of the line being scanned.
+   std::size_t scanned_size = 0, line_begin = 0;
+   for (;;) {
+      std::size_t avail;
+      char const * chars = fill(scanned_size + 1, &avail);
+      if (avail == scanned_size) {
+         // EOF; if a request had started, it’s incomplete.
+         return line_begin == 0 && scanned_size == 0 ? 1u : 400u;
+      }
+      // Look for the empty line that terminates the head, only scanning the newly-read bytes.
+      while (char const * lf = static_cast<char const *>(
+         std::memchr(chars + scanned_size, '\n', avail - scanned_size)
+      )) {
+         std::size_t lf_offset = static_cast<std::size_t>(lf - chars);
+         std::size_t line_size = lf_offset - line_begin;
+         if (line_size > 0 && chars[lf_offset - 1] == '\r') {
+            --line_size;
+         }
+         scanned_size = lf_offset + 1;
+         if (line_size == 0) {
+            if (line_begin > 0) {
+               *head_size = scanned_size;
+               return 0;
+            }
+            // Empty lines before a request line are to be ignored (RFC 7230 § 3.5).
+            buf_istream->consume_bytes(scanned_size);
+            chars += scanned_size;
+            avail -= scanned_size;
+            scanned_size = 0;
+         }
+         line_begin = scanned_size;
+      }
+      scanned_size = avail;
+      if (avail >= lims.head_size_max) {
+         return 431;
+      }
+   }
+}
+
+unsigned connection_engine::parse_head(char const * chars, std::size_t head_size) {
+   LOFTY_TRACE_FUNC(this, head_size);
+
+   req.reset();
+   content_length = 0;
+   chunked = false;
+   expect_continue = false;
+   bool content_length_found = false, transfer_encoding_found = false, connection_close = false;
+   bool connection_keep_alive = false;
+
+   char const * head_end = chars + head_size;
+   // Parse the request line: method SP request-target SP HTTP-version.
+   char const * line_end = static_cast<char const *>(std::memchr(chars, '\n', head_size));
+   char const * line_content_end = line_end > chars && line_end[-1] == '\r' ? line_end - 1 : line_end;
+   char const * method_end = static_cast<char const *>(
+      std::memchr(chars, ' ', static_cast<std::size_t>(line_content_end - chars))
+   );
+   if (!method_end || method_end == chars) {
+      return 400;
+   }
+   char const * target_begin = method_end + 1;
+   char const * target_end = static_cast<char const *>(
+      std::memchr(target_begin, ' ', static_cast<std::size_t>(line_content_end - target_begin))
+   );
+   if (!target_end || target_end == target_begin) {
+      return 400;
+   }
+   bytes_view version(target_end + 1, static_cast<std::size_t>(line_content_end - (target_end + 1)));
+   if (version.equals("HTTP/1.1")) {
+      req.ver_minor = 1;
+   } else if (version.equals("HTTP/1.0")) {
+      req.ver_minor = 0;
+   } else if (version.starts_with("HTTP/", 5)) {
+      return 505;
+   } else {
+      return 400;
+   }
+   req.method_range.begin = 0;
+   req.method_range.size = static_cast<std::uint32_t>(method_end - chars);
+   req.target_range.begin = static_cast<std::uint32_t>(target_begin - chars);
+   req.target_range.size = static_cast<std::uint32_t>(target_end - target_begin);
+   req.path_range = req.target_range;
+   if (char const * qmark = static_cast<char const *>(
+      std::memchr(target_begin, '?', static_cast<std::size_t>(target_end - target_begin))
+   )) {
+      req.path_range.size = static_cast<std::uint32_t>(qmark - target_begin);
+      req.query_range.begin = static_cast<std::uint32_t>(qmark + 1 - chars);
+      req.query_range.size = static_cast<std::uint32_t>(target_end - (qmark + 1));
+   }
+
+   // Parse each header line: field-name ":" OWS field-value OWS.
+   for (char const * line_begin = line_end + 1; line_begin < head_end; line_begin = line_end + 1) {
+      line_end = static_cast<char const *>(
+         std::memchr(line_begin, '\n', static_cast<std::size_t>(head_end - line_begin))
+      );
+      line_content_end = line_end > line_begin && line_end[-1] == '\r' ? line_end - 1 : line_end;
+      if (line_content_end == line_begin) {
+         // The empty line at the end of the head.
+         break;
+      }
+      char const * colon = static_cast<char const *>(
+         std::memchr(line_begin, ':', static_cast<std::size_t>(line_content_end - line_begin))
+      );
+      if (!colon || colon == line_begin) {
+         return 400;
+      }
+      for (char const * name_char = line_begin; name_char < colon; ++name_char) {
+         if (*name_char == ' ' || *name_char == '\t') {
+            // This also rejects obsolete line folding, since a continuation line begins with whitespace.
+            return 400;
+         }
+      }
+      char const * value_begin = colon + 1, * value_end = line_content_end;
+      while (value_begin < value_end && (*value_begin == ' ' || *value_begin == '\t')) {
+         ++value_begin;
+      }
+      while (value_end > value_begin && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+         --value_end;
+      }
+      if (req.headers.size() >= lims.headers_max) {
+         return 431;
+      }
+      request::header_ranges hdr;
+      hdr.name.begin = static_cast<std::uint32_t>(line_begin - chars);
+      hdr.name.size = static_cast<std::uint32_t>(colon - line_begin);
+      hdr.value.begin = static_cast<std::uint32_t>(value_begin - chars);
+      hdr.value.size = static_cast<std::uint32_t>(value_end - value_begin);
+      req.headers.push_back(hdr);
+
+      // Take note of the headers that affect framing and connection management.
+      bytes_view name(line_begin, hdr.name.size), value(value_begin, hdr.value.size);
+      if (name.equals_ignore_case("content-length")) {
+         std::size_t parsed_length = 0;
+         if (value.empty()) {
+            return 400;
+         }
+         for (char const * digit = value_begin; digit < value_end; ++digit) {
+            if (*digit < '0' || *digit > '9') {
+               return 400;
+            }
+            parsed_length = parsed_length * 10 + static_cast<std::size_t>(*digit - '0');
+            if (parsed_length > lims.body_size_max) {
+               // Also prevents overflows, as long as body_size_max is reasonable.
+               return 413;
+            }
+         }
+         if (content_length_found && parsed_length != content_length) {
+            return 400;
+         }
+         content_length = parsed_length;
+         content_length_found = true;
+      } else if (name.equals_ignore_case("transfer-encoding")) {
+         // Only chunked, as the last (or only) coding, is supported for requests.
+         static std::size_t const chunked_size = 7;
+         if (
+            value.size() < chunked_size ||
+            !bytes_view(value_end - chunked_size, chunked_size).equals_ignore_case("chunked") ||
+            (value.size() > chunked_size && value_end[-chunked_size - 1] != ',' &&
+               value_end[-chunked_size - 1] != ' ')
+         ) {
+            return 501;
+         }
+         transfer_encoding_found = true;
+      } else if (name.equals_ignore_case("connection")) {
+         // Look at each comma-separated token.
+         for (char const * token_begin = value_begin; token_begin < value_end; ) {
+            char const * token_end = static_cast<char const *>(
+               std::memchr(token_begin, ',', static_cast<std::size_t>(value_end - token_begin))
+            );
+            if (!token_end) {
+               token_end = value_end;
+            }
+            char const * token_trimmed_end = token_end;
+            while (token_begin < token_trimmed_end && (*token_begin == ' ' || *token_begin == '\t')) {
+               ++token_begin;
+            }
+            while (
+               token_trimmed_end > token_begin && (token_trimmed_end[-1] == ' ' || token_trimmed_end[-1] == '\t')
+            ) {
+               --token_trimmed_end;
+            }
+            bytes_view token(token_begin, static_cast<std::size_t>(token_trimmed_end - token_begin));
+            if (token.equals_ignore_case("close")) {
+               connection_close = true;
+            } else if (token.equals_ignore_case("keep-alive")) {
+               connection_keep_alive = true;
+            }
+            token_begin = token_end + 1;
+         }
+      } else if (name.equals_ignore_case("expect")) {
+         if (!value.equals_ignore_case("100-continue")) {
+            // No other expectations are defined.
+            return 417;
+         }
+         expect_continue = req.ver_minor > 0;
+      }
+   }
+   if (transfer_encoding_found) {
+      if (content_length_found) {
+         // Ambiguous framing, a common vector for request smuggling (RFC 7230 § 3.3.3).
+         return 400;
+      }
+      chunked = true;
+   }
+   req.persistent = !connection_close && (req.ver_minor > 0 || connection_keep_alive);
+   return 0;
+}
+
+unsigned connection_engine::read_line(std::size_t offset, std::size_t * line_size, std::size_t * next_offset) {
+   std::size_t scanned_size = offset;
+   for (;;) {
+      std::size_t avail;
+      char const * chars = fill(scanned_size + 1, &avail);
+      if (avail == scanned_size) {
+         return 1;
+      }
+      if (char const * lf = static_cast<char const *>(
+         std::memchr(chars + scanned_size, '\n', avail - scanned_size)
+      )) {
+         std::size_t lf_offset = static_cast<std::size_t>(lf - chars);
+         *line_size = lf_offset - offset;
+         if (*line_size > 0 && chars[lf_offset - 1] == '\r') {
+            --*line_size;
+         }
+         *next_offset = lf_offset + 1;
+         return 0;
+      }
+      scanned_size = avail;
+      if (scanned_size - offset > chunk_line_size_max) {
+         return 400;
+      }
+   }
+}
+
+unsigned connection_engine::read_chunked_body(std::size_t offset, std::size_t * raw_size) {
+   LOFTY_TRACE_FUNC(this, offset, raw_size);
+
+   std::size_t begin_offset = offset;
+   chunked_body.set_size(0);
+   for (;;) {
+      // Parse the chunk size line: chunk-size [ chunk-ext ] CRLF.
+      std::size_t line_size, next_offset, avail;
+      if (unsigned ret = read_line(offset, &line_size, &next_offset)) {
+         return ret;
+      }
+      char const * chars = fill(0, &avail);
+      std::size_t chunk_size = 0, digits = 0;
+      for (char const * line = chars + offset, * line_end = line + line_size; line < line_end; ++line, ++digits) {
+         unsigned digit;
+         if (*line >= '0' && *line <= '9') {
+            digit = static_cast<unsigned>(*line - '0');
+         } else if (ascii_to_lower(*line) >= 'a' && ascii_to_lower(*line) <= 'f') {
+            digit = static_cast<unsigned>(ascii_to_lower(*line) - 'a' + 10);
+         } else if (*line == ';' || *line == ' ' || *line == '\t') {
+            // Chunk extensions are ignored.
+            break;
+         } else {
+            return 400;
+         }
+         chunk_size = chunk_size * 16 + digit;
+         if (chunk_size > lims.body_size_max - chunked_body.size()) {
+            // Also prevents overflows, as long as body_size_max is reasonable.
+            return 413;
+         }
+      }
+      if (digits == 0) {
+         return 400;
+      }
+      offset = next_offset;
+      if (chunk_size == 0) {
+         // Skip any trailer fields, up to the empty line that ends the body.
+         do {
+            if (unsigned ret = read_line(offset, &line_size, &next_offset)) {
+               return ret;
+            }
+            offset = next_offset;
+         } while (line_size > 0);
+         *raw_size = offset - begin_offset;
+         return 0;
+      }
+      // Read the chunk data and the CRLF that follows it.
+      chars = fill(offset + chunk_size + 2, &avail);
+      if (avail < offset + chunk_size + 2) {
+         return 1;
+      }
+      chunked_body.push_back(reinterpret_cast<std::uint8_t const *>(chars + offset), chunk_size);
+      offset += chunk_size;
+      if (chars[offset] == '\r' && chars[offset + 1] == '\n') {
+         offset += 2;
+      } else {
+         return 400;
+      }
+   }
+}
+
+void connection_engine::run() {
+   LOFTY_TRACE_FUNC(this);
+
+   for (std::size_t requests_count = 1; ; ++requests_count) {
+      std::size_t head_size, body_offset, raw_body_size = 0, avail;
+      if (unsigned status = read_head(&head_size)) {
+         if (status != 1) {
+            send_error(status);
+         }
+         break;
+      }
+      if (unsigned status = parse_head(fill(head_size, &avail), head_size)) {
+         send_error(status);
+         break;
+      }
+      body_offset = head_size;
+      if (expect_continue && (chunked || content_length > 0)) {
+         // The body will only be sent after this interim response.
+         resp.reset(1, true, true);
+         resp.set_status(100);
+         resp.finish();
+         resp.flush();
+      }
+      if (chunked) {
+         if (unsigned status = read_chunked_body(body_offset, &raw_body_size)) {
+            if (status != 1) {
+               send_error(status);
+            }
+            break;
+         }
+      } else if (content_length > 0) {
+         raw_body_size = content_length;
+         fill(body_offset + raw_body_size, &avail);
+         if (avail < body_offset + raw_body_size) {
+            // The connection was closed before the end of the body.
+            break;
+         }
+      }
+
+      // Now that the whole request is in the read buffer, it won’t move until the request has been handled.
+      req.chars = fill(body_offset + raw_body_size, &avail);
+      if (chunked) {
+         req.body_chars = reinterpret_cast<char const *>(chunked_body.data());
+         req.body_size = chunked_body.size();
+      } else {
+         req.body_chars = req.chars + body_offset;
+         req.body_size = raw_body_size;
+      }
+      if (lims.requests_per_connection_max && requests_count >= lims.requests_per_connection_max) {
+         req.persistent = false;
+      }
+      resp.reset(req.ver_minor, req.persistent, req.method().equals("HEAD"));
+      try {
+         handler(req, &resp);
+      } catch (execution_interruption const &) {
+         throw;
+      } catch (_std::exception const &) {
+         if (resp.is_head_sent()) {
+            // Too late to report the error: abort the response by closing the connection.
+            break;
+         }
+         resp.reset(req.ver_minor, false, false);
+         resp.set_status(500);
+      }
+      resp.finish();
+      buf_istream->consume_bytes(body_offset + raw_body_size);
+      if (!resp.will_keep_alive()) {
+         break;
+      }
+   }
+   resp.flush();
+}
+
+void connection_engine::send_error(unsigned status) {
+   LOFTY_TRACE_FUNC(this, status);
+
+   resp.reset(req.ver_minor, false, false);
+   resp.set_status(status);
+   resp.finish();
+   resp.flush();
+}
+
+}}}} //namespace lofty::net::http::_pvt
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+router::router() {
+}
+
+router::~router() {
+}
+
+router & router::add_route(str const & method, str const & path, request_handler_type handler) {
+   LOFTY_TRACE_FUNC(this, method, path);
+
+   route r;
+   r.method = method.encode(text::encoding::utf8, false);
+   r.prefix = path.ends_with(LOFTY_SL("*"));
+   r.path = path.encode(text::encoding::utf8, false);
+   if (r.prefix) {
+      // Drop the “*”, which is a single byte in UTF-8.
+      r.path.set_size(r.path.size() - 1);
+   }
+   r.handler = _std::move(handler);
+   routes.push_back(_std::move(r));
+   return *this;
+}
+
+void router::operator()(request const & req, response * resp) const {
+   LOFTY_TRACE_FUNC(this);
+
+   bytes_view path(req.path()), method(req.method());
+   bool path_matched = false;
+   LOFTY_FOR_EACH(auto const & r, routes) {
+      bool matches = r.prefix
+         ? path.starts_with(reinterpret_cast<char const *>(r.path.data()), r.path.size())
+         : view_equals(path, r.path);
+      if (matches) {
+         if (
+            r.method.size() == 0 || view_equals(method, r.method) ||
+            // A HEAD request is answered like a GET, minus the body.
+            (method.equals("HEAD") && r.method.size() == 3 && std::memcmp(r.method.data(), "GET", 3) == 0)
+         ) {
+            r.handler(req, resp);
+            return;
+         }
+         path_matched = true;
+      }
+   }
+   resp->set_status(path_matched ? 405u : 404u);
+}
+
+}}} //namespace lofty::net::http
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace http {
+
+server::limits::limits() :
+   head_size_max(0x4000),
+   body_size_max(0x800000),
+   requests_per_connection_max(0),
+   headers_max(100) {
+}
+
+server::server(ip::address const & address, ip::port const & port, unsigned shards_count /*= 0*/) :
+   tcp_srv(address, port, shards_count) {
+   // Responses are written in as few writes as possible, so Nagle’s algorithm would only delay them.
+   tcp::socket_options opts;
+   opts.set_no_delay(true);
+   tcp_srv.set_accepted_options(opts);
+}
+
+server::~server() {
+}
+
+void server::interrupt() {
+   LOFTY_TRACE_FUNC(this);
+
+   tcp_srv.interrupt();
+}
+
+void server::run(request_handler_type const & handler) {
+   LOFTY_TRACE_FUNC(this);
+
+   tcp_srv.run([this, &handler] (_std::shared_ptr<tcp::connection> conn) {
+      LOFTY_TRACE_FUNC(conn);
+
+      auto socket(conn->socket());
+      serve(socket, socket, handler, lims);
+   });
+}
+
+/*static*/ void server::serve(
+   _std::shared_ptr<io::binary::istream> bin_istream, _std::shared_ptr<io::binary::ostream> bin_ostream,
+   request_handler_type const & handler, limits const & lims /*= limits()*/
+) {
+   LOFTY_TRACE_FUNC(bin_istream, bin_ostream);
+
+   try {
+      _pvt::connection_engine engine(_std::move(bin_istream), bin_ostream.get(), handler, lims);
+      engine.run();
+   } catch (io::error const &) {
+      // The connection was lost; there’s nobody left to report the error to.
+      try {
+         bin_ostream->finalize();
+      } catch (...) {
+         // Any unsent data is lost anyway.
+      }
+      return;
+   } catch (execution_interruption const &) {
+      // The server is being stopped; close the connection without waiting for the client.
+      try {
+         bin_ostream->finalize();
+      } catch (...) {
+         // Any unsent data is lost anyway.
+      }
+      throw;
+   }
+   bin_ostream->finalize();
+}
+
+}}} //namespace lofty::net::http
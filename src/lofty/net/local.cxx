@@ -0,0 +1,393 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/net/local.hxx>
+#include <lofty/thread.hxx>
+#include "../io/binary/_pvt/file_init_data.hxx"
+#include "../io/binary/file-subclasses.hxx"
+#include "_pvt/socket.hxx"
+
+#if LOFTY_HOST_API_POSIX
+   #include <errno.h> // E* errno
+   #include <sys/socket.h> // accept4() bind() connect() listen() recvmsg() sendmsg() socketpair() SCM_RIGHTS
+   #include <sys/un.h> // sockaddr_un
+   #include <unistd.h> // unlink()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+namespace {
+
+//! Time to wait before trying again to connect to a server whose backlog is full.
+unsigned const connect_retry_delay_ms = 10;
+//! Count of attempts to connect to a server whose backlog is full, after which connect() gives up.
+unsigned const connect_attempts_max = 100;
+
+/*! Returns the OS socket type corresponding to a socket_type.
+
+@param type
+   Socket type.
+@return
+   SOCK_* constant.
+*/
+int os_socket_type(socket_type type) {
+   switch (type.base()) {
+      case socket_type::stream:
+         return SOCK_STREAM;
+      case socket_type::seqpacket:
+         return SOCK_SEQPACKET;
+      LOFTY_SWITCH_WITHOUT_DEFAULT
+   }
+}
+
+/*! Fills a socket address with a path.
+
+@param path
+   Socket path.
+@param sa
+   Pointer to the destination socket address.
+@return
+   Size of the socket address.
+*/
+::socklen_t path_to_sockaddr(os::path const & path, ::sockaddr_un * sa) {
+   auto const & path_str = path.os_str();
+   std::size_t path_size = path_str.size_in_bytes();
+   if (path_size >= sizeof sa->sun_path) {
+      // The path is too long to fit in a socket address.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   memory::clear(sa);
+   sa->sun_family = AF_UNIX;
+   memory::copy(sa->sun_path, path_str.data(), path_size);
+   return static_cast< ::socklen_t>(offsetof(::sockaddr_un, sun_path) + path_size + 1 /*NUL*/);
+}
+
+} //namespace
+
+connection::connection(io::filedesc fd_) :
+   fd(_std::move(fd_)),
+   raw_fd(fd.get()) {
+}
+
+connection::~connection() {
+}
+
+std::size_t connection::receive_with_fds(
+   void * dst, std::size_t dst_max, collections::vector<io::filedesc> * fds
+) {
+   LOFTY_TRACE_FUNC(this, dst, dst_max, fds);
+
+   ::iovec iov;
+   iov.iov_base = dst;
+   iov.iov_len = dst_max;
+   union {
+      ::cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int) * max_fds_per_message)];
+   } control;
+   ::msghdr msg;
+   memory::clear(&msg);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   ::ssize_t bytes_read;
+   for (;;) {
+      msg.msg_control = &control;
+      msg.msg_controllen = sizeof control;
+      int flags = 0;
+   #ifdef MSG_CMSG_CLOEXEC
+      flags |= MSG_CMSG_CLOEXEC;
+   #endif
+      bytes_read = ::recvmsg(raw_fd, &msg, flags);
+      if (bytes_read >= 0) {
+         break;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            this_coroutine::sleep_until_fd_ready(raw_fd, false);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+   // Take ownership of every file descriptor received, even if we end up throwing.
+   for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+         std::size_t cmsg_fds_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+         auto cmsg_data = CMSG_DATA(cmsg);
+         for (std::size_t i = 0; i < cmsg_fds_count; ++i) {
+            int received_fd;
+            memory::copy(
+               reinterpret_cast<std::uint8_t *>(&received_fd), cmsg_data + sizeof(int) * i, sizeof(int)
+            );
+            io::filedesc received(received_fd);
+   #ifndef MSG_CMSG_CLOEXEC
+            received.set_close_on_exec(true);
+   #endif
+            fds->push_back(_std::move(received));
+         }
+      }
+   }
+   this_coroutine::interruption_point();
+   if (msg.msg_flags & MSG_CTRUNC) {
+      // Some file descriptors were discarded by the OS because they didn’t fit.
+      // TODO: use a better exception class.
+      LOFTY_THROW(generic_error, ());
+   }
+   return static_cast<std::size_t>(bytes_read);
+}
+
+void connection::send_with_fds(
+   void const * src, std::size_t src_size, io::filedesc_t const * fds, std::size_t fds_count
+) {
+   LOFTY_TRACE_FUNC(this, src, src_size, fds, fds_count);
+
+   if (src_size == 0 || fds_count > max_fds_per_message) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   ::iovec iov;
+   iov.iov_base = const_cast<void *>(src);
+   iov.iov_len = src_size;
+   union {
+      ::cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int) * max_fds_per_message)];
+   } control;
+   ::msghdr msg;
+   memory::clear(&msg);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   if (fds_count > 0) {
+      memory::clear(&control);
+      msg.msg_control = &control;
+      msg.msg_controllen = static_cast<decltype(msg.msg_controllen)>(CMSG_SPACE(sizeof(int) * fds_count));
+      auto cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = static_cast<decltype(cmsg->cmsg_len)>(CMSG_LEN(sizeof(int) * fds_count));
+      for (std::size_t i = 0; i < fds_count; ++i) {
+         int fd_to_send = fds[i];
+         memory::copy(
+            CMSG_DATA(cmsg) + sizeof(int) * i, reinterpret_cast<std::uint8_t const *>(&fd_to_send), sizeof(int)
+         );
+      }
+   }
+   /* The file descriptors are delivered with the first byte sent, so after a partial write the rest of the
+   data goes out without them. */
+   for (;;) {
+      ::ssize_t bytes_written = ::sendmsg(raw_fd, &msg, MSG_NOSIGNAL);
+      if (bytes_written >= 0) {
+         iov.iov_base = static_cast<std::int8_t *>(iov.iov_base) + bytes_written;
+         iov.iov_len -= static_cast<std::size_t>(bytes_written);
+         if (iov.iov_len == 0) {
+            break;
+         }
+         msg.msg_control = nullptr;
+         msg.msg_controllen = 0;
+      } else {
+         int err = errno;
+         switch (err) {
+            case EINTR:
+               this_coroutine::interruption_point();
+               break;
+            case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+   #endif
+               this_coroutine::sleep_until_fd_ready(raw_fd, true);
+               break;
+            default:
+               exception::throw_os_error(err);
+         }
+      }
+   }
+   this_coroutine::interruption_point();
+}
+
+_std::shared_ptr<io::binary::file_iostream> const & connection::socket() {
+   if (!socket_) {
+      // We already know this is a socket, so skip io::binary::make_iostream()’s detection of the file type.
+      io::binary::_pvt::file_init_data init_data;
+      init_data.fd = _std::move(fd);
+      init_data.mode = io::access_mode::read_write;
+      init_data.bypass_cache = false;
+      socket_ = _std::make_shared<io::binary::pipe_iostream>(&init_data);
+   }
+   return socket_;
+}
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+connection_pair::connection_pair(socket_type type /*= socket_type::stream*/) {
+   LOFTY_TRACE_FUNC(this, type);
+
+   bool async = (this_thread::coroutine_scheduler() != nullptr);
+   int os_type = os_socket_type(type);
+   #if !LOFTY_HOST_API_DARWIN
+      os_type |= SOCK_CLOEXEC;
+      if (async) {
+         // Using coroutines, so make the sockets non-blocking.
+         os_type |= SOCK_NONBLOCK;
+      }
+   #endif
+   int fds[2];
+   if (::socketpair(AF_UNIX, os_type, 0, fds) < 0) {
+      exception::throw_os_error();
+   }
+   io::filedesc fd1(fds[0]), fd2(fds[1]);
+   #if LOFTY_HOST_API_DARWIN
+      fd1.set_close_on_exec(true);
+      fd2.set_close_on_exec(true);
+      if (async) {
+         fd1.set_nonblocking(true);
+         fd2.set_nonblocking(true);
+      }
+   #endif
+   first = _std::make_shared<connection>(_std::move(fd1));
+   second = _std::make_shared<connection>(_std::move(fd2));
+}
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+_std::shared_ptr<connection> connect(os::path const & path, socket_type type /*= socket_type::stream*/) {
+   LOFTY_TRACE_FUNC(path, type);
+
+   ::sockaddr_un sa;
+   auto sa_size = path_to_sockaddr(path, &sa);
+   auto fd(_pvt::create_socket(AF_UNIX, os_socket_type(type)));
+   unsigned backlog_full_attempts = 0;
+   while (::connect(fd.get(), reinterpret_cast< ::sockaddr *>(&sa), sa_size) < 0) {
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            /* The server’s backlog is full. Unlike a TCP socket, the unconnected socket is always writable,
+            so there’s nothing to wait for: give the server some time to accept connections, then retry. */
+            if (++backlog_full_attempts >= connect_attempts_max) {
+               exception::throw_os_error(err);
+            }
+            this_coroutine::sleep_for_ms(connect_retry_delay_ms);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+   this_coroutine::interruption_point();
+   return _std::make_shared<connection>(_std::move(fd));
+}
+
+}}} //namespace lofty::net::local
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace local {
+
+server::server(os::path path, socket_type type /*= socket_type::stream*/, unsigned backlog_size /*= 128*/) :
+   sock_fd(_pvt::create_socket(AF_UNIX, os_socket_type(type))),
+   path_(_std::move(path)) {
+   LOFTY_TRACE_FUNC(this, path_, type, backlog_size);
+
+   ::sockaddr_un sa;
+   auto sa_size = path_to_sockaddr(path_, &sa);
+   if (
+      ::bind(sock_fd.get(), reinterpret_cast< ::sockaddr *>(&sa), sa_size) < 0 ||
+      ::listen(sock_fd.get(), static_cast<int>(backlog_size)) < 0
+   ) {
+      exception::throw_os_error();
+   }
+}
+
+server::~server() {
+   ::unlink(path_.os_str().c_str());
+}
+
+_std::shared_ptr<connection> server::accept() {
+   LOFTY_TRACE_FUNC(this);
+
+   bool async = (this_thread::coroutine_scheduler() != nullptr);
+   io::filedesc conn_fd;
+   for (;;) {
+   #if LOFTY_HOST_API_DARWIN
+      // accept4() is not available, so emulate it with accept() + fcntl().
+      conn_fd = io::filedesc(::accept(sock_fd.get(), nullptr, nullptr));
+      if (conn_fd) {
+         /* Note that at this point there’s no hack that will ensure a fork()/exec() from another thread won’t
+         leak the file descriptor. That’s the whole point of accept4(). */
+         conn_fd.set_close_on_exec(true);
+         if (async) {
+            conn_fd.set_nonblocking(true);
+         }
+      }
+   #else
+      int flags = SOCK_CLOEXEC;
+      if (async) {
+         // Using coroutines, so make the client socket non-blocking.
+         flags |= SOCK_NONBLOCK;
+      }
+      conn_fd = io::filedesc(::accept4(sock_fd.get(), nullptr, nullptr, flags));
+   #endif
+      if (conn_fd) {
+         break;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+         case ECONNABORTED:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            // Wait for sock_fd. Accepting a connection is considered a read event.
+            this_coroutine::sleep_until_fd_ready(sock_fd.get(), false);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+   this_coroutine::interruption_point();
+   return _std::make_shared<connection>(_std::move(conn_fd));
+}
+
+}}} //namespace lofty::net::local
+
+#endif //if LOFTY_HOST_API_POSIX
@@ -17,16 +17,26 @@ You should have received a copy of the GNU Lesser General Public License along w
 ------------------------------------------------------------------------------------------------------------*/
 
 #include <lofty.hxx>
+#include <lofty/collections/hash_map.hxx>
 #include <lofty/coroutine.hxx>
+#include <lofty/defer_to_scope_end.hxx>
 #include <lofty/net/tcp.hxx>
 #include <lofty/thread.hxx>
+#include "../io/binary/_pvt/file_init_data.hxx"
+#include "../io/binary/file-subclasses.hxx"
+#include "_pvt/socket.hxx"
+
+#include <chrono> // std::chrono::*
+#include <cstring> // std::memcmp()
 
 #if LOFTY_HOST_API_POSIX
    #include <arpa/inet.h> // inet_addr()
-   #include <errno.h> // EINTR errno
+   #include <errno.h> // E* errno
    #include <netinet/in.h> // htons() ntohs()
+   #include <netinet/tcp.h> // TCP_* tcp_info
    #include <sys/types.h> // sockaddr sockaddr_in
-   #include <sys/socket.h> // accept4() bind() getsockname() socket()
+   #include <sys/socket.h> // accept4() bind() connect() getsockname() recv() *sockopt() socket() SOMAXCONN
+   #include <unistd.h> // _SC_* sysconf()
 #elif LOFTY_HOST_API_WIN32
    #include <winsock2.h>
    #include <mswsock.h> // AcceptEx() GetAcceptExSockaddrs()
@@ -49,77 +59,778 @@ You should have received a copy of the GNU Lesser General Public License along w
 #endif
 
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+/*! Sets an int-valued socket option.
+
+@param fd
+   Socket.
+@param level
+   Protocol level of the option.
+@param name
+   Option name.
+@param value
+   Value to set.
+*/
+static void set_int_sockopt(io::filedesc_t fd, int level, int name, int value) {
+#if LOFTY_HOST_API_POSIX
+   if (::setsockopt(fd, level, name, &value, sizeof value) < 0) {
+      exception::throw_os_error();
+   }
+#elif LOFTY_HOST_API_WIN32
+   if (::setsockopt(
+      reinterpret_cast< ::SOCKET>(fd), level, name, reinterpret_cast<char const *>(&value), sizeof value
+   ) < 0) {
+      exception::throw_os_error(static_cast<errint_t>(::WSAGetLastError()));
+   }
+#else
+   #error "TODO: HOST_API"
+#endif
+}
+
+void socket_options::apply(io::filedesc_t fd) const {
+   LOFTY_TRACE_FUNC(this, fd);
+
+   if (no_delay_set) {
+      set_int_sockopt(fd, IPPROTO_TCP, TCP_NODELAY, no_delay_ ? 1 : 0);
+   }
+   if (cork_set) {
+#if LOFTY_HOST_API_LINUX
+      set_int_sockopt(fd, IPPROTO_TCP, TCP_CORK, cork_ ? 1 : 0);
+#else
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+#endif
+   }
+   if (send_buffer_size_) {
+      set_int_sockopt(fd, SOL_SOCKET, SO_SNDBUF, static_cast<int>(send_buffer_size_));
+   }
+   if (receive_buffer_size_) {
+      set_int_sockopt(fd, SOL_SOCKET, SO_RCVBUF, static_cast<int>(receive_buffer_size_));
+   }
+   if (keep_alive_set) {
+      set_int_sockopt(fd, SOL_SOCKET, SO_KEEPALIVE, keep_alive_ ? 1 : 0);
+      if (keep_alive_ && (keep_alive_idle_secs || keep_alive_interval_secs || keep_alive_probes)) {
+#if LOFTY_HOST_API_LINUX
+         if (keep_alive_idle_secs) {
+            set_int_sockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, static_cast<int>(keep_alive_idle_secs));
+         }
+         if (keep_alive_interval_secs) {
+            set_int_sockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, static_cast<int>(keep_alive_interval_secs));
+         }
+         if (keep_alive_probes) {
+            set_int_sockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, static_cast<int>(keep_alive_probes));
+         }
+#else
+         // TODO: use a better exception class.
+         LOFTY_THROW(argument_error, ());
+#endif
+      }
+   }
+   if (linger_set) {
+#if LOFTY_HOST_API_POSIX
+      ::linger l;
+      l.l_onoff = linger_ ? 1 : 0;
+      l.l_linger = static_cast<int>(linger_timeout_secs);
+      if (::setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof l) < 0) {
+         exception::throw_os_error();
+      }
+#elif LOFTY_HOST_API_WIN32
+      ::LINGER l;
+      l.l_onoff = static_cast< ::u_short>(linger_ ? 1 : 0);
+      l.l_linger = static_cast< ::u_short>(linger_timeout_secs);
+      if (::setsockopt(
+         reinterpret_cast< ::SOCKET>(fd), SOL_SOCKET, SO_LINGER, reinterpret_cast<char const *>(&l), sizeof l
+      ) < 0) {
+         exception::throw_os_error(static_cast<errint_t>(::WSAGetLastError()));
+      }
+#else
+   #error "TODO: HOST_API"
+#endif
+   }
+   if (defer_accept_set) {
+#if LOFTY_HOST_API_LINUX
+      set_int_sockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, static_cast<int>(defer_accept_timeout_secs));
+#else
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+#endif
+   }
+   if (fast_open_queue_size_) {
+#ifdef TCP_FASTOPEN
+      set_int_sockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, static_cast<int>(fast_open_queue_size_));
+#else
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+#endif
+   }
+}
+
+}}} //namespace lofty::net::tcp
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace lofty { namespace net { namespace tcp {
 
 connection::connection(
-   io::filedesc fd, ip::address && local_address__, ip::port && local_port__, ip::address && remote_address__,
-   ip::port && remote_port__
+   io::filedesc fd_, ip::address && local_address__, ip::port && local_port__,
+   ip::address && remote_address__, ip::port && remote_port__
 ) :
-   socket_(io::binary::make_iostream(_std::move(fd))),
+   fd(_std::move(fd_)),
+   raw_fd(fd.get()),
    local_address_(_std::move(local_address__)),
    local_port_(_std::move(local_port__)),
    remote_address_(_std::move(remote_address__)),
-   remote_port_(_std::move(remote_port__)) {
+   remote_port_(_std::move(remote_port__)),
+   local_address_resolved(true) {
+}
+connection::connection(io::filedesc fd_, ip::address && remote_address__, ip::port && remote_port__) :
+   fd(_std::move(fd_)),
+   raw_fd(fd.get()),
+   remote_address_(_std::move(remote_address__)),
+   remote_port_(_std::move(remote_port__)),
+   local_address_resolved(false) {
 }
 
 connection::~connection() {
 }
 
+void connection::create_socket_stream() {
+   LOFTY_TRACE_FUNC(this);
+
+   // We already know this is a socket, so skip io::binary::make_iostream()’s detection of the file type.
+   io::binary::_pvt::file_init_data init_data;
+   init_data.fd = _std::move(fd);
+   init_data.mode = io::access_mode::read_write;
+   init_data.bypass_cache = false;
+   socket_ = _std::make_shared<io::binary::pipe_iostream>(&init_data);
+}
+
+bool connection::is_reusable() const {
+   LOFTY_TRACE_FUNC(this);
+
+#if LOFTY_HOST_API_POSIX
+   /* Peek at the receive buffer without blocking: EOF means that the peer closed the connection, and any data
+   means that the next response would be mixed up with something else. Only “nothing to read” is good. */
+   std::int8_t b;
+   for (;;) {
+      ::ssize_t ret = ::recv(raw_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (ret >= 0) {
+         return false;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            return true;
+         default:
+            // ECONNRESET, ETIMEDOUT, etc.
+            return false;
+      }
+   }
+#elif LOFTY_HOST_API_WIN32
+   // The socket being readable means that it either has data or has been closed; either way, it’s unusable.
+   ::fd_set read_fds;
+   FD_ZERO(&read_fds);
+   FD_SET(reinterpret_cast< ::SOCKET>(raw_fd), &read_fds);
+   ::timeval timeout;
+   timeout.tv_sec = 0;
+   timeout.tv_usec = 0;
+   return ::select(0, &read_fds, nullptr, nullptr, &timeout) == 0;
+#else
+   #error "TODO: HOST_API"
+#endif
+}
+
+void connection::resolve_local_address() const {
+   LOFTY_TRACE_FUNC(this);
+
+   _pvt::get_socket_name(raw_fd, remote_address_.version(), &local_address_, &local_port_);
+   local_address_resolved = true;
+}
+
 }}} //namespace lofty::net::tcp
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace lofty { namespace net { namespace tcp {
 
-union sockaddr_any {
-   ::sockaddr_in sa4;
-   ::sockaddr_in6 sa6;
-};
-
-server::server(ip::address const & address, ip::port const & port, unsigned backlog_size /*= 5*/) :
-   sock_fd(create_socket(address.version())),
-   ip_version(address.version()) {
-   LOFTY_TRACE_FUNC(this, address, port, backlog_size);
+_std::shared_ptr<connection> connect(ip::address const & address, ip::port const & port) {
+   LOFTY_TRACE_FUNC(address, port);
 
+   auto fd(_pvt::create_socket(address.version(), SOCK_STREAM));
+   _pvt::sockaddr_any server_sockaddr;
+   auto server_sockaddr_size = _pvt::address_and_port_to_sockaddr(address, port, &server_sockaddr);
 #if LOFTY_HOST_API_POSIX
-   ::socklen_t server_sock_addr_size;
+   if (::connect(
+      fd.get(), reinterpret_cast< ::sockaddr *>(&server_sockaddr),
+      static_cast< ::socklen_t>(server_sockaddr_size)
+   ) < 0) {
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            // The connection continues to be established asynchronously, as for EINPROGRESS.
+            this_coroutine::interruption_point();
+            // Fall through.
+         case EINPROGRESS:
+            // Wait for the socket to become writable, then retrieve the outcome of the connection attempt.
+            this_coroutine::sleep_until_fd_ready(fd.get(), true);
+            {
+               ::socklen_t err_size = sizeof err;
+               if (::getsockopt(fd.get(), SOL_SOCKET, SO_ERROR, &err, &err_size) < 0) {
+                  exception::throw_os_error();
+               }
+            }
+            if (err != 0) {
+               exception::throw_os_error(err);
+            }
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
 #elif LOFTY_HOST_API_WIN32
-   int server_sock_addr_size;
+   // TODO: use ConnectEx() to avoid blocking the whole thread.
+   if (::connect(
+      reinterpret_cast< ::SOCKET>(fd.get()), reinterpret_cast< ::SOCKADDR *>(&server_sockaddr),
+      static_cast<int>(server_sockaddr_size)
+   ) < 0) {
+      exception::throw_os_error(static_cast<errint_t>(::WSAGetLastError()));
+   }
 #else
    #error "TODO: HOST_API"
 #endif
-   sockaddr_any server_sockaddr;
-   switch (ip_version.base()) {
-      case ip::version::v4:
-         server_sock_addr_size = sizeof server_sockaddr.sa4;
-         memory::clear(&server_sockaddr.sa4);
-         server_sockaddr.sa4.sin_family = AF_INET;
-         memory::copy(
-            reinterpret_cast<std::uint8_t *>(&server_sockaddr.sa4.sin_addr.s_addr), address.raw(),
-            sizeof server_sockaddr.sa4.sin_addr.s_addr
-         );
-         server_sockaddr.sa4.sin_port = htons(port.number());
-         break;
-      case ip::version::v6:
-         server_sock_addr_size = sizeof server_sockaddr.sa6;
-         memory::clear(&server_sockaddr.sa6);
-         //server_sockaddr.sa6.sin6_flowinfo = 0;
-         server_sockaddr.sa6.sin6_family = AF_INET6;
-         memory::copy(
-            &server_sockaddr.sa6.sin6_addr.s6_addr[0], address.raw(),
-            sizeof server_sockaddr.sa6.sin6_addr.s6_addr
-         );
-         server_sockaddr.sa6.sin6_port = htons(port.number());
-         break;
-      LOFTY_SWITCH_WITHOUT_DEFAULT
+   this_coroutine::interruption_point();
+   ip::address remote_address(address);
+   ip::port remote_port(port);
+   return _std::make_shared<connection>(_std::move(fd), _std::move(remote_address), _std::move(remote_port));
+}
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+namespace {
+
+//! Identifies a server in connection_pool.
+struct endpoint_key {
+   //! Address of the server.
+   ip::address address;
+   //! Port the server is listening on.
+   ip::port port;
+
+   /*! Constructor.
+
+   @param address_
+      Address of the server.
+   @param port_
+      Port the server is listening on.
+   */
+   endpoint_key(ip::address const & address_, ip::port const & port_) :
+      address(address_),
+      port(port_) {
+   }
+};
+
+//! Hash functor for endpoint_key.
+struct endpoint_key_hasher {
+   /*! Function call operator.
+
+   @param key
+      Key to hash.
+   @return
+      Hash of key.
+   */
+   std::size_t operator()(endpoint_key const & key) const {
+      // FNV-1a over the address bytes, version and port.
+      std::size_t ret = static_cast<std::size_t>(2166136261u);
+      for (std::size_t i = 0; i < sizeof key.address.bytes; ++i) {
+         ret = (ret ^ key.address.raw()[i]) * 16777619u;
+      }
+      ret = (ret ^ static_cast<std::size_t>(key.address.version().base())) * 16777619u;
+      return (ret ^ key.port.number()) * 16777619u;
+   }
+};
+
+//! Equality functor for endpoint_key.
+struct endpoint_key_equal {
+   /*! Function call operator.
+
+   @param key1
+      First key to compare.
+   @param key2
+      Second key to compare.
+   @return
+      true if the two keys identify the same server, or false otherwise.
+   */
+   bool operator()(endpoint_key const & key1, endpoint_key const & key2) const {
+      return key1.port.number() == key2.port.number() &&
+         key1.address.version() == key2.address.version() &&
+         std::memcmp(key1.address.bytes, key2.address.bytes, sizeof key1.address.bytes) == 0;
+   }
+};
+
+/*! Checkout parked until a connection to its server is released or discarded. The wake-up is delivered
+through a pipe, so the parked coroutine is blocked by the scheduler like for any other I/O. */
+class waiter : public noncopyable {
+public:
+   //! Constructor.
+   waiter() :
+      woken(false) {
+   }
+
+   //! Destructor.
+   ~waiter() {
+      try {
+         wake_pipe.write_end->finalize();
+      } catch (io::error const &) {
+         // Nothing to flush, so there’s nothing to lose.
+      }
+   }
+
+   //! Blocks the calling coroutine until wake() is called.
+   void wait() {
+      std::int8_t b;
+      wake_pipe.read_end->read(&b, 1);
+   }
+
+   /*! Unblocks the parked coroutine.
+
+   @param conn_
+      Connection handed to the waiter, or nullptr if the waiter is just being granted a free slot.
+   */
+   void wake(_std::shared_ptr<connection> conn_) {
+      conn = _std::move(conn_);
+      woken = true;
+      std::int8_t b = 0;
+      wake_pipe.write_end->write(&b, 1);
+   }
+
+public:
+   //! Connection handed over by wake(), if any.
+   _std::shared_ptr<connection> conn;
+   //! true if wake() was called.
+   bool woken;
+
+private:
+   //! Pipe used to deliver the wake-up.
+   io::binary::pipe wake_pipe;
+};
+
+/*! Closes a connection that won’t be used anymore.
+
+@param conn
+   Connection to close.
+*/
+void close_connection(connection * conn) {
+   try {
+      conn->socket()->finalize();
+   } catch (io::error const &) {
+      // Nothing was pending, so the connection can’t lose any data.
+   }
+}
+
+} //namespace
+
+//! Connections to a single server.
+struct connection_pool::endpoint {
+   //! Connection available for reuse.
+   struct idle_connection {
+      //! Connection.
+      _std::shared_ptr<connection> conn;
+      //! Time when the connection was released.
+      std::chrono::steady_clock::time_point idle_since;
+   };
+
+   //! Count of connections leased, idle or being established.
+   std::size_t open_count;
+   //! Idle connections, in order of release (least recently used first).
+   collections::vector<idle_connection> idle;
+   //! Checkouts waiting for a connection to be released or discarded, in order of arrival.
+   collections::vector<waiter *> waiters;
+
+   //! Default constructor.
+   endpoint() :
+      open_count(0) {
+   }
+};
+
+class connection_pool::impl : public noncopyable {
+public:
+   /*! Constructor.
+
+   @param connections_per_host_max_
+      See connection_pool::connection_pool().
+   @param idle_timeout_ms_
+      See connection_pool::connection_pool().
+   */
+   impl(std::size_t connections_per_host_max_, unsigned idle_timeout_ms_) :
+      connections_per_host_max(connections_per_host_max_),
+      idle_timeout(idle_timeout_ms_),
+      idle_count(0),
+      evicting_idle(false),
+      closed(false) {
+      memory::clear(&counters);
+   }
+
+   //! Closes every idle connection and lets parked checkouts establish their own connection.
+   void close() {
+      LOFTY_TRACE_FUNC(this);
+
+      closed = true;
+      LOFTY_FOR_EACH(auto kv, endpoints) {
+         auto & ep = *kv.value;
+         while (ep.idle) {
+            close_connection(ep.idle.pop_back().conn.get());
+            --ep.open_count;
+            --idle_count;
+         }
+         while (ep.waiters) {
+            ++ep.open_count;
+            pop_waiter(&ep)->wake(nullptr);
+         }
+      }
+   }
+
+   /*! Returns the connections to the specified server, creating an empty set if needed.
+
+   @param address
+      Address of the server.
+   @param port
+      Port the server is listening on.
+   @return
+      Pointer to the server’s connections.
+   */
+   _std::shared_ptr<endpoint> const & get_endpoint(ip::address const & address, ip::port const & port) {
+      endpoint_key key(address, port);
+      auto itr(endpoints.find(key));
+      if (itr == endpoints.end()) {
+         itr = _std::get<0>(endpoints.add_or_assign(_std::move(key), _std::make_shared<endpoint>()));
+      }
+      return itr->value;
+   }
+
+   /*! Frees the slot of a connection that’s been closed, passing it on to the first parked checkout, if any.
+
+   @param ep
+      Server the connection was to.
+   */
+   void free_slot(endpoint * ep) {
+      if (ep->waiters) {
+         pop_waiter(ep)->wake(nullptr);
+      } else {
+         --ep->open_count;
+      }
+   }
+
+   /*! Makes a released connection available to the first parked checkout or, if none, to later checkouts.
+
+   @param this_pimpl
+      Shared pointer to *this.
+   @param ep
+      Server the connection is to.
+   @param conn
+      Connection being released.
+   */
+   void put_back(
+      _std::shared_ptr<impl> const & this_pimpl, endpoint * ep, _std::shared_ptr<connection> conn
+   ) {
+      LOFTY_TRACE_FUNC(this, this_pimpl, ep, conn);
+
+      if (closed) {
+         close_connection(conn.get());
+         free_slot(ep);
+      } else if (ep->waiters) {
+         pop_waiter(ep)->wake(_std::move(conn));
+      } else {
+         endpoint::idle_connection idle_conn;
+         idle_conn.conn = _std::move(conn);
+         idle_conn.idle_since = std::chrono::steady_clock::now();
+         ep->idle.push_back(_std::move(idle_conn));
+         ++idle_count;
+         if (!evicting_idle) {
+            // Start a coroutine to close the connection once it exceeds the idle timeout.
+            evicting_idle = true;
+            coroutine([this_pimpl] () {
+               this_pimpl->evict_idle();
+            });
+         }
+      }
+   }
+
+   /*! Returns the most recently released usable idle connection to a server, closing any unusable ones found
+   along the way. The most recently released connection is the least likely to have been closed by the server.
+
+   @param ep
+      Server to get a connection to.
+   @return
+      Idle connection, or nullptr if none is available.
+   */
+   _std::shared_ptr<connection> take_idle(endpoint * ep) {
+      LOFTY_TRACE_FUNC(this, ep);
+
+      while (ep->idle) {
+         auto conn(ep->idle.pop_back().conn);
+         --idle_count;
+         if (conn->is_reusable()) {
+            ++counters.reuses;
+            return _std::move(conn);
+         }
+         close_connection(conn.get());
+         --ep->open_count;
+         ++counters.dead_evictions;
+      }
+      return nullptr;
+   }
+
+   /*! Removes the specified waiter from its server’s queue, if it’s still in it.
+
+   @param ep
+      Server the waiter is waiting for.
+   @param w
+      Waiter to remove.
+   */
+   static void remove_waiter(endpoint * ep, waiter * w) {
+      for (auto itr(ep->waiters.cbegin()); itr != ep->waiters.cend(); ++itr) {
+         if (*itr == w) {
+            ep->waiters.remove_at(itr);
+            break;
+         }
+      }
+   }
+
+private:
+   /*! Closes idle connections as they exceed the idle timeout, sleeping in between; returns once there are no
+   more idle connections. Runs in its own coroutine. */
+   void evict_idle() {
+      LOFTY_TRACE_FUNC(this);
+
+      while (idle_count) {
+         auto now(std::chrono::steady_clock::now());
+         auto next_expiry(now + idle_timeout);
+         LOFTY_FOR_EACH(auto kv, endpoints) {
+            auto & ep = *kv.value;
+            // Idle connections are in order of release, so the ones that expired are at the front.
+            while (ep.idle && ep.idle.front().idle_since + idle_timeout <= now) {
+               close_connection(ep.idle.front().conn.get());
+               ep.idle.remove_at(ep.idle.cbegin());
+               --idle_count;
+               ++counters.idle_evictions;
+               free_slot(&ep);
+            }
+            if (ep.idle) {
+               next_expiry = std::min(next_expiry, ep.idle.front().idle_since + idle_timeout);
+            }
+         }
+         if (!idle_count) {
+            break;
+         }
+         // Round up, so that the connection will have expired upon waking.
+         auto sleep_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            next_expiry - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)
+         ).count();
+         this_coroutine::sleep_for_ms(static_cast<unsigned>(sleep_ms > 0 ? sleep_ms : 1));
+      }
+      evicting_idle = false;
+   }
+
+   /*! Removes and returns the first waiter in a server’s queue.
+
+   @param ep
+      Server with at least one waiter.
+   @return
+      Pointer to the waiter.
+   */
+   static waiter * pop_waiter(endpoint * ep) {
+      auto w = ep->waiters.front();
+      ep->waiters.remove_at(ep->waiters.cbegin());
+      return w;
+   }
+
+public:
+   //! Maximum count of connections to each server.
+   std::size_t connections_per_host_max;
+   //! Time after which idle connections are closed.
+   std::chrono::milliseconds idle_timeout;
+   //! Options to apply to new connections.
+   socket_options opts;
+   //! Counters for usage_counters.
+   usage_counters counters;
+
+private:
+   //! Connections to each server.
+   collections::hash_map<
+      endpoint_key, _std::shared_ptr<endpoint>, endpoint_key_hasher, endpoint_key_equal
+   > endpoints;
+   //! Total count of idle connections.
+   std::size_t idle_count;
+   //! true while the evict_idle() coroutine is running.
+   bool evicting_idle;
+   //! true once the connection_pool object has been destructed.
+   bool closed;
+};
+
+
+connection_pool::lease::lease(
+   _std::shared_ptr<impl> pool_pimpl_, _std::shared_ptr<endpoint> ep_,
+   _std::shared_ptr<tcp::connection> conn_, bool reused
+) :
+   pool_pimpl(_std::move(pool_pimpl_)),
+   ep(_std::move(ep_)),
+   conn(_std::move(conn_)),
+   reused_(reused) {
+}
+connection_pool::lease::lease(lease && src) :
+   pool_pimpl(_std::move(src.pool_pimpl)),
+   ep(_std::move(src.ep)),
+   conn(_std::move(src.conn)),
+   reused_(src.reused_) {
+}
+
+connection_pool::lease::~lease() {
+   if (conn) {
+      discard();
+   }
+}
+
+void connection_pool::lease::discard() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (!conn) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   close_connection(conn.get());
+   conn.reset();
+   pool_pimpl->free_slot(ep.get());
+}
+
+void connection_pool::lease::release() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (!conn) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
    }
+   pool_pimpl->put_back(pool_pimpl, ep.get(), _std::move(conn));
+}
+
+
+/*explicit*/ connection_pool::connection_pool(
+   std::size_t connections_per_host_max, unsigned idle_timeout_ms /*= default_idle_timeout_ms*/
+) :
+   pimpl(_std::make_shared<impl>(connections_per_host_max, idle_timeout_ms)) {
+}
+
+connection_pool::~connection_pool() {
+   pimpl->close();
+}
+
+connection_pool::lease connection_pool::checkout(ip::address const & address, ip::port const & port) {
+   LOFTY_TRACE_FUNC(this, address, port);
+
+   auto ep(pimpl->get_endpoint(address, port));
+   if (auto conn = pimpl->take_idle(ep.get())) {
+      return lease(pimpl, _std::move(ep), _std::move(conn), true);
+   }
+   if (ep->open_count < pimpl->connections_per_host_max) {
+      ++ep->open_count;
+   } else {
+      // Park until a connection is released (and handed to us) or discarded (and its slot handed to us).
+      ++pimpl->counters.waits;
+      waiter w;
+      ep->waiters.push_back(&w);
+      try {
+         w.wait();
+      } catch (...) {
+         if (!w.woken) {
+            impl::remove_waiter(ep.get(), &w);
+         } else if (w.conn) {
+            pimpl->put_back(pimpl, ep.get(), _std::move(w.conn));
+         } else {
+            pimpl->free_slot(ep.get());
+         }
+         throw;
+      }
+      if (w.conn) {
+         ++pimpl->counters.reuses;
+         return lease(pimpl, _std::move(ep), _std::move(w.conn), true);
+      }
+   }
+   _std::shared_ptr<connection> conn;
+   try {
+      conn = connect(address, port);
+      if (!pimpl->opts.empty()) {
+         conn->set_options(pimpl->opts);
+      }
+   } catch (...) {
+      if (conn) {
+         close_connection(conn.get());
+      }
+      pimpl->free_slot(ep.get());
+      throw;
+   }
+   ++pimpl->counters.connects;
+   return lease(pimpl, _std::move(ep), _std::move(conn), false);
+}
+
+connection_pool::usage_counters connection_pool::counters() const {
+   return pimpl->counters;
+}
+
+void connection_pool::set_options(socket_options const & opts) {
+   LOFTY_TRACE_FUNC(this);
+
+   pimpl->opts = opts;
+}
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+unsigned const server::default_backlog_size = SOMAXCONN;
+
+server::server(
+   ip::address const & address, ip::port const & port, unsigned backlog_size /*= default_backlog_size*/,
+   bool reuse_port /*= false*/
+) :
+   sock_fd(create_socket(address.version())),
+   ip_version(address.version()),
+   accepted_count(0),
+   rejected_count(0),
+   backlog_full_sample_count(0) {
+   LOFTY_TRACE_FUNC(this, address, port, backlog_size, reuse_port);
+
+   if (reuse_port) {
+#if LOFTY_HOST_API_POSIX && defined(SO_REUSEPORT)
+      int enable = 1;
+      if (::setsockopt(sock_fd.get(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof enable) < 0) {
+         exception::throw_os_error();
+      }
+#else
+      // The OS doesn’t support load-balancing connections across sockets bound to the same port.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+#endif
+   }
+
+   _pvt::sockaddr_any server_sockaddr;
+   auto server_sock_addr_size = _pvt::address_and_port_to_sockaddr(address, port, &server_sockaddr);
 #if LOFTY_HOST_API_WIN32
    if (
       ::bind(
          reinterpret_cast< ::SOCKET>(sock_fd.get()),
-         reinterpret_cast< ::SOCKADDR *>(&server_sockaddr), server_sock_addr_size
+         reinterpret_cast< ::SOCKADDR *>(&server_sockaddr), static_cast<int>(server_sock_addr_size)
       ) < 0 ||
       ::listen(reinterpret_cast< ::SOCKET>(sock_fd.get()), static_cast<int>(backlog_size)) < 0
    ) {
@@ -127,7 +838,10 @@ server::server(ip::address const & address, ip::port const & port, unsigned back
    }
 #else
    if (
-      ::bind(sock_fd.get(), reinterpret_cast< ::sockaddr *>(&server_sockaddr), server_sock_addr_size) < 0 ||
+      ::bind(
+         sock_fd.get(), reinterpret_cast< ::sockaddr *>(&server_sockaddr),
+         static_cast< ::socklen_t>(server_sock_addr_size)
+      ) < 0 ||
       ::listen(sock_fd.get(), static_cast<int>(backlog_size)) < 0
    ) {
       exception::throw_os_error();
@@ -144,12 +858,61 @@ server::~server() {
 _std::shared_ptr<connection> server::accept() {
    LOFTY_TRACE_FUNC(this);
 
+   return accept_one(true);
+}
+
+std::size_t server::accept_batch(
+   collections::vector<_std::shared_ptr<connection>> * conns, std::size_t conns_max
+) {
+   LOFTY_TRACE_FUNC(this, conns, conns_max);
+
+   if (conns_max == 0) {
+      return 0;
+   }
+   // Wait for the first connection, then take any others that are already pending.
+   conns->push_back(accept_one(true));
+   std::size_t accepted = 1;
+#if LOFTY_HOST_API_POSIX
+   if (this_thread::coroutine_scheduler()) {
+   #if LOFTY_HOST_API_LINUX
+      /* Check whether the backlog was full before accepting the connection above, in which case the OS has
+      probably been dropping connection attempts. For a listening socket, tcpi_unacked is the current backlog
+      length, and tcpi_sacked is its maximum; Linux considers the backlog full when it exceeds that. */
+      ::tcp_info ti;
+      ::socklen_t ti_size = sizeof ti;
+      if (
+         ::getsockopt(sock_fd.get(), IPPROTO_TCP, TCP_INFO, &ti, &ti_size) == 0 &&
+         ti.tcpi_unacked + 1 /*the connection just accepted*/ > ti.tcpi_sacked
+      ) {
+         ++backlog_full_sample_count;
+      }
+   #endif
+      while (accepted < conns_max) {
+         try {
+            if (auto conn = accept_one(false)) {
+               conns->push_back(_std::move(conn));
+               ++accepted;
+            } else {
+               break;
+            }
+         } catch (generic_error const &) {
+            // Return the connections accepted so far; the error will likely repeat on the next call.
+            break;
+         }
+      }
+   }
+#endif
+   return accepted;
+}
+
+_std::shared_ptr<connection> server::accept_one(bool wait) {
+   LOFTY_TRACE_FUNC(this, wait);
+
    io::filedesc conn_fd;
-   sockaddr_any * local_sa_ptr, * remote_sa_ptr;
+   _pvt::sockaddr_any * remote_sa_ptr;
 #if LOFTY_HOST_API_POSIX
    bool async = (this_thread::coroutine_scheduler() != nullptr);
-   sockaddr_any local_sa, remote_sa;
-   local_sa_ptr = &local_sa;
+   _pvt::sockaddr_any remote_sa;
    remote_sa_ptr = &remote_sa;
    ::socklen_t remote_sock_addr_size;
    switch (ip_version.base()) {
@@ -161,7 +924,6 @@ _std::shared_ptr<connection> server::accept() {
          break;
       LOFTY_SWITCH_WITHOUT_DEFAULT
    }
-   ::socklen_t local_sock_addr_size = remote_sock_addr_size;
    for (;;) {
       ::socklen_t addr_size = remote_sock_addr_size;
    #if LOFTY_HOST_API_DARWIN
@@ -188,8 +950,13 @@ _std::shared_ptr<connection> server::accept() {
       );
    #endif
       if (conn_fd) {
-         remote_sock_addr_size = addr_size;
-         break;
+         if (apply_accepted_options(&conn_fd)) {
+            remote_sock_addr_size = addr_size;
+            break;
+         }
+         // The connection was rejected; move on to the next one.
+         this_coroutine::interruption_point();
+         continue;
       }
       auto err = errno;
       switch (err) {
@@ -200,42 +967,73 @@ _std::shared_ptr<connection> server::accept() {
    #if EWOULDBLOCK != EAGAIN
          case EWOULDBLOCK:
    #endif
+            if (!wait) {
+               return nullptr;
+            }
             // Wait for sock_fd. Accepting a connection is considered a read event.
             this_coroutine::sleep_until_fd_ready(sock_fd.get(), false);
             break;
+         case ECONNABORTED:
+         case EPERM:
+         case EPROTO:
+   #if LOFTY_HOST_API_LINUX
+         // Linux reports network errors already pending on the new socket as accept() errors.
+         case EHOSTDOWN:
+         case EHOSTUNREACH:
+         case ENETDOWN:
+         case ENETUNREACH:
+         case ENONET:
+         case ENOPROTOOPT:
+         case EOPNOTSUPP:
+   #endif
+            // The connection was lost or refused before it could be accepted; move on to the next one.
+            ++rejected_count;
+            this_coroutine::interruption_point();
+            break;
+         case EMFILE:
+         case ENFILE:
+         case ENOBUFS:
+         case ENOMEM:
+            // Out of resources: the connection will stay in the backlog, but it can’t be accepted now.
+            ++rejected_count;
+            exception::throw_os_error(static_cast<errint_t>(err));
          default:
             exception::throw_os_error(static_cast<errint_t>(err));
       }
    }
-   ::getsockname(conn_fd.get(), reinterpret_cast< ::sockaddr *>(&local_sa), &local_sock_addr_size);
 #elif LOFTY_HOST_API_WIN32
+   LOFTY_UNUSED_ARG(wait);
    // ::AcceptEx() expects a weird and under-documented buffer of which we only know the size.
-   static ::DWORD const sock_addr_buf_size = sizeof(sockaddr_any) + 16;
+   static ::DWORD const sock_addr_buf_size = sizeof(_pvt::sockaddr_any) + 16;
    std::int8_t sock_addr_buf[sock_addr_buf_size * 2];
 
-   conn_fd = create_socket(ip_version);
-   ::DWORD bytes_read;
-   io::overlapped ovl;
-   ovl.Offset = 0;
-   ovl.OffsetHigh = 0;
-   sock_fd.bind_to_this_coroutine_scheduler_iocp();
-   if (!::AcceptEx(
-      reinterpret_cast< ::SOCKET>(sock_fd.get()), reinterpret_cast< ::SOCKET>(conn_fd.get()),
-      sock_addr_buf, 0 /*don’t wait for data, just wait for a connection*/,
-      sock_addr_buf_size, sock_addr_buf_size, &bytes_read, &ovl
-   )) {
-      auto err = static_cast< ::DWORD>(::WSAGetLastError());
-      if (err == ERROR_IO_PENDING) {
-         this_coroutine::sleep_until_fd_ready(sock_fd.get(), false, &ovl);
-         err = ovl.status();
-         bytes_read = ovl.transferred_size();
-      }
-      if (err != ERROR_SUCCESS) {
-         exception::throw_os_error(err);
+   do {
+      conn_fd = create_socket(ip_version);
+      ::DWORD bytes_read;
+      io::overlapped ovl;
+      ovl.Offset = 0;
+      ovl.OffsetHigh = 0;
+      sock_fd.bind_to_this_coroutine_scheduler_iocp();
+      if (!::AcceptEx(
+         reinterpret_cast< ::SOCKET>(sock_fd.get()), reinterpret_cast< ::SOCKET>(conn_fd.get()),
+         sock_addr_buf, 0 /*don’t wait for data, just wait for a connection*/,
+         sock_addr_buf_size, sock_addr_buf_size, &bytes_read, &ovl
+      )) {
+         auto err = static_cast< ::DWORD>(::WSAGetLastError());
+         if (err == ERROR_IO_PENDING) {
+            this_coroutine::sleep_until_fd_ready(sock_fd.get(), false, &ovl);
+            err = ovl.status();
+            bytes_read = ovl.transferred_size();
+         }
+         if (err != ERROR_SUCCESS) {
+            exception::throw_os_error(err);
+         }
       }
-   }
+      // If the connection was rejected, accept the next one into a new socket.
+   } while (!apply_accepted_options(&conn_fd));
 
    // Parse the weird buffer.
+   _pvt::sockaddr_any * local_sa_ptr;
    int remote_sock_addr_size, local_sock_addr_size;
    ::GetAcceptExSockaddrs(
       sock_addr_buf, 0 /*no other data was read*/, sock_addr_buf_size, sock_addr_buf_size,
@@ -246,114 +1044,312 @@ _std::shared_ptr<connection> server::accept() {
    #error "TODO: HOST_API"
 #endif
    this_coroutine::interruption_point();
+   ++accepted_count;
 
-   ip::address local_addr, remote_address;
-   ip::port local_port, remote_port;
-   switch (ip_version.base()) {
-      case ip::version::v4:
-         if (local_sock_addr_size == sizeof local_sa_ptr->sa4) {
-            local_addr = ip::address(
-               *reinterpret_cast<ip::address::v4_type *>(&local_sa_ptr->sa4.sin_addr.s_addr)
-            );
-            local_port = ip::port(ntohs(local_sa_ptr->sa4.sin_port));
-         }
-         if (remote_sock_addr_size == sizeof local_sa_ptr->sa4) {
-            remote_address = ip::address(
-               *reinterpret_cast<ip::address::v4_type *>(&remote_sa_ptr->sa4.sin_addr.s_addr)
-            );
-            remote_port = ip::port(ntohs(remote_sa_ptr->sa4.sin_port));
-         }
-         break;
-      case ip::version::v6:
-         if (local_sock_addr_size == sizeof local_sa_ptr->sa6) {
-            local_addr = ip::address(
-               *reinterpret_cast<ip::address::v6_type *>(&local_sa_ptr->sa6.sin6_addr.s6_addr)
-            );
-            local_port = ip::port(ntohs(local_sa_ptr->sa6.sin6_port));
-         }
-         if (remote_sock_addr_size == sizeof local_sa_ptr->sa6) {
-            remote_address = ip::address(
-               *reinterpret_cast<ip::address::v6_type *>(&remote_sa_ptr->sa6.sin6_addr.s6_addr)
-            );
-            remote_port = ip::port(ntohs(remote_sa_ptr->sa6.sin6_port));
-         }
-         break;
-      LOFTY_SWITCH_WITHOUT_DEFAULT
-   }
+   ip::address remote_address;
+   ip::port remote_port;
+   _pvt::sockaddr_to_address_and_port(
+      *remote_sa_ptr, static_cast<std::size_t>(remote_sock_addr_size), ip_version, &remote_address,
+      &remote_port
+   );
+#if LOFTY_HOST_API_WIN32
+   // ::AcceptEx() already provided the local address, so there’s no reason to defer retrieving it.
+   ip::address local_address;
+   ip::port local_port;
+   _pvt::sockaddr_to_address_and_port(
+      *local_sa_ptr, static_cast<std::size_t>(local_sock_addr_size), ip_version, &local_address, &local_port
+   );
    return _std::make_shared<connection>(
-      _std::move(conn_fd), _std::move(local_addr), _std::move(local_port), _std::move(remote_address),
+      _std::move(conn_fd), _std::move(local_address), _std::move(local_port), _std::move(remote_address),
       _std::move(remote_port)
    );
+#else
+   return _std::make_shared<connection>(
+      _std::move(conn_fd), _std::move(remote_address), _std::move(remote_port)
+   );
+#endif
+}
+
+bool server::apply_accepted_options(io::filedesc * conn_fd) {
+   LOFTY_TRACE_FUNC(this, conn_fd);
+
+   if (!accepted_opts.empty()) {
+      try {
+         accepted_opts.apply(conn_fd->get());
+      } catch (generic_error const &) {
+         // Don’t hand out a socket without the requested options, but don’t stop accepting because of it.
+         *conn_fd = io::filedesc();
+         ++rejected_count;
+         return false;
+      }
+   }
+   return true;
+}
+
+server::accept_counters server::counters() const {
+   accept_counters ret;
+   ret.accepted = accepted_count.load();
+   ret.rejected = rejected_count.load();
+   ret.backlog_full_samples = backlog_full_sample_count.load();
+   return ret;
 }
 
 /*static*/ io::filedesc server::create_socket(ip::version ip_version_) {
    LOFTY_TRACE_FUNC(ip_version_);
 
-   if (ip_version_ == ip::version::any) {
-      // TODO: provide more information in the exception.
-      LOFTY_THROW(domain_error, ());
+   return _pvt::create_socket(ip_version_, SOCK_STREAM);
+}
+
+}}} //namespace lofty::net::tcp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace tcp {
+
+/*! Returns true if an error reported by accept() means that the process or the OS ran out of resources, in
+which case the connection is left in the backlog and can be accepted once resources are released.
+
+@param err
+   OS-defined error number.
+@return
+   true if err is a lack of resources, or false otherwise.
+*/
+static bool is_accept_resources_error(errint_t err) {
+#if LOFTY_HOST_API_POSIX
+   switch (err) {
+      case EMFILE:
+      case ENFILE:
+      case ENOBUFS:
+      case ENOMEM:
+         return true;
+      default:
+         return false;
    }
-   bool async = (this_thread::coroutine_scheduler() != nullptr);
-   int family;
-   switch (ip_version_.base()) {
-      case ip::version::v4:
-         family = AF_INET;
-         break;
-      case ip::version::v6:
-         family = AF_INET6;
-         break;
-      LOFTY_SWITCH_WITHOUT_DEFAULT
+#elif LOFTY_HOST_API_WIN32
+   return err == WSAEMFILE || err == WSAENOBUFS;
+#else
+   #error "TODO: HOST_API"
+#endif
+}
+
+sharded_server::sharded_server(
+   ip::address const & address, ip::port const & port, unsigned shards_count /*= 0*/,
+   unsigned backlog_size /*= server::default_backlog_size*/
+) :
+   interrupted(false) {
+   LOFTY_TRACE_FUNC(this, address, port, shards_count, backlog_size);
+
+   if (port.number() == 0) {
+      // Each shard would be bound to a different ephemeral port.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
    }
-   int type = SOCK_STREAM;
+   if (shards_count == 0) {
 #if LOFTY_HOST_API_POSIX
-   #if !LOFTY_HOST_API_DARWIN
-      type |= SOCK_CLOEXEC;
-      if (async) {
-         // Using coroutines, so make this socket non-blocking.
-         type |= SOCK_NONBLOCK;
+      long online_cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+      shards_count = online_cpus > 0 ? static_cast<unsigned>(online_cpus) : 1;
+#elif LOFTY_HOST_API_WIN32
+      ::SYSTEM_INFO si;
+      ::GetSystemInfo(&si);
+      shards_count = static_cast<unsigned>(si.dwNumberOfProcessors);
+#else
+   #error "TODO: HOST_API"
+#endif
+   }
+   for (unsigned i = 0; i < shards_count; ++i) {
+      _std::unique_ptr<server> shard_server(new server(address, port, backlog_size, true));
+#if LOFTY_HOST_API_POSIX
+      /* The socket was created on this thread, which might not have a coroutine scheduler; it will be used by
+      a shard thread that does, so make sure accept() won’t block the whole shard. */
+      shard_server->sock_fd.set_nonblocking(true);
+#endif
+      servers.push_back(_std::move(shard_server));
+   }
+#if LOFTY_HOST_API_POSIX
+   int fds[2];
+   while (::pipe(fds)) {
+      int err = errno;
+      if (err != EINTR) {
+         exception::throw_os_error(err);
       }
-   #endif
-   io::filedesc fd(::socket(family, type, 0));
-   if (!fd) {
-      exception::throw_os_error();
    }
-   #if LOFTY_HOST_API_DARWIN
-      /* Note that at this point there’s no hack that will ensure a fork()/exec() from another thread won’t
-      leak the file descriptor. That’s the whole point of the extra SOCK_* flags. */
-      fd.set_close_on_exec(true);
-      if (async) {
-         fd.set_nonblocking(true);
+   stop_read_fd = io::filedesc(fds[0]);
+   stop_write_fd = io::filedesc(fds[1]);
+   stop_read_fd.set_close_on_exec(true);
+   stop_write_fd.set_close_on_exec(true);
+   // Neither interrupt() nor reset_interruption() may block.
+   stop_read_fd.set_nonblocking(true);
+   stop_write_fd.set_nonblocking(true);
+#endif
+   /* Elsewhere, the server constructor will have already thrown, since SO_REUSEPORT is not available, so
+   there’s no need for a stop pipe. */
+}
+
+sharded_server::~sharded_server() {
+}
+
+server::accept_counters sharded_server::counters() const {
+   server::accept_counters ret;
+   memory::clear(&ret);
+   LOFTY_FOR_EACH(auto & shard_server, servers) {
+      auto shard_counters(shard_server->counters());
+      ret.accepted += shard_counters.accepted;
+      ret.rejected += shard_counters.rejected;
+      ret.backlog_full_samples += shard_counters.backlog_full_samples;
+   }
+   return ret;
+}
+
+void sharded_server::set_accepted_options(socket_options const & opts) {
+   LOFTY_TRACE_FUNC(this);
+
+   LOFTY_FOR_EACH(auto & shard_server, servers) {
+      shard_server->set_accepted_options(opts);
+   }
+}
+
+void sharded_server::set_options(socket_options const & opts) {
+   LOFTY_TRACE_FUNC(this);
+
+   LOFTY_FOR_EACH(auto & shard_server, servers) {
+      shard_server->set_options(opts);
+   }
+}
+
+void sharded_server::interrupt() {
+   LOFTY_TRACE_FUNC(this);
+
+   if (interrupted.exchange(true)) {
+      // The stop pipe is already readable.
+      return;
+   }
+#if LOFTY_HOST_API_POSIX
+   /* The first shard runs on the thread that called run(), and neither lofty::thread::interrupt() nor
+   lofty::coroutine::interrupt() can stop another thread’s coroutines without also terminating that thread or
+   the process. Instead, make the stop pipe readable: every shard has a coroutine waiting for that. */
+   std::int8_t b = 0;
+   while (::write(stop_write_fd.get(), &b, 1) < 0) {
+      int err = errno;
+      if (err != EINTR) {
+         exception::throw_os_error(err);
       }
-   #endif
-   return _std::move(fd);
-#elif LOFTY_HOST_API_WIN32 //if LOFTY_HOST_API_POSIX
-   static std::uint8_t const wsa_major_version = 2, wsa_minor_version = 2;
-   ::WSADATA wsa_data;
-   if (int ret = ::WSAStartup(MAKEWORD(wsa_major_version, wsa_minor_version), &wsa_data)) {
-      exception::throw_os_error(static_cast<errint_t>(ret));
-   }
-   if (LOBYTE(wsa_data.wVersion) != wsa_major_version || HIBYTE(wsa_data.wVersion) != wsa_minor_version) {
-      // The loaded WinSock implementation does not support the requested version.
-      ::WSACleanup();
-      // TODO: use a better exception class.
-      LOFTY_THROW(generic_error, ());
    }
+#endif
+}
+
+bool sharded_server::reset_interruption() {
+   LOFTY_TRACE_FUNC(this);
+
+#if LOFTY_HOST_API_POSIX
+   // interrupt() writes at most one byte, and the pipe is non-blocking, so this can’t block.
+   std::int8_t b;
+   while (::read(stop_read_fd.get(), &b, 1) < 0 && errno == EINTR) {
+   }
+#endif
+   return interrupted.exchange(false);
+}
+
+void sharded_server::run(connection_handler_type const & conn_handler) {
+   LOFTY_TRACE_FUNC(this);
 
-   ::DWORD flags = 0;
-   if (async) {
-      flags |= WSA_FLAG_OVERLAPPED;
+   try {
+      // Reserve space upfront, so that a failed push_back() can’t lose a new (and still joinable) thread.
+      threads.set_capacity(servers.size() - 1, false);
+      // The first shard will run on this thread, so it can react to interruptions (e.g. Ctrl+C).
+      for (std::size_t i = 1; i < servers.size(); ++i) {
+         auto shard_server = servers[static_cast<std::ptrdiff_t>(i)].get();
+         threads.push_back(thread([this, shard_server, &conn_handler] () {
+            run_shard(shard_server, conn_handler);
+         }));
+      }
+      run_shard(servers[0].get(), conn_handler);
+      LOFTY_FOR_EACH(auto & thread_, threads) {
+         thread_.join();
+      }
+   } catch (...) {
+      /* Don’t leave any shards running: they reference conn_handler, and destructing a joinable thread would
+      abort the process. */
+      interrupt();
+      LOFTY_FOR_EACH(auto & thread_, threads) {
+         if (thread_.joinable()) {
+            try {
+               thread_.join();
+            } catch (...) {
+               // Only the first exception is relevant.
+            }
+         }
+      }
+      threads.clear();
+      reset_interruption();
+      throw;
    }
-   #ifdef WSA_FLAG_NO_HANDLE_INHERIT
-      flags |= WSA_FLAG_NO_HANDLE_INHERIT;
-   #endif
-   ::SOCKET sock = ::WSASocket(family, type, 0, nullptr, 0, flags);
-   if (sock == INVALID_SOCKET) {
-      exception::throw_os_error();
+   threads.clear();
+   if (reset_interruption()) {
+      LOFTY_THROW(execution_interruption, ());
    }
-   return io::filedesc(reinterpret_cast<io::filedesc_t>(sock));
-#else //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32
-   #error "TODO: HOST_API"
-#endif //if LOFTY_HOST_API_POSIX … elif LOFTY_HOST_API_WIN32 … else
+}
+
+void sharded_server::run_shard(server * shard_server, connection_handler_type const & conn_handler) {
+   LOFTY_TRACE_FUNC(this, shard_server);
+
+   // Coroutines running conn_handler, so that they can be interrupted along with the accept loop.
+   collections::hash_map<coroutine::id_type, coroutine> handler_coros;
+   coroutine accept_coro([this, shard_server, &conn_handler, &handler_coros] () {
+      LOFTY_TRACE_FUNC(shard_server);
+
+      collections::vector<_std::shared_ptr<connection>> conns;
+      try {
+         for (;;) {
+            try {
+               // This will cause a context switch if no connections are ready to be established.
+               shard_server->accept_batch(&conns, accept_batch_size);
+            } catch (generic_error const & x) {
+               if (!is_accept_resources_error(x.os_error())) {
+                  throw;
+               }
+               /* Out of file descriptors or memory, e.g. due to a connection storm: give the handlers time to
+               release some, instead of stopping the shard. */
+               this_coroutine::sleep_for_ms(accept_retry_delay_ms);
+               continue;
+            }
+            // Add a coroutine for each newly-established connection, to process it.
+            LOFTY_FOR_EACH(auto & conn, conns) {
+               coroutine handler_coro([this, conn, &conn_handler, &handler_coros] () {
+                  LOFTY_DEFER_TO_SCOPE_END(handler_coros.remove(this_coroutine::id()));
+                  try {
+                     conn_handler(conn);
+                  } catch (execution_interruption const &) {
+                     // Only an interruption caused by interrupt() is a regular way for the handler to end.
+                     if (!interrupted.load()) {
+                        throw;
+                     }
+                  }
+               });
+               auto handler_coro_id = handler_coro.id();
+               handler_coros.add_or_assign(handler_coro_id, _std::move(handler_coro));
+            }
+            conns.clear();
+         }
+      } catch (execution_interruption const &) {
+         if (!interrupted.load()) {
+            throw;
+         }
+      }
+   });
+#if LOFTY_HOST_API_POSIX
+   coroutine([this, &accept_coro, &handler_coros] () {
+      LOFTY_TRACE_FUNC(this);
+
+      // This never consumes the byte written by interrupt(), so the pipe stays readable for every shard.
+      this_coroutine::sleep_until_fd_ready(stop_read_fd.get(), false);
+      accept_coro.interrupt();
+      LOFTY_FOR_EACH(auto kv, handler_coros) {
+         kv.value.interrupt();
+      }
+   });
+#endif
+   // Switch this thread to run coroutines, until they all terminate.
+   this_thread::run_coroutines();
 }
 
 }}} //namespace lofty::net::tcp
@@ -0,0 +1,479 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/net/udp.hxx>
+#include <lofty/thread.hxx>
+#include "_pvt/socket.hxx"
+
+#if LOFTY_HOST_API_POSIX
+   #include <errno.h> // E* errno
+   #include <netinet/in.h> // IPPROTO_UDP
+   #include <netinet/udp.h> // UDP_*
+   #include <sys/socket.h> // bind() getsockname() recvfrom() recvmmsg() sendmmsg() sendto() setsockopt()
+   #include <sys/uio.h> // iovec
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace udp {
+
+namespace {
+
+#if LOFTY_HOST_API_POSIX
+   #if LOFTY_HOST_API_LINUX
+//! Message header as used by recvmmsg() and sendmmsg().
+typedef ::mmsghdr os_msg;
+   #else
+//! Message header with the same layout as Linux’s mmsghdr, to be used with recvmsg() and sendmsg().
+struct os_msg {
+   ::msghdr msg_hdr;
+   unsigned msg_len;
+};
+   #endif
+
+//! Storage referenced by an os_msg.
+struct os_msg_storage {
+   //! Describes the datagram buffer.
+   ::iovec iov;
+   //! Remote address.
+   _pvt::sockaddr_any sa;
+   //! Ancillary data, i.e. the size of coalesced segments.
+   union {
+      ::cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+   } control;
+};
+
+/*! Returns a pointer to the OS-specific message headers of a batch, which are followed by the storage they
+reference.
+
+@param os_descs
+   Memory allocated for the OS-specific structures of a batch.
+@return
+   Pointer to the first message header.
+*/
+inline os_msg * os_msgs(void * os_descs) {
+   return static_cast<os_msg *>(os_descs);
+}
+
+/*! Returns a pointer to the storage referenced by the OS-specific message headers of a batch.
+
+@param os_descs
+   Memory allocated for the OS-specific structures of a batch.
+@param capacity
+   Capacity of the batch.
+@return
+   Pointer to the storage for the first message.
+*/
+inline os_msg_storage * os_msg_storages(void * os_descs, std::size_t capacity) {
+   return reinterpret_cast<os_msg_storage *>(os_msgs(os_descs) + capacity);
+}
+#endif //if LOFTY_HOST_API_POSIX
+
+} //namespace
+
+datagram_batch::datagram_batch(std::size_t capacity, std::size_t datagram_max_size) :
+   capacity_(capacity),
+   datagram_max_size_(datagram_max_size),
+   size_(0),
+   bufs_pages(capacity * datagram_max_size),
+   bufs(static_cast<std::uint8_t *>(bufs_pages.get())),
+   infos(new datagram_info[capacity]) {
+#if LOFTY_HOST_API_POSIX
+   os_descs = memory::alloc_bytes_unique(capacity * (sizeof(os_msg) + sizeof(os_msg_storage)));
+   auto msgs = os_msgs(os_descs.get());
+   auto storages = os_msg_storages(os_descs.get(), capacity);
+   // Link each header to its storage once; the sizes are reset by every system call.
+   for (std::size_t i = 0; i < capacity; ++i) {
+      memory::clear(&msgs[i]);
+      storages[i].iov.iov_base = data(i);
+      storages[i].iov.iov_len = datagram_max_size;
+      msgs[i].msg_hdr.msg_name = &storages[i].sa;
+      msgs[i].msg_hdr.msg_iov = &storages[i].iov;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+#endif
+}
+
+datagram_batch::~datagram_batch() {
+}
+
+std::uint8_t * datagram_batch::push_back(std::size_t size, ip::address const & address, ip::port const & port) {
+   if (size_ == capacity_ || size > datagram_max_size_) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   auto & info = infos[size_];
+   info.address = address;
+   info.port = port;
+   info.size = size;
+   info.segment_size = 0;
+   info.truncated = false;
+   return data(size_++);
+}
+
+}}} //namespace lofty::net::udp
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace net { namespace udp {
+
+socket::socket(ip::version ip_version_) :
+   fd(_pvt::create_socket(ip_version_, SOCK_DGRAM)),
+   ip_version(ip_version_),
+   receive_coalescing(false) {
+}
+
+socket::socket(ip::address const & address, ip::port const & port) :
+   fd(_pvt::create_socket(address.version(), SOCK_DGRAM)),
+   ip_version(address.version()),
+   receive_coalescing(false) {
+   LOFTY_TRACE_FUNC(this, address, port);
+
+   _pvt::sockaddr_any sa;
+   auto sa_size = _pvt::address_and_port_to_sockaddr(address, port, &sa);
+#if LOFTY_HOST_API_POSIX
+   if (::bind(fd.get(), reinterpret_cast< ::sockaddr *>(&sa), static_cast< ::socklen_t>(sa_size)) < 0) {
+      exception::throw_os_error();
+   }
+#elif LOFTY_HOST_API_WIN32
+   if (::bind(
+      reinterpret_cast< ::SOCKET>(fd.get()), reinterpret_cast< ::SOCKADDR *>(&sa), static_cast<int>(sa_size)
+   ) < 0) {
+      exception::throw_os_error(static_cast<errint_t>(::WSAGetLastError()));
+   }
+#else
+   #error "TODO: HOST_API"
+#endif
+}
+
+socket::~socket() {
+#if LOFTY_HOST_API_WIN32
+   ::WSACleanup();
+#endif
+}
+
+ip::address socket::local_address() const {
+   LOFTY_TRACE_FUNC(this);
+
+   ip::address address;
+   ip::port port;
+   _pvt::get_socket_name(fd.get(), ip_version, &address, &port);
+   return _std::move(address);
+}
+
+ip::port socket::local_port() const {
+   LOFTY_TRACE_FUNC(this);
+
+   ip::address address;
+   ip::port port;
+   _pvt::get_socket_name(fd.get(), ip_version, &address, &port);
+   return _std::move(port);
+}
+
+std::size_t socket::receive(void * dst, std::size_t dst_max, ip::address * address, ip::port * port) {
+   LOFTY_TRACE_FUNC(this, dst, dst_max, address, port);
+
+   _pvt::sockaddr_any sa;
+#if LOFTY_HOST_API_POSIX
+   ::ssize_t bytes_read;
+   ::socklen_t sa_size;
+   for (;;) {
+      sa_size = sizeof sa;
+      bytes_read = ::recvfrom(fd.get(), dst, dst_max, 0, reinterpret_cast< ::sockaddr *>(&sa), &sa_size);
+      if (bytes_read >= 0) {
+         break;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            this_coroutine::sleep_until_fd_ready(fd.get(), false);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+#elif LOFTY_HOST_API_WIN32
+   // TODO: use overlapped I/O to avoid blocking the thread.
+   int sa_size = sizeof sa;
+   int bytes_read = ::recvfrom(
+      reinterpret_cast< ::SOCKET>(fd.get()), static_cast<char *>(dst), static_cast<int>(dst_max), 0,
+      reinterpret_cast< ::SOCKADDR *>(&sa), &sa_size
+   );
+   if (bytes_read < 0) {
+      auto err = ::WSAGetLastError();
+      if (err == WSAEMSGSIZE) {
+         // The datagram was truncated to fit dst.
+         bytes_read = static_cast<int>(dst_max);
+      } else {
+         exception::throw_os_error(static_cast<errint_t>(err));
+      }
+   }
+#else
+   #error "TODO: HOST_API"
+#endif
+   this_coroutine::interruption_point();
+   _pvt::sockaddr_to_address_and_port(sa, static_cast<std::size_t>(sa_size), ip_version, address, port);
+   return static_cast<std::size_t>(bytes_read);
+}
+
+std::size_t socket::receive_batch(datagram_batch * batch) {
+   LOFTY_TRACE_FUNC(this, batch);
+
+   batch->clear();
+   if (batch->capacity_ == 0) {
+      return 0;
+   }
+#if LOFTY_HOST_API_POSIX
+   auto msgs = os_msgs(batch->os_descs.get());
+   auto storages = os_msg_storages(batch->os_descs.get(), batch->capacity_);
+   for (std::size_t i = 0; i < batch->capacity_; ++i) {
+      // These are all updated by the OS, so they need to be reset every time.
+      storages[i].iov.iov_len = batch->datagram_max_size_;
+      msgs[i].msg_hdr.msg_namelen = sizeof storages[i].sa;
+      if (receive_coalescing) {
+         msgs[i].msg_hdr.msg_control = &storages[i].control;
+         msgs[i].msg_hdr.msg_controllen = sizeof storages[i].control;
+      } else {
+         msgs[i].msg_hdr.msg_control = nullptr;
+         msgs[i].msg_hdr.msg_controllen = 0;
+      }
+      msgs[i].msg_hdr.msg_flags = 0;
+   }
+   std::size_t received;
+   for (;;) {
+   #if LOFTY_HOST_API_LINUX
+      // MSG_WAITFORONE makes recvmmsg() stop blocking after the first datagram, if the socket is blocking.
+      int ret = ::recvmmsg(fd.get(), msgs, static_cast<unsigned>(batch->capacity_), MSG_WAITFORONE, nullptr);
+      if (ret >= 0) {
+         received = static_cast<std::size_t>(ret);
+         break;
+      }
+   #else
+      /* Emulate recvmmsg() with one recvmsg() per datagram; only the first call may block, since the socket
+      will be non-blocking if there’s a coroutine scheduler, and otherwise only one datagram is received. */
+      ::ssize_t ret = ::recvmsg(fd.get(), &msgs[0].msg_hdr, 0);
+      if (ret >= 0) {
+         msgs[0].msg_len = static_cast<unsigned>(ret);
+         received = 1;
+         if (this_thread::coroutine_scheduler()) {
+            for (; received < batch->capacity_; ++received) {
+               ret = ::recvmsg(fd.get(), &msgs[received].msg_hdr, 0);
+               if (ret < 0) {
+                  break;
+               }
+               msgs[received].msg_len = static_cast<unsigned>(ret);
+            }
+         }
+         break;
+      }
+   #endif
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            this_coroutine::sleep_until_fd_ready(fd.get(), false);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+   for (std::size_t i = 0; i < received; ++i) {
+      auto & info = batch->infos[i];
+      info.size = msgs[i].msg_len;
+      info.segment_size = 0;
+      info.truncated = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+      _pvt::sockaddr_to_address_and_port(
+         storages[i].sa, msgs[i].msg_hdr.msg_namelen, ip_version, &info.address, &info.port
+      );
+   #if defined(UDP_GRO)
+      if (receive_coalescing) {
+         for (
+            auto cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)
+         ) {
+            if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+               int segment_size;
+               memory::copy(
+                  reinterpret_cast<std::uint8_t *>(&segment_size), CMSG_DATA(cmsg), sizeof segment_size
+               );
+               info.segment_size = static_cast<std::size_t>(segment_size);
+            }
+         }
+      }
+   #endif
+   }
+   batch->size_ = received;
+#elif LOFTY_HOST_API_WIN32
+   // TODO: use WSARecvMsg() with overlapped I/O; for now, only receive one datagram at a time.
+   auto & info = batch->infos[0];
+   info.size = receive(batch->data(0), batch->datagram_max_size_, &info.address, &info.port);
+   info.segment_size = 0;
+   // TODO: receive() hides WSAEMSGSIZE, so truncation can’t be detected here.
+   info.truncated = false;
+   batch->size_ = 1;
+#else
+   #error "TODO: HOST_API"
+#endif
+   this_coroutine::interruption_point();
+   return batch->size_;
+}
+
+void socket::send(void const * src, std::size_t src_size, ip::address const & address, ip::port const & port) {
+   LOFTY_TRACE_FUNC(this, src, src_size, address, port);
+
+   _pvt::sockaddr_any sa;
+   auto sa_size = _pvt::address_and_port_to_sockaddr(address, port, &sa);
+#if LOFTY_HOST_API_POSIX
+   while (::sendto(
+      fd.get(), src, src_size, 0, reinterpret_cast< ::sockaddr *>(&sa), static_cast< ::socklen_t>(sa_size)
+   ) < 0) {
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            this_coroutine::sleep_until_fd_ready(fd.get(), true);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+#elif LOFTY_HOST_API_WIN32
+   // TODO: use overlapped I/O to avoid blocking the thread.
+   if (::sendto(
+      reinterpret_cast< ::SOCKET>(fd.get()), static_cast<char const *>(src), static_cast<int>(src_size), 0,
+      reinterpret_cast< ::SOCKADDR *>(&sa), static_cast<int>(sa_size)
+   ) < 0) {
+      exception::throw_os_error(static_cast<errint_t>(::WSAGetLastError()));
+   }
+#else
+   #error "TODO: HOST_API"
+#endif
+   this_coroutine::interruption_point();
+}
+
+void socket::send_batch(datagram_batch const & batch) {
+   LOFTY_TRACE_FUNC(this/*, batch*/);
+
+#if LOFTY_HOST_API_POSIX
+   auto msgs = os_msgs(batch.os_descs.get());
+   auto storages = os_msg_storages(batch.os_descs.get(), batch.capacity_);
+   for (std::size_t i = 0; i < batch.size_; ++i) {
+      auto const & info = batch.infos[i];
+      storages[i].iov.iov_len = info.size;
+      msgs[i].msg_hdr.msg_namelen = static_cast< ::socklen_t>(
+         _pvt::address_and_port_to_sockaddr(info.address, info.port, &storages[i].sa)
+      );
+      msgs[i].msg_hdr.msg_control = nullptr;
+      msgs[i].msg_hdr.msg_controllen = 0;
+      msgs[i].msg_hdr.msg_flags = 0;
+   }
+   for (std::size_t sent = 0; sent < batch.size_; ) {
+   #if LOFTY_HOST_API_LINUX
+      int ret = ::sendmmsg(fd.get(), msgs + sent, static_cast<unsigned>(batch.size_ - sent), 0);
+   #else
+      ::ssize_t ret = ::sendmsg(fd.get(), &msgs[sent].msg_hdr, 0);
+      if (ret >= 0) {
+         ret = 1;
+      }
+   #endif
+      if (ret >= 0) {
+         sent += static_cast<std::size_t>(ret);
+         continue;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+   #if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+   #endif
+            this_coroutine::sleep_until_fd_ready(fd.get(), true);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+   this_coroutine::interruption_point();
+#elif LOFTY_HOST_API_WIN32
+   // TODO: use WSASendMsg() with overlapped I/O; for now, send one datagram at a time.
+   for (std::size_t i = 0; i < batch.size_; ++i) {
+      auto const & info = batch.infos[i];
+      send(batch.data(i), info.size, info.address, info.port);
+   }
+#else
+   #error "TODO: HOST_API"
+#endif
+}
+
+void socket::set_receive_coalescing(bool enable) {
+   LOFTY_TRACE_FUNC(this, enable);
+
+#if defined(UDP_GRO)
+   int value = enable ? 1 : 0;
+   if (::setsockopt(fd.get(), IPPROTO_UDP, UDP_GRO, &value, sizeof value) < 0) {
+      exception::throw_os_error();
+   }
+   receive_coalescing = enable;
+#else
+   if (enable) {
+      // The OS doesn’t support coalescing received datagrams.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+#endif
+}
+
+void socket::set_send_segment_size(std::size_t segment_size) {
+   LOFTY_TRACE_FUNC(this, segment_size);
+
+#if defined(UDP_SEGMENT)
+   int value = static_cast<int>(segment_size);
+   if (::setsockopt(fd.get(), IPPROTO_UDP, UDP_SEGMENT, &value, sizeof value) < 0) {
+      exception::throw_os_error();
+   }
+#else
+   if (segment_size) {
+      // The OS doesn’t support segmenting sent datagrams.
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+#endif
+}
+
+}}} //namespace lofty::net::udp
@@ -0,0 +1,547 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/collections/queue.hxx>
+#include <lofty/collections/vector.hxx>
+#include <lofty/os/dir.hxx>
+#include <lofty/thread.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <dirent.h> // DT_*
+   #include <errno.h> // E* errno
+   #include <fcntl.h> // O_* openat()
+   #include <sys/stat.h> // fstatat() S_*
+   #include <unistd.h> // pipe() pipe2() read() write()
+   #if LOFTY_HOST_API_LINUX
+      #include <sys/syscall.h> // SYS_getdents64 syscall()
+   #endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace os {
+
+#if LOFTY_HOST_API_LINUX
+//! Layout of the records returned by getdents64(); glibc doesn’t define it.
+struct linux_dirent64 {
+   std::uint64_t d_ino;
+   std::int64_t d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[1];
+};
+#endif
+
+/*! Converts a DT_* constant into a dir_entry_type, calling fstatat() if the file system didn’t provide one.
+
+@param d_type
+   Type returned by the OS.
+@param dir_fd
+   Directory containing the entry.
+@param name
+   NUL-terminated name of the entry.
+@return
+   Type of the entry.
+*/
+static dir_entry_type::enum_type entry_type_from_dirent(
+   unsigned d_type, io::filedesc_t dir_fd, char_t const * name
+) {
+   switch (d_type) {
+      case DT_BLK:  return dir_entry_type::block_device;
+      case DT_CHR:  return dir_entry_type::char_device;
+      case DT_DIR:  return dir_entry_type::dir;
+      case DT_FIFO: return dir_entry_type::fifo;
+      case DT_LNK:  return dir_entry_type::symlink;
+      case DT_REG:  return dir_entry_type::regular_file;
+      case DT_SOCK: return dir_entry_type::socket;
+   }
+   struct ::stat st;
+   if (::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+      // The entry was probably removed after being read.
+      return dir_entry_type::unknown;
+   }
+   if (S_ISBLK(st.st_mode)) {
+      return dir_entry_type::block_device;
+   } else if (S_ISCHR(st.st_mode)) {
+      return dir_entry_type::char_device;
+   } else if (S_ISDIR(st.st_mode)) {
+      return dir_entry_type::dir;
+   } else if (S_ISFIFO(st.st_mode)) {
+      return dir_entry_type::fifo;
+   } else if (S_ISLNK(st.st_mode)) {
+      return dir_entry_type::symlink;
+   } else if (S_ISREG(st.st_mode)) {
+      return dir_entry_type::regular_file;
+   } else if (S_ISSOCK(st.st_mode)) {
+      return dir_entry_type::socket;
+   } else {
+      return dir_entry_type::unknown;
+   }
+}
+
+/*! Returns true if the name of a directory entry is “.” or “..”.
+
+@param name
+   NUL-terminated name of the entry.
+@return
+   true if the name should be skipped, or false otherwise.
+*/
+static bool is_dot_or_dot_dot(char_t const * name) {
+   return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/*! Creates a pipe whose ends will be closed on exec().
+
+@param read_fd
+   Receives the read end of the pipe.
+@param write_fd
+   Receives the write end of the pipe.
+*/
+static void create_pipe(io::filedesc * read_fd, io::filedesc * write_fd) {
+   int fds[2];
+#if LOFTY_HOST_API_DARWIN
+   // pipe2() is not available, so emulate it with pipe() + fcntl().
+   if (::pipe(fds) < 0) {
+      exception::throw_os_error();
+   }
+   *read_fd = io::filedesc(fds[0]);
+   *write_fd = io::filedesc(fds[1]);
+   read_fd->set_close_on_exec(true);
+   write_fd->set_close_on_exec(true);
+#else
+   if (::pipe2(fds, O_CLOEXEC) < 0) {
+      exception::throw_os_error();
+   }
+   *read_fd = io::filedesc(fds[0]);
+   *write_fd = io::filedesc(fds[1]);
+#endif
+}
+
+/*! Blocks until a byte can be read from a pipe, retrying in case of EINTR.
+
+@param fd
+   File descriptor to read from.
+*/
+static void read_byte(io::filedesc_t fd) {
+   std::int8_t b;
+   while (::read(fd, &b, 1) <= 0) {
+      int err = errno;
+      if (err != EINTR) {
+         exception::throw_os_error(err);
+      }
+      this_thread::interruption_point();
+   }
+}
+
+/*! Writes bytes to a pipe, retrying in case of EINTR.
+
+@param fd
+   File descriptor to write to.
+@param count
+   Count of bytes to write.
+*/
+static void write_bytes(io::filedesc_t fd, std::size_t count) {
+   std::int8_t b = 0;
+   while (count) {
+      if (::write(fd, &b, 1) > 0) {
+         --count;
+      } else {
+         int err = errno;
+         if (err != EINTR) {
+            exception::throw_os_error(err);
+         }
+      }
+   }
+}
+
+/*! Opens a directory for enumeration.
+
+@param parent_fd
+   Directory that name is relative to, or AT_FDCWD.
+@param name
+   NUL-terminated name or path of the directory.
+@return
+   Open directory, or an invalid file descriptor if the call failed; errno will have been set accordingly.
+*/
+static io::filedesc open_dir(io::filedesc_t parent_fd, char_t const * name) {
+   int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+   if (parent_fd != AT_FDCWD) {
+      // A symlink to a directory reported as a symlink must never be followed.
+      flags |= O_NOFOLLOW;
+   }
+   io::filedesc_t fd;
+   do {
+      fd = ::openat(parent_fd, name, flags);
+   } while (fd < 0 && errno == EINTR);
+   return io::filedesc(fd);
+}
+
+
+dir_iterator::dir_iterator(path const & dir_path) :
+#if LOFTY_HOST_API_LINUX
+   buf_used(0),
+   buf_offset(0),
+#else
+   dir(nullptr),
+#endif
+   eof(false) {
+   LOFTY_TRACE_FUNC(this, dir_path);
+
+   fd_ = open_dir(AT_FDCWD, dir_path.os_str().c_str());
+   if (!fd_) {
+      exception::throw_os_error();
+   }
+   read_next();
+}
+
+dir_iterator::dir_iterator(io::filedesc_t parent_fd, str const & name) :
+#if LOFTY_HOST_API_LINUX
+   buf_used(0),
+   buf_offset(0),
+#else
+   dir(nullptr),
+#endif
+   eof(false) {
+   LOFTY_TRACE_FUNC(this, parent_fd, name);
+
+   fd_ = open_dir(parent_fd, name.c_str());
+   if (!fd_) {
+      exception::throw_os_error();
+   }
+   read_next();
+}
+
+dir_iterator::dir_iterator(io::filedesc && dir_fd) :
+   fd_(_std::move(dir_fd)),
+#if LOFTY_HOST_API_LINUX
+   buf_used(0),
+   buf_offset(0),
+#else
+   dir(nullptr),
+#endif
+   eof(false) {
+   LOFTY_TRACE_FUNC(this);
+
+   read_next();
+}
+
+dir_iterator::~dir_iterator() {
+#if LOFTY_HOST_API_POSIX && !LOFTY_HOST_API_LINUX
+   if (dir) {
+      // closedir() also closes the file descriptor.
+      fd_.release();
+      ::closedir(dir);
+   }
+#endif
+}
+
+void dir_iterator::read_next() {
+   LOFTY_TRACE_FUNC(this);
+
+   for (;;) {
+#if LOFTY_HOST_API_LINUX
+      if (buf_offset >= buf_used) {
+         if (!buf) {
+            buf = memory::alloc_bytes_unique(buffer_size);
+         }
+         long read_bytes;
+         do {
+            read_bytes = ::syscall(SYS_getdents64, fd_.get(), buf.get(), buffer_size);
+         } while (read_bytes < 0 && errno == EINTR);
+         if (read_bytes < 0) {
+            exception::throw_os_error();
+         } else if (read_bytes == 0) {
+            eof = true;
+            return;
+         }
+         buf_used = static_cast<std::size_t>(read_bytes);
+         buf_offset = 0;
+      }
+      auto dirent = reinterpret_cast<linux_dirent64 const *>(
+         static_cast<std::int8_t *>(buf.get()) + buf_offset
+      );
+      buf_offset += dirent->d_reclen;
+      char_t const * name = dirent->d_name;
+      if (is_dot_or_dot_dot(name)) {
+         continue;
+      }
+      curr.inode_ = dirent->d_ino;
+      unsigned d_type = dirent->d_type;
+#else //if LOFTY_HOST_API_LINUX
+      if (!dir) {
+         dir = ::fdopendir(fd_.get());
+         if (!dir) {
+            exception::throw_os_error();
+         }
+      }
+      errno = 0;
+      ::dirent const * dirent = ::readdir(dir);
+      if (!dirent) {
+         if (errno != 0) {
+            exception::throw_os_error();
+         }
+         eof = true;
+         return;
+      }
+      char_t const * name = dirent->d_name;
+      if (is_dot_or_dot_dot(name)) {
+         continue;
+      }
+      curr.inode_ = dirent->d_ino;
+      unsigned d_type = dirent->d_type;
+#endif //if LOFTY_HOST_API_LINUX … else
+      curr.name_chars = name;
+      curr.name_size = text::size_in_chars(name);
+      curr.rel_path_chars = curr.name_chars;
+      curr.rel_path_size = curr.name_size;
+      curr.dir_fd_ = fd_.get();
+      curr.type_ = entry_type_from_dirent(d_type, fd_.get(), name);
+      return;
+   }
+}
+
+
+//! Directory opened by a thread, waiting for another one to enumerate it.
+struct queued_dir {
+   //! Open directory.
+   io::filedesc fd;
+   //! Path of the directory relative to the root of the walk.
+   str rel_path;
+   //! Depth of the directory’s entries.
+   unsigned depth;
+};
+
+struct dir_walker::walk_state {
+   //! Function to call for each entry.
+   visit_fn_type const * visit;
+   //! Governs access to the non-atomic members below.
+   _std::mutex mtx;
+   //! Directories waiting for a thread.
+   collections::queue<_std::shared_ptr<queued_dir>> queued_dirs;
+   //! Count of threads enumerating a directory.
+   std::size_t busy_threads;
+   //! Count of threads waiting for a queued directory; read without locking mtx to decide whether to queue.
+   _std::atomic<unsigned> idle_threads;
+   //! Set to stop all threads as soon as possible.
+   _std::atomic<bool> aborted;
+   //! First error that aborted the walk.
+   int err;
+   //! First exception thrown by a thread, to be rethrown by walk().
+   _std::exception_ptr exception;
+   //! If true, threads will terminate instead of waiting for more directories.
+   bool stopping;
+   //! Read end of the pipe used to wake threads, one byte per queued directory.
+   io::filedesc wake_read_fd;
+   //! Write end of the pipe used to wake threads.
+   io::filedesc wake_write_fd;
+
+   /*! Constructor.
+
+   @param visit_
+      Function to call for each entry.
+   */
+   walk_state(visit_fn_type const * visit_) :
+      visit(visit_),
+      busy_threads(0),
+      idle_threads(0),
+      aborted(false),
+      err(0),
+      stopping(false) {
+   }
+
+   /*! Makes all threads stop as soon as possible, recording an error if it’s the first one. The walk will
+   continue until every thread has stopped enumerating its directory.
+
+   @param err_
+      Error to be thrown by walk().
+   */
+   void abort(int err_) {
+      _std::lock_guard<_std::mutex> lock(mtx);
+      if (err == 0) {
+         err = err_;
+      }
+      aborted.store(true);
+   }
+
+   /*! Makes all threads terminate as soon as possible, without waiting for them to finish. Used when an
+   exception is thrown, since the thread that threw it won’t keep track of its directory anymore.
+
+   @param threads
+      Count of threads that could be waiting for a directory.
+   @param x
+      Exception to be rethrown by walk(), unless another thread already recorded one.
+   */
+   void terminate(std::size_t threads, _std::exception_ptr x) {
+      {
+         _std::lock_guard<_std::mutex> lock(mtx);
+         if (!exception) {
+            exception = _std::move(x);
+         }
+         aborted.store(true);
+         stopping = true;
+      }
+      write_bytes(wake_write_fd.get(), threads);
+   }
+};
+
+
+void dir_walker::walk(path const & root_path, visit_fn_type const & visit) const {
+   LOFTY_TRACE_FUNC(this, root_path);
+
+   io::filedesc root_fd(open_dir(AT_FDCWD, root_path.os_str().c_str()));
+   if (!root_fd) {
+      exception::throw_os_error();
+   }
+   walk_state state(&visit);
+   if (threads_ <= 1) {
+      collections::vector<char_t> rel_path;
+      walk_dir(&state, &rel_path, _std::move(root_fd), 0);
+   } else {
+      create_pipe(&state.wake_read_fd, &state.wake_write_fd);
+      {
+         _std::shared_ptr<queued_dir> root_dir(new queued_dir());
+         root_dir->fd = _std::move(root_fd);
+         root_dir->depth = 0;
+         state.queued_dirs.push_back(_std::move(root_dir));
+      }
+      state.idle_threads.store(threads_);
+      write_bytes(state.wake_write_fd.get(), 1);
+      collections::vector<thread> workers;
+      for (unsigned i = 1; i < threads_; ++i) {
+         workers.push_back(thread([this, &state] () {
+            worker_main(&state);
+         }));
+      }
+      /* worker_main() doesn’t throw; exceptions from the filter, the visit function or the enumeration are
+      rethrown here, once every thread is done using state. */
+      worker_main(&state);
+      LOFTY_FOR_EACH(auto & worker, workers) {
+         worker.join();
+      }
+      if (state.exception) {
+         _std::rethrow_exception(state.exception);
+      }
+   }
+   if (state.err != 0) {
+      exception::throw_os_error(state.err);
+   }
+}
+
+void dir_walker::walk_dir(
+   walk_state * state, collections::vector<char_t> * rel_path, io::filedesc && dir_fd, unsigned depth
+) const {
+   LOFTY_TRACE_FUNC(this, state, rel_path, depth);
+
+   std::size_t dir_rel_path_size = rel_path->size();
+   dir_iterator itr(_std::move(dir_fd));
+   for (; itr; ++itr) {
+      if (state->aborted.load()) {
+         break;
+      }
+      dir_entry & entry = itr.curr;
+      // Replace the previous entry’s name with this one’s.
+      rel_path->set_size(dir_rel_path_size);
+      if (dir_rel_path_size > 0) {
+         rel_path->push_back(path::separator()[0]);
+      }
+      rel_path->push_back(entry.name_chars, entry.name_size);
+      entry.rel_path_chars = rel_path->data();
+      entry.rel_path_size = rel_path->size();
+      entry.depth_ = depth;
+      if (filter_ && !filter_(entry)) {
+         continue;
+      }
+      (*state->visit)(entry);
+      if (entry.type_ != dir_entry_type::dir || depth >= max_depth_) {
+         continue;
+      }
+      io::filedesc subdir_fd(open_dir(itr.fd(), entry.name_chars));
+      if (!subdir_fd) {
+         int err = errno;
+         switch (err) {
+            case EACCES: // Can’t be read.
+            case ELOOP: // Replaced by a symlink after being read.
+            case ENOENT: // Removed after being read.
+            case ENOTDIR: // Replaced by something else after being read.
+               continue;
+            default:
+               state->abort(err);
+               return;
+         }
+      }
+      if (state->idle_threads.load() > 0) {
+         _std::lock_guard<_std::mutex> lock(state->mtx);
+         // Only hand off as many directories as there are threads to take them.
+         if (state->queued_dirs.size() < state->idle_threads.load()) {
+            _std::shared_ptr<queued_dir> subdir(new queued_dir());
+            subdir->fd = _std::move(subdir_fd);
+            subdir->rel_path = str(rel_path->data(), rel_path->data() + rel_path->size());
+            subdir->depth = depth + 1;
+            state->queued_dirs.push_back(_std::move(subdir));
+            write_bytes(state->wake_write_fd.get(), 1);
+            continue;
+         }
+      }
+      walk_dir(state, rel_path, _std::move(subdir_fd), depth + 1);
+   }
+   rel_path->set_size(dir_rel_path_size);
+}
+
+void dir_walker::worker_main(walk_state * state) const {
+   LOFTY_TRACE_FUNC(this, state);
+
+   collections::vector<char_t> rel_path;
+   try {
+      for (;;) {
+         read_byte(state->wake_read_fd.get());
+         _std::shared_ptr<queued_dir> dir;
+         {
+            _std::lock_guard<_std::mutex> lock(state->mtx);
+            if (state->stopping) {
+               break;
+            }
+            /* Each byte in the pipe was written together with a queued directory, and only threads that
+            have read one take directories from the queue. */
+            dir = state->queued_dirs.pop_front();
+            ++state->busy_threads;
+            state->idle_threads.store(state->idle_threads.load() - 1);
+         }
+         rel_path.set_size(0);
+         rel_path.push_back(dir->rel_path.data(), dir->rel_path.size_in_chars());
+         walk_dir(state, &rel_path, _std::move(dir->fd), dir->depth);
+         dir.reset();
+         _std::lock_guard<_std::mutex> lock(state->mtx);
+         --state->busy_threads;
+         state->idle_threads.store(state->idle_threads.load() + 1);
+         if (state->busy_threads == 0 && !state->queued_dirs) {
+            // Nothing left to enumerate, and nothing that could queue more: wake every thread to terminate.
+            state->stopping = true;
+            write_bytes(state->wake_write_fd.get(), threads_);
+         }
+      }
+   } catch (...) {
+      /* Escaping a thread would terminate the process: record the exception for walk() to rethrow, and make
+      the other threads stop. */
+      state->terminate(threads_, _std::current_exception());
+   }
+}
+
+}} //namespace lofty::os
+
+#endif //if LOFTY_HOST_API_POSIX
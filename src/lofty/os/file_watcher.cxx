@@ -0,0 +1,237 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/collections/hash_map.hxx>
+#include <lofty/collections/vector.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/os/file_watcher.hxx>
+
+#if LOFTY_HOST_API_LINUX
+   #include <errno.h> // E* errno
+   #include <sys/inotify.h> // inotify_*() IN_*
+   #include <unistd.h> // read()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace os {
+
+//! Maps each file_watcher::change to the inotify events that report it.
+static struct {
+   unsigned change;
+   std::uint32_t in_mask;
+} const change_in_masks[] = {
+   { file_watcher::change_attributes, IN_ATTRIB },
+   { file_watcher::change_created,    IN_CREATE },
+   { file_watcher::change_deleted,    IN_DELETE | IN_DELETE_SELF },
+   { file_watcher::change_moved,      IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF },
+   { file_watcher::change_modified,   IN_MODIFY },
+   { file_watcher::change_written,    IN_CLOSE_WRITE },
+   { file_watcher::change_unwatched,  IN_IGNORED },
+   { file_watcher::change_overflow,   IN_Q_OVERFLOW }
+};
+
+namespace {
+
+//! Identifies the entry an event is reported for, to coalesce the changes reported by a single wait().
+struct event_key {
+   //! Watch the change was reported for.
+   file_watcher::watch_id_type watch_id;
+   //! Name of the entry; may be an external_buffer view when only used for a lookup.
+   str name;
+
+   /*! Constructor.
+
+   @param watch_id_
+      Watch the change was reported for.
+   @param name_
+      Name of the entry.
+   */
+   event_key(file_watcher::watch_id_type watch_id_, str name_) :
+      watch_id(watch_id_),
+      name(_std::move(name_)) {
+   }
+};
+
+//! Hash functor for event_key.
+struct event_key_hasher {
+   /*! Function call operator.
+
+   @param key
+      Key to hash.
+   @return
+      Hash of key.
+   */
+   std::size_t operator()(event_key const & key) const {
+      return (std::hash<str>()(key.name) ^ static_cast<std::size_t>(key.watch_id)) * 16777619u;
+   }
+};
+
+//! Equality functor for event_key.
+struct event_key_equal {
+   /*! Function call operator.
+
+   @param key1
+      First key to compare.
+   @param key2
+      Second key to compare.
+   @return
+      true if the two keys identify the same entry, or false otherwise.
+   */
+   bool operator()(event_key const & key1, event_key const & key2) const {
+      return key1.watch_id == key2.watch_id && key1.name == key2.name;
+   }
+};
+
+//! Maps each entry reported by a single wait() to the index of its event.
+typedef collections::hash_map<event_key, std::size_t, event_key_hasher, event_key_equal> event_indices;
+
+/*! Appends an event to *events, or merges it with an event already appended by the same call to wait().
+
+@param events
+   Pointer to the vector to append the event to.
+@param indices
+   Pointer to the indices of the events appended by the current call to wait().
+@param watch_id
+   Watch the change was reported for.
+@param changes
+   Changes that occurred.
+@param name
+   Pointer to the NUL-terminated name of the entry, or nullptr.
+*/
+void coalesce(
+   collections::vector<file_watcher::event> * events, event_indices * indices,
+   file_watcher::watch_id_type watch_id, unsigned changes, char_t const * name
+) {
+   if (!name) {
+      name = LOFTY_SL("");
+   }
+   // Avoid allocating a string just to look it up.
+   event_key key(watch_id, str(external_buffer, name, text::size_in_chars(name)));
+   auto itr(indices->find(key));
+   if (itr != indices->end()) {
+      (*events)[static_cast<std::ptrdiff_t>(itr->value)].changes |= changes;
+      return;
+   }
+   file_watcher::event e;
+   e.watch_id = watch_id;
+   e.changes = changes;
+   // Copy the name, since it points to the buffer that will receive the next batch.
+   e.name = str(key.name.data(), key.name.data_end());
+   key.name = e.name;
+   indices->add_or_assign(_std::move(key), events->size());
+   events->push_back(_std::move(e));
+}
+
+} //namespace
+
+
+std::size_t const file_watcher::buffer_size;
+
+file_watcher::file_watcher() :
+   fd_(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+   buf(memory::alloc_bytes_unique(buffer_size)) {
+   LOFTY_TRACE_FUNC(this);
+
+   if (!fd_) {
+      exception::throw_os_error();
+   }
+}
+
+file_watcher::~file_watcher() {
+}
+
+file_watcher::watch_id_type file_watcher::add(path const & path_, unsigned changes /*= change_all*/) {
+   LOFTY_TRACE_FUNC(this, path_, changes);
+
+   std::uint32_t in_mask = 0;
+   LOFTY_FOR_EACH(auto const & change_in_mask, change_in_masks) {
+      if (changes & change_all & change_in_mask.change) {
+         in_mask |= change_in_mask.in_mask;
+      }
+   }
+   if (in_mask == 0) {
+      // TODO: use a better exception class.
+      LOFTY_THROW(argument_error, ());
+   }
+   int watch_id = ::inotify_add_watch(fd_.get(), path_.os_str().c_str(), in_mask);
+   if (watch_id < 0) {
+      exception::throw_os_error();
+   }
+   return watch_id;
+}
+
+void file_watcher::remove(watch_id_type watch_id) {
+   LOFTY_TRACE_FUNC(this, watch_id);
+
+   if (::inotify_rm_watch(fd_.get(), watch_id) < 0) {
+      exception::throw_os_error();
+   }
+}
+
+std::size_t file_watcher::wait(collections::vector<event> * events) {
+   LOFTY_TRACE_FUNC(this, events);
+
+   std::size_t batch_begin = events->size();
+   event_indices indices;
+   for (;;) {
+      ::ssize_t read_bytes = ::read(fd_.get(), buf.get(), buffer_size);
+      if (read_bytes > 0) {
+         auto buf_bytes = static_cast<std::int8_t const *>(buf.get());
+         for (std::size_t offset = 0; offset < static_cast<std::size_t>(read_bytes); ) {
+            auto in_event = reinterpret_cast< ::inotify_event const *>(buf_bytes + offset);
+            offset += sizeof(::inotify_event) + in_event->len;
+            unsigned changes = 0;
+            LOFTY_FOR_EACH(auto const & change_in_mask, change_in_masks) {
+               if (in_event->mask & change_in_mask.in_mask) {
+                  changes |= change_in_mask.change;
+               }
+            }
+            if (changes != 0) {
+               char_t const * name = in_event->len > 0 ? in_event->name : nullptr;
+               coalesce(events, &indices, in_event->wd, changes, name);
+            }
+         }
+         /* Return what’s been read, instead of draining the queue: with a steady stream of changes, that
+         could go on forever. */
+         if (events->size() > batch_begin) {
+            return events->size() - batch_begin;
+         }
+         continue;
+      }
+      int err = errno;
+      switch (err) {
+         case EINTR:
+            this_coroutine::interruption_point();
+            break;
+         case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+         case EWOULDBLOCK:
+#endif
+            this_coroutine::sleep_until_fd_ready(fd_.get(), false);
+            break;
+         default:
+            exception::throw_os_error(err);
+      }
+   }
+}
+
+}} //namespace lofty::os
+
+#endif //if LOFTY_HOST_API_LINUX
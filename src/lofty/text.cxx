@@ -20,6 +20,7 @@ You should have received a copy of the GNU Lesser General Public License along w
 #include <lofty/byte_order.hxx>
 #include <lofty/numeric.hxx>
 #include <lofty/text.hxx>
+#include "text/transcode_fast.hxx"
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -355,8 +356,16 @@ std::size_t transcode(
       dst_bytes_end = static_cast<std::uint8_t *>(nullptr) + numeric::max<std::size_t>::value;
    }
 
+   /* Well-formed runs in the most common pairs of encodings are converted in bulk by transcode_fast();
+   whatever it stops at is handled by the loop below, one code point at a time. */
+   bool fast = _pvt::has_fast_transcoder(src_enc, dst_enc);
    std::uint8_t const * last_used_src_byte_ptr;
    for (;;) {
+      if (fast) {
+         _pvt::transcode_fast(
+            src_enc, &src_bytes, src_bytes_end, dst_enc, &dst_bytes, dst_bytes_end, write
+         );
+      }
       last_used_src_byte_ptr = src_bytes;
       char32_t ch32;
 
@@ -0,0 +1,666 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/text.hxx>
+#include "transcode_fast.hxx"
+
+#if LOFTY_HOST_ARCH_X86_64
+   #include <emmintrin.h> // _mm_*_si128() _mm_*_epi8() _mm_*_epi16()
+   #if LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC
+      #include <immintrin.h> // _mm256_*()
+   #endif
+#elif LOFTY_HOST_ARCH_ARM && defined(__ARM_NEON)
+   #include <arm_neon.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace text { namespace _pvt {
+
+namespace {
+
+//! Signature of the functions implementing ascii_prefix_size().
+typedef std::size_t (* ascii_prefix_size_fn)(std::uint8_t const * src, std::size_t src_size);
+
+/*! Returns the index of the lowest bit set in a non-zero mask.
+
+@param mask
+   Mask to scan; must not be 0.
+@return
+   Index of the lowest set bit.
+*/
+inline unsigned lowest_set_bit(unsigned mask) {
+#if LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC
+   return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+   unsigned ret = 0;
+   for (; !(mask & 1); mask >>= 1) {
+      ++ret;
+   }
+   return ret;
+#endif
+}
+
+/*! Counts the ASCII bytes at the start of a buffer, 8 bytes at a time.
+
+@param src
+   Pointer to the bytes to scan.
+@param src_size
+   Count of bytes to scan.
+@return
+   Count of leading bytes lower than 0x80.
+*/
+std::size_t ascii_prefix_size_word(std::uint8_t const * src, std::size_t src_size) {
+   std::size_t i = 0;
+   for (; i + sizeof(std::uint64_t) <= src_size; i += sizeof(std::uint64_t)) {
+      std::uint64_t word;
+      memory::copy(reinterpret_cast<std::uint8_t *>(&word), src + i, sizeof word);
+      if (word & 0x8080808080808080ull) {
+         break;
+      }
+   }
+   for (; i < src_size && src[i] < 0x80; ++i) {
+   }
+   return i;
+}
+
+#if LOFTY_HOST_ARCH_X86_64
+//! SSE2 implementation of ascii_prefix_size(); SSE2 is part of the x86-64 baseline.
+std::size_t ascii_prefix_size_sse2(std::uint8_t const * src, std::size_t src_size) {
+   std::size_t i = 0;
+   for (; i + 16 <= src_size; i += 16) {
+      // The sign bit of each byte ends up in mask, so any bit set there marks a non-ASCII byte.
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+         _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i))
+      ));
+      if (mask) {
+         return i + lowest_set_bit(mask);
+      }
+   }
+   return i + ascii_prefix_size_word(src + i, src_size - i);
+}
+
+   #if LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC
+//! AVX2 implementation of ascii_prefix_size().
+__attribute__((target("avx2")))
+std::size_t ascii_prefix_size_avx2(std::uint8_t const * src, std::size_t src_size) {
+   std::size_t i = 0;
+   for (; i + 64 <= src_size; i += 64) {
+      __m256i chunk0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+      __m256i chunk1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i + 32));
+      if (_mm256_movemask_epi8(_mm256_or_si256(chunk0, chunk1))) {
+         break;
+      }
+   }
+   for (; i + 32 <= src_size; i += 32) {
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+         _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i))
+      ));
+      if (mask) {
+         return i + lowest_set_bit(mask);
+      }
+   }
+   return i + ascii_prefix_size_sse2(src + i, src_size - i);
+}
+   #endif
+#elif LOFTY_HOST_ARCH_ARM && defined(__ARM_NEON)
+//! NEON implementation of ascii_prefix_size().
+std::size_t ascii_prefix_size_neon(std::uint8_t const * src, std::size_t src_size) {
+   std::size_t i = 0;
+   for (; i + 16 <= src_size; i += 16) {
+      uint8x16_t chunk = vld1q_u8(src + i);
+      uint8x8_t folded = vorr_u8(vget_low_u8(chunk), vget_high_u8(chunk));
+      if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) & 0x8080808080808080ull) {
+         break;
+      }
+   }
+   return i + ascii_prefix_size_word(src + i, src_size - i);
+}
+#endif
+
+/*! Returns the fastest implementation of ascii_prefix_size() that the CPU supports.
+
+@return
+   Pointer to the implementation.
+*/
+ascii_prefix_size_fn select_ascii_prefix_size() {
+#if LOFTY_HOST_ARCH_X86_64
+   #if LOFTY_HOST_CXX_CLANG || LOFTY_HOST_CXX_GCC
+   // Needed in case this runs before the constructor that normally initializes the CPU model.
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      return &ascii_prefix_size_avx2;
+   }
+   #endif
+   return &ascii_prefix_size_sse2;
+#elif LOFTY_HOST_ARCH_ARM && defined(__ARM_NEON)
+   return &ascii_prefix_size_neon;
+#else
+   return &ascii_prefix_size_word;
+#endif
+}
+
+/*! Counts the ASCII bytes at the start of a buffer.
+
+@param src
+   Pointer to the bytes to scan.
+@param src_size
+   Count of bytes to scan.
+@return
+   Count of leading bytes lower than 0x80.
+*/
+std::size_t ascii_prefix_size(std::uint8_t const * src, std::size_t src_size) {
+   static ascii_prefix_size_fn const impl = select_ascii_prefix_size();
+   return impl(src, src_size);
+}
+
+/*! Stores a 16-bit code unit.
+
+@param dst
+   Pointer to the destination.
+@param ch16
+   Code unit to store.
+@param big_endian
+   If true, the code unit is stored in big-endian byte order; otherwise in little-endian order.
+*/
+inline void store_16(std::uint8_t * dst, char32_t ch16, bool big_endian) {
+   dst[big_endian ? 0 : 1] = static_cast<std::uint8_t>(ch16 >> 8);
+   dst[big_endian ? 1 : 0] = static_cast<std::uint8_t>(ch16);
+}
+
+/*! Stores a 32-bit code unit.
+
+@param dst
+   Pointer to the destination.
+@param ch32
+   Code unit to store.
+@param big_endian
+   If true, the code unit is stored in big-endian byte order; otherwise in little-endian order.
+*/
+inline void store_32(std::uint8_t * dst, char32_t ch32, bool big_endian) {
+   store_16(dst + (big_endian ? 0 : 2), ch32 >> 16, big_endian);
+   store_16(dst + (big_endian ? 2 : 0), ch32 & 0xffff, big_endian);
+}
+
+/*! Loads a 16-bit code unit.
+
+@param src
+   Pointer to the code unit.
+@param big_endian
+   If true, the code unit is in big-endian byte order; otherwise it’s in little-endian order.
+@return
+   Code unit.
+*/
+inline char16_t load_16(std::uint8_t const * src, bool big_endian) {
+   return static_cast<char16_t>(big_endian ? (src[0] << 8) | src[1] : (src[1] << 8) | src[0]);
+}
+
+/*! Widens ASCII bytes into 16- or 32-bit code units.
+
+@param dst
+   Pointer to the destination.
+@param src
+   Pointer to the ASCII bytes.
+@param src_size
+   Count of bytes to widen.
+@param unit_size
+   Size of each destination code unit: 2 or 4.
+@param big_endian
+   If true, code units are stored in big-endian byte order; otherwise in little-endian order.
+*/
+void widen_ascii(
+   std::uint8_t * dst, std::uint8_t const * src, std::size_t src_size, unsigned unit_size, bool big_endian
+) {
+   std::size_t i = 0;
+#if LOFTY_HOST_ARCH_X86_64
+   __m128i zero = _mm_setzero_si128();
+   for (; i + 16 <= src_size; i += 16, dst += 16 * unit_size) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i));
+      // Interleaving with zeroes yields 16-bit units; zeroes first means big endian.
+      __m128i lo16 = big_endian ? _mm_unpacklo_epi8(zero, chunk) : _mm_unpacklo_epi8(chunk, zero);
+      __m128i hi16 = big_endian ? _mm_unpackhi_epi8(zero, chunk) : _mm_unpackhi_epi8(chunk, zero);
+      __m128i * dst128 = reinterpret_cast<__m128i *>(dst);
+      if (unit_size == sizeof(char16_t)) {
+         _mm_storeu_si128(dst128    , lo16);
+         _mm_storeu_si128(dst128 + 1, hi16);
+      } else if (big_endian) {
+         _mm_storeu_si128(dst128    , _mm_unpacklo_epi16(zero, lo16));
+         _mm_storeu_si128(dst128 + 1, _mm_unpackhi_epi16(zero, lo16));
+         _mm_storeu_si128(dst128 + 2, _mm_unpacklo_epi16(zero, hi16));
+         _mm_storeu_si128(dst128 + 3, _mm_unpackhi_epi16(zero, hi16));
+      } else {
+         _mm_storeu_si128(dst128    , _mm_unpacklo_epi16(lo16, zero));
+         _mm_storeu_si128(dst128 + 1, _mm_unpackhi_epi16(lo16, zero));
+         _mm_storeu_si128(dst128 + 2, _mm_unpacklo_epi16(hi16, zero));
+         _mm_storeu_si128(dst128 + 3, _mm_unpackhi_epi16(hi16, zero));
+      }
+   }
+#elif LOFTY_HOST_ARCH_ARM && defined(__ARM_NEON)
+   for (; i + 16 <= src_size; i += 16) {
+      uint8x16_t chunk = vld1q_u8(src + i);
+      uint16x8_t halves[2] = { vmovl_u8(vget_low_u8(chunk)), vmovl_u8(vget_high_u8(chunk)) };
+      for (unsigned j = 0; j < 2; ++j) {
+         if (unit_size == sizeof(char16_t)) {
+            uint8x16_t units = vreinterpretq_u8_u16(halves[j]);
+            vst1q_u8(dst, big_endian ? vrev16q_u8(units) : units);
+            dst += 16;
+         } else {
+            uint32x4_t quarters[2] = {
+               vmovl_u16(vget_low_u16(halves[j])), vmovl_u16(vget_high_u16(halves[j]))
+            };
+            for (unsigned k = 0; k < 2; ++k) {
+               uint8x16_t units = vreinterpretq_u8_u32(quarters[k]);
+               vst1q_u8(dst, big_endian ? vrev32q_u8(units) : units);
+               dst += 16;
+            }
+         }
+      }
+   }
+#endif
+   if (unit_size == sizeof(char16_t)) {
+      for (; i < src_size; ++i, dst += sizeof(char16_t)) {
+         store_16(dst, src[i], big_endian);
+      }
+   } else {
+      for (; i < src_size; ++i, dst += sizeof(char32_t)) {
+         store_32(dst, src[i], big_endian);
+      }
+   }
+}
+
+/*! Narrows 16-bit code units into ASCII bytes, stopping at the first code unit that’s not ASCII.
+
+@param dst
+   Pointer to the destination, or nullptr to only count the ASCII code units.
+@param src
+   Pointer to the code units.
+@param src_units
+   Count of code units available.
+@param big_endian
+   If true, code units are in big-endian byte order; otherwise they’re in little-endian order.
+@return
+   Count of leading ASCII code units, all of which have been narrowed into *dst.
+*/
+std::size_t narrow_ascii_16(
+   std::uint8_t * dst, std::uint8_t const * src, std::size_t src_units, bool big_endian
+) {
+   std::size_t i = 0;
+#if LOFTY_HOST_ARCH_X86_64
+   __m128i non_ascii_bits = _mm_set1_epi16(static_cast<short>(0xff80));
+   __m128i zero = _mm_setzero_si128();
+   for (; i + 16 <= src_units; i += 16) {
+      __m128i units0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i * sizeof(char16_t)));
+      __m128i units1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i * sizeof(char16_t) + 16));
+      if (big_endian) {
+         units0 = _mm_or_si128(_mm_slli_epi16(units0, 8), _mm_srli_epi16(units0, 8));
+         units1 = _mm_or_si128(_mm_slli_epi16(units1, 8), _mm_srli_epi16(units1, 8));
+      }
+      __m128i non_ascii = _mm_and_si128(_mm_or_si128(units0, units1), non_ascii_bits);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(non_ascii, zero)) != 0xffff) {
+         break;
+      }
+      if (dst) {
+         _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(units0, units1));
+      }
+   }
+#elif LOFTY_HOST_ARCH_ARM && defined(__ARM_NEON)
+   uint16x8_t non_ascii_bits = vdupq_n_u16(0xff80);
+   for (; i + 16 <= src_units; i += 16) {
+      uint8x16_t bytes0 = vld1q_u8(src + i * sizeof(char16_t));
+      uint8x16_t bytes1 = vld1q_u8(src + i * sizeof(char16_t) + 16);
+      if (big_endian) {
+         bytes0 = vrev16q_u8(bytes0);
+         bytes1 = vrev16q_u8(bytes1);
+      }
+      uint16x8_t units0 = vreinterpretq_u16_u8(bytes0), units1 = vreinterpretq_u16_u8(bytes1);
+      uint16x8_t non_ascii = vandq_u16(vorrq_u16(units0, units1), non_ascii_bits);
+      uint16x4_t folded = vorr_u16(vget_low_u16(non_ascii), vget_high_u16(non_ascii));
+      if (vget_lane_u64(vreinterpret_u64_u16(folded), 0)) {
+         break;
+      }
+      if (dst) {
+         vst1q_u8(dst + i, vcombine_u8(vmovn_u16(units0), vmovn_u16(units1)));
+      }
+   }
+#endif
+   for (; i < src_units; ++i) {
+      char16_t ch16 = load_16(src + i * sizeof(char16_t), big_endian);
+      if (ch16 >= 0x80) {
+         break;
+      }
+      if (dst) {
+         dst[i] = static_cast<std::uint8_t>(ch16);
+      }
+   }
+   return i;
+}
+
+/*! Decodes a well-formed multi-byte UTF-8 sequence. Overlong sequences, surrogates and code points beyond
+U+10FFFF are not accepted, even though the generic decoder in transcode() lets some of them through: they’re
+left for it to deal with.
+
+@param src
+   Pointer to the sequence; its lead byte must not be ASCII.
+@param src_size
+   Count of bytes available at src.
+@param cp
+   Pointer to a variable that will receive the decoded code point.
+@return
+   Size of the sequence, in bytes, or 0 if the sequence is not well-formed or is incomplete.
+*/
+unsigned decode_utf8_seq(std::uint8_t const * src, std::size_t src_size, char32_t * cp) {
+   std::uint8_t lead = src[0];
+   if (lead < 0xc2) {
+      // Trail byte, or lead byte of an overlong 2-byte sequence.
+      return 0;
+   } else if (lead < 0xe0) {
+      if (src_size < 2 || (src[1] & 0xc0) != 0x80) {
+         return 0;
+      }
+      *cp = (static_cast<char32_t>(lead & 0x1f) << 6) | (src[1] & 0x3f);
+      return 2;
+   } else if (lead < 0xf0) {
+      if (src_size < 3) {
+         return 0;
+      }
+      // 0xe0 needs ≥ 0xa0 to not be overlong; 0xed needs < 0xa0 to not encode a surrogate.
+      std::uint8_t trail1_min = lead == 0xe0 ? 0xa0 : 0x80, trail1_max = lead == 0xed ? 0x9f : 0xbf;
+      if (src[1] < trail1_min || src[1] > trail1_max || (src[2] & 0xc0) != 0x80) {
+         return 0;
+      }
+      *cp = (static_cast<char32_t>(lead & 0x0f) << 12) | (static_cast<char32_t>(src[1] & 0x3f) << 6) |
+         (src[2] & 0x3f);
+      return 3;
+   } else if (lead < 0xf5) {
+      if (src_size < 4) {
+         return 0;
+      }
+      // 0xf0 needs ≥ 0x90 to not be overlong; 0xf4 needs < 0x90 to not exceed U+10FFFF.
+      std::uint8_t trail1_min = lead == 0xf0 ? 0x90 : 0x80, trail1_max = lead == 0xf4 ? 0x8f : 0xbf;
+      if (
+         src[1] < trail1_min || src[1] > trail1_max || (src[2] & 0xc0) != 0x80 || (src[3] & 0xc0) != 0x80
+      ) {
+         return 0;
+      }
+      *cp = (static_cast<char32_t>(lead & 0x07) << 18) | (static_cast<char32_t>(src[1] & 0x3f) << 12) |
+         (static_cast<char32_t>(src[2] & 0x3f) << 6) | (src[3] & 0x3f);
+      return 4;
+   } else {
+      return 0;
+   }
+}
+
+/*! Encodes a code point as UTF-8.
+
+@param dst
+   Pointer to the destination.
+@param cp
+   Code point to encode; must be valid and not ASCII.
+@param seq_size
+   Size of the sequence to generate: 2, 3 or 4.
+*/
+void encode_utf8_seq(std::uint8_t * dst, char32_t cp, unsigned seq_size) {
+   static std::uint8_t const lead_bits[] = { 0, 0, 0xc0, 0xe0, 0xf0 };
+   for (unsigned i = seq_size - 1; i > 0; --i, cp >>= 6) {
+      dst[i] = static_cast<std::uint8_t>(0x80 | (cp & 0x3f));
+   }
+   dst[0] = static_cast<std::uint8_t>(lead_bits[seq_size] | cp);
+}
+
+//! Returns the count of bytes available between two pointers, or 0 if begin is past end.
+inline std::size_t bytes_between(std::uint8_t const * begin, std::uint8_t const * end) {
+   return end > begin ? static_cast<std::size_t>(end - begin) : 0;
+}
+
+//! Implementation of transcode_fast() for UTF-8 to UTF-8: validation followed by a single copy.
+void utf8_to_utf8(
+   std::uint8_t const ** src, std::uint8_t const * src_end,
+   std::uint8_t ** dst, std::uint8_t const * dst_end, bool write
+) {
+   std::uint8_t const * src_begin = *src, * s = src_begin;
+   // Every valid byte is copied as-is, so the destination size caps how much of the source can be validated.
+   std::uint8_t const * limit = s + std::min(bytes_between(s, src_end), bytes_between(*dst, dst_end));
+   while (s < limit) {
+      s += ascii_prefix_size(s, static_cast<std::size_t>(limit - s));
+      if (s == limit) {
+         break;
+      }
+      char32_t cp;
+      unsigned seq_size = decode_utf8_seq(s, static_cast<std::size_t>(limit - s), &cp);
+      if (!seq_size) {
+         break;
+      }
+      s += seq_size;
+   }
+   std::size_t size = static_cast<std::size_t>(s - src_begin);
+   if (write) {
+      memory::copy(*dst, src_begin, size);
+   }
+   *src = s;
+   *dst += size;
+}
+
+//! Implementation of transcode_fast() for UTF-8 to UTF-16 or UTF-32.
+void utf8_to_utf16_or_32(
+   std::uint8_t const ** src, std::uint8_t const * src_end,
+   std::uint8_t ** dst, std::uint8_t const * dst_end, bool write, unsigned unit_size, bool big_endian
+) {
+   std::uint8_t const * s = *src;
+   std::uint8_t * d = *dst;
+   while (s < src_end) {
+      std::size_t run = ascii_prefix_size(s, std::min(
+         static_cast<std::size_t>(src_end - s), bytes_between(d, dst_end) / unit_size
+      ));
+      if (run) {
+         if (write) {
+            widen_ascii(d, s, run, unit_size, big_endian);
+         }
+         s += run;
+         d += run * unit_size;
+         if (s == src_end) {
+            break;
+         }
+      }
+      if (*s < 0x80) {
+         // No room for this ASCII character.
+         break;
+      }
+      char32_t cp;
+      unsigned seq_size = decode_utf8_seq(s, static_cast<std::size_t>(src_end - s), &cp);
+      if (!seq_size) {
+         break;
+      }
+      std::size_t dst_seq_size = unit_size == sizeof(char16_t) && cp < 0x10000 ? 2 : 4;
+      if (bytes_between(d, dst_end) < dst_seq_size) {
+         break;
+      }
+      if (write) {
+         if (unit_size == sizeof(char32_t)) {
+            store_32(d, cp, big_endian);
+         } else if (dst_seq_size == sizeof(char16_t)) {
+            store_16(d, cp, big_endian);
+         } else {
+            cp -= 0x10000;
+            store_16(d,                    0xd800 | (cp >> 10   ), big_endian);
+            store_16(d + sizeof(char16_t), 0xdc00 | (cp & 0x03ff), big_endian);
+         }
+      }
+      s += seq_size;
+      d += dst_seq_size;
+   }
+   *src = s;
+   *dst = d;
+}
+
+//! Implementation of transcode_fast() for UTF-16 to UTF-8.
+void utf16_to_utf8(
+   std::uint8_t const ** src, std::uint8_t const * src_end,
+   std::uint8_t ** dst, std::uint8_t const * dst_end, bool write, bool big_endian
+) {
+   std::uint8_t const * s = *src;
+   std::uint8_t * d = *dst;
+   for (;;) {
+      std::size_t src_units = static_cast<std::size_t>(src_end - s) / sizeof(char16_t);
+      std::size_t run = narrow_ascii_16(
+         write ? d : nullptr, s, std::min(src_units, bytes_between(d, dst_end)), big_endian
+      );
+      s += run * sizeof(char16_t);
+      d += run;
+      if (run == src_units) {
+         break;
+      }
+      char32_t cp = load_16(s, big_endian);
+      if (cp < 0x80) {
+         // No room for this ASCII character.
+         break;
+      }
+      unsigned src_seq_size = sizeof(char16_t), dst_seq_size;
+      if (cp < 0x800) {
+         dst_seq_size = 2;
+      } else if (!utf16_char_traits::is_surrogate(static_cast<char16_t>(cp))) {
+         dst_seq_size = 3;
+      } else if (utf16_char_traits::is_lead_surrogate(static_cast<char16_t>(cp)) && src_units - run >= 2) {
+         char16_t ch16_trail = load_16(s + sizeof(char16_t), big_endian);
+         if (!utf16_char_traits::is_trail_char(ch16_trail)) {
+            break;
+         }
+         cp = ((static_cast<char32_t>(cp & 0x03ff) << 10) | (ch16_trail & 0x03ff)) + 0x10000;
+         src_seq_size = sizeof(char16_t) * 2;
+         dst_seq_size = 4;
+      } else {
+         // Lone trail surrogate, or lead surrogate at the end of the source.
+         break;
+      }
+      if (bytes_between(d, dst_end) < dst_seq_size) {
+         break;
+      }
+      if (write) {
+         encode_utf8_seq(d, cp, dst_seq_size);
+      }
+      s += src_seq_size;
+      d += dst_seq_size;
+   }
+   *src = s;
+   *dst = d;
+}
+
+//! Implementation of transcode_fast() for ISO-8859-1 to UTF-8.
+void iso_8859_1_to_utf8(
+   std::uint8_t const ** src, std::uint8_t const * src_end,
+   std::uint8_t ** dst, std::uint8_t const * dst_end, bool write
+) {
+   std::uint8_t const * s = *src;
+   std::uint8_t * d = *dst;
+   while (s < src_end) {
+      std::size_t run = ascii_prefix_size(s, std::min(
+         static_cast<std::size_t>(src_end - s), bytes_between(d, dst_end)
+      ));
+      if (run) {
+         if (write) {
+            memory::copy(d, s, run);
+         }
+         s += run;
+         d += run;
+         if (s == src_end) {
+            break;
+         }
+      }
+      // Non-ASCII characters need 2 bytes; ASCII ones only get here if there’s no room for them.
+      if (*s < 0x80 || bytes_between(d, dst_end) < 2) {
+         break;
+      }
+      if (write) {
+         d[0] = static_cast<std::uint8_t>(0xc0 | (*s >> 6));
+         d[1] = static_cast<std::uint8_t>(0x80 | (*s & 0x3f));
+      }
+      ++s;
+      d += 2;
+   }
+   *src = s;
+   *dst = d;
+}
+
+} //namespace
+
+bool has_fast_transcoder(encoding src_enc, encoding dst_enc) {
+   switch (src_enc.base()) {
+      case encoding::utf8:
+         switch (dst_enc.base()) {
+            case encoding::utf8:
+            case encoding::utf16le:
+            case encoding::utf16be:
+            case encoding::utf32le:
+            case encoding::utf32be:
+               return true;
+            default:
+               return false;
+         }
+      case encoding::utf16le:
+      case encoding::utf16be:
+      case encoding::iso_8859_1:
+         return dst_enc == encoding::utf8;
+      default:
+         return false;
+   }
+}
+
+void transcode_fast(
+   encoding src_enc, std::uint8_t const ** src, std::uint8_t const * src_end,
+   encoding dst_enc, std::uint8_t       ** dst, std::uint8_t const * dst_end, bool write
+) {
+   switch (src_enc.base()) {
+      case encoding::utf8:
+         switch (dst_enc.base()) {
+            case encoding::utf8:
+               utf8_to_utf8(src, src_end, dst, dst_end, write);
+               break;
+            case encoding::utf16le:
+            case encoding::utf16be:
+               utf8_to_utf16_or_32(
+                  src, src_end, dst, dst_end, write, sizeof(char16_t), dst_enc == encoding::utf16be
+               );
+               break;
+            case encoding::utf32le:
+            case encoding::utf32be:
+               utf8_to_utf16_or_32(
+                  src, src_end, dst, dst_end, write, sizeof(char32_t), dst_enc == encoding::utf32be
+               );
+               break;
+            default:
+               break;
+         }
+         break;
+      case encoding::utf16le:
+      case encoding::utf16be:
+         if (dst_enc == encoding::utf8) {
+            utf16_to_utf8(src, src_end, dst, dst_end, write, src_enc == encoding::utf16be);
+         }
+         break;
+      case encoding::iso_8859_1:
+         if (dst_enc == encoding::utf8) {
+            iso_8859_1_to_utf8(src, src_end, dst, dst_end, write);
+         }
+         break;
+      default:
+         break;
+   }
+}
+
+}}} //namespace lofty::text::_pvt
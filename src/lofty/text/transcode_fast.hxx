@@ -0,0 +1,80 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#ifndef _LOFTY_TEXT_TRANSCODE_FAST_HXX
+#define _LOFTY_TEXT_TRANSCODE_FAST_HXX
+
+#ifndef _LOFTY_HXX
+   #error "Please #include <lofty.hxx> before this file"
+#endif
+#ifdef LOFTY_CXX_PRAGMA_ONCE
+   #pragma once
+#endif
+
+#include <lofty/text.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace text { namespace _pvt {
+
+/*! Returns true if transcode_fast() has a kernel for the specified pair of encodings.
+
+@param src_enc
+   Source encoding.
+@param dst_enc
+   Destination encoding.
+@return
+   true if transcode_fast() can make progress converting from src_enc to dst_enc, or false if it would always
+   return without doing anything.
+*/
+bool has_fast_transcoder(encoding src_enc, encoding dst_enc);
+
+/*! Converts the longest prefix of the source that is well-formed and fits in the destination, using kernels
+specialized for the most common pairs of encodings (UTF-8 to UTF-8, UTF-16 or UTF-32; UTF-16 to UTF-8;
+ISO-8859-1 to UTF-8). Runs of ASCII characters are scanned and widened or narrowed with SIMD instructions.
+
+It stops on anything that it can’t convert with certainty, such as an invalid or incomplete sequence, leaving
+it for the generic loop in transcode() to deal with; the output it produces is always identical to what the
+generic loop would produce for the same input.
+
+@param src_enc
+   Source encoding.
+@param src
+   Pointer to the source bytes; on return it will point to the first byte not consumed.
+@param src_end
+   End of the source bytes.
+@param dst_enc
+   Destination encoding.
+@param dst
+   Pointer to the destination bytes; on return it will point past the last byte written.
+@param dst_end
+   End of the destination buffer.
+@param write
+   If false, *dst is only advanced as if the converted bytes were written, and is never dereferenced.
+*/
+void transcode_fast(
+   encoding src_enc, std::uint8_t const ** src, std::uint8_t const * src_end,
+   encoding dst_enc, std::uint8_t       ** dst, std::uint8_t const * dst_end, bool write
+);
+
+}}} //namespace lofty::text::_pvt
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif //ifndef _LOFTY_TEXT_TRANSCODE_FAST_HXX
@@ -307,7 +307,7 @@ void thread::impl::start(_std::shared_ptr<impl> * this_pimpl_ptr) {
    ::pthread_sigmask(SIG_BLOCK, &blocked_sigset, &orig_sigset);
    {
       // Reset this thread’s signal mask to orig_sigset right after (failing to?) create the thread.
-      LOFTY_DEFER_TO_SCOPE_END(::pthread_sigmask(SIG_BLOCK, &orig_sigset, nullptr));
+      LOFTY_DEFER_TO_SCOPE_END(::pthread_sigmask(SIG_SETMASK, &orig_sigset, nullptr));
       if (int err = ::pthread_create(&handle, nullptr, &outer_main, this_pimpl_ptr)) {
          exception::throw_os_error(err);
       }
@@ -543,7 +543,7 @@ void sleep_until_fd_ready(
 #if LOFTY_HOST_API_POSIX
    ::pollfd pfd;
    pfd.fd = fd;
-   pfd.events = (write ? POLLIN : POLLOUT) | POLLPRI;
+   pfd.events = (write ? POLLOUT : POLLIN) | POLLPRI;
    while (::poll(&pfd, 1, -1) < 0) {
       int err = errno;
       if (err == EINTR) {
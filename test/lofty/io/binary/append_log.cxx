@@ -0,0 +1,231 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/append_log.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+//! Record appended by the test below: which appender wrote it, and its sequence number for that appender.
+struct append_log_test_record {
+   std::uint32_t appender;
+   std::uint32_t seq;
+   //! Makes records of different appenders different sizes.
+   std::uint8_t padding[32];
+};
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_append_log,
+   "lofty::io::binary::append_log – concurrent appends from threads and coroutines"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static unsigned const threads_count = 3, coros_count = 6, appenders_count = threads_count + coros_count;
+   static std::uint32_t const records_per_appender = 40;
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-append_log-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   // Make sure the log starts out empty.
+   io::binary::open_ostream(file_path)->finalize();
+   io::binary::append_log::writer log_writer(file_path, 0x100000);
+   std::size_t out_of_order = 0;
+   _std::atomic<std::size_t> out_of_order_in_threads(0);
+   auto append_records = [&log_writer] (std::uint32_t appender) -> std::size_t {
+      std::size_t errors = 0;
+      io::full_size_t last_offset = 0;
+      for (std::uint32_t seq = 0; seq < records_per_appender; ++seq) {
+         append_log_test_record record;
+         record.appender = appender;
+         record.seq = seq;
+         memory::clear(record.padding, sizeof record.padding);
+         io::full_size_t offset = log_writer.append(&record, sizeof record - appender);
+         // Each append() returns after the record is durable, so the next one must come after it.
+         if ((seq > 0 && offset <= last_offset) || log_writer.durable_size() <= offset) {
+            ++errors;
+         }
+         last_offset = offset;
+      }
+      return errors;
+   };
+
+   collections::vector<_std::unique_ptr<thread>> threads;
+   for (std::uint32_t i = 0; i < threads_count; ++i) {
+      threads.push_back(_std::unique_ptr<thread>(new thread(
+         [&append_records, &out_of_order_in_threads, i] () {
+            out_of_order_in_threads.fetch_add(append_records(i));
+         }
+      )));
+   }
+   for (std::uint32_t i = threads_count; i < appenders_count; ++i) {
+      coroutine([&append_records, &out_of_order, i] () {
+         out_of_order += append_records(i);
+      });
+   }
+   this_thread::run_coroutines();
+   LOFTY_FOR_EACH(auto & thr, threads) {
+      thr->join();
+   }
+   log_writer.finalize();
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+
+   LOFTY_TESTING_ASSERT_EQUAL(out_of_order, 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(out_of_order_in_threads.load(), 0u);
+
+   // Read the log back, checking that each appender’s records are all there, in order.
+   io::full_size_t log_size;
+   {
+      std::uint32_t next_seqs[appenders_count] = {};
+      std::size_t records_count = 0, mismatches = 0;
+      io::binary::append_log::reader log_reader(
+         io::binary::buffer_istream(io::binary::open_istream(file_path))
+      );
+      io::binary::const_buffer record_buf;
+      while (log_reader.read(&record_buf)) {
+         append_log_test_record record;
+         memory::copy(
+            reinterpret_cast<std::uint8_t *>(&record), static_cast<std::uint8_t const *>(record_buf.src),
+            std::min(record_buf.src_size, sizeof record)
+         );
+         if (
+            record.appender >= appenders_count || record_buf.src_size != sizeof record - record.appender ||
+            record.seq != next_seqs[record.appender]
+         ) {
+            ++mismatches;
+         } else {
+            ++next_seqs[record.appender];
+         }
+         ++records_count;
+      }
+      LOFTY_TESTING_ASSERT_FALSE(log_reader.damaged());
+      LOFTY_TESTING_ASSERT_EQUAL(records_count, std::size_t(appenders_count * records_per_appender));
+      LOFTY_TESTING_ASSERT_EQUAL(mismatches, 0u);
+      log_size = log_reader.valid_size();
+      LOFTY_TESTING_ASSERT_EQUAL(log_writer.durable_size(), log_size);
+   }
+
+   // Simulate a crash in the middle of writing a record; the reader must stop before it.
+   {
+      auto file_ostream(_std::dynamic_pointer_cast<io::binary::file_ostream>(
+         io::binary::open(file_path, io::access_mode::write_append)
+      ));
+      std::uint8_t torn_record[] = { 100, 0, 0, 0, 1, 2, 3, 4, 5, 6 };
+      file_ostream->write(torn_record, sizeof torn_record);
+      file_ostream->finalize();
+   }
+   {
+      io::binary::append_log::reader log_reader(
+         io::binary::buffer_istream(io::binary::open_istream(file_path))
+      );
+      io::binary::const_buffer record_buf;
+      std::size_t records_count = 0;
+      while (log_reader.read(&record_buf)) {
+         ++records_count;
+      }
+      LOFTY_TESTING_ASSERT_TRUE(log_reader.damaged());
+      LOFTY_TESTING_ASSERT_EQUAL(records_count, std::size_t(appenders_count * records_per_appender));
+      LOFTY_TESTING_ASSERT_EQUAL(log_reader.valid_size(), log_size);
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_append_log_interrupted_commit,
+   "lofty::io::binary::append_log – interrupting an appender while it commits a batch"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-append_log-interrupted-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   io::binary::open_ostream(file_path)->finalize();
+   io::binary::append_log::writer log_writer(file_path);
+   std::uint32_t const first_record = 1, second_record = 2;
+   bool interrupted = false, appended_again = false;
+   {
+      coroutine appender_coro([&log_writer, &first_record, &interrupted] () {
+         try {
+            log_writer.append(&first_record, sizeof first_record);
+         } catch (execution_interruption const &) {
+            interrupted = true;
+         }
+      });
+      /* This only gets to run once the appender has blocked, which can only happen while it’s committing its
+      record. */
+      coroutine([&appender_coro] () {
+         appender_coro.interrupt();
+      });
+      this_thread::run_coroutines();
+      // The log must still be usable.
+      coroutine([&log_writer, &second_record, &appended_again] () {
+         log_writer.append(&second_record, sizeof second_record);
+         appended_again = true;
+      });
+      this_thread::run_coroutines();
+   }
+   log_writer.finalize();
+   this_thread::detach_coroutine_scheduler();
+
+   LOFTY_TESTING_ASSERT_TRUE(interrupted);
+   LOFTY_TESTING_ASSERT_TRUE(appended_again);
+
+   // Both records must be in the log: the interrupted one was committed with the second one, if not before.
+   io::binary::append_log::reader log_reader(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+   io::binary::const_buffer record_buf;
+   collections::vector<std::uint32_t> records;
+   while (log_reader.read(&record_buf)) {
+      std::uint32_t record = 0;
+      memory::copy(
+         reinterpret_cast<std::uint8_t *>(&record), static_cast<std::uint8_t const *>(record_buf.src),
+         std::min(record_buf.src_size, sizeof record)
+      );
+      records.push_back(record);
+   }
+   LOFTY_TESTING_ASSERT_FALSE(log_reader.damaged());
+   LOFTY_TESTING_ASSERT_EQUAL(records.size(), 2u);
+   if (records.size() == 2) {
+      LOFTY_TESTING_ASSERT_EQUAL(records[0], first_record);
+      LOFTY_TESTING_ASSERT_EQUAL(records[1], second_record);
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(log_writer.durable_size(), log_reader.valid_size());
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
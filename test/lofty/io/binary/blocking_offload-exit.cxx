@@ -0,0 +1,78 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+/* This test gets its own executable because what it checks is the process exit: the worker threads started
+by blocking_offload must not be touched after the Lofty runtime has been torn down, which used to crash the
+process after every test case had passed. */
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/app.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LOFTY_APP_CLASS(lofty::testing::app)
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_blocking_offload_exit,
+   "lofty::io::binary – process exit after regular file I/O from a coroutine"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-blocking_offload-exit-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   std::size_t written_size = 0;
+   coroutine([&file_path, &written_size] () {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      std::uint8_t const src[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+      written_size = file_ostream->write(src, sizeof src);
+      // Flushing also runs ::fsync() on a worker thread.
+      file_ostream->flush();
+      file_ostream->finalize();
+   });
+   this_thread::run_coroutines();
+   this_thread::detach_coroutine_scheduler();
+
+   LOFTY_TESTING_ASSERT_EQUAL(written_size, 8u);
+   // The worker threads are still running; returning from main() must terminate them cleanly.
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
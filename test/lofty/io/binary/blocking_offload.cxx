@@ -0,0 +1,109 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_blocking_offload,
+   "lofty::io::binary – regular file I/O from a coroutine doesn’t block other coroutines"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   std::size_t const chunk_size = 0x10000, chunks = 8;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[chunk_size]);
+   for (std::size_t i = 0; i < chunk_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i * 7);
+   }
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-blocking_offload-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   bool io_started = false, io_completed = false;
+   std::size_t ticks_during_io = 0, written_size = 0, read_size = 0, mismatches = 0;
+   coroutine io_coro([&] () {
+      io_started = true;
+      auto file_ostream(io::binary::open_ostream(file_path));
+      io::binary::const_buffer bufs[2];
+      bufs[0].src = src.get();
+      bufs[0].src_size = chunk_size / 2;
+      bufs[1].src = src.get() + chunk_size / 2;
+      bufs[1].src_size = chunk_size / 2;
+      for (std::size_t i = 0; i < chunks; i += 2) {
+         written_size += file_ostream->write(src.get(), chunk_size);
+         written_size += file_ostream->write_buffers(bufs, 2);
+      }
+      file_ostream->flush();
+      file_ostream->finalize();
+
+      auto file_istream(io::binary::open_istream(file_path));
+      _std::unique_ptr<std::uint8_t[]> dst(new std::uint8_t[chunk_size]);
+      while (std::size_t bytes_read = file_istream->read(dst.get(), chunk_size)) {
+         for (std::size_t i = 0; i < bytes_read; ++i) {
+            if (dst[i] != src[(read_size + i) % chunk_size]) {
+               ++mismatches;
+            }
+         }
+         read_size += bytes_read;
+      }
+      io_completed = true;
+   });
+   coroutine ticker_coro([&] () {
+      while (!io_completed) {
+         if (io_started) {
+            ++ticks_during_io;
+         }
+         this_coroutine::sleep_for_ms(1);
+      }
+   });
+   this_thread::run_coroutines();
+
+   LOFTY_TESTING_ASSERT_TRUE(io_completed);
+   LOFTY_TESTING_ASSERT_EQUAL(written_size, chunk_size * chunks);
+   LOFTY_TESTING_ASSERT_EQUAL(read_size, chunk_size * chunks);
+   LOFTY_TESTING_ASSERT_EQUAL(mismatches, 0u);
+   // The writes and the flush were performed on worker threads, giving the other coroutine a chance to run.
+   LOFTY_TESTING_ASSERT_TRUE(ticks_during_io > 0);
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
@@ -0,0 +1,98 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/buffer_pool.hxx>
+#include <lofty/testing/test_case.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_buffer_pool,
+   "lofty::io::binary::buffer_pool – size classes and block reuse"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   auto & pool = io::binary::buffer_pool::instance();
+   std::size_t page_size = memory::page_size();
+   pool.trim();
+   LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(io::binary::buffer_pool::block_size(1), page_size);
+   LOFTY_TESTING_ASSERT_EQUAL(io::binary::buffer_pool::block_size(page_size + 1), page_size * 2);
+   LOFTY_TESTING_ASSERT_EQUAL(io::binary::buffer_pool::block_size(page_size * 3), page_size * 4);
+
+   // A returned block is handed right back for a request in the same size class.
+   auto counters_before(pool.counters());
+   memory::pages_ptr block(pool.acquire(page_size * 3));
+   LOFTY_TESTING_ASSERT_EQUAL(block.size(), page_size * 4);
+   void * block_ptr = block.get();
+   pool.release(&block);
+   LOFTY_TESTING_ASSERT_TRUE(block.get() == nullptr);
+   LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), page_size * 4);
+   block = pool.acquire(page_size * 4);
+   LOFTY_TESTING_ASSERT_TRUE(block.get() == block_ptr);
+   LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), 0u);
+   pool.release(&block);
+
+   // Blocks too large for any size class are not cached.
+   std::size_t large_size = io::binary::buffer_pool::block_size_max() + 1;
+   block = pool.acquire(large_size);
+   LOFTY_TESTING_ASSERT_TRUE(block.size() >= large_size);
+   pool.release(&block);
+   LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), page_size * 4);
+   auto counters_after(pool.counters());
+   LOFTY_TESTING_ASSERT_EQUAL(counters_after.acquires - counters_before.acquires, 3u);
+   LOFTY_TESTING_ASSERT_EQUAL(counters_after.reuses - counters_before.reuses, 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(counters_after.releases - counters_before.releases, 2u);
+   LOFTY_TESTING_ASSERT_EQUAL(counters_after.frees - counters_before.frees, 1u);
+
+   // A buffered stream set to release idle buffers gives its buffer back as soon as it’s been read empty…
+   {
+      io::binary::pipe pipe;
+      auto buf_istream(io::binary::buffer_istream(
+         pipe.read_end, io::binary::buffer_sizing().set_release_when_idle(true)
+      ));
+      pipe.write_end->write("lofty", 5);
+      pipe.write_end->finalize();
+      std::size_t peeked_size = _std::get<1>(buf_istream->peek<char>(1));
+      std::size_t cached_size = pool.cached_size();
+      buf_istream->consume<char>(peeked_size);
+      LOFTY_TESTING_ASSERT_EQUAL(peeked_size, 5u);
+      LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), cached_size + page_size);
+   }
+   // …while by default it keeps it.
+   {
+      io::binary::pipe pipe;
+      auto buf_istream(io::binary::buffer_istream(pipe.read_end));
+      pipe.write_end->write("lofty", 5);
+      pipe.write_end->finalize();
+      std::size_t peeked_size = _std::get<1>(buf_istream->peek<char>(1));
+      std::size_t cached_size = pool.cached_size();
+      buf_istream->consume<char>(peeked_size);
+      LOFTY_TESTING_ASSERT_EQUAL(peeked_size, 5u);
+      LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), cached_size);
+   }
+   pool.trim();
+   LOFTY_TESTING_ASSERT_EQUAL(pool.cached_size(), 0u);
+}
+
+}} //namespace lofty::test
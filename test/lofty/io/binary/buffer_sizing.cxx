@@ -0,0 +1,137 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <cstring>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_buffer_sizing_istream,
+   "lofty::io::binary::buffer_istream() – read buffer growth and shrinkage"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   // Small enough to fit in the pipe’s buffer, since there’s no concurrent reader.
+   static std::size_t const src_size = 0xe00a;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[src_size]);
+   for (std::size_t i = 0; i < src_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i * 5);
+   }
+   io::binary::pipe pipe;
+   auto buf_istream(io::binary::buffer_istream(
+      pipe.read_end, io::binary::buffer_sizing().set_size_min(0x1000).set_size_max(0x4000)
+   ));
+   std::size_t offset = 0;
+   auto peek_and_consume = [&buf_istream, &src, &offset] () -> std::size_t {
+      auto peeked(buf_istream->peek<std::uint8_t>(1));
+      std::size_t peeked_size = _std::get<1>(peeked);
+      if (std::memcmp(_std::get<0>(peeked), src.get() + offset, peeked_size) != 0) {
+         return 0;
+      }
+      buf_istream->consume<std::uint8_t>(peeked_size);
+      offset += peeked_size;
+      return peeked_size;
+   };
+
+   // Reads that fill the buffer make it grow, up to the maximum size.
+   pipe.write_end->write(src.get(), 0xc000);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x1000u);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x2000u);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x4000u);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x4000u);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x1000u);
+   // A short read makes the stream idle, so the next read only gets the minimum buffer size…
+   pipe.write_end->write(src.get() + offset, 10);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 10u);
+   pipe.write_end->write(src.get() + offset, 0x2000);
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x1000u);
+   // …until reads start filling it again.
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0x1000u);
+   pipe.write_end->finalize();
+   LOFTY_TESTING_ASSERT_EQUAL(peek_and_consume(), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(offset, 0xc000u + 10u + 0x2000u);
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_buffer_sizing_ostream,
+   "lofty::io::binary::buffer_ostream() – write buffer growth and shrinkage"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   io::binary::pipe pipe;
+   auto buf_ostream(io::binary::buffer_ostream(
+      pipe.write_end,
+      io::binary::buffer_sizing().set_size_min(0x1000).set_size_max(0x4000).set_release_when_idle(true)
+   ));
+   std::size_t written_size = 0;
+   auto fill_buffer = [&buf_ostream, &written_size] () -> std::size_t {
+      auto buf(buf_ostream->get_buffer<std::uint8_t>(1));
+      std::size_t buf_size = _std::get<1>(buf);
+      for (std::size_t i = 0; i < buf_size; ++i) {
+         _std::get<0>(buf)[i] = static_cast<std::uint8_t>((written_size + i) * 5);
+      }
+      buf_ostream->commit<std::uint8_t>(buf_size);
+      written_size += buf_size;
+      return buf_size;
+   };
+
+   // Filling the buffer makes it grow, up to the maximum size.
+   LOFTY_TESTING_ASSERT_EQUAL(fill_buffer(), 0x1000u);
+   LOFTY_TESTING_ASSERT_EQUAL(fill_buffer(), 0x2000u);
+   LOFTY_TESTING_ASSERT_EQUAL(fill_buffer(), 0x4000u);
+   LOFTY_TESTING_ASSERT_EQUAL(fill_buffer(), 0x4000u);
+   // Flushing a buffer that’s mostly empty makes the stream idle, releasing the buffer.
+   auto buf(buf_ostream->get_buffer<std::uint8_t>(10));
+   for (std::size_t i = 0; i < 10; ++i) {
+      _std::get<0>(buf)[i] = static_cast<std::uint8_t>((written_size + i) * 5);
+   }
+   buf_ostream->commit<std::uint8_t>(10);
+   written_size += 10;
+   buf_ostream->flush();
+   LOFTY_TESTING_ASSERT_EQUAL(_std::get<1>(buf_ostream->get_buffer<std::uint8_t>(1)), 0x1000u);
+   buf_ostream->finalize();
+
+   // Verify that the data made it through unchanged.
+   std::size_t read_size = 0;
+   bool matched = true;
+   std::uint8_t read_buf[0x1000];
+   while (std::size_t read_bytes = pipe.read_end->read(read_buf, sizeof read_buf)) {
+      for (std::size_t i = 0; i < read_bytes; ++i) {
+         if (read_buf[i] != static_cast<std::uint8_t>((read_size + i) * 5)) {
+            matched = false;
+         }
+      }
+      read_size += read_bytes;
+   }
+   LOFTY_TESTING_ASSERT_TRUE(matched);
+   LOFTY_TESTING_ASSERT_EQUAL(read_size, written_size);
+}
+
+}} //namespace lofty::test
@@ -0,0 +1,190 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/checksum.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+//! Size of the data checksummed by the tests below.
+static std::size_t const checksum_test_size = 1000;
+
+/*! Fills a buffer with a recognizable pattern.
+
+@param buf
+   Pointer to the buffer, which must be checksum_test_size bytes long.
+*/
+static void fill_checksum_test_buffer(std::uint8_t * buf) {
+   for (std::size_t i = 0; i < checksum_test_size; ++i) {
+      buf[i] = static_cast<std::uint8_t>(i * 7);
+   }
+}
+
+/*! Feeds data to a checksum in chunks of increasing size.
+
+@param sum
+   Checksum to update.
+@param src
+   Pointer to the data.
+@param src_size
+   Size of the data.
+*/
+static void update_checksum_in_chunks(
+   io::binary::checksum * sum, std::uint8_t const * src, std::size_t src_size
+) {
+   for (std::size_t chunk_size = 1; src_size > 0; ++chunk_size) {
+      std::size_t update_size = chunk_size < src_size ? chunk_size : src_size;
+      sum->update(src, update_size);
+      src += update_size;
+      src_size -= update_size;
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_checksum_algorithms,
+   "lofty::io::binary – CRC-32C and XXH64 reference values"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   std::uint8_t buf[checksum_test_size];
+   fill_checksum_test_buffer(buf);
+
+   io::binary::crc32c crc;
+   LOFTY_TESTING_ASSERT_EQUAL(crc.value(), 0u);
+   crc.update("123456789", 9);
+   LOFTY_TESTING_ASSERT_EQUAL(crc.value(), 0xe3069283u);
+   crc.reset();
+   update_checksum_in_chunks(&crc, buf, checksum_test_size);
+   LOFTY_TESTING_ASSERT_EQUAL(crc.value(), 0x79a16ae6u);
+   // Misaligned start.
+   crc.reset();
+   crc.update(buf, 1);
+   crc.update(buf + 1, checksum_test_size - 1);
+   LOFTY_TESTING_ASSERT_EQUAL(crc.value(), 0x79a16ae6u);
+
+   io::binary::xxhash64 hash;
+   LOFTY_TESTING_ASSERT_EQUAL(hash.value(), 0xef46db3751d8e999ULL);
+   hash.update("abc", 3);
+   LOFTY_TESTING_ASSERT_EQUAL(hash.value(), 0x44bc2cf5ad770999ULL);
+   hash.reset();
+   hash.update(buf, checksum_test_size);
+   LOFTY_TESTING_ASSERT_EQUAL(hash.value(), 0x25275608a9cfc168ULL);
+   hash.reset();
+   update_checksum_in_chunks(&hash, buf, checksum_test_size);
+   LOFTY_TESTING_ASSERT_EQUAL(hash.value(), 0x25275608a9cfc168ULL);
+
+   io::binary::xxhash64 seeded_hash(0x12345678);
+   update_checksum_in_chunks(&seeded_hash, buf, checksum_test_size);
+   LOFTY_TESTING_ASSERT_EQUAL(seeded_hash.value(), 0x446aa51048dd57c1ULL);
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_checksum_streams,
+   "lofty::io::binary – checksumming while reading and writing"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   std::uint8_t buf[checksum_test_size];
+   fill_checksum_test_buffer(buf);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-checksum-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str), copy_path(file_path_str + LOFTY_SL("-copy"));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(copy_path.os_str().c_str()));
+
+   // Write using both write() and get_buffer()/commit().
+   {
+      auto crc(_std::make_shared<io::binary::crc32c>());
+      io::binary::checksum_ostream file_ostream(
+         io::binary::buffer_ostream(io::binary::open_ostream(file_path)), crc
+      );
+      file_ostream.write(buf, 100);
+      auto reserved(file_ostream.get_buffer<std::uint8_t>(checksum_test_size - 100));
+      memory::copy(_std::get<0>(reserved), buf + 100, checksum_test_size - 100);
+      file_ostream.commit<std::uint8_t>(checksum_test_size - 100);
+      file_ostream.finalize();
+      LOFTY_TESTING_ASSERT_EQUAL(crc->value(), 0x79a16ae6u);
+   }
+
+   // Read computing two checksums at once, using both read() and peek()/consume().
+   {
+      auto crc(_std::make_shared<io::binary::crc32c>());
+      auto hash(_std::make_shared<io::binary::xxhash64>());
+      io::binary::checksum_istream file_istream(
+         _std::make_shared<io::binary::checksum_istream>(
+            io::binary::buffer_istream(io::binary::open_istream(file_path)), crc
+         ), hash
+      );
+      std::uint8_t dst[checksum_test_size];
+      LOFTY_TESTING_ASSERT_EQUAL(file_istream.read(dst, 10), 10u);
+      std::size_t read_size = 10;
+      for (;;) {
+         auto peeked(file_istream.peek<std::uint8_t>(7));
+         if (_std::get<1>(peeked) == 0) {
+            break;
+         }
+         std::size_t consume_size = _std::get<1>(peeked) < 7 ? _std::get<1>(peeked) : 7;
+         memory::copy(dst + read_size, _std::get<0>(peeked), consume_size);
+         file_istream.consume<std::uint8_t>(consume_size);
+         read_size += consume_size;
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(read_size, checksum_test_size);
+      LOFTY_TESTING_ASSERT_EQUAL(crc->value(), 0x79a16ae6u);
+      LOFTY_TESTING_ASSERT_EQUAL(hash->value(), 0x25275608a9cfc168ULL);
+   }
+
+   // copy() must not bypass the checksum.
+   {
+      auto crc(_std::make_shared<io::binary::crc32c>());
+      io::binary::checksum_istream file_istream(
+         io::binary::buffer_istream(io::binary::open_istream(file_path)), crc
+      );
+      auto copy_ostream(io::binary::open_ostream(copy_path));
+      LOFTY_TESTING_ASSERT_EQUAL(
+         io::binary::copy(&file_istream, copy_ostream.get()), io::full_size_t(checksum_test_size)
+      );
+      copy_ostream->finalize();
+      LOFTY_TESTING_ASSERT_EQUAL(crc->value(), 0x79a16ae6u);
+   }
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
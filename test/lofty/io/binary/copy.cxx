@@ -0,0 +1,298 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // link() unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+/*! Fills a buffer with a recognizable pattern.
+
+@param buf
+   Pointer to the buffer.
+@param buf_size
+   Size of *buf.
+*/
+static void fill_copy_test_buffer(std::uint8_t * buf, std::size_t buf_size) {
+   for (std::size_t i = 0; i < buf_size; ++i) {
+      buf[i] = static_cast<std::uint8_t>(i * 7);
+   }
+}
+
+/*! Returns the count of bytes in a buffer that don’t match the pattern written by fill_copy_test_buffer().
+
+@param buf
+   Pointer to the buffer.
+@param buf_size
+   Size of *buf.
+@param offset
+   Offset of *buf in the pattern.
+@return
+   Count of mismatching bytes.
+*/
+static std::size_t count_copy_test_buffer_errors(
+   std::uint8_t const * buf, std::size_t buf_size, std::size_t offset
+) {
+   std::size_t errors = 0;
+   for (std::size_t i = 0; i < buf_size; ++i) {
+      if (buf[i] != static_cast<std::uint8_t>((offset + i) * 7)) {
+         ++errors;
+      }
+   }
+   return errors;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_copy_pipe,
+   "lofty::io::binary::copy() – pipe to pipe"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   // Small enough to fit in the pipes’ buffers, since there’s no concurrent reader.
+   static std::size_t const buffer_size = 3000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]), dst(new std::uint8_t[buffer_size]);
+   fill_copy_test_buffer(src.get(), buffer_size);
+
+   io::binary::pipe pipe1, pipe2;
+   pipe1.write_end->write(src.get(), buffer_size);
+   pipe1.write_end->finalize();
+   // Copy only part of the data, then the rest until EOF.
+   LOFTY_TESTING_ASSERT_EQUAL(io::binary::copy(pipe1.read_end.get(), pipe2.write_end.get(), 1000), 1000u);
+   LOFTY_TESTING_ASSERT_EQUAL(
+      io::binary::copy(pipe1.read_end.get(), pipe2.write_end.get()), io::full_size_t(buffer_size - 1000)
+   );
+   pipe2.write_end->finalize();
+
+   std::size_t read_bytes = 0, last_read_bytes;
+   while ((last_read_bytes = pipe2.read_end->read(dst.get() + read_bytes, buffer_size - read_bytes)) > 0) {
+      read_bytes += last_read_bytes;
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(read_bytes, buffer_size);
+   LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get(), buffer_size, 0), 0u);
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_copy_regular_file,
+   "lofty::io::binary::copy() – buffered regular file to pipe"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const buffer_size = 3000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]), dst(new std::uint8_t[buffer_size]);
+   fill_copy_test_buffer(src.get(), buffer_size);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-copy-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      file_ostream->write(src.get(), buffer_size);
+      file_ostream->finalize();
+   }
+
+   io::binary::pipe pipe;
+   auto file_istream(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+   // Load some data in the read buffer, which copy() will have to write before the rest of the file.
+   LOFTY_TESTING_ASSERT_GREATER(_std::get<1>(file_istream->peek_bytes(10)), 10u);
+   file_istream->consume_bytes(10);
+   LOFTY_TESTING_ASSERT_EQUAL(
+      io::binary::copy(file_istream.get(), pipe.write_end.get()), io::full_size_t(buffer_size - 10)
+   );
+   pipe.write_end->finalize();
+
+   std::size_t read_bytes = 0, last_read_bytes;
+   while ((last_read_bytes = pipe.read_end->read(dst.get() + read_bytes, buffer_size - read_bytes)) > 0) {
+      read_bytes += last_read_bytes;
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(read_bytes, buffer_size - 10);
+   LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get(), read_bytes, 10), 0u);
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_copy_file,
+   "lofty::io::binary::copy_file() – regular file to regular file"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const buffer_size = 300000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]), dst(new std::uint8_t[buffer_size]);
+   fill_copy_test_buffer(src.get(), buffer_size);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-copy_file-"));
+   file_path_str += to_str(this_process::id());
+   os::path src_path(file_path_str + LOFTY_SL("-src")), dst_path(file_path_str + LOFTY_SL("-dst"));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(src_path.os_str().c_str()));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(dst_path.os_str().c_str()));
+   {
+      auto file_ostream(io::binary::open_ostream(src_path));
+      file_ostream->write(src.get(), buffer_size);
+      file_ostream->finalize();
+   }
+
+   // Whole file, reporting progress.
+   io::full_size_t last_progress = 0;
+   bool progress_monotonic = true;
+   LOFTY_TESTING_ASSERT_EQUAL(
+      io::binary::copy_file(src_path, dst_path, io::binary::copy_options().set_progress(
+         [&last_progress, &progress_monotonic] (io::full_size_t copied) {
+            if (copied < last_progress) {
+               progress_monotonic = false;
+            }
+            last_progress = copied;
+         }
+      )),
+      io::full_size_t(buffer_size)
+   );
+   LOFTY_TESTING_ASSERT_TRUE(progress_monotonic);
+   LOFTY_TESTING_ASSERT_EQUAL(last_progress, io::full_size_t(buffer_size));
+   {
+      auto file_istream(io::binary::open_istream(dst_path));
+      std::size_t read_bytes = 0, last_read_bytes;
+      while ((last_read_bytes = file_istream->read(dst.get() + read_bytes, buffer_size - read_bytes)) > 0) {
+         read_bytes += last_read_bytes;
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(read_bytes, buffer_size);
+      LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get(), read_bytes, 0), 0u);
+   }
+
+   // Range of a file, appended to data already written to a buffered stream.
+   {
+      auto file_istream(io::binary::buffer_istream(io::binary::open_istream(src_path)));
+      // Fill the read buffer, which copy() must discard since an offset is specified.
+      LOFTY_TESTING_ASSERT_GREATER(_std::get<1>(file_istream->peek_bytes(10)), 10u);
+      auto file_ostream(io::binary::buffer_ostream(io::binary::open_ostream(dst_path)));
+      file_ostream->write(src.get(), 100);
+      LOFTY_TESTING_ASSERT_EQUAL(
+         io::binary::copy(
+            file_istream.get(), file_ostream.get(),
+            io::binary::copy_options().set_offset(1000).set_max_size(200000)
+         ),
+         io::full_size_t(200000)
+      );
+      file_ostream->finalize();
+   }
+   {
+      auto file_istream(io::binary::open_istream(dst_path));
+      std::size_t read_bytes = 0, last_read_bytes;
+      while ((last_read_bytes = file_istream->read(dst.get() + read_bytes, buffer_size - read_bytes)) > 0) {
+         read_bytes += last_read_bytes;
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(read_bytes, 200100u);
+      LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get(), 100, 0), 0u);
+      LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get() + 100, 200000, 1000), 0u);
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_copy_file_onto_itself,
+   "lofty::io::binary::copy_file() – source and destination are the same file"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const buffer_size = 3000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]), dst(new std::uint8_t[buffer_size]);
+   fill_copy_test_buffer(src.get(), buffer_size);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-copy_file-self-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str), link_path(file_path_str + LOFTY_SL("-link"));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(link_path.os_str().c_str()));
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      file_ostream->write(src.get(), buffer_size);
+      file_ostream->finalize();
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(::link(file_path.os_str().c_str(), link_path.os_str().c_str()), 0);
+
+   LOFTY_TESTING_ASSERT_THROWS(argument_error, io::binary::copy_file(file_path, file_path));
+   LOFTY_TESTING_ASSERT_THROWS(argument_error, io::binary::copy_file(file_path, link_path));
+   {
+      auto file_istream(io::binary::open_istream(file_path));
+      std::size_t read_bytes = 0, last_read_bytes;
+      while ((last_read_bytes = file_istream->read(dst.get() + read_bytes, buffer_size - read_bytes)) > 0) {
+         read_bytes += last_read_bytes;
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(read_bytes, buffer_size);
+      LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get(), read_bytes, 0), 0u);
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_copy_pipe_to_appended_file,
+   "lofty::io::binary::copy() – pipe to regular file open for appending"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   // Small enough to fit in the pipe’s buffer, since there’s no concurrent reader.
+   static std::size_t const buffer_size = 3000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]), dst(new std::uint8_t[buffer_size]);
+   fill_copy_test_buffer(src.get(), buffer_size);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-copy-append-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   io::binary::pipe pipe;
+   pipe.write_end->write(src.get(), buffer_size);
+   pipe.write_end->finalize();
+   {
+      /* Linux refuses to splice() into a file open for appending, which only becomes apparent after data has
+      already been moved from the source into the intermediate pipe; none of it must be lost. */
+      auto file_ostream(_std::dynamic_pointer_cast<io::binary::ostream>(
+         io::binary::open(file_path, io::access_mode::write_append)
+      ));
+      LOFTY_TESTING_ASSERT_EQUAL(
+         io::binary::copy(pipe.read_end.get(), file_ostream.get()), io::full_size_t(buffer_size)
+      );
+      file_ostream->finalize();
+   }
+   auto file_istream(io::binary::open_istream(file_path));
+   std::size_t read_bytes = 0, last_read_bytes;
+   while ((last_read_bytes = file_istream->read(dst.get() + read_bytes, buffer_size - read_bytes)) > 0) {
+      read_bytes += last_read_bytes;
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(read_bytes, buffer_size);
+   LOFTY_TESTING_ASSERT_EQUAL(count_copy_test_buffer_errors(dst.get(), read_bytes, 0), 0u);
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
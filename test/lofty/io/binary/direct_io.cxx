@@ -0,0 +1,158 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/to_str.hxx>
+
+#include <algorithm> // std::min()
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+/*! Returns the count of bytes in a buffer that don’t match the pattern i * 13.
+
+@param buf
+   Pointer to the buffer.
+@param buf_size
+   Size of *buf.
+@param offset
+   Offset of *buf in the pattern.
+@return
+   Count of mismatching bytes.
+*/
+static std::size_t count_direct_io_test_errors(void const * buf, std::size_t buf_size, std::size_t offset) {
+   std::size_t errors = 0;
+   for (std::size_t i = 0; i < buf_size; ++i) {
+      if (static_cast<std::uint8_t const *>(buf)[i] != static_cast<std::uint8_t>((offset + i) * 13)) {
+         ++errors;
+      }
+   }
+   return errors;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_direct_io,
+   "lofty::io::binary – unaligned access to files opened with bypass_cache"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   // Large enough for several chunks of read-ahead, and deliberately not a multiple of any block size.
+   std::size_t const file_size = 0x480000 + 1234, piece_size = 1000;
+   memory::pages_ptr src(file_size);
+   for (std::size_t i = 0; i < file_size; ++i) {
+      static_cast<std::uint8_t *>(src.get())[i] = static_cast<std::uint8_t>(i * 13);
+   }
+   std::uint8_t const * src_bytes = static_cast<std::uint8_t const *>(src.get());
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-direct_io-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+   {
+      auto file_ostream(io::binary::open_ostream(file_path, true));
+      // Unaligned pieces, with a flush leaving an unaligned tail in the middle.
+      std::size_t written_size = 0;
+      for (; written_size < 0x10000 + 10; written_size += piece_size) {
+         file_ostream->write(src_bytes + written_size, piece_size);
+      }
+      file_ostream->flush();
+      auto sized = dynamic_cast<io::binary::sized *>(file_ostream.get());
+      LOFTY_TESTING_ASSERT_EQUAL(sized->size(), static_cast<io::full_size_t>(written_size));
+      // An aligned piece that can skip the staging chunk, then the rest in one write.
+      std::size_t page_size = memory::page_size();
+      std::size_t aligned_end = (written_size + page_size - 1) / page_size * page_size + page_size * 2;
+      file_ostream->write(src_bytes + written_size, aligned_end - written_size);
+      file_ostream->write(src_bytes + aligned_end, page_size * 3);
+      written_size = aligned_end + page_size * 3;
+      file_ostream->write(src_bytes + written_size, file_size - written_size);
+      file_ostream->finalize();
+   }
+
+   auto file_istream(io::binary::open_istream(file_path, true));
+   auto seekable = dynamic_cast<io::binary::seekable *>(file_istream.get());
+   auto sized = dynamic_cast<io::binary::sized *>(file_istream.get());
+   LOFTY_TESTING_ASSERT_EQUAL(sized->size(), static_cast<io::full_size_t>(file_size));
+
+   // Sequential reads in small pieces, which will trigger read-ahead.
+   std::uint8_t dst[piece_size];
+   std::size_t read_size = 0, errors = 0;
+   while (std::size_t bytes_read = file_istream->read(dst, piece_size)) {
+      errors += count_direct_io_test_errors(dst, bytes_read, read_size);
+      read_size += bytes_read;
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(read_size, file_size);
+   LOFTY_TESTING_ASSERT_EQUAL(errors, 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(seekable->tell(), static_cast<io::offset_t>(file_size));
+
+   // Seeking to an unaligned offset, then reading across the end of a block.
+   LOFTY_TESTING_ASSERT_EQUAL(seekable->seek(12345, io::seek_from::start), 12345);
+   std::size_t bytes_read = file_istream->read(dst, piece_size);
+   LOFTY_TESTING_ASSERT_EQUAL(bytes_read, piece_size);
+   LOFTY_TESTING_ASSERT_EQUAL(count_direct_io_test_errors(dst, bytes_read, 12345), 0u);
+   io::offset_t end_offset = static_cast<io::offset_t>(file_size - 10);
+   LOFTY_TESTING_ASSERT_EQUAL(seekable->seek(-10, io::seek_from::end), end_offset);
+   bytes_read = file_istream->read(dst, piece_size);
+   LOFTY_TESTING_ASSERT_EQUAL(bytes_read, 10u);
+   LOFTY_TESTING_ASSERT_EQUAL(count_direct_io_test_errors(dst, bytes_read, file_size - 10), 0u);
+
+   // An aligned read into an aligned buffer goes straight to the caller.
+   memory::pages_ptr aligned_dst(0x20000);
+   LOFTY_TESTING_ASSERT_EQUAL(seekable->seek(0x40000, io::seek_from::start), 0x40000);
+   bytes_read = file_istream->read(aligned_dst.get(), aligned_dst.size());
+   LOFTY_TESTING_ASSERT_EQUAL(bytes_read, aligned_dst.size());
+   LOFTY_TESTING_ASSERT_EQUAL(count_direct_io_test_errors(aligned_dst.get(), bytes_read, 0x40000), 0u);
+
+   /* Rewriting bytes in the middle of the file leaves an unaligned tail, whose block must be padded with the
+   bytes that follow it rather than with zeroes, and without changing the size of the file. */
+   {
+      auto file_iostream(io::binary::open(file_path, io::access_mode::read_write, true));
+      auto iostream_seekable = dynamic_cast<io::binary::seekable *>(file_iostream.get());
+      auto file_ostream = dynamic_cast<io::binary::ostream *>(file_iostream.get());
+      iostream_seekable->seek(5000, io::seek_from::start);
+      file_ostream->write(src_bytes + 5000, piece_size);
+      file_ostream->finalize();
+   }
+   file_istream = io::binary::open_istream(file_path);
+   sized = dynamic_cast<io::binary::sized *>(file_istream.get());
+   LOFTY_TESTING_ASSERT_EQUAL(sized->size(), static_cast<io::full_size_t>(file_size));
+   read_size = 0;
+   errors = 0;
+   while (std::size_t bytes_read_ = file_istream->read(dst, piece_size)) {
+      errors += count_direct_io_test_errors(dst, bytes_read_, read_size);
+      read_size += bytes_read_;
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(read_size, file_size);
+   LOFTY_TESTING_ASSERT_EQUAL(errors, 0u);
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
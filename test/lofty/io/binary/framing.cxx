@@ -0,0 +1,172 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/framing.hxx>
+#include <lofty/testing/test_case.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+/*! Checks that a frame’s payload contains bytes i * 7 + seed.
+
+@param frame
+   Frame to check.
+@param seed
+   Value of the first byte.
+@return
+   true if the payload matches the pattern, or false otherwise.
+*/
+static bool frame_matches_pattern(io::binary::const_buffer const & frame, std::uint8_t seed) {
+   auto payload = static_cast<std::uint8_t const *>(frame.src);
+   for (std::size_t i = 0; i < frame.src_size; ++i) {
+      if (payload[i] != static_cast<std::uint8_t>(i * 7 + seed)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_framing_varint,
+   "lofty::io::binary::framing – varint-prefixed frames, views and copies"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   namespace framing = io::binary::framing;
+
+   // Small enough to fit in the pipe’s buffer, since there’s no concurrent reader.
+   static std::size_t const large_size = 10000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[large_size]);
+   for (std::size_t i = 0; i < large_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i * 7 + 1);
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(framing::prefix_size(framing::length_prefix::varint, 127), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(framing::prefix_size(framing::length_prefix::varint, 128), 2u);
+
+   io::binary::pipe pipe;
+   {
+      auto buf_ostream(io::binary::buffer_ostream(pipe.write_end));
+      framing::writer frame_writer(buf_ostream, framing::length_prefix::varint, large_size);
+      frame_writer.write(src.get(), 0);
+      frame_writer.write(src.get(), 5);
+      frame_writer.write(src.get(), 200);
+      // Encoded in place, with a prefix sized for 300 bytes: 2 bytes, padded since the payload is just 3.
+      auto buf = static_cast<std::uint8_t *>(frame_writer.get_buffer(300));
+      buf[0] = 2;
+      buf[1] = 9;
+      buf[2] = 16;
+      frame_writer.commit(3);
+      // Large enough to be written together with its prefix instead of copied into the buffer.
+      frame_writer.write(src.get(), large_size);
+      LOFTY_TESTING_ASSERT_THROWS(domain_error, frame_writer.write(src.get(), large_size + 1));
+      LOFTY_TESTING_ASSERT_THROWS(argument_error, frame_writer.commit(0));
+      frame_writer.write(src.get(), 1);
+      buf_ostream->finalize();
+   }
+
+   auto buf_istream(io::binary::buffer_istream(pipe.read_end));
+   // Frames over 0x100 bytes that aren’t already buffered will be copied.
+   framing::reader frame_reader(buf_istream, framing::length_prefix::varint, large_size, 0x100);
+   io::binary::const_buffer frame;
+   LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+   LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, 0u);
+   LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+   LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, 5u);
+   LOFTY_TESTING_ASSERT_TRUE(frame_matches_pattern(frame, 1));
+   // This frame must be a view into the stream’s buffer.
+   auto buffered(buf_istream->peek<std::uint8_t>(0));
+   LOFTY_TESTING_ASSERT_GREATER(static_cast<std::uint8_t const *>(frame.src), _std::get<0>(buffered));
+   LOFTY_TESTING_ASSERT_TRUE(
+      static_cast<std::uint8_t const *>(frame.src) < _std::get<0>(buffered) + _std::get<1>(buffered)
+   );
+   LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+   LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, 200u);
+   LOFTY_TESTING_ASSERT_TRUE(frame_matches_pattern(frame, 1));
+   LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+   LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, 3u);
+   LOFTY_TESTING_ASSERT_TRUE(frame_matches_pattern(frame, 2));
+   // This frame spans several refills of the stream’s buffer.
+   LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+   LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, large_size);
+   LOFTY_TESTING_ASSERT_TRUE(frame_matches_pattern(frame, 1));
+   LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+   LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, 1u);
+   LOFTY_TESTING_ASSERT_TRUE(frame_matches_pattern(frame, 1));
+   LOFTY_TESTING_ASSERT_FALSE(frame_reader.read(&frame));
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_framing_fixed,
+   "lofty::io::binary::framing – fixed-size prefixes, limits and truncation"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   namespace framing = io::binary::framing;
+
+   std::uint8_t const src[] = { 1, 8, 15, 22, 29, 36 };
+   {
+      io::binary::pipe pipe;
+      auto buf_ostream(io::binary::buffer_ostream(pipe.write_end));
+      framing::writer frame_writer(buf_ostream, framing::length_prefix::uint16_be, 0x10000);
+      // Larger than a 2-byte prefix can express.
+      LOFTY_TESTING_ASSERT_THROWS(domain_error, frame_writer.write(src, 0x10000));
+      frame_writer.write(src, sizeof src);
+      frame_writer.write(src, 2);
+      buf_ostream->finalize();
+
+      auto buf_istream(io::binary::buffer_istream(pipe.read_end));
+      auto raw(buf_istream->peek<std::uint8_t>(2));
+      LOFTY_TESTING_ASSERT_EQUAL(_std::get<0>(raw)[0], 0u);
+      LOFTY_TESTING_ASSERT_EQUAL(_std::get<0>(raw)[1], sizeof src);
+      framing::reader frame_reader(buf_istream, framing::length_prefix::uint16_be, 4);
+      io::binary::const_buffer frame;
+      // The first frame exceeds the reader’s limit.
+      LOFTY_TESTING_ASSERT_THROWS(domain_error, frame_reader.read(&frame));
+   }
+   {
+      io::binary::pipe pipe;
+      auto buf_ostream(io::binary::buffer_ostream(pipe.write_end));
+      framing::writer frame_writer(buf_ostream, framing::length_prefix::uint32_le, 0x100);
+      frame_writer.write(src, sizeof src);
+      // Prefix for a 6-byte frame, followed by just 2 bytes.
+      std::uint8_t const truncated[] = { 6, 0, 0, 0, 1, 8 };
+      buf_ostream->write(truncated, sizeof truncated);
+      buf_ostream->finalize();
+
+      framing::reader frame_reader(
+         io::binary::buffer_istream(pipe.read_end), framing::length_prefix::uint32_le, 0x100
+      );
+      io::binary::const_buffer frame;
+      LOFTY_TESTING_ASSERT_TRUE(frame_reader.read(&frame));
+      LOFTY_TESTING_ASSERT_EQUAL(frame.src_size, sizeof src);
+      LOFTY_TESTING_ASSERT_TRUE(frame_matches_pattern(frame, 1));
+      LOFTY_TESTING_ASSERT_THROWS(io::error, frame_reader.read(&frame));
+   }
+}
+
+}} //namespace lofty::test
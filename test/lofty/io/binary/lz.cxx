@@ -0,0 +1,265 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/lz.hxx>
+#include <lofty/io/text.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+/*! Fills a buffer with data that exercises all the compressor’s paths: runs with short and long periods,
+repeated records, and a stretch of incompressible bytes.
+
+@param buf
+   Pointer to the buffer.
+@param buf_size
+   Size of *buf.
+*/
+static void fill_lz_test_buffer(std::uint8_t * buf, std::size_t buf_size) {
+   std::uint32_t rand_state = 0x12345678;
+   for (std::size_t i = 0; i < buf_size; ++i) {
+      std::size_t section = (i / 5000) % 6;
+      switch (section) {
+         case 0: // Run of a single byte.
+            buf[i] = 'a';
+            break;
+         case 1: // Short period.
+            buf[i] = static_cast<std::uint8_t>('0' + i % 3);
+            break;
+         case 2: // Period just under the size of a vector copy.
+            buf[i] = static_cast<std::uint8_t>('A' + i % 15);
+            break;
+         case 3: // Records with a changing field.
+            buf[i] = static_cast<std::uint8_t>(i % 40 < 4 ? '0' + (i / 40) % 10 : 'k' + i % 7);
+            break;
+         default: // Incompressible.
+            rand_state ^= rand_state << 13;
+            rand_state ^= rand_state >> 17;
+            rand_state ^= rand_state << 5;
+            buf[i] = static_cast<std::uint8_t>(rand_state);
+            break;
+      }
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_lz_round_trip,
+   "lofty::io::binary::lz_ostream/lz_istream – compression and decompression"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const buffer_size = 100000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]), dst(new std::uint8_t[buffer_size]);
+   fill_lz_test_buffer(src.get(), buffer_size);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-lz-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   LOFTY_TESTING_ASSERT_THROWS(argument_error, io::binary::lz_ostream(nullptr, 3000));
+
+   {
+      io::binary::lz_ostream lz_ostream(
+         io::binary::buffer_ostream(io::binary::open_ostream(file_path)), 0x1000
+      );
+      // Mix write(), which compresses whole blocks from the source, with get_buffer()/commit().
+      std::size_t written_size = 0;
+      lz_ostream.write(src.get(), 1000);
+      written_size += 1000;
+      lz_ostream.write(src.get() + written_size, 20000);
+      written_size += 20000;
+      while (written_size < buffer_size) {
+         std::size_t chunk_size = std::min(buffer_size - written_size, std::size_t(7777));
+         auto buf(lz_ostream.get_buffer<std::uint8_t>(chunk_size));
+         memory::copy(_std::get<0>(buf), src.get() + written_size, chunk_size);
+         lz_ostream.commit<std::uint8_t>(chunk_size);
+         written_size += chunk_size;
+      }
+      lz_ostream.finalize();
+   }
+   {
+      auto compressed_istream(io::binary::open_istream(file_path));
+      io::full_size_t compressed_size = _std::dynamic_pointer_cast<io::binary::sized>(
+         compressed_istream
+      )->size();
+      // A third of the data is incompressible.
+      LOFTY_TESTING_ASSERT_TRUE(compressed_size < io::full_size_t(buffer_size / 2));
+   }
+   {
+      io::binary::lz_istream lz_istream(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+      std::size_t read_size = 0;
+      for (;;) {
+         std::uint8_t const * buf;
+         std::size_t buf_size;
+         _std::tie(buf, buf_size) = lz_istream.peek<std::uint8_t>(3333);
+         if (buf_size == 0) {
+            break;
+         }
+         std::size_t consume_size = std::min(buf_size, buffer_size - read_size);
+         memory::copy(dst.get() + read_size, buf, consume_size);
+         lz_istream.consume<std::uint8_t>(consume_size);
+         read_size += consume_size;
+         if (consume_size < buf_size) {
+            break;
+         }
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(read_size, buffer_size);
+      std::size_t errors = 0;
+      for (std::size_t i = 0; i < buffer_size; ++i) {
+         if (dst[i] != src[i]) {
+            ++errors;
+         }
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(errors, 0u);
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_lz_corrupt,
+   "lofty::io::binary::lz_istream – detection of corrupted data"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const buffer_size = 20000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]);
+   fill_lz_test_buffer(src.get(), buffer_size);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-lz-corrupt-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   collections::vector<std::uint8_t> compressed;
+   {
+      io::binary::lz_ostream lz_ostream(io::binary::buffer_ostream(io::binary::open_ostream(file_path)));
+      lz_ostream.write(src.get(), buffer_size);
+      lz_ostream.finalize();
+      auto compressed_istream(io::binary::open_istream(file_path));
+      std::uint8_t chunk[4096];
+      while (std::size_t chunk_size = compressed_istream->read(chunk, sizeof chunk)) {
+         compressed.push_back(chunk, chunk_size);
+      }
+   }
+
+   // Alter the content checksum.
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      compressed[compressed.size() - 1] ^= 0x01;
+      file_ostream->write(compressed.data(), compressed.size());
+      file_ostream->finalize();
+      compressed[compressed.size() - 1] ^= 0x01;
+   }
+   {
+      io::binary::lz_istream lz_istream(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+      LOFTY_TESTING_ASSERT_THROWS(io::error, lz_istream.peek<std::uint8_t>(buffer_size + 1));
+   }
+
+   /* Alter a byte in the block; depending on what it was, this will either make the block malformed or change
+   the decompressed data, which will no longer match the content checksum. */
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      compressed[110] ^= 0x01;
+      file_ostream->write(compressed.data(), compressed.size());
+      file_ostream->finalize();
+      compressed[110] ^= 0x01;
+   }
+   {
+      io::binary::lz_istream lz_istream(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+      LOFTY_TESTING_ASSERT_THROWS(generic_error, lz_istream.peek<std::uint8_t>(buffer_size + 1));
+   }
+
+   // Truncate the stream before the end mark.
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      file_ostream->write(compressed.data(), compressed.size() - 10);
+      file_ostream->finalize();
+   }
+   {
+      io::binary::lz_istream lz_istream(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+      LOFTY_TESTING_ASSERT_THROWS(io::error, lz_istream.peek<std::uint8_t>(buffer_size + 1));
+   }
+
+   // Not a compressed stream at all.
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      file_ostream->write(src.get(), 100);
+      file_ostream->finalize();
+   }
+   {
+      io::binary::lz_istream lz_istream(io::binary::buffer_istream(io::binary::open_istream(file_path)));
+      LOFTY_TESTING_ASSERT_THROWS(domain_error, lz_istream.peek<std::uint8_t>(1));
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_lz_text,
+   "lofty::io::binary::lz_ostream/lz_istream – compressed text streams"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-lz-text-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   static unsigned const lines_count = 2000;
+   {
+      auto text_ostream(io::text::make_ostream(_std::make_shared<io::binary::lz_ostream>(
+         io::binary::buffer_ostream(io::binary::open_ostream(file_path))
+      ), text::encoding::utf8));
+      // The last line has no new-line, so that read_line() won’t return an empty line after it.
+      for (unsigned i = 0; i < lines_count; ++i) {
+         if (i > 0) {
+            text_ostream->write_line();
+         }
+         text_ostream->write(LOFTY_SL("log line ") + to_str(i));
+      }
+      text_ostream->finalize();
+   }
+   {
+      auto text_istream(io::text::make_istream(_std::make_shared<io::binary::lz_istream>(
+         io::binary::buffer_istream(io::binary::open_istream(file_path))
+      ), text::encoding::utf8));
+      str line;
+      unsigned i = 0;
+      for (; text_istream->read_line(&line); ++i) {
+         LOFTY_TESTING_ASSERT_EQUAL(line, LOFTY_SL("log line ") + to_str(i));
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(i, lines_count);
+   }
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
@@ -0,0 +1,130 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <unistd.h> // unlink()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+/*! Returns the count of bytes in a buffer that don’t match the pattern i * 7.
+
+@param buf
+   Pointer to the buffer.
+@param buf_size
+   Size of *buf.
+@param offset
+   Offset of *buf in the pattern.
+@return
+   Count of mismatching bytes.
+*/
+static std::size_t count_map_istream_test_errors(void const * buf, std::size_t buf_size, std::size_t offset) {
+   std::size_t errors = 0;
+   for (std::size_t i = 0; i < buf_size; ++i) {
+      if (static_cast<std::uint8_t const *>(buf)[i] != static_cast<std::uint8_t>((offset + i) * 7)) {
+         ++errors;
+      }
+   }
+   return errors;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_map_istream,
+   "lofty::io::binary::map_istream() – sliding windows, growing file and copy()"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   std::size_t page_size = memory::page_size();
+   std::size_t const file_size = page_size * 3 + 100, appended_size = 50;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[file_size + appended_size]);
+   for (std::size_t i = 0; i < file_size + appended_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i * 7);
+   }
+
+   str file_path_str(LOFTY_SL("/tmp/lofty-test-io-binary-map_istream-"));
+   file_path_str += to_str(this_process::id());
+   os::path file_path(file_path_str);
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+   {
+      auto file_ostream(io::binary::open_ostream(file_path));
+      file_ostream->write(src.get(), file_size);
+      file_ostream->finalize();
+   }
+
+   // Map a page at a time, so that reading the file will require sliding the window.
+   auto file_istream(io::binary::map_istream(io::binary::open_istream(file_path), page_size));
+   auto buf(file_istream->peek_bytes(1));
+   LOFTY_TESTING_ASSERT_EQUAL(_std::get<1>(buf), page_size);
+   LOFTY_TESTING_ASSERT_EQUAL(count_map_istream_test_errors(_std::get<0>(buf), page_size, 0), 0u);
+   file_istream->consume_bytes(page_size - 10);
+   // Ask for more than what’s left in the window: the new window must start within the old one.
+   buf = file_istream->peek_bytes(page_size + 20);
+   LOFTY_TESTING_ASSERT_GREATER_EQUAL(_std::get<1>(buf), page_size + 20);
+   LOFTY_TESTING_ASSERT_EQUAL(
+      count_map_istream_test_errors(_std::get<0>(buf), page_size + 20, page_size - 10), 0u
+   );
+   file_istream->consume_bytes(page_size + 20);
+
+   // Append to the file: reaching the old EOF must reveal the new data.
+   {
+      auto file_ostream(_std::dynamic_pointer_cast<io::binary::file_ostream>(
+         io::binary::open(file_path, io::access_mode::write_append)
+      ));
+      file_ostream->write(src.get() + file_size, appended_size);
+      file_ostream->finalize();
+   }
+   std::size_t offset = page_size * 2 + 10;
+   for (;;) {
+      buf = file_istream->peek_bytes(1);
+      if (_std::get<1>(buf) == 0) {
+         break;
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(count_map_istream_test_errors(_std::get<0>(buf), 1, offset), 0u);
+      file_istream->consume_bytes(1);
+      ++offset;
+      if (offset == page_size * 3) {
+         // Hand the rest of the file to copy(), which must pick up where we left off.
+         io::binary::pipe pipe;
+         auto copied = io::binary::copy(file_istream.get(), pipe.write_end.get());
+         pipe.write_end->finalize();
+         LOFTY_TESTING_ASSERT_EQUAL(copied, io::full_size_t(file_size + appended_size - offset));
+         std::uint8_t dst[200];
+         LOFTY_TESTING_ASSERT_EQUAL(pipe.read_end->read(dst, sizeof dst), std::size_t(copied));
+         LOFTY_TESTING_ASSERT_EQUAL(count_map_istream_test_errors(dst, std::size_t(copied), offset), 0u);
+         offset += std::size_t(copied);
+      }
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(offset, file_size + appended_size);
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
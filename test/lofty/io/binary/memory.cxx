@@ -0,0 +1,136 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/io/binary/lz.hxx>
+#include <lofty/io/binary/memory.hxx>
+#include <lofty/testing/test_case.hxx>
+
+#include <cstring> // std::memcmp()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_memory_istream,
+   "lofty::io::binary::memory_istream – reading from a memory buffer"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   std::uint8_t const src[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+   io::binary::memory_istream mem_istream(src, sizeof src);
+   LOFTY_TESTING_ASSERT_EQUAL(mem_istream.size(), io::full_size_t(sizeof src));
+
+   // peek() must return a pointer into the source buffer, not a copy.
+   auto peeked(mem_istream.peek<std::uint8_t>(3));
+   LOFTY_TESTING_ASSERT_TRUE(_std::get<0>(peeked) == src);
+   LOFTY_TESTING_ASSERT_EQUAL(_std::get<1>(peeked), sizeof src);
+   mem_istream.consume<std::uint8_t>(3);
+   LOFTY_TESTING_ASSERT_EQUAL(mem_istream.remaining_size(), sizeof src - 3);
+
+   std::uint8_t dst[4];
+   LOFTY_TESTING_ASSERT_EQUAL(mem_istream.read(dst, sizeof dst), sizeof dst);
+   LOFTY_TESTING_ASSERT_EQUAL(dst[0], 4u);
+   LOFTY_TESTING_ASSERT_EQUAL(dst[3], 7u);
+   LOFTY_TESTING_ASSERT_THROWS(argument_error, mem_istream.consume<std::uint8_t>(4));
+   LOFTY_TESTING_ASSERT_EQUAL(mem_istream.read(dst, sizeof dst), 3u);
+   LOFTY_TESTING_ASSERT_EQUAL(dst[2], 10u);
+   LOFTY_TESTING_ASSERT_EQUAL(mem_istream.read(dst, sizeof dst), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(_std::get<1>(mem_istream.peek<std::uint8_t>(1)), 0u);
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_memory_ostream,
+   "lofty::io::binary::memory_ostream – writing to a vector"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   io::binary::memory_ostream mem_ostream;
+   std::uint8_t const src[] = { 1, 2, 3 };
+   mem_ostream.write(src, sizeof src);
+   // A large request must be satisfied in full, straight from the vector’s capacity.
+   static std::size_t const large_size = 100000;
+   auto buf(mem_ostream.get_buffer<std::uint8_t>(large_size));
+   LOFTY_TESTING_ASSERT_TRUE(_std::get<1>(buf) >= large_size);
+   LOFTY_TESTING_ASSERT_TRUE(_std::get<0>(buf) == mem_ostream.content().data() + sizeof src);
+   for (std::size_t i = 0; i < large_size; ++i) {
+      _std::get<0>(buf)[i] = static_cast<std::uint8_t>(i);
+   }
+   mem_ostream.commit<std::uint8_t>(large_size);
+   io::binary::const_buffer bufs[] = { { src, 2 }, { src + 2, 1 } };
+   mem_ostream.write_buffers(bufs, 2);
+   mem_ostream.finalize();
+
+   auto const & content = mem_ostream.content();
+   LOFTY_TESTING_ASSERT_EQUAL(content.size(), sizeof src + large_size + sizeof src);
+   LOFTY_TESTING_ASSERT_EQUAL(content[2], 3u);
+   LOFTY_TESTING_ASSERT_EQUAL(content[sizeof src + 1000], static_cast<std::uint8_t>(1000));
+   LOFTY_TESTING_ASSERT_EQUAL(content[sizeof src + large_size + 2], 3u);
+
+   auto released(mem_ostream.release_content());
+   LOFTY_TESTING_ASSERT_EQUAL(released.size(), sizeof src + large_size + sizeof src);
+   LOFTY_TESTING_ASSERT_EQUAL(mem_ostream.content().size(), 0u);
+
+   // An external vector is appended to.
+   collections::vector<std::uint8_t> ext_buf;
+   ext_buf.push_back(9);
+   io::binary::memory_ostream ext_ostream(external_buffer, &ext_buf);
+   ext_ostream.write(src, sizeof src);
+   LOFTY_TESTING_ASSERT_EQUAL(ext_buf.size(), 1u + sizeof src);
+   LOFTY_TESTING_ASSERT_EQUAL(ext_buf[0], 9u);
+   LOFTY_TESTING_ASSERT_EQUAL(ext_buf[3], 3u);
+   ext_ostream.clear();
+   LOFTY_TESTING_ASSERT_EQUAL(ext_buf.size(), 0u);
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_memory_stacked,
+   "lofty::io::binary::memory_istream/memory_ostream – underneath other buffered streams"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const data_size = 50000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[data_size]), dst(new std::uint8_t[data_size]);
+   for (std::size_t i = 0; i < data_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i % 251 < 100 ? 'x' : i * 7);
+   }
+
+   auto mem_ostream(_std::make_shared<io::binary::memory_ostream>());
+   {
+      io::binary::lz_ostream lz_ostream(mem_ostream);
+      lz_ostream.write(src.get(), data_size);
+      lz_ostream.finalize();
+   }
+   auto const & compressed = mem_ostream->content();
+   LOFTY_TESTING_ASSERT_TRUE(compressed.size() < data_size);
+
+   io::binary::lz_istream lz_istream(
+      _std::make_shared<io::binary::memory_istream>(compressed.data(), compressed.size())
+   );
+   std::size_t read_size = 0;
+   while (std::size_t chunk_size = lz_istream.read(dst.get() + read_size, data_size - read_size)) {
+      read_size += chunk_size;
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(read_size, data_size);
+   LOFTY_TESTING_ASSERT_EQUAL(std::memcmp(dst.get(), src.get(), data_size), 0);
+}
+
+}} //namespace lofty::test
@@ -0,0 +1,81 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <cstring>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_buffered_istream_ring,
+   "lofty::io::binary::buffer_istream() – contiguous peeks across the end of a large read buffer"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::size_t const buf_size = 0x10000, chunk_size = 10000, consume_size = 7000, rounds = 50;
+   // Each peek covers the bytes left over from the previous round, plus a new chunk.
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[consume_size * rounds + chunk_size]);
+   for (std::size_t i = 0; i < consume_size * rounds + chunk_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i * 7 + i / 251);
+   }
+   io::binary::pipe pipe;
+   auto buf_istream(io::binary::buffer_istream(
+      pipe.read_end,
+      io::binary::buffer_sizing().set_size_min(buf_size).set_size_max(buf_size).set_release_when_idle(false)
+   ));
+   pipe.write_end->write(src.get(), chunk_size);
+   std::size_t offset = 0, mismatches = 0;
+   std::uint8_t const * expected_ptr = nullptr;
+   bool contiguous = true;
+   for (std::size_t round = 0; round < rounds; ++round) {
+      std::uint8_t const * buf;
+      std::size_t buf_avail;
+      _std::tie(buf, buf_avail) = buf_istream->peek<std::uint8_t>(chunk_size);
+      if (buf_avail != chunk_size || std::memcmp(buf, src.get() + offset, chunk_size) != 0) {
+         ++mismatches;
+      }
+      /* Unless the read buffer can wrap around, it will eventually have to move the unconsumed bytes to its
+      start. */
+      if (expected_ptr && buf != expected_ptr && buf + buf_size != expected_ptr) {
+         contiguous = false;
+      }
+      buf_istream->consume<std::uint8_t>(consume_size);
+      offset += consume_size;
+      expected_ptr = buf + consume_size;
+      pipe.write_end->write(src.get() + offset + chunk_size - consume_size, consume_size);
+   }
+   pipe.write_end->finalize();
+   LOFTY_TESTING_ASSERT_EQUAL(mismatches, 0u);
+#if LOFTY_HOST_API_LINUX
+   LOFTY_TESTING_ASSERT_TRUE(contiguous);
+#else
+   LOFTY_UNUSED_ARG(contiguous);
+#endif
+   // Drain what’s left, verifying it too.
+   std::size_t tail_size = _std::get<1>(buf_istream->peek<std::uint8_t>(chunk_size));
+   LOFTY_TESTING_ASSERT_EQUAL(tail_size, chunk_size);
+   buf_istream->consume<std::uint8_t>(tail_size);
+   LOFTY_TESTING_ASSERT_EQUAL(_std::get<1>(buf_istream->peek<std::uint8_t>(1)), 0u);
+}
+
+}} //namespace lofty::test
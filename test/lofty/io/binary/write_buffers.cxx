@@ -0,0 +1,100 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/testing/test_case.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+/*! Reads from a pipe until EOF, verifying that each byte i equals i * 3.
+
+@param bin_istream
+   Pointer to the read end of the pipe.
+@param buf_size
+   Maximum count of bytes to read.
+@return
+   Count of bytes read, or 0 if any byte didn’t match the pattern.
+*/
+static std::size_t read_write_buffers_test_pattern(io::binary::istream * bin_istream, std::size_t buf_size) {
+   _std::unique_ptr<std::uint8_t[]> buf(new std::uint8_t[buf_size]);
+   std::size_t read_bytes = 0, last_read_bytes;
+   while ((last_read_bytes = bin_istream->read(buf.get() + read_bytes, buf_size - read_bytes)) > 0) {
+      read_bytes += last_read_bytes;
+   }
+   for (std::size_t i = 0; i < read_bytes; ++i) {
+      if (buf[i] != static_cast<std::uint8_t>(i * 3)) {
+         return 0;
+      }
+   }
+   return read_bytes;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   io_binary_write_buffers,
+   "lofty::io::binary::ostream::write_buffers() – unbuffered and buffered pipe"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   // Small enough to fit in the pipe’s buffer, since there’s no concurrent reader.
+   static std::size_t const buffer_size = 20000;
+   _std::unique_ptr<std::uint8_t[]> src(new std::uint8_t[buffer_size]);
+   for (std::size_t i = 0; i < buffer_size; ++i) {
+      src[i] = static_cast<std::uint8_t>(i * 3);
+   }
+   io::binary::const_buffer bufs[3];
+   bufs[0].src = src.get();
+   bufs[0].src_size = 10;
+   bufs[1].src = src.get() + 10;
+   bufs[1].src_size = 0;
+   bufs[2].src = src.get() + 10;
+   bufs[2].src_size = 8000;
+
+   {
+      io::binary::pipe pipe;
+      LOFTY_TESTING_ASSERT_EQUAL(pipe.write_end->write_buffers(bufs, 3), 8010u);
+      pipe.write_end->finalize();
+      LOFTY_TESTING_ASSERT_EQUAL(read_write_buffers_test_pattern(pipe.read_end.get(), buffer_size), 8010u);
+   }
+   {
+      io::binary::pipe pipe;
+      auto buf_ostream(io::binary::buffer_ostream(pipe.write_end));
+      // A small write that will stay in the buffer…
+      buf_ostream->write(src.get(), 5);
+      // …followed by small buffers that will be appended to it…
+      bufs[0].src = src.get() + 5;
+      bufs[0].src_size = 5;
+      bufs[1].src = src.get() + 10;
+      bufs[1].src_size = 20;
+      LOFTY_TESTING_ASSERT_EQUAL(buf_ostream->write_buffers(bufs, 2), 25u);
+      // …and then by large payloads that will be written together with the buffered bytes.
+      bufs[0].src = src.get() + 30;
+      bufs[0].src_size = 9970;
+      bufs[1].src = src.get() + 10000;
+      bufs[1].src_size = 3;
+      LOFTY_TESTING_ASSERT_EQUAL(buf_ostream->write_buffers(bufs, 2), 9973u);
+      LOFTY_TESTING_ASSERT_EQUAL(buf_ostream->write(src.get() + 10003, 9997), 9997u);
+      buf_ostream->finalize();
+      LOFTY_TESTING_ASSERT_EQUAL(read_write_buffers_test_pattern(pipe.read_end.get(), buffer_size), buffer_size);
+   }
+}
+
+}} //namespace lofty::test
@@ -0,0 +1,160 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/net/http.hxx>
+#include <lofty/testing/test_case.hxx>
+
+#include <cstring> // std::memcmp() std::strlen()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+/*! Serves the specified raw requests with http::server::serve(), and returns the count of bytes of the
+responses that differ from the expected ones.
+
+@param requests
+   Raw requests to serve.
+@param handler
+   Request handler.
+@param expected_responses
+   Raw responses that handler should cause to be sent.
+@return
+   0 if the responses match expected_responses; otherwise, a non-zero value.
+*/
+static std::size_t serve_http_test_requests(
+   char const * requests, net::http::request_handler_type const & handler, char const * expected_responses
+) {
+   // Requests and responses are small enough to fit in the pipes’ buffers.
+   io::binary::pipe requests_pipe, responses_pipe;
+   requests_pipe.write_end->write(requests, std::strlen(requests));
+   requests_pipe.write_end->finalize();
+   net::http::server::serve(requests_pipe.read_end, responses_pipe.write_end, handler);
+
+   char buf[1024];
+   std::size_t read_bytes = 0, last_read_bytes;
+   while ((last_read_bytes = responses_pipe.read_end->read(buf + read_bytes, sizeof buf - read_bytes)) > 0) {
+      read_bytes += last_read_bytes;
+   }
+   std::size_t expected_size = std::strlen(expected_responses);
+   if (read_bytes != expected_size) {
+      return read_bytes + 1;
+   }
+   return std::memcmp(buf, expected_responses, read_bytes) != 0 ? 1u : 0u;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_http_server_pipelining,
+   "lofty::net::http::server – pipelined requests, bodies and keep-alive"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str last_header;
+   std::size_t requests_count = 0;
+   net::http::router router;
+   router.add_route(LOFTY_SL("GET"), LOFTY_SL("/"), [&last_header, &requests_count] (
+      net::http::request const & req, net::http::response * resp
+   ) {
+      ++requests_count;
+      last_header = req.header("x-test").to_str();
+      resp->write(LOFTY_SL("OK"));
+   });
+   router.add_route(LOFTY_SL("POST"), LOFTY_SL("/echo/*"), [&requests_count] (
+      net::http::request const & req, net::http::response * resp
+   ) {
+      ++requests_count;
+      resp->write(req.body().data(), req.body().size());
+   });
+   auto handler = [&router] (net::http::request const & req, net::http::response * resp) {
+      router(req, resp);
+   };
+
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "\r\n"
+      "GET / HTTP/1.1\r\nX-Test:  abc \r\n\r\n"
+      "POST /echo/x?y HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+      "POST /echo/ HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3;ext\r\nabc\r\n2\r\nde\r\n0\r\nT: 1\r\n\r\n"
+      "HEAD / HTTP/1.1\r\n\r\n"
+      "PUT / HTTP/1.1\r\n\r\n"
+      "GET /missing HTTP/1.0\r\n\r\n"
+      "GET / HTTP/1.1\r\n\r\n",
+      handler,
+      "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK"
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello"
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nabcde"
+      "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n"
+      "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n"
+      // HTTP/1.0 without keep-alive: the connection is closed, and the last request is never served.
+      "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+   ), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(requests_count, 4u);
+   LOFTY_TESTING_ASSERT_EQUAL(last_header, LOFTY_SL(""));
+
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "GET / HTTP/1.0\r\nConnection: keep-alive\r\nX-Test: abc\r\n\r\n",
+      handler,
+      "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: keep-alive\r\n\r\nOK"
+   ), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(last_header, LOFTY_SL("abc"));
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_http_server_errors,
+   "lofty::net::http::server – invalid requests"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   auto handler = [] (net::http::request const & req, net::http::response * resp) {
+      if (req.path().equals("/throw")) {
+         LOFTY_THROW(argument_error, ());
+      }
+      resp->enable_chunked();
+      resp->write(LOFTY_SL("abc"));
+   };
+
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "GET /chunked HTTP/1.1\r\n\r\nGET /throw HTTP/1.1\r\n\r\n",
+      handler,
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n"
+      "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+   ), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "GET /\r\n\r\n",
+      handler,
+      "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+   ), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n",
+      handler,
+      "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+   ), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "GET / HTTP/2.0\r\n\r\n",
+      handler,
+      "HTTP/1.1 505 HTTP Version Not Supported\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+   ), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(serve_http_test_requests(
+      "GET / HTTP/1.1\r\nX-Folded: a\r\n b\r\n\r\n",
+      handler,
+      "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+   ), 0u);
+}
+
+}} //namespace lofty::test
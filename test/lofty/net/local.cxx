@@ -0,0 +1,136 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/net/local.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <errno.h> // EAGAIN
+   #include <unistd.h> // pipe()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_local_server,
+   "lofty::net::local::server – connecting and exchanging data"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str socket_path_str(LOFTY_SL("/tmp/lofty-test-net-local-"));
+   socket_path_str += to_str(this_process::id());
+   os::path socket_path(socket_path_str);
+   net::local::server server(socket_path);
+   // Connecting only requires space in the backlog, so this won’t block even though nobody is accepting yet.
+   auto client_conn(net::local::connect(socket_path));
+   auto server_conn(server.accept());
+
+   static char const data[] = "local";
+   char buf[16];
+   client_conn->socket()->write(data, sizeof data);
+   LOFTY_TESTING_ASSERT_EQUAL(server_conn->socket()->read(buf, sizeof buf), sizeof data);
+   LOFTY_TESTING_ASSERT_EQUAL(buf[0], 'l');
+   LOFTY_TESTING_ASSERT_EQUAL(buf[4], 'l');
+   client_conn->socket()->finalize();
+   server_conn->socket()->finalize();
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_local_connect_backlog_full,
+   "lofty::net::local::connect() – server with a full backlog"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str socket_path_str(LOFTY_SL("/tmp/lofty-test-net-local-backlog-"));
+   socket_path_str += to_str(this_process::id());
+   os::path socket_path(socket_path_str);
+   collections::vector<_std::shared_ptr<net::local::connection>> client_conns;
+   int backlog_full_err = 0;
+   bool connected_after_accept = false;
+   // In a coroutine, sockets are non-blocking, so connect() sees the full backlog instead of waiting.
+   coroutine([&socket_path, &client_conns, &backlog_full_err, &connected_after_accept] () {
+      net::local::server server(socket_path, net::local::socket_type::stream, 1);
+      try {
+         // Nobody is accepting, so the backlog will fill up and connect() will eventually give up.
+         for (unsigned i = 0; i < 16; ++i) {
+            client_conns.push_back(net::local::connect(socket_path));
+         }
+      } catch (generic_error const & x) {
+         backlog_full_err = x.os_error();
+      }
+      // Make room in the backlog; connecting must work again.
+      server.accept();
+      client_conns.push_back(net::local::connect(socket_path));
+      connected_after_accept = true;
+   });
+   this_thread::run_coroutines();
+   this_thread::detach_coroutine_scheduler();
+
+   LOFTY_TESTING_ASSERT_EQUAL(backlog_full_err, EAGAIN);
+   LOFTY_TESTING_ASSERT_TRUE(connected_after_accept);
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_local_connection_pair_fds,
+   "lofty::net::local::connection_pair – passing file descriptors"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   net::local::connection_pair conns(net::local::socket_type::seqpacket);
+   int pipe_fds[2];
+   LOFTY_TESTING_ASSERT_EQUAL(::pipe(pipe_fds), 0);
+   auto pipe_read_end(io::binary::make_istream(io::filedesc(pipe_fds[0])));
+   io::filedesc pipe_write_fd(pipe_fds[1]);
+   conns.first->send_with_fds("p", 1, &pipe_fds[1], 1);
+
+   char buf[4];
+   collections::vector<io::filedesc> received_fds;
+   LOFTY_TESTING_ASSERT_EQUAL(conns.second->receive_with_fds(buf, sizeof buf, &received_fds), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(buf[0], 'p');
+   LOFTY_TESTING_ASSERT_EQUAL(received_fds.size(), 1u);
+   LOFTY_TESTING_ASSERT_NOT_EQUAL(received_fds[0].get(), pipe_write_fd.get());
+
+   // The received file descriptor must refer to the same pipe.
+   {
+      auto received_write_end(io::binary::make_ostream(_std::move(received_fds[0])));
+      received_write_end->write("q", 1);
+      received_write_end->finalize();
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(pipe_read_end->read(buf, sizeof buf), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(buf[0], 'q');
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
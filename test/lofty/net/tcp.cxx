@@ -0,0 +1,445 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/net/tcp.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <netinet/in.h> // htonl() htons() INADDR_LOOPBACK IPPROTO_TCP sockaddr_in
+   #include <netinet/tcp.h> // TCP_*
+   #include <sys/resource.h> // getrlimit() rlimit setrlimit()
+   #include <sys/socket.h> // connect() getsockopt() linger send() socket() SO_*
+   #include <unistd.h> // dup()
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_tcp_connect,
+   "lofty::net::tcp::connect() – connecting to a server and exchanging data"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+   net::ip::address loopback(loopback_raw);
+   // Pick a port unlikely to be in use by anything else, including other instances of this test.
+   net::ip::port port(static_cast<net::ip::port::number_type>(20000 + this_process::id() % 10000));
+   net::tcp::server server(loopback, port);
+   // Connecting only requires space in the backlog, so this won’t block even though nobody is accepting yet.
+   auto client_conn(net::tcp::connect(loopback, port));
+   auto server_conn(server.accept());
+   LOFTY_TESTING_ASSERT_EQUAL(client_conn->remote_port().number(), port.number());
+   LOFTY_TESTING_ASSERT_EQUAL(server_conn->local_port().number(), port.number());
+   LOFTY_TESTING_ASSERT_EQUAL(server_conn->remote_port().number(), client_conn->local_port().number());
+
+   static char const data[] = "tcp";
+   char buf[16];
+   client_conn->socket()->write(data, sizeof data);
+   LOFTY_TESTING_ASSERT_EQUAL(server_conn->socket()->read(buf, sizeof buf), sizeof data);
+   LOFTY_TESTING_ASSERT_EQUAL(buf[0], 't');
+   client_conn->socket()->finalize();
+   server_conn->socket()->finalize();
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_tcp_connection_pool,
+   "lofty::net::tcp::connection_pool – reuse, parked checkouts, liveness check and idle eviction"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   coroutine([this] () {
+      static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+      net::ip::address loopback(loopback_raw);
+      net::ip::port port(static_cast<net::ip::port::number_type>(20000 + (this_process::id() + 1) % 10000));
+      net::tcp::server server(loopback, port);
+      /* At most one connection to the server, closed after 200 ms of inactivity; that’s much longer than the
+      steps below take before the test waits for the idle timeout at the end. */
+      net::tcp::connection_pool pool(1, 200);
+      /* Lets the other coroutines run until the condition is met, rather than for a fixed time; gives up
+      after a while instead of hanging, leaving it to the assertions to catch that. */
+      auto wait_until = [] (_std::function<bool ()> const & cond) {
+         for (unsigned i = 0; !cond() && i < 5000; ++i) {
+            this_coroutine::sleep_for_ms(1);
+         }
+      };
+
+      auto lease1(pool.checkout(loopback, port));
+      LOFTY_TESTING_ASSERT_FALSE(lease1.reused());
+      auto server_conn1(server.accept());
+      auto conn1 = lease1.get().get();
+      lease1.release();
+      net::tcp::connection * waiter_conn = nullptr;
+      bool waiter_done = false;
+      {
+         auto lease2(pool.checkout(loopback, port));
+         LOFTY_TESTING_ASSERT_TRUE(lease2.reused());
+         LOFTY_TESTING_ASSERT_TRUE(lease2.get().get() == conn1);
+         // This checkout will have to wait for lease2 to be released.
+         coroutine([&pool, &loopback, &port, &waiter_conn, &waiter_done] () {
+            auto lease3(pool.checkout(loopback, port));
+            waiter_conn = lease3.get().get();
+            lease3.release();
+            waiter_done = true;
+         });
+         wait_until([&pool] () {
+            return pool.counters().waits > 0;
+         });
+         LOFTY_TESTING_ASSERT_TRUE(waiter_conn == nullptr);
+         lease2.release();
+      }
+      wait_until([&waiter_done] () {
+         return waiter_done;
+      });
+      LOFTY_TESTING_ASSERT_TRUE(waiter_conn == conn1);
+
+      /* Have the server close the idle connection: the next checkout will need a new one. Reading from the
+      idle connection returns once the client end has seen it closed. */
+      server_conn1->socket()->finalize();
+      char eof_buf[1];
+      LOFTY_TESTING_ASSERT_EQUAL(conn1->socket()->read(eof_buf, sizeof eof_buf), 0u);
+      auto lease4(pool.checkout(loopback, port));
+      LOFTY_TESTING_ASSERT_FALSE(lease4.reused());
+      auto server_conn2(server.accept());
+      lease4.release();
+      // Let the idle timeout expire.
+      wait_until([&pool] () {
+         return pool.counters().idle_evictions > 0;
+      });
+      auto counters(pool.counters());
+      LOFTY_TESTING_ASSERT_EQUAL(counters.connects, 2u);
+      LOFTY_TESTING_ASSERT_EQUAL(counters.reuses, 2u);
+      LOFTY_TESTING_ASSERT_EQUAL(counters.waits, 1u);
+      LOFTY_TESTING_ASSERT_EQUAL(counters.dead_evictions, 1u);
+      LOFTY_TESTING_ASSERT_EQUAL(counters.idle_evictions, 1u);
+      server_conn2->socket()->finalize();
+   });
+   this_thread::run_coroutines();
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_tcp_sharded_server,
+   "lofty::net::tcp::sharded_server – serving connections on 2 shards, and interrupt() from another thread"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+   net::ip::address loopback(loopback_raw);
+   net::ip::port port(static_cast<net::ip::port::number_type>(20000 + (this_process::id() + 2) % 10000));
+   net::tcp::sharded_server server(loopback, port, 2);
+   LOFTY_TESTING_ASSERT_EQUAL(server.shards_count(), 2u);
+
+   _std::atomic<unsigned> handled(0);
+   thread client_thread([&server, &loopback, &port, &handled] () {
+      static char const data[] = "x";
+      auto client_conn1(net::tcp::connect(loopback, port));
+      auto client_conn2(net::tcp::connect(loopback, port));
+      client_conn1->socket()->write(data, 1);
+      client_conn2->socket()->write(data, 1);
+      // Give up after a while, rather than hang; the assertions below will catch that.
+      for (unsigned i = 0; handled.load() < 2 && i < 5000; ++i) {
+         this_thread::sleep_for_ms(1);
+      }
+      // Both handlers are now blocked reading from their connections; this has to stop them as well.
+      server.interrupt();
+      client_conn1->socket()->finalize();
+      client_conn2->socket()->finalize();
+   });
+   bool interrupted = false;
+   try {
+      server.run([&handled] (_std::shared_ptr<net::tcp::connection> conn) {
+         char buf[1];
+         auto socket(conn->socket());
+         try {
+            socket->read(buf, sizeof buf);
+            ++handled;
+            // The client never sends any more data, so this can only end by interruption.
+            socket->read(buf, sizeof buf);
+         } catch (...) {
+            socket->finalize();
+            throw;
+         }
+      });
+   } catch (execution_interruption const &) {
+      interrupted = true;
+   }
+   client_thread.join();
+   LOFTY_TESTING_ASSERT_TRUE(interrupted);
+   LOFTY_TESTING_ASSERT_EQUAL(handled.load(), 2u);
+   LOFTY_TESTING_ASSERT_EQUAL(server.counters().accepted, 2u);
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_tcp_server_accept_batch,
+   "lofty::net::tcp::server – batched accept, counters and lazily-created connection streams"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   coroutine([this] () {
+      static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+      net::ip::address loopback(loopback_raw);
+      net::ip::port port(static_cast<net::ip::port::number_type>(20000 + (this_process::id() + 5) % 10000));
+      // Room for exactly 3 pending connections, since the backlog is full only when it exceeds its size.
+      net::tcp::server server(loopback, port, 2);
+      auto client_conn1(net::tcp::connect(loopback, port));
+      auto client_conn2(net::tcp::connect(loopback, port));
+      auto client_conn3(net::tcp::connect(loopback, port));
+
+      collections::vector<_std::shared_ptr<net::tcp::connection>> conns;
+      // All three connections are pending, but only two will fit in this batch.
+      LOFTY_TESTING_ASSERT_EQUAL(server.accept_batch(&conns, 2), 2u);
+      LOFTY_TESTING_ASSERT_EQUAL(conns.size(), 2u);
+      LOFTY_TESTING_ASSERT_EQUAL(server.accept_batch(&conns, 2), 1u);
+      LOFTY_TESTING_ASSERT_EQUAL(conns.size(), 3u);
+      auto counters(server.counters());
+      LOFTY_TESTING_ASSERT_EQUAL(counters.accepted, 3u);
+      LOFTY_TESTING_ASSERT_EQUAL(counters.rejected, 0u);
+#if LOFTY_HOST_API_LINUX
+      // Only the first batch found the backlog full.
+      LOFTY_TESTING_ASSERT_EQUAL(counters.backlog_full_samples, 1u);
+#endif
+
+      // The local address and the socket are only created when first requested.
+      auto & server_conn = conns[0];
+      LOFTY_TESTING_ASSERT_EQUAL(to_str(server_conn->local_address()), LOFTY_SL("127.0.0.1"));
+      LOFTY_TESTING_ASSERT_EQUAL(server_conn->local_port().number(), port.number());
+      LOFTY_TESTING_ASSERT_EQUAL(server_conn->remote_port().number(), client_conn1->local_port().number());
+      static char const data[] = "batch";
+      char buf[16];
+      server_conn->socket()->write(data, sizeof data);
+      LOFTY_TESTING_ASSERT_EQUAL(client_conn1->socket()->read(buf, sizeof buf), sizeof data);
+      LOFTY_TESTING_ASSERT_EQUAL(buf[0], 'b');
+      // The socket is created once, and then reused.
+      LOFTY_TESTING_ASSERT_TRUE(server_conn->socket() == server_conn->socket());
+
+      LOFTY_FOR_EACH(auto & conn, conns) {
+         conn->socket()->finalize();
+      }
+      client_conn1->socket()->finalize();
+      client_conn2->socket()->finalize();
+      client_conn3->socket()->finalize();
+   });
+   this_thread::run_coroutines();
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+}
+
+}} //namespace lofty::test
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if LOFTY_HOST_API_POSIX
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_tcp_socket_options,
+   "lofty::net::tcp::socket_options – applying options to a loopback socket, and to accepted sockets"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+   net::ip::address loopback(loopback_raw);
+   net::ip::port port(static_cast<net::ip::port::number_type>(20000 + (this_process::id() + 3) % 10000));
+   net::tcp::server server(loopback, port);
+
+   {
+      io::filedesc fd(::socket(AF_INET, SOCK_STREAM, 0));
+      ::sockaddr_in sa;
+      memory::clear(&sa);
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(port.number());
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      LOFTY_TESTING_ASSERT_EQUAL(::connect(fd.get(), reinterpret_cast< ::sockaddr *>(&sa), sizeof sa), 0);
+      net::tcp::socket_options().set_no_delay(true).set_keep_alive(true).set_linger(true, 5)
+         .set_receive_buffer_size(0x10000).apply(fd.get());
+
+      int value;
+      ::socklen_t value_size = sizeof value;
+      ::getsockopt(fd.get(), IPPROTO_TCP, TCP_NODELAY, &value, &value_size);
+      LOFTY_TESTING_ASSERT_NOT_EQUAL(value, 0);
+      value_size = sizeof value;
+      ::getsockopt(fd.get(), SOL_SOCKET, SO_KEEPALIVE, &value, &value_size);
+      LOFTY_TESTING_ASSERT_NOT_EQUAL(value, 0);
+      value_size = sizeof value;
+      ::getsockopt(fd.get(), SOL_SOCKET, SO_RCVBUF, &value, &value_size);
+      // The OS may round the size up (Linux doubles it), but never down.
+      LOFTY_TESTING_ASSERT_GREATER_EQUAL(value, 0x10000);
+      ::linger l;
+      ::socklen_t l_size = sizeof l;
+      ::getsockopt(fd.get(), SOL_SOCKET, SO_LINGER, &l, &l_size);
+      LOFTY_TESTING_ASSERT_NOT_EQUAL(l.l_onoff, 0);
+      LOFTY_TESTING_ASSERT_EQUAL(l.l_linger, 5);
+      // Don’t leave this connection in the backlog for the checks below.
+      server.accept()->socket()->finalize();
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(server.counters().accepted, 1u);
+
+#if LOFTY_HOST_API_LINUX
+   coroutine([this, &loopback] () {
+      // Create a server with a non-blocking socket, so that accept() can wait without blocking the thread.
+      net::ip::port port(static_cast<net::ip::port::number_type>(20000 + (this_process::id() + 4) % 10000));
+      net::tcp::server server(loopback, port);
+      // TCP_FASTOPEN can’t be set on an established socket, so the first connection will be rejected.
+      server.set_accepted_options(net::tcp::socket_options().set_fast_open(5));
+      auto client_conn1(net::tcp::connect(loopback, port));
+      coroutine([&server, &loopback, &port] () {
+         // Give accept() the time to reject client_conn1, then let it accept another connection.
+         this_coroutine::sleep_for_ms(20);
+         server.set_accepted_options(net::tcp::socket_options().set_no_delay(true));
+         auto client_conn2(net::tcp::connect(loopback, port));
+         this_coroutine::sleep_for_ms(20);
+         client_conn2->socket()->finalize();
+      });
+      auto server_conn(server.accept());
+      auto counters(server.counters());
+      LOFTY_TESTING_ASSERT_EQUAL(counters.accepted, 1u);
+      LOFTY_TESTING_ASSERT_EQUAL(counters.rejected, 1u);
+      server_conn->socket()->finalize();
+      client_conn1->socket()->finalize();
+   });
+   this_thread::run_coroutines();
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+#endif
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_tcp_sharded_server_out_of_fds,
+   "lofty::net::tcp::sharded_server – running out of file descriptors while accepting"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static net::ip::address::v4_type const loopback_raw = { 127, 0, 0, 1 };
+   net::ip::address loopback(loopback_raw);
+   net::ip::port port(static_cast<net::ip::port::number_type>(20000 + (this_process::id() + 6) % 10000));
+   net::tcp::sharded_server server(loopback, port, 1);
+
+   _std::atomic<unsigned> handled(0);
+   _std::atomic<std::uint64_t> rejected_out_of_fds(0);
+   thread client_thread([&server, &loopback, &port, &handled, &rejected_out_of_fds] () {
+      // Give up waiting after a while, rather than hang; the assertions below will catch that.
+      auto wait_for = [] (_std::function<bool ()> const & cond) {
+         for (unsigned i = 0; !cond() && i < 5000; ++i) {
+            this_thread::sleep_for_ms(1);
+         }
+      };
+      auto client_conn1(net::tcp::connect(loopback, port));
+      client_conn1->socket()->write("1", 1);
+      wait_for([&handled] () {
+         return handled.load() >= 1;
+      });
+
+      // Create the second client’s socket now: soon there won’t be any file descriptors left.
+      io::filedesc client_fd(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+      ::rlimit orig_limit;
+      ::getrlimit(RLIMIT_NOFILE, &orig_limit);
+      ::rlimit limit(orig_limit);
+      limit.rlim_cur = static_cast< ::rlim_t>(client_fd.get() + 16);
+      ::setrlimit(RLIMIT_NOFILE, &limit);
+      collections::vector<io::filedesc> hog_fds;
+      for (int fd; (fd = ::dup(client_fd.get())) >= 0; ) {
+         hog_fds.push_back(io::filedesc(fd));
+      }
+      ::sockaddr_in sa;
+      memory::clear(&sa);
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(port.number());
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      ::connect(client_fd.get(), reinterpret_cast< ::sockaddr *>(&sa), sizeof sa);
+      // The shard won’t be able to accept the connection, which will stay in the backlog.
+      wait_for([&server] () {
+         return server.counters().rejected > 0;
+      });
+      rejected_out_of_fds = server.counters().rejected;
+      hog_fds.clear();
+      ::setrlimit(RLIMIT_NOFILE, &orig_limit);
+
+      // Now the shard must be able to accept and serve the connection.
+      ::send(client_fd.get(), "2", 1, 0);
+      wait_for([&handled] () {
+         return handled.load() >= 2;
+      });
+      server.interrupt();
+      client_conn1->socket()->finalize();
+   });
+   bool interrupted = false;
+   try {
+      server.run([&handled] (_std::shared_ptr<net::tcp::connection> conn) {
+         // Make the shard set up its timer while file descriptors are available; it will need it later.
+         this_coroutine::sleep_for_ms(1);
+         char buf[1];
+         auto socket(conn->socket());
+         try {
+            socket->read(buf, sizeof buf);
+         } catch (...) {
+            socket->finalize();
+            throw;
+         }
+         ++handled;
+         socket->finalize();
+      });
+   } catch (execution_interruption const &) {
+      interrupted = true;
+   }
+   client_thread.join();
+   LOFTY_TESTING_ASSERT_TRUE(interrupted);
+   LOFTY_TESTING_ASSERT_GREATER(rejected_out_of_fds.load(), 0u);
+   LOFTY_TESTING_ASSERT_EQUAL(handled.load(), 2u);
+   LOFTY_TESTING_ASSERT_EQUAL(server.counters().accepted, 2u);
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
@@ -0,0 +1,102 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/net/ip.hxx>
+#include <lofty/net/udp.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/to_str.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   net_udp_socket_batch,
+   "lofty::net::udp::socket – single and batched loopback datagrams"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static std::uint8_t const loopback_bytes[] = { 127, 0, 0, 1 };
+   net::ip::address loopback(loopback_bytes);
+   net::udp::socket receiver(loopback, net::ip::port(0));
+   net::udp::socket sender(net::ip::version::v4);
+   auto receiver_port(receiver.local_port());
+   LOFTY_TESTING_ASSERT_NOT_EQUAL(receiver_port.number(), 0u);
+
+   {
+      static char const data[] = "single";
+      sender.send(data, sizeof data, loopback, receiver_port);
+      char buf[16];
+      net::ip::address src_address;
+      net::ip::port src_port;
+      LOFTY_TESTING_ASSERT_EQUAL(receiver.receive(buf, sizeof buf, &src_address, &src_port), sizeof data);
+      LOFTY_TESTING_ASSERT_EQUAL(to_str(src_address), LOFTY_SL("127.0.0.1"));
+      LOFTY_TESTING_ASSERT_EQUAL(src_port.number(), sender.local_port().number());
+      std::size_t errors = 0;
+      for (std::size_t i = 0; i < sizeof data; ++i) {
+         if (buf[i] != data[i]) {
+            ++errors;
+         }
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(errors, 0u);
+   }
+
+   static std::size_t const datagrams_count = 5;
+   net::udp::datagram_batch send_batch(datagrams_count, 64), receive_batch(datagrams_count * 2, 64);
+   for (std::size_t i = 0; i < datagrams_count; ++i) {
+      auto buf = send_batch.push_back(i + 1, loopback, receiver_port);
+      for (std::size_t j = 0; j <= i; ++j) {
+         buf[j] = static_cast<std::uint8_t>(i);
+      }
+   }
+   LOFTY_TESTING_ASSERT_THROWS(argument_error, send_batch.push_back(1, loopback, receiver_port));
+   sender.send_batch(send_batch);
+
+   // All the datagrams are already queued, so they should be received with a single call.
+   LOFTY_TESTING_ASSERT_EQUAL(receiver.receive_batch(&receive_batch), datagrams_count);
+   std::size_t errors = 0;
+   for (std::size_t i = 0; i < datagrams_count; ++i) {
+      if (
+         receive_batch.data_size(i) != i + 1 || receive_batch.truncated(i) ||
+         receive_batch.port(i).number() != sender.local_port().number()
+      ) {
+         ++errors;
+      } else {
+         for (std::size_t j = 0; j <= i; ++j) {
+            if (receive_batch.data(i)[j] != static_cast<std::uint8_t>(i)) {
+               ++errors;
+            }
+         }
+      }
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(errors, 0u);
+
+   // A datagram larger than the batch’s buffers is truncated, and reported as such.
+   {
+      std::uint8_t oversized[100];
+      memory::clear(oversized, sizeof oversized);
+      sender.send(oversized, sizeof oversized, loopback, receiver_port);
+      LOFTY_TESTING_ASSERT_EQUAL(receiver.receive_batch(&receive_batch), 1u);
+      LOFTY_TESTING_ASSERT_TRUE(receive_batch.truncated(0));
+      LOFTY_TESTING_ASSERT_EQUAL(receive_batch.data_size(0), receive_batch.datagram_max_size());
+   }
+}
+
+}} //namespace lofty::test
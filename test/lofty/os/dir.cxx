@@ -0,0 +1,293 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/os/dir.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_POSIX
+   #include <fcntl.h> // open()
+   #include <sys/stat.h> // mkdir()
+   #include <unistd.h> // close() rmdir() symlink() unlink()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+//! Count of subdirectories in the root of the test tree, each of which has the same count of subdirectories.
+static unsigned const dir_test_subdirs = 3;
+//! Count of files in each subdirectory of the test tree.
+static unsigned const dir_test_files = 5;
+
+/*! Returns a name made of a prefix and a number.
+
+@param prefix
+   Prefix.
+@param i
+   Number.
+@return
+   Name.
+*/
+static str dir_test_name(char_t const * prefix, unsigned i) {
+   return str(external_buffer, prefix) + to_str(i);
+}
+
+/*! Creates or removes a tree of directories for dir_walker tests:
+   root/f0, root/f1, root/link → d0
+   root/d<i>/f<j>
+   root/d<i>/s<k>/f<j>
+
+@param root
+   Root of the tree.
+@param create
+   If true, the tree will be created; if false, it will be removed.
+*/
+static void dir_test_tree(os::path const & root, bool create) {
+   if (create) {
+      ::mkdir(root.os_str().c_str(), 0755);
+      ::symlink("d0", (root / LOFTY_SL("link")).os_str().c_str());
+   }
+   for (unsigned i = 0; i < 2; ++i) {
+      os::path file(root / dir_test_name(LOFTY_SL("f"), i));
+      if (create) {
+         ::close(::open(file.os_str().c_str(), O_WRONLY | O_CREAT, 0644));
+      } else {
+         ::unlink(file.os_str().c_str());
+      }
+   }
+   for (unsigned i = 0; i <= dir_test_subdirs; ++i) {
+      os::path dir(root / dir_test_name(LOFTY_SL("d"), i));
+      if (create) {
+         ::mkdir(dir.os_str().c_str(), 0755);
+      }
+      for (unsigned k = 0; k <= dir_test_subdirs; ++k) {
+         // k == dir_test_subdirs stands for dir itself.
+         os::path subdir(k < dir_test_subdirs ? dir / dir_test_name(LOFTY_SL("s"), k) : dir);
+         if (create && k < dir_test_subdirs) {
+            ::mkdir(subdir.os_str().c_str(), 0755);
+         }
+         for (unsigned j = 0; j < dir_test_files; ++j) {
+            os::path file(subdir / dir_test_name(LOFTY_SL("f"), j));
+            if (create) {
+               ::close(::open(file.os_str().c_str(), O_WRONLY | O_CREAT, 0644));
+            } else {
+               ::unlink(file.os_str().c_str());
+            }
+         }
+         if (!create && k < dir_test_subdirs) {
+            ::rmdir(subdir.os_str().c_str());
+         }
+      }
+      if (!create) {
+         ::rmdir(dir.os_str().c_str());
+      }
+   }
+   if (!create) {
+      ::unlink((root / LOFTY_SL("link")).os_str().c_str());
+      ::rmdir(root.os_str().c_str());
+   }
+}
+
+//! Entry counts collected by walking the test tree.
+struct dir_test_counts {
+   //! Governs access to the counters.
+   _std::mutex mtx;
+   //! Count of directories.
+   unsigned dirs;
+   //! Count of regular files.
+   unsigned files;
+   //! Count of symbolic links.
+   unsigned symlinks;
+   //! Sum of the depths of all entries.
+   unsigned depths;
+   //! true if a known deep file was reported with the expected relative path.
+   bool deep_file_found;
+
+   //! Default constructor.
+   dir_test_counts() :
+      dirs(0),
+      files(0),
+      symlinks(0),
+      depths(0),
+      deep_file_found(false) {
+   }
+
+   /*! Walks a tree, counting its entries.
+
+   @param walker
+      Walker to use.
+   @param root
+      Root of the tree.
+   */
+   void walk(os::dir_walker const & walker, os::path const & root) {
+      walker.walk(root, [this] (os::dir_entry const & entry) {
+         _std::lock_guard<_std::mutex> lock(mtx);
+         switch (entry.type().base()) {
+            case os::dir_entry_type::dir:
+               ++dirs;
+               break;
+            case os::dir_entry_type::regular_file:
+               ++files;
+               break;
+            case os::dir_entry_type::symlink:
+               ++symlinks;
+               break;
+            default:
+               break;
+         }
+         depths += entry.depth();
+         if (entry.rel_path() == LOFTY_SL("d1/s2/f3")) {
+            deep_file_found = entry.depth() == 2 && entry.name() == LOFTY_SL("f3");
+         }
+      });
+   }
+};
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   os_dir_iterator,
+   "lofty::os::dir_iterator – enumeration of a directory"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str root_str(LOFTY_SL("/tmp/lofty-test-os-dir_iterator-"));
+   root_str += to_str(this_process::id());
+   os::path root(root_str);
+   dir_test_tree(root, true);
+   LOFTY_DEFER_TO_SCOPE_END(dir_test_tree(root, false));
+
+   unsigned dirs = 0, files = 0, symlinks = 0, others = 0;
+   for (os::dir_iterator itr(root); itr; ++itr) {
+      switch (itr->type().base()) {
+         case os::dir_entry_type::dir:
+            ++dirs;
+            break;
+         case os::dir_entry_type::regular_file:
+            ++files;
+            break;
+         case os::dir_entry_type::symlink:
+            LOFTY_TESTING_ASSERT_EQUAL(itr->name(), LOFTY_SL("link"));
+            ++symlinks;
+            break;
+         default:
+            ++others;
+            break;
+      }
+      LOFTY_TESTING_ASSERT_EQUAL(itr->rel_path(), itr->name());
+      LOFTY_TESTING_ASSERT_EQUAL(itr->depth(), 0u);
+      LOFTY_TESTING_ASSERT_EQUAL(itr->dir_fd(), itr.fd());
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(dirs, dir_test_subdirs + 1);
+   LOFTY_TESTING_ASSERT_EQUAL(files, 2u);
+   LOFTY_TESTING_ASSERT_EQUAL(symlinks, 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(others, 0u);
+
+   // Open a subdirectory relative to the root.
+   os::dir_iterator root_itr(root);
+   files = 0;
+   for (os::dir_iterator itr(root_itr.fd(), LOFTY_SL("d2")); itr; ++itr) {
+      if (itr->type() == os::dir_entry_type::regular_file) {
+         ++files;
+      }
+   }
+   LOFTY_TESTING_ASSERT_EQUAL(files, dir_test_files);
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   os_dir_walker,
+   "lofty::os::dir_walker – recursive enumeration"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str root_str(LOFTY_SL("/tmp/lofty-test-os-dir_walker-"));
+   root_str += to_str(this_process::id());
+   os::path root(root_str);
+   dir_test_tree(root, true);
+   LOFTY_DEFER_TO_SCOPE_END(dir_test_tree(root, false));
+
+   unsigned const all_dirs = (dir_test_subdirs + 1) * (1 + dir_test_subdirs);
+   unsigned const all_files = 2 + (dir_test_subdirs + 1) * (1 + dir_test_subdirs) * dir_test_files;
+   unsigned const all_depths = (dir_test_subdirs + 1) * (
+      // Entries in d<i>, then entries in d<i>/s<k>.
+      (dir_test_subdirs + dir_test_files) + dir_test_subdirs * dir_test_files * 2
+   );
+   for (unsigned threads = 1; threads <= 4; threads += 3) {
+      dir_test_counts counts;
+      counts.walk(os::dir_walker().set_threads(threads), root);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.dirs, all_dirs);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.files, all_files);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.symlinks, 1u);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.depths, all_depths);
+      LOFTY_TESTING_ASSERT_TRUE(counts.deep_file_found);
+   }
+
+   // Filter out a subtree.
+   {
+      dir_test_counts counts;
+      counts.walk(os::dir_walker().set_filter([] (os::dir_entry const & entry) -> bool {
+         return entry.name() != LOFTY_SL("d0");
+      }), root);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.dirs, all_dirs - (1 + dir_test_subdirs));
+      LOFTY_TESTING_ASSERT_EQUAL(counts.files, all_files - (1 + dir_test_subdirs) * dir_test_files);
+   }
+
+   // Limit the depth.
+   {
+      dir_test_counts counts;
+      counts.walk(os::dir_walker().set_max_depth(0), root);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.dirs, dir_test_subdirs + 1);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.files, 2u);
+      LOFTY_TESTING_ASSERT_EQUAL(counts.depths, 0u);
+      LOFTY_TESTING_ASSERT_TRUE(!counts.deep_file_found);
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   os_dir_walker_visit_throws,
+   "lofty::os::dir_walker – exceptions thrown by the visit function during a parallel walk"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str root_str(LOFTY_SL("/tmp/lofty-test-os-dir_walker-throw-"));
+   root_str += to_str(this_process::id());
+   os::path root(root_str);
+   dir_test_tree(root, true);
+   LOFTY_DEFER_TO_SCOPE_END(dir_test_tree(root, false));
+
+   /* Subdirectories are handed to the other threads, so they will all throw; the first exception must reach
+   the caller, instead of terminating the process. */
+   _std::atomic<unsigned> thrown(0);
+   LOFTY_TESTING_ASSERT_THROWS(argument_error,
+      os::dir_walker().set_threads(4).walk(root, [&thrown] (os::dir_entry const & entry) {
+         if (entry.depth() > 0) {
+            thrown.fetch_add(1);
+            LOFTY_THROW(argument_error, ());
+         }
+      })
+   );
+   LOFTY_TESTING_ASSERT_GREATER(thrown.load(), 0u);
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_POSIX
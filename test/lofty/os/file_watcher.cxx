@@ -0,0 +1,144 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/collections/vector.hxx>
+#include <lofty/coroutine.hxx>
+#include <lofty/defer_to_scope_end.hxx>
+#include <lofty/io/binary.hxx>
+#include <lofty/os/file_watcher.hxx>
+#include <lofty/os/path.hxx>
+#include <lofty/process.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/thread.hxx>
+#include <lofty/to_str.hxx>
+
+#if LOFTY_HOST_API_LINUX
+   #include <sys/stat.h> // mkdir()
+   #include <unistd.h> // rmdir() unlink()
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+/*! Creates a file, writing to it twice.
+
+@param file_path
+   Path to the file.
+*/
+static void file_watcher_test_write(os::path const & file_path) {
+   std::int8_t const data[] = { 1, 2, 3 };
+   auto file_ostream(io::binary::open_ostream(file_path));
+   file_ostream->write(data, sizeof data);
+   file_ostream->write(data, sizeof data);
+   file_ostream->finalize();
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   os_file_watcher,
+   "lofty::os::file_watcher – reporting and coalescing of changes"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str dir_path_str(LOFTY_SL("/tmp/lofty-test-os-file_watcher-"));
+   dir_path_str += to_str(this_process::id());
+   os::path dir_path(dir_path_str), file_path(dir_path / LOFTY_SL("file"));
+   ::mkdir(dir_path.os_str().c_str(), 0755);
+   LOFTY_DEFER_TO_SCOPE_END(::rmdir(dir_path.os_str().c_str()));
+
+   os::file_watcher watcher;
+   auto watch_id = watcher.add(dir_path);
+   collections::vector<os::file_watcher::event> events;
+
+   // Creating and writing to a file generates several changes, which are coalesced.
+   file_watcher_test_write(file_path);
+   LOFTY_TESTING_ASSERT_EQUAL(watcher.wait(&events), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].watch_id, watch_id);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].name, LOFTY_SL("file"));
+   unsigned const written_changes = os::file_watcher::change_created | os::file_watcher::change_modified |
+      os::file_watcher::change_written;
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].changes & written_changes, written_changes);
+
+   ::unlink(file_path.os_str().c_str());
+   events.clear();
+   LOFTY_TESTING_ASSERT_EQUAL(watcher.wait(&events), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].changes, unsigned(os::file_watcher::change_deleted));
+
+   // Changes to different entries are reported separately, each coalesced with its own.
+   os::path file2_path(dir_path / LOFTY_SL("file2"));
+   file_watcher_test_write(file_path);
+   file_watcher_test_write(file2_path);
+   file_watcher_test_write(file_path);
+   ::unlink(file_path.os_str().c_str());
+   ::unlink(file2_path.os_str().c_str());
+   events.clear();
+   LOFTY_TESTING_ASSERT_EQUAL(watcher.wait(&events), 2u);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].name, LOFTY_SL("file"));
+   LOFTY_TESTING_ASSERT_EQUAL(events[1].name, LOFTY_SL("file2"));
+   unsigned const rewritten_changes = written_changes | os::file_watcher::change_deleted;
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].changes & rewritten_changes, rewritten_changes);
+   LOFTY_TESTING_ASSERT_EQUAL(events[1].changes & rewritten_changes, rewritten_changes);
+
+   watcher.remove(watch_id);
+   events.clear();
+   LOFTY_TESTING_ASSERT_EQUAL(watcher.wait(&events), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].watch_id, watch_id);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].changes, unsigned(os::file_watcher::change_unwatched));
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   os_file_watcher_coroutine,
+   "lofty::os::file_watcher – waiting from a coroutine"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   str dir_path_str(LOFTY_SL("/tmp/lofty-test-os-file_watcher_coroutine-"));
+   dir_path_str += to_str(this_process::id());
+   os::path dir_path(dir_path_str), file_path(dir_path / LOFTY_SL("file"));
+   ::mkdir(dir_path.os_str().c_str(), 0755);
+   LOFTY_DEFER_TO_SCOPE_END(::rmdir(dir_path.os_str().c_str()));
+   LOFTY_DEFER_TO_SCOPE_END(::unlink(file_path.os_str().c_str()));
+
+   os::file_watcher watcher;
+   watcher.add(dir_path, os::file_watcher::change_written);
+   bool written = false, written_before_event = false;
+   collections::vector<os::file_watcher::event> events;
+   coroutine watcher_coro([&] () {
+      watcher.wait(&events);
+      written_before_event = written;
+   });
+   // This can only run if watcher_coro doesn’t block the thread while waiting.
+   coroutine writer_coro([&] () {
+      this_coroutine::sleep_for_ms(10);
+      file_watcher_test_write(file_path);
+      written = true;
+   });
+   this_thread::run_coroutines();
+
+   LOFTY_TESTING_ASSERT_TRUE(written_before_event);
+   LOFTY_TESTING_ASSERT_EQUAL(events.size(), 1u);
+   LOFTY_TESTING_ASSERT_EQUAL(events[0].changes, unsigned(os::file_watcher::change_written));
+
+   // Avoid running other tests with a coroutine scheduler, as it might change their behavior.
+   this_thread::detach_coroutine_scheduler();
+}
+
+}} //namespace lofty::test
+
+#endif //if LOFTY_HOST_API_LINUX
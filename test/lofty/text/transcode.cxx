@@ -0,0 +1,281 @@
+﻿/* -*- coding: utf-8; mode: c++; tab-width: 3; indent-tabs-mode: nil -*-
+
+Copyright 2017 Raffaello D. Di Napoli
+
+This file is part of Lofty.
+
+Lofty is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General
+Public License as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+Lofty is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License along with Lofty. If not, see
+<http://www.gnu.org/licenses/>.
+------------------------------------------------------------------------------------------------------------*/
+
+#include <lofty.hxx>
+#include <lofty/collections/vector.hxx>
+#include <lofty/testing/test_case.hxx>
+#include <lofty/text.hxx>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace lofty { namespace test {
+
+//! Bytes of encoded text.
+typedef collections::vector<std::uint8_t> transcode_test_bytes;
+
+/*! Appends the encoded form of a code point, without relying on lofty::text.
+
+@param bytes
+   Pointer to the bytes to append to.
+@param enc
+   Encoding to use.
+@param cp
+   Code point to encode.
+*/
+static void append_transcode_test_codepoint(transcode_test_bytes * bytes, text::encoding enc, char32_t cp) {
+   std::uint8_t seq[4];
+   std::size_t seq_size;
+   switch (enc.base()) {
+      case text::encoding::utf8:
+         if (cp < 0x80) {
+            seq[0] = static_cast<std::uint8_t>(cp);
+            seq_size = 1;
+         } else if (cp < 0x800) {
+            seq[0] = static_cast<std::uint8_t>(0xc0 | (cp >> 6));
+            seq_size = 2;
+         } else if (cp < 0x10000) {
+            seq[0] = static_cast<std::uint8_t>(0xe0 | (cp >> 12));
+            seq_size = 3;
+         } else {
+            seq[0] = static_cast<std::uint8_t>(0xf0 | (cp >> 18));
+            seq_size = 4;
+         }
+         for (std::size_t i = 1; i < seq_size; ++i) {
+            seq[i] = static_cast<std::uint8_t>(0x80 | ((cp >> ((seq_size - 1 - i) * 6)) & 0x3f));
+         }
+         break;
+      case text::encoding::utf16le:
+      case text::encoding::utf16be: {
+         char32_t units[2];
+         if (cp >= 0x10000) {
+            units[0] = 0xd800 | ((cp - 0x10000) >> 10);
+            units[1] = 0xdc00 | ((cp - 0x10000) & 0x3ff);
+            seq_size = 4;
+         } else {
+            units[0] = cp;
+            seq_size = 2;
+         }
+         bool big_endian = enc == text::encoding::utf16be;
+         for (std::size_t i = 0; i < seq_size; ++i) {
+            std::size_t shift = ((i & 1) ^ (big_endian ? 1u : 0u)) * 8;
+            seq[i] = static_cast<std::uint8_t>(units[i >> 1] >> shift);
+         }
+         break;
+      }
+      case text::encoding::utf32le:
+      case text::encoding::utf32be: {
+         bool big_endian = enc == text::encoding::utf32be;
+         for (std::size_t i = 0; i < 4; ++i) {
+            seq[i] = static_cast<std::uint8_t>(cp >> ((big_endian ? 3 - i : i) * 8));
+         }
+         seq_size = 4;
+         break;
+      }
+      default:
+         seq[0] = static_cast<std::uint8_t>(cp);
+         seq_size = 1;
+         break;
+   }
+   bytes->push_back(seq, seq_size);
+}
+
+/*! Generates text mixing ASCII runs of every length up to 70, which cover every SIMD block boundary, with
+non-ASCII code points, followed by a long ASCII run.
+
+@param cps
+   Pointer to the vector that will receive the code points.
+@param latin1_only
+   If true, only code points representable in ISO-8859-1 will be generated.
+*/
+static void make_transcode_test_codepoints(collections::vector<char32_t> * cps, bool latin1_only) {
+   static char32_t const non_ascii[] = { 0x00e9, 0x03b1, 0x20ac, 0xfeff, 0x1f600, 0x10ffff, 0x0800, 0x0080 };
+   static char32_t const latin1_non_ascii[] = { 0x00e9, 0x0080, 0x00a0, 0x00ff };
+   for (unsigned i = 0; i < 300; ++i) {
+      unsigned run = (i * 7) % 71;
+      for (unsigned j = 0; j < run; ++j) {
+         cps->push_back(static_cast<char32_t>(0x20 + (i + j) % 0x5f));
+      }
+      cps->push_back(latin1_only ? latin1_non_ascii[i % LOFTY_COUNTOF(latin1_non_ascii)] :
+         non_ascii[i % LOFTY_COUNTOF(non_ascii)]);
+   }
+   for (unsigned i = 0; i < 1000; ++i) {
+      cps->push_back(static_cast<char32_t>('a' + i % 26));
+   }
+}
+
+/*! Transcodes a whole buffer, a few destination bytes at a time.
+
+@param throw_on_errors
+   See text::transcode().
+@param src_enc
+   Source encoding.
+@param src_bytes
+   Source bytes.
+@param dst_enc
+   Destination encoding.
+@param dst_chunk_size
+   Size of the destination buffer passed to each text::transcode() call.
+@param src_left
+   Pointer to a variable that will receive the count of source bytes that could not be transcoded.
+@return
+   Transcoded bytes.
+*/
+static transcode_test_bytes transcode_in_chunks(
+   bool throw_on_errors, text::encoding src_enc, transcode_test_bytes const & src_bytes,
+   text::encoding dst_enc, std::size_t dst_chunk_size, std::size_t * src_left
+) {
+   void const * src = src_bytes.data();
+   std::size_t src_size = src_bytes.size();
+   transcode_test_bytes dst_bytes;
+   while (src_size > 0) {
+      std::size_t used_size = dst_bytes.size();
+      dst_bytes.set_size(used_size + dst_chunk_size);
+      void * dst = dst_bytes.data() + used_size;
+      std::size_t dst_size = dst_chunk_size;
+      std::size_t transcoded_size = text::transcode(
+         throw_on_errors, src_enc, &src, &src_size, dst_enc, &dst, &dst_size
+      );
+      dst_bytes.set_size(used_size + transcoded_size);
+      if (transcoded_size == 0) {
+         break;
+      }
+   }
+   *src_left = src_size;
+   return dst_bytes;
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   text_transcode_pairs,
+   "lofty::text::transcode() – long mixed text in every fast-path pair of encodings"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   static struct {
+      text::encoding::enum_type src_enc;
+      text::encoding::enum_type dst_enc;
+   } const pairs[] = {
+      { text::encoding::utf8,       text::encoding::utf8    },
+      { text::encoding::utf8,       text::encoding::utf16le },
+      { text::encoding::utf8,       text::encoding::utf16be },
+      { text::encoding::utf8,       text::encoding::utf32le },
+      { text::encoding::utf8,       text::encoding::utf32be },
+      { text::encoding::utf16le,    text::encoding::utf8    },
+      { text::encoding::utf16be,    text::encoding::utf8    },
+      { text::encoding::iso_8859_1, text::encoding::utf8    },
+      // Pairs without a fast path, as a control.
+      { text::encoding::utf32le,    text::encoding::utf16be },
+      { text::encoding::utf16be,    text::encoding::utf32le }
+   };
+   for (std::size_t i = 0; i < LOFTY_COUNTOF(pairs); ++i) {
+      text::encoding src_enc(pairs[i].src_enc), dst_enc(pairs[i].dst_enc);
+      collections::vector<char32_t> cps;
+      make_transcode_test_codepoints(&cps, src_enc == text::encoding::iso_8859_1);
+      transcode_test_bytes src_bytes, expected_bytes;
+      for (auto itr(cps.cbegin()); itr != cps.cend(); ++itr) {
+         append_transcode_test_codepoint(&src_bytes, src_enc, *itr);
+         append_transcode_test_codepoint(&expected_bytes, dst_enc, *itr);
+      }
+
+      // Size-only mode.
+      void const * src = src_bytes.data();
+      std::size_t src_size = src_bytes.size();
+      LOFTY_TESTING_ASSERT_EQUAL(
+         text::transcode(true, src_enc, &src, &src_size, dst_enc), expected_bytes.size()
+      );
+
+      /* Destination sizes that are not multiples of any code unit size cause the fast path to stop in the
+      middle of ASCII runs and multi-byte sequences. */
+      static std::size_t const dst_chunk_sizes[] = { 7, 61, 0x10000 };
+      for (std::size_t j = 0; j < LOFTY_COUNTOF(dst_chunk_sizes); ++j) {
+         std::size_t src_left;
+         transcode_test_bytes dst_bytes(transcode_in_chunks(
+            true, src_enc, src_bytes, dst_enc, dst_chunk_sizes[j], &src_left
+         ));
+         LOFTY_TESTING_ASSERT_EQUAL(src_left, 0u);
+         LOFTY_TESTING_ASSERT_TRUE(dst_bytes == expected_bytes);
+      }
+   }
+}
+
+LOFTY_TESTING_TEST_CASE_FUNC(
+   text_transcode_invalid,
+   "lofty::text::transcode() – invalid and incomplete sequences amid ASCII runs"
+) {
+   LOFTY_TRACE_FUNC(this);
+
+   // Each invalid sequence is placed after 40 ASCII characters and followed by 40 more.
+   static std::size_t const ascii_run_size = 40;
+   static struct {
+      text::encoding::enum_type src_enc;
+      std::uint8_t invalid[4];
+      std::size_t invalid_size;
+   } const cases[] = {
+      // Lead byte followed by ASCII.
+      { text::encoding::utf8, { 0xc3 }, 1 },
+      // Lone trail byte.
+      { text::encoding::utf8, { 0x80 }, 1 },
+      // Truncated 3-byte sequence.
+      { text::encoding::utf8, { 0xe2, 0x82 }, 2 },
+      // Lone trail surrogate.
+      { text::encoding::utf16le, { 0x00, 0xdc }, 2 },
+      // Lead surrogate not followed by a trail surrogate.
+      { text::encoding::utf16be, { 0xd8, 0x00 }, 2 }
+   };
+   for (std::size_t i = 0; i < LOFTY_COUNTOF(cases); ++i) {
+      text::encoding src_enc(cases[i].src_enc);
+      transcode_test_bytes src_bytes, expected_bytes;
+      for (std::size_t j = 0; j < ascii_run_size; ++j) {
+         append_transcode_test_codepoint(&src_bytes, src_enc, 'a');
+         append_transcode_test_codepoint(&expected_bytes, text::encoding::utf8, 'a');
+      }
+      src_bytes.push_back(cases[i].invalid, cases[i].invalid_size);
+      append_transcode_test_codepoint(&expected_bytes, text::encoding::utf8, text::replacement_char);
+      for (std::size_t j = 0; j < ascii_run_size; ++j) {
+         append_transcode_test_codepoint(&src_bytes, src_enc, 'b');
+         append_transcode_test_codepoint(&expected_bytes, text::encoding::utf8, 'b');
+      }
+
+      std::size_t src_left;
+      transcode_test_bytes dst_bytes(transcode_in_chunks(
+         false, src_enc, src_bytes, text::encoding::utf8, 0x1000, &src_left
+      ));
+      LOFTY_TESTING_ASSERT_EQUAL(src_left, 0u);
+      LOFTY_TESTING_ASSERT_TRUE(dst_bytes == expected_bytes);
+      LOFTY_TESTING_ASSERT_THROWS(text::decode_error, transcode_in_chunks(
+         true, src_enc, src_bytes, text::encoding::utf8, 0x1000, &src_left
+      ));
+   }
+
+   // An incomplete sequence at the end of the source must be left for the next call.
+   transcode_test_bytes src_bytes, expected_bytes;
+   for (std::size_t i = 0; i < ascii_run_size; ++i) {
+      append_transcode_test_codepoint(&src_bytes, text::encoding::utf8, 'c');
+      append_transcode_test_codepoint(&expected_bytes, text::encoding::utf16le, 'c');
+   }
+   static std::uint8_t const incomplete[] = { 0xf0, 0x9f, 0x98 };
+   src_bytes.push_back(incomplete, LOFTY_COUNTOF(incomplete));
+   std::size_t src_left;
+   transcode_test_bytes dst_bytes(transcode_in_chunks(
+      true, text::encoding::utf8, src_bytes, text::encoding::utf16le, 0x1000, &src_left
+   ));
+   LOFTY_TESTING_ASSERT_EQUAL(src_left, LOFTY_COUNTOF(incomplete));
+   LOFTY_TESTING_ASSERT_TRUE(dst_bytes == expected_bytes);
+}
+
+}} //namespace lofty::test